@@ -47,6 +47,7 @@ USAGE:
 Put '#define CPPIMG_IMPLEMENTATION' before including this file to create the implementation.
 Put '#define CPPIMG_DISABLE_PNG' to disable support for PNG.
 Put '#define CPPIMG_DISABLE_OPENEXR' to disable support for OpenEXR
+Put '#define CPPIMG_DISABLE_THREADS' to disable multithreaded encoding and decoding
 */
 #include <cassert>
 #include <cmath>
@@ -57,7 +58,7 @@ Put '#define CPPIMG_DISABLE_OPENEXR' to disable support for OpenEXR
 #include <utility>
 // #define CPPIMG_IMPLEMENTATION
 
-#if !defined(CPPIMG_DISABLE_PNG) && !defined(CPPIMG_DISABLE_OPENEXR)
+#if !defined(CPPIMG_DISABLE_PNG) || !defined(CPPIMG_DISABLE_OPENEXR)
 
 #    ifdef CPPIMG_IMPLEMENTATION
 #        define SZLIB_IMPLEMENTATION
@@ -261,6 +262,15 @@ u16 toFloat16(f32 f);
     */
 f32 toFloat32(u16 h);
 
+/**
+    @brief Convert an array of single precision floats to half precision floats, rounding to nearest even
+    */
+void convertF32ToF16(s32 count, u16* dst, const f32* src);
+/**
+    @brief Convert an array of half precision floats to single precision floats
+    */
+void convertF16ToF32(s32 count, f32* dst, const u16* src);
+
 static const Char CPPIMG_NULLCHAR = '\0';
 static const u32 MaxWidth = 0x7FFFFFFFU;
 static const u32 MaxHeight = 0x7FFFFFFFU;
@@ -309,6 +319,69 @@ s32 getBytesPerPixel(s32 channels, const s32* types);
 s32 getSize(Type type);
 s32 getNumChannels(ColorType type);
 
+/**
+    @brief Layout and type of pixels in memory
+    */
+enum class PixelFormat
+{
+    GRAY8 = 0,
+    RGB8,
+    RGBA8,
+    GRAYF16,
+    RGBF16,
+    RGBAF16,
+    GRAYF32,
+    RGBF32,
+    RGBAF32,
+};
+
+ColorType getColorType(PixelFormat format);
+s32 getNumChannels(PixelFormat format);
+s32 getBytesPerSample(PixelFormat format);
+s32 getBytesPerPixel(PixelFormat format);
+/**
+    @brief Format of 8 bits samples
+    */
+PixelFormat getPixelFormat(ColorType colorType);
+/**
+    @brief Format of HALF or FLOAT samples
+    */
+PixelFormat getPixelFormat(ColorType colorType, Type type);
+
+/**
+    @brief Pixels in memory, with any distance between rows
+    */
+struct ImageView
+{
+    /**
+        @param data ... the top left pixel
+        @param pitch ... bytes from a row to the next one below, 0 for tightly packed rows
+        */
+    static ImageView create(void* data, s32 width, s32 height, PixelFormat format, s64 pitch = 0);
+    /**
+        @brief Rows from the bottom to the top in memory
+        @param data ... the bottom left pixel, the first byte of the memory
+        @param pitch ... bytes from a row to the next one above, 0 for tightly packed rows
+        */
+    static ImageView createBottomUp(void* data, s32 width, s32 height, PixelFormat format, s64 pitch = 0);
+
+    u8* getRow(s32 y) const
+    {
+        return data_ + y * pitch_;
+    }
+
+    /**
+        @brief Pixels in the rectangle of x, y, width, and height
+        */
+    ImageView getSubView(s32 x, s32 y, s32 width, s32 height) const;
+
+    u8* data_; ///< the top left pixel
+    s32 width_;
+    s32 height_;
+    s64 pitch_; ///< bytes from a row to the next one below, negative if rows are bottom-up
+    PixelFormat format_;
+};
+
 struct F32ToF16
 {
     u16 operator()(f32 x) const
@@ -332,9 +405,15 @@ struct F16ToF32
 
 struct F32ToU32
 {
+    static u32 convert(f32 x)
+    {
+        // 0xFFFFFFFF is not representable in f32, multiply in f64 to stay in the range of u32
+        return static_cast<u32>(static_cast<f64>(0xFFFFFFFFU) * clamp01(x));
+    }
+
     u32 operator()(f32 x) const
     {
-        return static_cast<u32>(0xFFFFFFFFU * clamp01(x));
+        return convert(x);
     }
 };
 
@@ -357,7 +436,7 @@ struct F16ToU32
 {
     u32 operator()(u16 x) const
     {
-        return static_cast<u32>(0xFFFFFFFFU * clamp01(toFloat32(x)));
+        return F32ToU32::convert(toFloat32(x));
     }
 };
 
@@ -379,17 +458,15 @@ void convertType(s32 width, s32 height, s32 channels, T* dst, const U* src, V fu
     CPPIMG_ASSERT(CPPIMG_NULL != dst);
     CPPIMG_ASSERT(CPPIMG_NULL != src);
 
+    s32 count = width * channels;
     T* dr = dst;
     const U* sr = src;
     for(s32 i = 0; i < height; ++i) {
-        for(s32 j = 0; j < width; ++j) {
-            s32 c = j * channels;
-            for(s32 k = 0; k < channels; ++k) {
-                dst[c + k] = func(src[c + k]);
-            }
+        for(s32 j = 0; j < count; ++j) {
+            dr[j] = func(sr[j]);
         }
-        dr += width;
-        sr += width;
+        dr += count;
+        sr += count;
     }
 }
 
@@ -397,13 +474,13 @@ void convertType(s32 width, s32 height, s32 channels, T* dst, const U* src, V fu
  */
 inline void convertF32ToF16(s32 width, s32 height, s32 channels, u16* dst, const f32* src)
 {
-    convertType(width, height, channels, dst, src, F32ToF16());
+    convertF32ToF16(width * height * channels, dst, src);
 }
 /**
  */
 inline void convertF16ToF32(s32 width, s32 height, s32 channels, f32* dst, const u16* src)
 {
-    convertType(width, height, channels, dst, src, F16ToF32());
+    convertF16ToF32(width * height * channels, dst, src);
 }
 
 /**
@@ -469,14 +546,107 @@ struct Color
     static u8 toGray(u8 r, u8 g, u8 b);
 };
 
-void convert(s32 width, s32 height, s32 channels, u8* dst, const void* src, const s32* types);
+static const s32 Convert_None = 0;
+static const s32 Convert_SRGB = (0x01 << 0); ///< Encode with the sRGB transfer function
+static const s32 Convert_Reinhard = (0x01 << 1); ///< Tone map with x/(1+x)
+static const s32 Convert_ACES = (0x01 << 2); ///< Tone map with the fitted ACES filmic curve
+
+/**
+    @return Success:true, Fail:false if memory cannot be allocated
+    */
+bool convert(s32 width, s32 height, s32 channels, u8* dst, const void* src, const s32* types);
+
+/**
+    @brief Convert samples to 8 bits, with exposure, tone mapping, and sRGB encoding of colors
+    @return Success:true, Fail:false if memory cannot be allocated
+    @param channels ... the last one of 2 or 4 channels is alpha, which is kept linear
+    @param options ... combination of Convert_SRGB, and Convert_Reinhard or Convert_ACES
+    @param exposure ... colors are scaled by 2^exposure
+    */
+bool convert(s32 width, s32 height, s32 channels, u8* dst, const void* src, const s32* types, s32 options, f32 exposure = 0.0f);
+/**
+    @brief Weights of colors to luma
+    */
+enum class Luma
+{
+    BT601 = 0,
+    BT709,
+};
+
+// dst can be src. It needs the size of the destination when expanding
 void convertGrayToRGB(s32 width, s32 height, u8* dst, const u8* src);
 void convertGrayToRGBA(s32 width, s32 height, u8* dst, const u8* src);
-void convertRGBToGray(s32 width, s32 height, u8* dst, const u8* src);
+void convertRGBToGray(s32 width, s32 height, u8* dst, const u8* src, Luma luma = Luma::BT601);
 void convertRGBToRGBA(s32 width, s32 height, u8* dst, const u8* src);
-void convertRGBAToGray(s32 width, s32 height, u8* dst, const u8* src);
+void convertRGBAToGray(s32 width, s32 height, u8* dst, const u8* src, Luma luma = Luma::BT601);
 void convertRGBAToRGB(s32 width, s32 height, u8* dst, const u8* src);
 
+/**
+    @brief Convert layouts and types of pixels row by row
+    @return Success:true, Fail:false if sizes are different
+    @param options ... options of 8 bits conversion, Convert_SRGB, Convert_Reinhard, or Convert_ACES
+    @param exposure ... colors are scaled by 2^exposure when converted to 8 bits
+    */
+bool convert(const ImageView& dst, const ImageView& src, s32 options = Convert_None, f32 exposure = 0.0f);
+
+/**
+    @brief Store rows decoded in a source format into a view of another format.
+    A decoder writes a row to begin(y), then end(y) converts it into the view.
+    Rows are written to the view directly if formats are same
+    */
+class RowConverter
+{
+public:
+    RowConverter();
+    ~RowConverter();
+
+    /**
+        @brief Store rows to image directly
+        @param pitch ... bytes from a row to the next one below
+        */
+    void initialize(void* image, s64 pitch);
+
+    /**
+        @return Success:true, Fail:false if memory cannot be allocated
+        @param dst
+        @param srcFormat ... format of decoded rows
+        @param options ... options of 8 bits conversion
+        @param exposure
+        */
+    bool initialize(const ImageView& dst, PixelFormat srcFormat, s32 options = Convert_None, f32 exposure = 0.0f);
+    void terminate();
+
+    bool isDirect() const
+    {
+        return CPPIMG_NULL == row_;
+    }
+
+    /**
+        @brief Memory to decode row y in the source format
+        */
+    u8* begin(s32 y) const
+    {
+        return isDirect() ? dst_.data_ + y * dst_.pitch_ : row_;
+    }
+
+    /**
+        @brief Convert row y, which has been decoded
+        */
+    void end(s32 y);
+
+private:
+    RowConverter(const RowConverter&) = delete;
+    RowConverter& operator=(const RowConverter&) = delete;
+
+    ImageView dst_;
+    PixelFormat srcFormat_;
+    s32 options_;
+    f32 exposure_;
+    u8* row_;
+    u8* work_;
+    f32* scratch_;
+};
+
 //----------------------------------------------------
 //---
 //--- Stream
@@ -701,6 +871,12 @@ public:
         */
     static bool read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream);
 
+    /**
+        @brief Read into a view of the size of the image. Rows are converted to the format of the view while they are stored
+        @return Success:true, Fail:false
+        */
+    static bool read(const ImageView& image, Stream& stream);
+
     /**
         @brief
         @return Success:true, Fail:false
@@ -712,6 +888,12 @@ public:
         */
     static bool write(Stream& stream, s32 width, s32 height, ColorType colorType, const void* image);
 
+    /**
+        @brief Write a view of 8 bits samples
+        @return Success:true, Fail:false
+        */
+    static bool write(Stream& stream, const ImageView& image);
+
 private:
     static const u16 MAGIC = 0x4D42U; //'MB';
 
@@ -782,8 +964,12 @@ private:
         u32 reserved_;
     };
 
-    static bool read24(u8* image, s32 width, s32 height, bool leftBottom, Stream& stream);
-    static bool read32(u8* image, s32 width, s32 height, bool leftBottom, Stream& stream);
+    /**
+        @brief Read the header, and pixels into view or image if either is not null
+        */
+    static bool readImage(s32& width, s32& height, ColorType& colorType, void* image, const ImageView* view, Stream& stream);
+    static bool read24(RowConverter& rows, s32 width, s32 height, bool leftBottom, Stream& stream);
+    static bool read32(RowConverter& rows, s32 width, s32 height, bool leftBottom, Stream& stream);
 };
 
 //----------------------------------------------------
@@ -808,6 +994,12 @@ public:
         */
     static bool read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream);
 
+    /**
+        @brief Read into a view of the size of the image. Rows are converted to the format of the view while they are stored
+        @return Success:true, Fail:false
+        */
+    static bool read(const ImageView& image, Stream& stream);
+
     /**
         @brief
         @return Success:true, Fail:false
@@ -819,6 +1011,12 @@ public:
         */
     static bool write(Stream& stream, s32 width, s32 height, ColorType colorType, const void* image, s32 options = Option_Compress);
 
+    /**
+        @brief Write a view of RGB8 or RGBA8
+        @return Success:true, Fail:false
+        */
+    static bool write(Stream& stream, const ImageView& image, s32 options = Option_Compress);
+
 private:
     enum Type
     {
@@ -863,21 +1061,14 @@ private:
     {
         return (static_cast<u16>(high) << 8) + low;
     }
-    static inline bool check(u8 bpp, const u8* x0, const u8* x1)
-    {
-        for(u8 i = 0; i < bpp; ++i) {
-            if(x0[i] != x1[i]) {
-                return false;
-            }
-        }
-        return true;
-    }
-
-    static bool readInternal(s32 width, s32 height, u8 bpp, u8* image, Stream& stream);
-    static bool readRLEInternal(s32 width, s32 height, u8 bpp, u8* image, Stream& stream);
-    static u8 calcRunLength(u8 bpp, s32 x, s32 y, s32 width, const u8* image);
-    static bool writeUncompress(Stream& stream, s32 width, s32 height, u8 bpp, const u8* image);
-    static bool writeRLE(Stream& stream, s32 width, s32 height, u8 bpp, const u8* image);
+    /**
+        @brief Read the header, and pixels into view or image if either is not null
+        */
+    static bool readImage(s32& width, s32& height, ColorType& colorType, void* image, const ImageView* view, Stream& stream);
+    static bool readInternal(RowConverter& rows, s32 width, s32 height, u8 bpp, Stream& stream);
+    static bool readRLEInternal(RowConverter& rows, s32 width, s32 height, u8 bpp, Stream& stream);
+    static bool writeUncompress(Stream& stream, const ImageView& image, u8 bpp);
+    static bool writeRLE(Stream& stream, const ImageView& image, u8 bpp);
 };
 
 //----------------------------------------------------
@@ -898,6 +1089,12 @@ public:
         @param stream
         */
     static bool write(Stream& stream, s32 width, s32 height, ColorType colorType, const void* image);
+
+    /**
+        @brief Write a view of 8 bits samples
+        @return Success:true, Fail:false
+        */
+    static bool write(Stream& stream, const ImageView& image);
 };
 
 #if !defined(CPPIMG_DISABLE_PNG)
@@ -909,6 +1106,19 @@ public:
 class PNG
 {
 public:
+    static const s32 Option_None = 0;
+    static const s32 Option_Keep16Bits = (0x01 << 0); ///< Output 16 bits samples as native u16 instead of 8 bits
+
+    /**
+        @brief Called each time a pass has been decoded into the image
+        @param pass ... 0 to 6 for Adam7 interlaced images, always 0 for non-interlaced ones
+        @param image ... pixels of the pass are at their final position, the others are not written yet
+        @param userData
+        */
+    typedef void (*PassCallback)(s32 pass, const void* image, void* userData);
+
+    class Decoder;
+
     /**
         @brief
         @return Success:true, Fail:false
@@ -920,6 +1130,27 @@ public:
         */
     static bool read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream);
 
+    /**
+        @brief
+        @return Success:true, Fail:false
+        @param width
+        @param height
+        @param colorType
+        @param bitDepth ... bits per channel of the output, 8 or 16
+        @param image
+        @param stream
+        @param options
+        @param callback ... optional, called after each pass
+        @param userData ... passed to the callback
+        */
+    static bool read(s32& width, s32& height, ColorType& colorType, s32& bitDepth, void* image, Stream& stream, s32 options, PassCallback callback = CPPIMG_NULL, void* userData = CPPIMG_NULL);
+
+    /**
+        @brief Read into a view of the size of the image. Rows are converted to the format of the view while they are stored
+        @return Success:true, Fail:false
+        */
+    static bool read(const ImageView& image, Stream& stream);
+
 #    if 0
         /**
         @brief
@@ -947,6 +1178,20 @@ private:
     static const u8 FilterType_Avg = 3;
     static const u8 FilterType_Paeth = 4;
 
+    static const u8 Interlace_None = 0;
+    static const u8 Interlace_Adam7 = 1;
+    static const u32 Adam7Passes = 7;
+
+    struct Pass
+    {
+        u32 x_;
+        u32 y_;
+        u32 stepX_;
+        u32 stepY_;
+    };
+    static const Pass Adam7[Adam7Passes];
+    static const Pass NoInterlace;
+
     struct Chunk
     {
         u32 length_;
@@ -973,11 +1218,16 @@ private:
         static const u32 Type = 0x45544C50U; //'ETLP';
         static const u32 MaxSize = 256;
         bool read(Stream& stream);
+        bool readTransparency(u32 length, Stream& stream);
 
         u32 size_;
-        u8 r_[MaxSize];
-        u8 g_[MaxSize];
-        u8 b_[MaxSize];
+        bool hasAlpha_;
+        u32 rgba_[MaxSize]; ///< RGBA bytes in memory order for each index
+    };
+
+    struct ChunkTRNS: public Chunk
+    {
+        static const u32 Type = 0x534E5274U; //'SNRt';
     };
 
     struct ChunkIDAT: public Chunk
@@ -985,24 +1235,65 @@ private:
         static const u32 Type = 0x54414449U; //'TADI';
         static const u32 BufferSize = 1024;
 
-        ChunkIDAT(u32 totalSrcSize, u32 width, u32 height, s32 color, s32 alpha);
+        explicit ChunkIDAT(const ChunkPLTE& palette);
         ~ChunkIDAT();
 
-        bool initialize();
+        bool initialize(u32 totalSrcSize, const ChunkIHDR& header, s32 options);
         bool terminate();
         bool read(Stream& stream);
-        bool decode(void* image);
-        void filter(u32 scanlineSize, s32 filterFlag, u8* scanline, u8* image);
+        /**
+            @brief Decode scanlines into rows, which must be direct for interlaced images
+            */
+        bool decode(RowConverter& rows, PassCallback callback, void* userData);
+
+        bool begin();
+        void end();
+        /**
+            @brief Inflate and unfilter the next scanline of the current pass into scanline_
+            */
+        bool nextScanline();
+        void store(u32 width, u8* dst, const u8* scanline);
+        void scatter(u32 pass, u32 width, u8* dst, const u8* src);
+        const Pass& getPass(u32 pass) const;
+        u32 getNextPass(u32 pass, u32& width, u32& height) const;
 
         u8* src_;
         u32 totalSrcSize_;
         u32 srcSize_;
         u32 totalSize_;
         u32 totalCount_;
-        u32 color_;
-        u32 alpha_;
         u32 width_;
         u32 height_;
+        u8 colorType_;
+        u8 bitDepth_;
+        u8 keep16Bits_;
+        u8 interlace_;
+        u32 samplesPerPixel_;
+        u32 bitsPerPixel_;
+        u32 bytesPerPixel_;
+        u32 scanlineSize_;
+        u32 dstScanlineSize_;
+        u32 dstBytesPerPixel_;
+        u8* row_;
+        u8* scanlines_;
+        u8* indices_;
+        const ChunkPLTE& palette_;
+
+        // Decoding state
+        szlib::szContext context_;
+        s32 status_;
+        u32 bufferOffset_;
+        u32 bufferSize_;
+        u32 pass_;
+        u32 passWidth_;
+        u32 passHeight_;
+        u32 passScanlineSize_;
+        u32 y_;
+        s32 filterFlag_;
+        u32 scanlineOffset_;
+        u8* upper_;
+        u8* scanline_;
+        u8 buffer_[BufferSize];
     };
 
     struct ChunkIEND: public Chunk
@@ -1012,6 +1303,33 @@ private:
 
     static inline u16 reverse(u16 x);
     static inline u32 reverse(u32 x);
+
+    static inline u32 getSamplesPerPixel(u32 colorType)
+    {
+        switch(colorType) {
+        case ColorType_True:
+            return 3;
+        case ColorType_GrayAlpha:
+            return 2;
+        case ColorType_TrueAlpha:
+            return 4;
+        default:
+            return 1;
+        }
+    }
+
+    /**
+        @brief Reverse the filter of a scanline in place
+        @param bytesPerPixel ... 1, 2, 3, 4, 6, or 8
+        @param filterType
+        @param size ... bytes of the scanline without a filter type byte
+        @param scanline
+        @param upper ... the previous scanline, or NULL for the first scanline
+        */
+    static void unfilter(u32 bytesPerPixel, u8 filterType, u32 size, u8* scanline, const u8* upper);
+    template<u32 BPP>
+    static void unfilter(u8 filterType, u32 size, u8* scanline, const u8* upper);
+
     static bool readHeader(Stream& stream);
     static bool checkCRC32(const Chunk& chunk, Stream& stream);
     static bool skipChunk(const Chunk& chunk, Stream& stream);
@@ -1022,6 +1340,88 @@ private:
     template<class T>
     static bool readHeader(T& chunk, Stream& stream);
     static bool writeChunk(Stream& stream, u32 type, u32 size, const void* data);
+
+    /**
+        @brief Read the signature and IHDR, then scan chunks until IEND
+        @param start ... position of the first chunk after IHDR
+        @param totalIDAT ... sum of sizes of IDAT chunks
+        @param transparency ... whether there is a tRNS chunk
+        */
+    static bool readImageHeader(ChunkIHDR& header, cppimg::off_t& start, u32& totalIDAT, bool& transparency, Stream& stream);
+    static bool getColorType(ColorType& colorType, const ChunkIHDR& header, bool transparency);
+    /**
+        @brief Read PLTE, tRNS, and IDAT chunks from the first chunk after IHDR
+        */
+    static bool readImageData(ChunkPLTE& palette, ChunkIDAT& data, Stream& stream);
+    /**
+        @brief Read the header, and pixels into view or image if either is not null
+        */
+    static bool readImage(s32& width, s32& height, ColorType& colorType, s32& bitDepth, void* image, const ImageView* view, Stream& stream, s32 options, PassCallback callback, void* userData);
+};
+
+/**
+    @brief Decode a PNG image row by row
+
+    Only two scanlines are kept for unfiltering, and rows are converted into buffers of the caller.
+    The compressed data are still read into memory at once, because inflate needs all of them.
+    Interlaced images are not supported, because their rows cannot be completed in order.
+    */
+class PNG::Decoder
+{
+public:
+    Decoder();
+    ~Decoder();
+
+    /**
+        @brief Read chunks and prepare to decode rows
+        @return Success:true, Fail:false
+        @param stream
+        @param options
+        */
+    bool open(Stream& stream, s32 options = Option_None);
+    void close();
+
+    s32 getWidth() const;
+    s32 getHeight() const;
+    ColorType getColorType() const;
+    /**
+        @brief Bits per channel of output rows, 8 or 16
+        */
+    s32 getBitDepth() const;
+    /**
+        @brief Bytes of an output row
+        */
+    s32 getRowSize() const;
+    /**
+        @brief Index of the row which will be decoded next
+        */
+    s32 getRow() const;
+
+    /**
+        @brief Decode the next row
+        @return Success:true, Fail:false
+        @param row ... getRowSize() bytes
+        */
+    bool readRow(void* row);
+
+    /**
+        @brief Decode next rows into rows of a ring buffer
+        @return Number of decoded rows
+        @param count
+        @param rows ... count pointers to buffers of getRowSize() bytes
+        */
+    s32 readRows(s32 count, void** rows);
+
+private:
+    Decoder(const Decoder&) = delete;
+    Decoder& operator=(const Decoder&) = delete;
+
+    ColorType colorType_;
+    s32 bitDepth_;
+    s32 row_;
+    bool opened_;
+    ChunkPLTE palette_;
+    ChunkIDAT data_;
 };
 #endif
 
@@ -1047,6 +1447,12 @@ public:
         */
     static bool read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream);
 
+    /**
+        @brief Read into a view of the size of the image. Rows are converted to the format of the view while they are stored
+        @return Success:true, Fail:false
+        */
+    static bool read(const ImageView& image, Stream& stream);
+
     /**
         @brief
         @return Success:true, Fail:false
@@ -1284,7 +1690,7 @@ private:
 
         ByteStream byteStream_;
         s16* work_;
-        u8* rgb_;
+        RowConverter* rows_;
     };
 
     class AutoFree
@@ -1418,6 +1824,10 @@ private:
 
     static bool readJFXX(Context& context, const Segment& segment);
 
+    /**
+        @brief Read the header, and pixels into view or image if either is not null
+        */
+    static bool readImage(s32& width, s32& height, ColorType& colorType, void* image, const ImageView* view, Stream& stream);
     static bool decode(Context& context);
     static bool decodeMCU(Context& context);
     static s32 decodeHuffmanCode(Context& context, s32 type, s32 table);
@@ -1439,6 +1849,31 @@ private:
 class OpenEXR
 {
 public:
+    enum Compression
+    {
+        NO_COMPRESSION = 0,
+        RLE_COMPRESSION = 1,
+        ZIPS_COMPRESSION = 2,
+        ZIP_COMPRESSION = 3,
+        PIZ_COMPRESSION = 4,
+        PXR24_COMPRESSION = 5,
+        B44_COMPRESSION = 6,
+        B44A_COMPRESSION = 7,
+    };
+
+    enum LevelMode
+    {
+        ONE_LEVEL = 0,
+        MIPMAP_LEVELS = 1,
+        RIPMAP_LEVELS = 2,
+    };
+
+    enum RoundingMode
+    {
+        ROUND_DOWN = 0,
+        ROUND_UP = 1,
+    };
+
     struct Information
     {
         s32 getBytesPerPixel() const
@@ -1459,13 +1894,47 @@ public:
     };
 
     /**
-        @brief
+        @brief Destination of a channel. The sample at (x, y) from the top left of the region to read is written to base_ + x * xStride_ + y * yStride_,
+        and converted to type_
+        */
+    struct Slice
+    {
+        const Char* name_;
+        Type type_;
+        void* base_;
+        s64 xStride_;
+        s64 yStride_;
+    };
+
+    /**
+        @brief A rectangle of pixels
+        */
+    struct Rect
+    {
+        s32 x_;
+        s32 y_;
+        s32 width_;
+        s32 height_;
+    };
+
+    class TiledReader;
+    class MultiPartReader;
+
+    /**
+        @brief Read a scanline image, the full resolution level of a tiled image, or the first part of a multi-part image
         @return Success:true, Fail:false
-        @param information
-        @param image
+        @param information ... the size of the display window
+        @param image ... pixels out of the data window are zero
         @param stream
+        @param numThreads ... number of threads to decompress chunks, 0 uses all hardware threads
+        */
+    static bool read(Information& information, void* image, Stream& stream, s32 numThreads = 0);
+
+    /**
+        @brief Read into a view of the size of the display window, converting samples to the format of the view
+        @return Success:true, Fail:false
         */
-    static bool read(Information& information, void* image, Stream& stream);
+    static bool read(Information& information, const ImageView& image, Stream& stream, s32 numThreads = 0);
 
     /**
         @brief
@@ -1476,28 +1945,65 @@ public:
         @param colorType
         @param pixelType
         @param image
+        @param compression ... NO_COMPRESSION, RLE_COMPRESSION, ZIPS_COMPRESSION, ZIP_COMPRESSION, PIZ_COMPRESSION, or PXR24_COMPRESSION
+        @param numThreads ... number of threads to compress blocks, 0 uses all hardware threads
         */
-    static bool write(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, const void* image);
+    static bool write(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, const void* image, Compression compression = ZIP_COMPRESSION, s32 numThreads = 0);
 
-private:
-    static const u32 MAGIC = 0x01312F76U;
-    static const s32 MinStringBufferSize = 16;
-    static const s32 MaxStringSize = 256;
-    static const s32 MaxInChannels = 8;
-    static const s32 MaxOutChannels = 4;
-    static const s32 LinesPerBlock = 16;
+    /**
+        @brief Write an image, converting samples while they are shuffled into planes
+        @return Success:true, Fail:false
+        @param pixelType ... type of samples in the file
+        @param imageType ... type of samples in the image, same as pixelType, or FLOAT for HALF
+        */
+    static bool write(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const void* image, Compression compression = ZIP_COMPRESSION, s32 numThreads = 0);
 
-    enum Compression
-    {
-        NO_COMPRESSION = 0,
-        RLE_COMPRESSION = 1,
-        ZIPS_COMPRESSION = 2,
-        ZIP_COMPRESSION = 3,
-        PIZ_COMPRESSION = 4,
-        PXR24_COMPRESSION = 5,
-        B44_COMPRESSION = 6,
-        B44A_COMPRESSION = 7,
-    };
+    /**
+        @brief Write a view of HALF or FLOAT samples
+        @return Success:true, Fail:false
+        @param pixelType ... type of samples in the file
+        */
+    static bool write(Stream& stream, const ImageView& image, Type pixelType, Compression compression = ZIP_COMPRESSION, s32 numThreads = 0);
+
+    /**
+        @brief Write a tiled image, and generate lower resolution levels with a box filter
+        @return Success:true, Fail:false
+        @param stream
+        @param width
+        @param height
+        @param colorType
+        @param pixelType
+        @param image ... the full resolution level
+        @param tileWidth
+        @param tileHeight
+        @param levelMode
+        @param roundingMode ... rounding of the sizes of levels
+        @param compression ... NO_COMPRESSION, RLE_COMPRESSION, ZIPS_COMPRESSION, ZIP_COMPRESSION, PIZ_COMPRESSION, or PXR24_COMPRESSION
+        @param numThreads ... number of threads to compress tiles, 0 uses all hardware threads
+        */
+    static bool writeTiled(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, const void* image, s32 tileWidth, s32 tileHeight, LevelMode levelMode = ONE_LEVEL, RoundingMode roundingMode = ROUND_DOWN, Compression compression = ZIP_COMPRESSION, s32 numThreads = 0);
+
+    /**
+        @brief Write a tiled image, converting samples while they are shuffled into planes
+        @return Success:true, Fail:false
+        @param pixelType ... type of samples in the file
+        @param imageType ... type of samples in the image, same as pixelType, or FLOAT for HALF
+        */
+    static bool writeTiled(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const void* image, s32 tileWidth, s32 tileHeight, LevelMode levelMode = ONE_LEVEL, RoundingMode roundingMode = ROUND_DOWN, Compression compression = ZIP_COMPRESSION, s32 numThreads = 0);
+
+    /**
+        @brief Write a view of HALF or FLOAT samples as a tiled image
+        @return Success:true, Fail:false
+        @param pixelType ... type of samples in the file
+        */
+    static bool writeTiled(Stream& stream, const ImageView& image, Type pixelType, s32 tileWidth, s32 tileHeight, LevelMode levelMode = ONE_LEVEL, RoundingMode roundingMode = ROUND_DOWN, Compression compression = ZIP_COMPRESSION, s32 numThreads = 0);
+
+private:
+    static const u32 MAGIC = 0x01312F76U;
+    static const s32 MinStringBufferSize = 16;
+    static const s32 MaxStringSize = 256;
+    static const s32 MaxInChannels = 64;
+    static const s32 MaxOutChannels = 4;
 
     enum EnvMap
     {
@@ -1512,19 +2018,6 @@ private:
         RANDOM_Y = 2,
     };
 
-    enum LevelMode
-    {
-        ONE_LEVEL = 0,
-        MIPMAP_LEVELS = 1,
-        RIPMAP_LEVELS = 2,
-    };
-
-    enum RoundingMode
-    {
-        ROUND_DOWN = 0,
-        ROUND_UP = 1,
-    };
-
     enum AttributeName
     {
         AttrName_Channels,
@@ -1698,7 +2191,7 @@ private:
         u32 xSize_;
         u32 ySize_;
         u8 levelMode_;
-        u8 roundingMode_[16];
+        u8 roundingMode_;
     };
 
     struct TimeCode
@@ -1817,15 +2310,106 @@ private:
         Buffer buffer_;
     };
 
+    /**
+        @brief Haar wavelet and Huffman coder of PIZ_COMPRESSION
+        */
+    class PIZ
+    {
+    public:
+        PIZ();
+        ~PIZ();
+
+        /**
+            @brief Compress a block of scanlines
+            @return Size of compressed data, or -1 if fail
+            @param dst
+            @param width
+            @param lines
+            @param numChannels
+            @param sizes ... bytes per sample of each channel
+            @param src ... scanlines in the layout of a chunk
+            */
+        s32 compress(Buffer& dst, s32 width, s32 lines, s32 numChannels, const s32* sizes, const u8* src);
+
+        /**
+            @brief Uncompress a block of scanlines
+            @return Success:true, Fail:false
+            @param dst ... scanlines in the layout of a chunk
+            @param width
+            @param lines
+            @param numChannels
+            @param sizes ... bytes per sample of each channel
+            @param srcSize
+            @param src
+            */
+        bool uncompress(u8* dst, s32 width, s32 lines, s32 numChannels, const s32* sizes, s32 srcSize, const u8* src);
+
+    private:
+        PIZ(const PIZ&) = delete;
+        PIZ(PIZ&&) = delete;
+        PIZ& operator=(const PIZ&) = delete;
+        PIZ& operator=(PIZ&&) = delete;
+
+        static const s32 UShortRange = 1 << 16;
+        static const s32 BitmapSize = UShortRange >> 3;
+        static const s32 HufEncBits = 16;
+        static const s32 HufDecBits = 14;
+        static const s32 HufEncSize = (1 << HufEncBits) + 1;
+        static const s32 HufDecSize = 1 << HufDecBits;
+        static const s32 HufDecMask = HufDecSize - 1;
+        static const s32 HufMaxCodeLength = 58;
+        static const s32 ShortZeroCodeRun = 59;
+        static const s32 LongZeroCodeRun = 63;
+        static const s32 ShortestLongRun = 2 + LongZeroCodeRun - ShortZeroCodeRun;
+        static const s32 LongestLongRun = 255 + ShortestLongRun;
+
+        /**
+            @brief An entry of the decoding table.
+            A code longer than HufDecBits is listed in longCodes_ from offset_
+            */
+        struct HufDec
+        {
+            s32 length_;
+            s32 literal_;
+            s32 offset_;
+        };
+
+        s32 getPlanes(s32 width, s32 lines, s32 numChannels, const s32* sizes, s32 starts[MaxInChannels]);
+
+        s32 compressHuffman(u8* dst, s32 size, const u16* src);
+        bool uncompressHuffman(u16* dst, s32 size, s32 srcSize, const u8* src);
+        bool buildEncodeTable(s32& minIndex, s32& maxIndex);
+        bool buildDecodeTable(s32 minIndex, s32 maxIndex);
+        bool unpackEncodeTable(const u8*& src, s32 srcSize, s32 minIndex, s32 maxIndex);
+        bool decodeHuffman(s32 rlc, s32 bits, const u8* src, s32 size, u16* dst) const;
+
+        static bool buildCanonicalCodes(s64* codes);
+        static u8* packEncodeTable(u8* dst, const s64* codes, s32 minIndex, s32 maxIndex);
+        static u8* encodeHuffman(u8* dst, const s64* codes, s32 rlc, s32 size, const u16* src, s32& bits);
+
+        void pushHeap(s32 size, s32 index);
+        s32 popHeap(s32 size);
+
+        Buffer planes_;
+        u8 bitmap_[BitmapSize];
+        u16 lut_[UShortRange];
+        s64 codes_[HufEncSize];
+        s64 lengths_[HufEncSize];
+        s32 links_[HufEncSize];
+        s32 heap_[HufEncSize];
+        s32 longCodes_[HufEncSize];
+        HufDec table_[HufDecSize];
+    };
+
     struct Header
     {
         void initialize();
 
         bool getColorType(ColorType& colorType) const;
         void getTypes(s32 types[MaxInChannels]) const;
+        s32 getBytesPerPixel() const;
         const Channel* findChannel(const Char* name) const;
         void sortChannels();
-        void getChannelAssign(s32 assign[MaxInChannels]) const;
 
         s32 numChannels_;
         Channel channels_[MaxInChannels];
@@ -1879,21 +2463,133 @@ private:
         static bool readChannel(Channel& channel, Stream& stream);
         bool readChannels(Stream& stream, s32 valueSize);
 
+        /**
+            @brief Scratch of a thread decoding chunks
+            */
+        struct Worker
+        {
+            Worker();
+            ~Worker();
+
+            bool initialize(s32 compression);
+
+            szlib::szContext context_;
+            bool hasContext_;
+            PIZ* piz_;
+            Buffer src_;
+            Buffer dst_;
+            Buffer tmp_;
+        };
+        struct ScanlineChunkJob;
+        struct TileChunkJob;
+
         bool readOffsetTable(Stream& stream);
-        bool readScanlines(Stream& stream);
-        bool readScanlines_NO_COMPRESSION(Stream& stream);
-        bool readScanlines_RLE_COMPRESSION(Stream& stream);
-        bool readScanlines_ZIP_COMPRESSION(Stream& stream);
+        /**
+            @brief Chunks of multi-part files begin with the part number
+            */
+        bool readPartNumber(Stream& stream) const;
+        /**
+            @brief Get the color channels, which are read as interleaved pixels
+            @return Success:true, Fail:false if the image is not gray, rgb, or rgba
+            */
+        bool getInformation(Information& information, s32 width, s32 height) const;
+        /**
+            @brief Get slices of the color channels to interleaved pixels, the other channels are skipped
+            @param slices ... by channels in the header
+            */
+        /**
+            @brief Slices of gray, rgb, or rgba channels interleaved into image
+            @param type ... converts all channels to the type if not null
+            */
+        void getImageSlices(Slice slices[MaxInChannels], void* image, s64 pitch, const Type* type = CPPIMG_NULL) const;
+        /**
+            @brief Assign slices to channels in the header by name, the other channels are skipped
+            @return Success:true, Fail:false if a channel is not found
+            @param slices ... by channels in the header
+            */
+        bool getSlices(Slice slices[MaxInChannels], s32 numSlices, const Slice* selected) const;
+
+        /**
+            @brief Whether the data window covers the region or not
+            */
+        bool isInDataWindow(const Box2i& region) const;
+
+        /**
+            @brief Decode the chunks which intersect the region
+            @param region ... in the coordinates of the data window, the slices start at its top left
+            */
+        bool readScanlines(Stream& stream, const Slice* slices, const Box2i& region, s32 numThreads);
+        bool readScanlineChunks(Stream& stream, const Slice* slices, const Box2i& region, s32 first, s32 count, s32 numThreads);
+        /**
+            @brief Read a compressed chunk into the src_ of a worker
+            */
+        bool readScanlineChunk(Worker& worker, s32 index, Stream& stream, s32& y, s32& dataSize);
+        /**
+            @brief Uncompress a chunk in the src_ of a worker, and copy the part in the region
+            */
+        bool decodeScanlineChunk(Worker& worker, const Slice* slices, const Box2i& region, s32 y, s32 dataSize);
+        s32 getLinesPerChunk() const;
 
-        void getChannelInformation(s32 sizes[MaxInChannels], s32 offsets[MaxInChannels]) const;
-        bool uncompressRLE(Stream& stream, s32 dstSize, u8* dst, u8* tmp, s32 srcSize);
+        /**
+            @brief Uncompress a chunk in the src_ of a worker
+            @param data ... uncompressed chunk, points to the src_ or the dst_ of the worker
+            */
+        bool uncompressChunk(Worker& worker, const u8*& data, s32 width, s32 lines, s32 dataSize);
+        /**
+            @brief Copy the channels of an uncompressed chunk to the slices, only the columns and rows in the region
+            @param x ... position of the chunk
+            @param y ... position of the chunk
+            */
+        void copyChunk(const Slice* slices, const Box2i& region, s32 x, s32 y, s32 width, s32 lines, const u8* src) const;
+        /**
+            @brief Find slices which are interleaved pixels of the types in the file
+            @return Top left sample of the pixels, or NULL
+            @param channels ... in the order of samples in a pixel
+            */
+        u8* getInterleaved(const Slice* slices, s32& numChannels, s32 channels[MaxChannels]) const;
+
+        bool initializeLevels();
+        s32 getLevelWidth(s32 lx) const;
+        s32 getLevelHeight(s32 ly) const;
+        s32 getNumXTiles(s32 lx) const;
+        s32 getNumYTiles(s32 ly) const;
+        s32 getTileIndex(s32 tx, s32 ty, s32 lx, s32 ly) const;
+        bool isValidLevel(s32 lx, s32 ly) const;
+        /**
+            @brief Uncompressed bytes of a tile, which is cropped to the level
+            */
+        s32 getTileDataSize(s32 tx, s32 ty, s32 lx, s32 ly) const;
+        /**
+            @brief Uncompressed bytes of the largest tile in a level
+            @return -1 if it does not fit in s32
+            */
+        s32 getMaxTileDataSize(s32 lx, s32 ly) const;
+        /**
+            @brief Decode the tiles which intersect the region of a level
+            @param region ... in the coordinates of the data window, the slices start at its top left
+            */
+        bool readTiles(Stream& stream, const Slice* slices, const Box2i& region, s32 lx, s32 ly, s32 numThreads);
+        /**
+            @brief Decode the chunks or the tiles of the full resolution level which intersect the region
+            */
+        bool readRegion(Stream& stream, const Slice* slices, const Box2i& region, s32 numThreads);
+        /**
+            @brief Read a compressed tile into the src_ of a worker
+            */
+        bool readTileChunk(Worker& worker, Stream& stream, s32 tx, s32 ty, s32 lx, s32 ly, s32& dataSize);
+        /**
+            @brief Uncompress a tile in the src_ of a worker, and copy the part in the region
+            */
+        bool decodeTileChunk(Worker& worker, const Slice* slices, const Box2i& region, s32 tx, s32 ty, s32 lx, s32 ly, s32 dataSize);
+        static s32 uncompressRLE(Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src);
 
         Version version_;
         Header header_;
+        s32 part_;
+        s32 numXLevels_;
+        s32 numYLevels_;
 
         u64* offsetTable_;
-        Information* information_;
-        void* image_;
     };
 
     class WriteContext
@@ -1932,30 +2628,308 @@ private:
             return streamBuffer_.write(size, data);
         }
 
-        s32 numScanlines_;
+        s32 numChunks_;
         u64* offsetTable_;
         StreamBuffer streamBuffer_;
     };
 
+    /**
+        @brief Scratch of a thread compressing blocks
+        */
+    struct CompressWorker
+    {
+        CompressWorker();
+        ~CompressWorker();
+
+        bool initialize(s32 compression, s32 bytesPerChunk, s32 bytesPerLine);
+
+        szlib::szContext context_;
+        bool hasContext_;
+        PIZ* piz_;
+        Buffer tmp0_;
+        Buffer tmp1_;
+        Buffer dst_;
+        Buffer line_; // a line converted to the type of the file
+    };
+    struct CompressBlockJob;
+
+    /**
+        @brief Pixels of a scanline block or a tile to be compressed
+        */
+    struct BlockRegion
+    {
+        const u8* src_; // top left pixel
+        s64 pitch_;
+        s32 width_;
+        s32 lines_;
+        s32 coordinates_[4]; // y, or tx, ty, lx, and ly
+    };
+
     static AttributeName findAttributeName(const Char* str);
     static AttributeType findAttributeType(const Char* str);
     static s32 read(Char str[MaxStringSize], Stream& stream);
-    static s32 readString(Char str[MaxStringSize], Stream& stream);
+    static s32 readString(Char str[MaxStringSize], s32 size, Stream& stream);
     static s32 writeAttribute(Stream& stream, AttributeName name, AttributeType type, s32 size, const void* data);
     static s32 writeChannels(Stream& stream, ColorType colorType, Type pixelType);
     static s32 writeChannels(Stream& stream, s32 size, const Char** names, Type pixelType, u8 linear, s32 xSampling, s32 ySampling);
     static s32 writeNull(Stream& stream);
+    static bool writeHeader(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Compression compression, const TiledDesc* tiles);
 
     static void getChannelInformation(s32 offsets[MaxOutChannels], ColorType colorType, Type pixelType);
 
     static void preprocess(s32 size, u8* dst, const u8* src);
-    static void postprocess(s32 size, u8* dst, u8* src);
+    static void postprocess(s32 size, u8* dst, const u8* src);
 
+    static s32 getNumThreads(s32 numThreads, s32 count);
+    static s32 getLinesPerBlock(s32 compression);
+
+    static s32 deflateZlib(szlib::szContext& context, Buffer& dst, s32 srcSize, const u8* src);
+    static s32 inflateZlib(szlib::szContext& context, Buffer& dst, s32 srcSize, const u8* src);
     static s32 compressZlib(szlib::szContext& context, Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src);
+    static s32 compressRLE(Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src);
     static s32 uncompressZlib(szlib::szContext& context, Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src);
+    static s32 compressPXR24(szlib::szContext& context, Buffer& dst, Buffer& tmp, s32 width, s32 lines, s32 numChannels, const s32* types, const u8* src);
+    static bool uncompressPXR24(szlib::szContext& context, u8* dst, Buffer& tmp, s32 width, s32 lines, s32 numChannels, const s32* types, s32 srcSize, const u8* src);
+    static bool uncompressB44(u8* dst, Buffer& tmp, s32 width, s32 lines, s32 numChannels, const s32* types, const u8* linears, s32 srcSize, const u8* src);
+
+    static bool isSupportedConversion(Type pixelType, Type imageType);
+    /**
+        @brief HALF for 16 bits formats, FLOAT for 32 bits formats
+        */
+    static bool getViewType(Type& type, PixelFormat format);
+    static void clearView(const ImageView& view, s32 bytesPerPixel);
+    /**
+        @brief Read a region into a view of the same size.
+        Views of the color type and floating point samples are written by slices,
+        the others are converted from bands of whole chunks decoded in floats
+        */
+    static bool readView(Context& context, Stream& stream, const ImageView& view, ColorType colorType, const Box2i& region, s32 numThreads);
+    /**
+        @brief Read the header, and pixels into view or image if either is not null
+        */
+    static bool readImage(Information& information, void* image, const ImageView* view, Stream& stream, s32 numThreads);
+    static bool writeImage(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const void* image, s64 pitch, Compression compression, s32 numThreads);
+    static bool writeTiledImage(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const void* image, s64 pitch, s32 tileWidth, s32 tileHeight, LevelMode levelMode, RoundingMode roundingMode, Compression compression, s32 numThreads);
+    static bool writeScanlineBlocks(WriteContext& context, u64 offset, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, Compression compression, const void* data, s64 pitch, s32 numThreads);
+    static bool writeTileBlocks(WriteContext& context, u64 offset, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const TiledDesc& tiles, Compression compression, const void* data, s64 pitch, s32 numThreads);
+    /**
+        @brief Compress blocks in parallel, and lay them out with the offset table
+        @param numCoordinates ... 1 for scanline blocks, 4 for tiles
+        */
+    static bool writeBlocks(WriteContext& context, u64 offset, s32 numBlocks, const BlockRegion* regions, s32 numCoordinates, ColorType colorType, Type pixelType, Type imageType, Compression compression, s32 numThreads);
+};
+
+/**
+    @brief Random access to tiles and levels of a tiled image
+    */
+class OpenEXR::TiledReader
+{
+public:
+    TiledReader();
+    ~TiledReader();
+
+    /**
+        @brief Read the header and the offset table. The stream is referenced until close
+        @return Success:true, Fail:false
+        @param stream
+        */
+    bool open(Stream& stream);
+    void close();
+
+    /**
+        @brief Channels of the image, and the size of the full resolution level
+        */
+    const Information& getInformation() const;
+    LevelMode getLevelMode() const;
+    RoundingMode getRoundingMode() const;
+    s32 getTileWidth() const;
+    s32 getTileHeight() const;
+    /**
+        @brief Number of levels in x, it is same as in y for MIPMAP_LEVELS
+        */
+    s32 getNumXLevels() const;
+    s32 getNumYLevels() const;
+    s32 getLevelWidth(s32 lx) const;
+    s32 getLevelHeight(s32 ly) const;
+    s32 getNumXTiles(s32 lx) const;
+    s32 getNumYTiles(s32 ly) const;
+
+    /**
+        @brief Find the smallest level which is not smaller than the target resolution
+        @param lx
+        @param ly ... same as lx for MIPMAP_LEVELS
+        @param width
+        @param height
+        */
+    void findLevel(s32& lx, s32& ly, s32 width, s32 height) const;
+
+    /**
+        @brief Decode a tile
+        @return Success:true, Fail:false
+        @param image ... top left pixel of the tile
+        @param pitch ... bytes per row of the image
+        @param tx
+        @param ty
+        @param lx
+        @param ly
+        */
+    bool readTile(void* image, s32 pitch, s32 tx, s32 ty, s32 lx, s32 ly);
+
+    /**
+        @brief Decode all tiles of a level
+        @return Success:true, Fail:false
+        @param image ... getLevelWidth(lx) x getLevelHeight(ly) pixels
+        @param lx
+        @param ly
+        @param numThreads ... number of threads to decompress tiles, 0 uses all hardware threads
+        */
+    bool readLevel(void* image, s32 lx, s32 ly, s32 numThreads = 0);
+
+    /**
+        @brief Decode only the tiles which intersect a rectangle of a level
+        @return Success:true, Fail:false
+        @param image ... rect.width_ x rect.height_ pixels, pixels out of the level are not written
+        @param rect ... in pixels of the level
+        @param lx
+        @param ly
+        @param numThreads ... number of threads to decompress tiles, 0 uses all hardware threads
+        */
+    bool readLevel(void* image, const Rect& rect, s32 lx, s32 ly, s32 numThreads = 0);
+
+private:
+    TiledReader(const TiledReader&) = delete;
+    TiledReader& operator=(const TiledReader&) = delete;
+
+    Context* context_;
+    Context::Worker* worker_;
+    Stream* stream_;
+    Information information_;
+};
+
+/**
+    @brief Index of parts of a multi-part image, and decoding of a part without reading the others.
+    A single-part image is read as one part
+    */
+class OpenEXR::MultiPartReader
+{
+public:
+    MultiPartReader();
+    ~MultiPartReader();
+
+    /**
+        @brief Read the headers of all parts. The stream is referenced until close
+        @return Success:true, Fail:false
+        @param stream
+        */
+    bool open(Stream& stream);
+    void close();
+
+    s32 getNumParts() const;
+    /**
+        @return Index of the part, or -1 if not found
+        @param name
+        */
+    s32 findPart(const Char* name) const;
+    const Char* getName(s32 part) const;
+    bool isTiled(s32 part) const;
+    s32 getNumChannels(s32 part) const;
+    /**
+        @brief Channels are sorted by name
+        */
+    const Char* getChannelName(s32 part, s32 channel) const;
+    /**
+        @return Type of samples in the file
+        */
+    s32 getChannelType(s32 part, s32 channel) const;
+    /**
+        @brief Find channels by a pattern like "diffuse.*", '*' matches any characters, and '?' matches a character
+        @return Number of found channels, it can be more than maxChannels
+        @param channels ... indices of found channels
+        @param maxChannels
+        @param part
+        @param pattern
+        */
+    s32 findChannels(s32* channels, s32 maxChannels, s32 part, const Char* pattern) const;
+
+    /**
+        @brief Channels of a part, and the size of its data window
+        @return Success:true, Fail:false if the part cannot be decoded
+        @param information
+        @param part
+        */
+    bool getInformation(Information& information, s32 part) const;
+    /**
+        @brief Pixels stored in a part, rectangles are in the coordinates of the file
+        */
+    void getDataWindow(Rect& rect, s32 part) const;
+    /**
+        @brief Pixels to be displayed, it can be larger or smaller than the data window
+        */
+    void getDisplayWindow(Rect& rect, s32 part) const;
+
+    /**
+        @brief Decode a part, or the full resolution level of a tiled part. The offset table of the part is read at first
+        @return Success:true, Fail:false
+        @param image
+        @param part
+        @param numThreads ... number of threads to decompress chunks, 0 uses all hardware threads
+        */
+    bool read(void* image, s32 part, s32 numThreads = 0);
+
+    /**
+        @brief Decode only the chunks or the tiles which intersect a rectangle, and copy only the overlapping pixels
+        @return Success:true, Fail:false
+        @param image ... rect.width_ x rect.height_ pixels, pixels out of the data window are zero
+        @param part
+        @param rect ... in the coordinates of the file, like getDataWindow or getDisplayWindow
+        @param numThreads ... number of threads to decompress chunks, 0 uses all hardware threads
+        */
+    bool read(void* image, s32 part, const Rect& rect, s32 numThreads = 0);
+
+    /**
+        @brief Read a rectangle into a view of the size of rect, converting samples to the format of the view
+        @return Success:true, Fail:false
+        */
+    bool read(const ImageView& image, s32 part, const Rect& rect, s32 numThreads = 0);
+
+    /**
+        @brief Decode selected channels of a part, or of the full resolution level of a tiled part.
+        Only the selected channels are converted and copied, so any layout of planar or interleaved samples can be used
+        @return Success:true, Fail:false if a channel is not found
+        @param part
+        @param numSlices
+        @param slices ... destinations of channels selected by name, base_ points the top left sample of the data window
+        @param numThreads ... number of threads to decompress chunks, 0 uses all hardware threads
+        */
+    bool read(s32 part, s32 numSlices, const Slice* slices, s32 numThreads = 0);
+
+    /**
+        @brief Decode selected channels in a rectangle, samples out of the data window are not written
+        @return Success:true, Fail:false if a channel is not found
+        @param part
+        @param rect ... in the coordinates of the file, the slices start at its top left
+        @param numSlices
+        @param slices
+        @param numThreads ... number of threads to decompress chunks, 0 uses all hardware threads
+        */
+    bool read(s32 part, const Rect& rect, s32 numSlices, const Slice* slices, s32 numThreads = 0);
+
+private:
+    MultiPartReader(const MultiPartReader&) = delete;
+    MultiPartReader& operator=(const MultiPartReader&) = delete;
 
-    static bool writeScanlines_NO_COMPRESSION(WriteContext& context, u64 offset, s32 width, s32 height, ColorType colorType, Type pixelType, const void* data);
-    static bool writeScanlines_ZIP_COMPRESSION(WriteContext& context, u64 offset, s32 width, s32 height, ColorType colorType, Type pixelType, s32 linesPerBlock, const void* data);
+    bool readHeaders(Stream& stream, Version version);
+    /**
+        @brief Read the offset table of a part, if it has not been read
+        */
+    bool readOffsetTable(s32 part);
+    bool readPart(s32 part, const Slice* slices, const Box2i& region, s32 numThreads);
+
+    s32 numParts_;
+    Context** parts_;
+    Information* informations_;
+    off_t offsetTables_;
+    Stream* stream_;
 };
 #endif
 
@@ -2384,14 +3358,25 @@ private:
 #    define ALIGNED(N) __attribute__((aligned(N)))
 #endif
 
-// Enable the use of F16C intrinsic functions
-#if !defined(_MSC_VER)
-#    define CPPIMG_DISABLE_F16C
+// Enable the use of F16C intrinsic functions, with MSVC or compilers targeting F16C
+#if defined(CPPIMG_DISABLE_AVX) || (!defined(_MSC_VER) && !defined(__F16C__))
+#    if !defined(CPPIMG_DISABLE_F16C)
+#        define CPPIMG_DISABLE_F16C
+#    endif
 #endif
 
-#if !defined(CPPIMG_DISABLE_F16C) && !defined(CPPIMG_DISABLE_AVX)
+#if !defined(CPPIMG_DISABLE_AVX)
 #    include <emmintrin.h>
 #    include <immintrin.h>
+#    ifdef _MSC_VER
+#        include <intrin.h>
+#    endif
+#endif
+
+#if !defined(CPPIMG_DISABLE_THREADS)
+#    include <atomic>
+#    include <mutex>
+#    include <thread>
 #endif
 
 #ifndef CPPIMG_MALLOC
@@ -2549,91 +3534,145 @@ f32 clamp01(f32 x)
     return u.f32_;
 }
 
-u16 toFloat16(f32 f)
-{
 #if defined(CPPIMG_DISABLE_F16C)
-    UnionU32F32 t;
-    t.f32_ = f;
-
-    u16 sign = (t.u32_ >> 16) & 0x8000U;
-    s32 exponent = (t.u32_ >> 23) & 0x00FFU;
-    u32 fraction = t.u32_ & 0x007FFFFFU;
-
-    if(exponent == 0) {
-        return sign; // Signed zero
-
-    } else if(exponent == 0xFFU) {
-        if(fraction == 0) {
-            return sign | 0x7C00U; // Signed infinity
-        } else {
-            return static_cast<u16>((fraction >> 13) | 0x7C00U); // NaN
-        }
-    } else {
-        exponent += (-127 + 15);
-        if(exponent >= 0x1F) { // Overflow
-            return sign | 0x7C00U;
-        } else if(exponent <= 0) { // Underflow
-            s32 shift = 14 - exponent;
-            if(shift > 24) { // Too small
-                return sign;
-            } else {
-                fraction |= 0x800000U; // Add hidden bit
-                u16 frac = static_cast<u16>(fraction >> shift);
-                if((fraction >> (shift - 1)) & 0x01U) { // Round lowest 1 bit
-                    frac += 1;
+namespace
+{
+    /**
+        @brief Tables to convert half precision floats by adding bits of a mantissa and an exponent
+        */
+    struct HalfTable
+    {
+        HalfTable()
+        {
+            mantissas_[0] = 0;
+            for(u32 i = 1; i < 1024; ++i) { // normalize denormals
+                u32 m = i << 13;
+                u32 e = 0;
+                while(0 == (m & 0x00800000U)) {
+                    e -= 0x00800000U;
+                    m <<= 1;
                 }
-                return sign | frac;
+                mantissas_[i] = (m & ~0x00800000U) | (e + 0x38800000U);
+            }
+            for(u32 i = 1024; i < 2048; ++i) {
+                mantissas_[i] = 0x38000000U + ((i - 1024) << 13);
             }
+            for(u32 i = 0; i < 32; ++i) {
+                exponents_[i] = i << 23;
+                exponents_[i + 32] = 0x80000000U | (i << 23);
+                offsets_[i] = offsets_[i + 32] = 1024;
+            }
+            exponents_[0] = 0;
+            exponents_[31] = 0x47800000U; // Infinity or NaN
+            exponents_[32] = 0x80000000U;
+            exponents_[63] = 0xC7800000U;
+            offsets_[0] = offsets_[32] = 0;
         }
-    }
 
-    u16 ret = static_cast<u16>(sign | ((exponent << 10) & 0x7C00U) | (fraction >> 13));
-    if((fraction >> 12) & 0x01U) { // Round lower 1 bit
-        ret += 1;
+        f32 toFloat32(u16 h) const
+        {
+            UnionU32F32 t;
+            t.u32_ = mantissas_[offsets_[h >> 10] + (h & 0x03FFU)] + exponents_[h >> 10];
+            return t.f32_;
+        }
+
+        u32 mantissas_[2048];
+        u32 exponents_[64];
+        u16 offsets_[64];
+    };
+
+    const HalfTable& getHalfTable()
+    {
+        static const HalfTable table;
+        return table;
     }
-    return ret;
-#else
-    ALIGNED(16)
-    u16 result[8];
-    _mm_store_si128((__m128i*)result, _mm_cvtps_ph(_mm_set1_ps(f), 0)); // round to nearest
-    return result[0];
+} // namespace
 #endif
-}
 
-f32 toFloat32(u16 h)
+u16 toFloat16(f32 f)
 {
 #if defined(CPPIMG_DISABLE_F16C)
-    u32 sign = (h & 0x8000U) << 16;
-    u32 exponent = ((h & 0x7C00U) >> 10);
-    u32 fraction = (h & 0x03FFU);
-
-    if(exponent == 0) {
-        if(fraction != 0) {
-            fraction <<= 1;
-            while(0 == (fraction & 0x0400U)) {
-                ++exponent;
-                fraction <<= 1;
-            }
-            exponent = (127 - 15) - exponent;
-            fraction &= 0x03FFU;
-        }
-
-    } else if(exponent == 0x1FU) {
-        exponent = 0xFFU; // Infinity or NaN
+    // Round the mantissa by adding, then the carry moves the exponent
+    static const u32 Infinity = 0xFFU << 23;
+    static const u32 HalfOverflow = (127 + 16) << 23;
+    static const u32 HalfNormal = 113 << 23;
+    UnionU32F32 denormalMagic;
+    denormalMagic.u32_ = ((127 - 15) + (23 - 10) + 1) << 23;
 
+    UnionU32F32 t;
+    t.f32_ = f;
+    u32 sign = t.u32_ & 0x80000000U;
+    t.u32_ ^= sign;
+
+    u16 ret;
+    if(HalfOverflow <= t.u32_) {
+        ret = (Infinity < t.u32_) ? 0x7E00U : 0x7C00U; // NaN or infinity
+    } else if(t.u32_ < HalfNormal) {
+        t.f32_ += denormalMagic.f32_; // Shift a denormal by the adder of floats
+        ret = static_cast<u16>(t.u32_ - denormalMagic.u32_);
     } else {
-        exponent += (127 - 15);
+        u32 odd = (t.u32_ >> 13) & 0x01U;
+        t.u32_ += (static_cast<u32>(15 - 127) << 23) + 0xFFFU + odd;
+        ret = static_cast<u16>(t.u32_ >> 13);
     }
+    return static_cast<u16>(ret | (sign >> 16));
+#else
+    return static_cast<u16>(_mm_cvtsi128_si32(_mm_cvtps_ph(_mm_set_ss(f), 0))); // round to nearest
+#endif
+}
 
-    UnionU32F32 t;
-    t.u32_ = sign | (exponent << 23) | (fraction << 13);
+f32 toFloat32(u16 h)
+{
+#if defined(CPPIMG_DISABLE_F16C)
+    return getHalfTable().toFloat32(h);
+#else
+    return _mm_cvtss_f32(_mm_cvtph_ps(_mm_cvtsi32_si128(h)));
+#endif
+}
+
+void convertF32ToF16(s32 count, u16* dst, const f32* src)
+{
+    CPPIMG_ASSERT(0 <= count);
+    s32 i = 0;
+#if !defined(CPPIMG_DISABLE_F16C)
+#    if defined(__AVX512F__)
+    // The masked forms with a zero source, the unmasked ones use an uninitialized value in GCC's headers
+    for(; (i + 16) <= count; i += 16) {
+        __m256i x = _mm512_mask_cvtps_ph(_mm256_setzero_si256(), 0xFFFFU, _mm512_loadu_ps(src + i), 0); // round to nearest
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), x);
+    }
+#    endif
+    for(; (i + 8) <= count; i += 8) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), 0));
+    }
+#endif
+    for(; i < count; ++i) {
+        dst[i] = toFloat16(src[i]);
+    }
+}
 
-    return t.f32_;
+void convertF16ToF32(s32 count, f32* dst, const u16* src)
+{
+    CPPIMG_ASSERT(0 <= count);
+#if !defined(CPPIMG_DISABLE_F16C)
+    s32 i = 0;
+#    if defined(__AVX512F__)
+    for(; (i + 16) <= count; i += 16) {
+        __m512 x = _mm512_mask_cvtph_ps(_mm512_setzero_ps(), 0xFFFFU, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+        _mm512_storeu_ps(dst + i, x);
+    }
+#    endif
+    for(; (i + 8) <= count; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))));
+    }
+    for(; i < count; ++i) {
+        dst[i] = toFloat32(src[i]);
+    }
 #else
-    ALIGNED(16)
-    f32 result[4];
-    _mm_store_ps(result, _mm_cvtph_ps(_mm_set1_epi16(*(s16*)&h)));
-    return result[0];
+    const HalfTable& table = getHalfTable();
+    for(s32 i = 0; i < count; ++i) {
+        dst[i] = table.toFloat32(src[i]);
+    }
 #endif
 }
 
@@ -2683,6 +3722,79 @@ s32 getNumChannels(ColorType type)
     }
 }
 
+ColorType getColorType(PixelFormat format)
+{
+    return static_cast<ColorType>(static_cast<s32>(format) % 3);
+}
+
+s32 getNumChannels(PixelFormat format)
+{
+    return getNumChannels(getColorType(format));
+}
+
+s32 getBytesPerSample(PixelFormat format)
+{
+    switch(static_cast<s32>(format) / 3) {
+    case 0:
+        return 1;
+    case 1:
+        return sizeof(u16);
+    default:
+        return sizeof(f32);
+    }
+}
+
+s32 getBytesPerPixel(PixelFormat format)
+{
+    return getNumChannels(format) * getBytesPerSample(format);
+}
+
+PixelFormat getPixelFormat(ColorType colorType)
+{
+    return static_cast<PixelFormat>(static_cast<s32>(colorType));
+}
+
+PixelFormat getPixelFormat(ColorType colorType, Type type)
+{
+    CPPIMG_ASSERT(Type::UINT != type);
+    s32 offset = (Type::HALF == type) ? 3 : 6;
+    return static_cast<PixelFormat>(offset + static_cast<s32>(colorType));
+}
+
+ImageView ImageView::create(void* data, s32 width, s32 height, PixelFormat format, s64 pitch)
+{
+    CPPIMG_ASSERT(0 <= width);
+    CPPIMG_ASSERT(0 <= height);
+    ImageView view;
+    view.data_ = reinterpret_cast<u8*>(data);
+    view.width_ = width;
+    view.height_ = height;
+    view.pitch_ = (0 == pitch) ? static_cast<s64>(width) * getBytesPerPixel(format) : pitch;
+    view.format_ = format;
+    return view;
+}
+
+ImageView ImageView::createBottomUp(void* data, s32 width, s32 height, PixelFormat format, s64 pitch)
+{
+    ImageView view = create(data, width, height, format, pitch);
+    if(0 < height) {
+        view.data_ += (height - 1) * view.pitch_;
+    }
+    view.pitch_ = -view.pitch_;
+    return view;
+}
+
+ImageView ImageView::getSubView(s32 x, s32 y, s32 width, s32 height) const
+{
+    CPPIMG_ASSERT(0 <= x && 0 <= width && (x + width) <= width_);
+    CPPIMG_ASSERT(0 <= y && 0 <= height && (y + height) <= height_);
+    ImageView view = *this;
+    view.data_ = getRow(y) + static_cast<s64>(x) * getBytesPerPixel(format_);
+    view.width_ = width;
+    view.height_ = height;
+    return view;
+}
+
 float Color::toFloat(u8 x)
 {
     return (1.0f / 255.0f) * x;
@@ -2704,73 +3816,385 @@ u8 Color::toGray(u8 r, u8 g, u8 b)
     return t < 256 ? static_cast<u8>(t) : 255;
 }
 
-void convert(s32 width, s32 height, s32 channels, u8* dst, const void* src, const s32* types)
+namespace
 {
-    CPPIMG_ASSERT(0 <= width);
-    CPPIMG_ASSERT(0 <= height);
-    CPPIMG_ASSERT(0 <= channels);
-    CPPIMG_ASSERT(CPPIMG_NULL != dst);
-    CPPIMG_ASSERT(CPPIMG_NULL != src);
-    CPPIMG_ASSERT(CPPIMG_NULL != types);
+    enum ToneMap
+    {
+        ToneMap_None = 0,
+        ToneMap_Reinhard,
+        ToneMap_ACES,
+    };
 
-    s32 sizes[MaxChannels];
-    for(s32 i = 0; i < channels; ++i) {
-        sizes[i] = getSize(static_cast<Type>(types[i]));
+    /**
+        @brief sRGB encoded 8 bits of 12 bits linear values
+        */
+    struct SRGBTable
+    {
+        static const s32 Size = 4096;
+
+        SRGBTable()
+        {
+            for(s32 i = 0; i < Size; ++i) {
+                f32 x = static_cast<f32>(i) / (Size - 1);
+                x = (x <= 0.0031308f) ? 12.92f * x : 1.055f * powf(x, 1.0f / 2.4f) - 0.055f;
+                table_[i] = static_cast<u8>(x * 255.0f + 0.5f);
+            }
+        }
+
+        u8 table_[Size];
+    };
+
+    const SRGBTable& getSRGBTable()
+    {
+        static const SRGBTable table;
+        return table;
     }
-    s32 srcBytesPerPixel = getBytesPerPixel(channels, types);
 
-    F32ToU8 f32ToU8;
-    U32ToU8 u32ToU8;
-    F16ToU8 f16ToU8;
+    /**
+        @brief Inputs of the curves are clamped to this. The curves reach 1 before it, and ACES does not overflow
+        */
+    static const f32 MaxToneMapInput = 1.0e9f;
 
-    s32 dstStep = width * channels;
-    u8* dr = reinterpret_cast<u8*>(dst);
-    s32 srcStep = width * srcBytesPerPixel;
-    const u8* sr = reinterpret_cast<const u8*>(src);
-    for(s32 i = 0; i < height; ++i) {
-        u8* d = dr;
-        const u8* s = sr;
+    /**
+        @brief Clamp to [0, maxValue], NaN to 0 same as _mm_max_ps(x, 0)
+        */
+    inline f32 saturate(f32 x, f32 maxValue)
+    {
+        return (0.0f < x) ? minimum(x, maxValue) : 0.0f;
+    }
+
+    template<s32 Mode>
+    f32 toneMap(f32 x)
+    {
+        switch(Mode) {
+        case ToneMap_Reinhard:
+            return x / (1.0f + x);
+        case ToneMap_ACES:
+            return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+        default:
+            return x;
+        }
+    }
+
+#    if !defined(CPPIMG_DISABLE_AVX)
+    template<s32 Mode>
+    __m128 toneMap(__m128 x)
+    {
+        switch(Mode) {
+        case ToneMap_Reinhard:
+            return _mm_div_ps(x, _mm_add_ps(_mm_set1_ps(1.0f), x));
+        case ToneMap_ACES: {
+            __m128 n = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+            __m128 d = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+            return _mm_div_ps(n, d);
+        }
+        default:
+            return x;
+        }
+    }
+#    endif
+
+    /**
+        @brief Map a row of samples to 8 bits. Samples are truncated if linear, or rounded through the table if sRGB
+        @param alpha ... step of alpha samples, 2 or 4, or 0 for no alpha
+        */
+    template<s32 Mode, bool SRGB>
+    void storeU8(u8* dst, const f32* src, s32 count, s32 alpha, f32 scale)
+    {
+        const u8* table = SRGB ? getSRGBTable().table_ : CPPIMG_NULL;
+        const f32 limit = SRGB ? static_cast<f32>(SRGBTable::Size - 1) : 255.0f;
+        s32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        // Alpha lanes bypass exposure, tone mapping, and the table
+        __m128 alphaMask = _mm_setzero_ps();
+        if(0 < alpha) {
+            alphaMask = (2 == alpha) ? _mm_castsi128_ps(_mm_setr_epi32(0, -1, 0, -1)) : _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+        }
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 colorScale = _mm_set1_ps(scale);
+        const __m128 maxInput = _mm_set1_ps(MaxToneMapInput);
+        const __m128 colorLimit = _mm_set1_ps(limit);
+        const __m128 alphaLimit = _mm_set1_ps(255.0f);
+        const __m128 half = _mm_set1_ps(SRGB ? 0.5f : 0.0f);
+        for(; (i + 16) <= count; i += 16) {
+            __m128i v[4];
+            for(s32 k = 0; k < 4; ++k) {
+                __m128 a = _mm_loadu_ps(src + i + k * 4);
+                // NaN is replaced by the second operand of max
+                __m128 c = toneMap<Mode>(_mm_min_ps(_mm_max_ps(_mm_mul_ps(a, colorScale), zero), maxInput));
+                c = _mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(c, zero), one), colorLimit), half);
+                a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(a, zero), one), alphaLimit);
+                v[k] = _mm_cvttps_epi32(_mm_blendv_ps(c, a, alphaMask));
+            }
+            if(SRGB) {
+                ALIGNED(16)
+                s32 indices[16];
+                for(s32 k = 0; k < 4; ++k) {
+                    _mm_store_si128(reinterpret_cast<__m128i*>(indices + k * 4), v[k]);
+                }
+                for(s32 k = 0; k < 16; ++k) {
+                    bool isAlpha = 0 < alpha && (alpha - 1) == ((i + k) % alpha);
+                    dst[i + k] = isAlpha ? static_cast<u8>(indices[k]) : table[indices[k]];
+                }
+            } else {
+                __m128i x = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), x);
+            }
+        }
+#    endif
+        for(; i < count; ++i) {
+            f32 x = src[i];
+            if(0 < alpha && (alpha - 1) == (i % alpha)) {
+                dst[i] = static_cast<u8>(saturate(x, 1.0f) * 255.0f);
+                continue;
+            }
+            x = toneMap<Mode>(saturate(x * scale, MaxToneMapInput));
+            x = saturate(x, 1.0f) * limit;
+            dst[i] = SRGB ? table[static_cast<s32>(x + 0.5f)] : static_cast<u8>(x);
+        }
+    }
+
+    typedef void (*StoreU8)(u8* dst, const f32* src, s32 count, s32 alpha, f32 scale);
+
+    template<s32 Mode>
+    StoreU8 getStoreU8(bool srgb)
+    {
+        return srgb ? storeU8<Mode, true> : storeU8<Mode, false>;
+    }
+
+    /**
+        @brief Load a row of samples of a type into floats
+        */
+    template<Type T>
+    const f32* loadRow(f32* dst, const u8* src, s32 count);
+
+    template<>
+    const f32* loadRow<Type::UINT>(f32* dst, const u8* src, s32 count)
+    {
+        const u32* s = reinterpret_cast<const u32*>(src);
+        for(s32 i = 0; i < count; ++i) {
+            dst[i] = U32ToF32::convert(s[i]);
+        }
+        return dst;
+    }
+
+    template<>
+    const f32* loadRow<Type::HALF>(f32* dst, const u8* src, s32 count)
+    {
+        convertF16ToF32(count, dst, reinterpret_cast<const u16*>(src));
+        return dst;
+    }
+
+    template<>
+    const f32* loadRow<Type::FLOAT>(f32*, const u8* src, s32)
+    {
+        return reinterpret_cast<const f32*>(src);
+    }
+
+    const f32* loadMixedRow(f32* dst, const u8* src, s32 width, s32 channels, const s32* types)
+    {
+        f32* d = dst;
         for(s32 j = 0; j < width; ++j) {
-            for(s32 k = 0; k < channels; ++k) {
+            for(s32 k = 0; k < channels; ++k, ++d) {
                 switch(types[k]) {
                 case static_cast<s32>(Type::UINT):
-                    *d = u32ToU8(*reinterpret_cast<const u32*>(s));
+                    *d = U32ToF32::convert(*reinterpret_cast<const u32*>(src));
+                    src += sizeof(u32);
                     break;
                 case static_cast<s32>(Type::HALF):
-                    *d = f16ToU8(*reinterpret_cast<const u16*>(s));
+                    *d = toFloat32(*reinterpret_cast<const u16*>(src));
+                    src += sizeof(u16);
                     break;
                 case static_cast<s32>(Type::FLOAT):
-                    *d = f32ToU8(*reinterpret_cast<const f32*>(s));
+                    *d = *reinterpret_cast<const f32*>(src);
+                    src += sizeof(f32);
                     break;
                 default:
                     CPPIMG_ASSERT(false);
                     break;
                 }
-                ++d;
-                s += sizes[k];
             }
         }
-        dr += dstStep;
-        sr += srcStep;
+        return dst;
+    }
+
+    /**
+        @brief Convert samples to 8 bits through a row of floats
+        @param row ... width*channels floats
+        */
+    void convertToU8(s32 width, s32 height, s32 channels, u8* dst, const void* src, const s32* types, s32 options, f32 exposure, f32* row)
+    {
+        StoreU8 store;
+        if(0 != (options & Convert_ACES)) {
+            store = getStoreU8<ToneMap_ACES>(0 != (options & Convert_SRGB));
+        } else if(0 != (options & Convert_Reinhard)) {
+            store = getStoreU8<ToneMap_Reinhard>(0 != (options & Convert_SRGB));
+        } else {
+            store = getStoreU8<ToneMap_None>(0 != (options & Convert_SRGB));
+        }
+        f32 scale = exp2f(exposure);
+        s32 alpha = (2 == channels || 4 == channels) ? channels : 0;
+
+        // Rows of a type are converted at once, mixed rows sample by sample
+        s32 type = (0 < channels) ? types[0] : static_cast<s32>(Type::FLOAT);
+        for(s32 i = 1; i < channels; ++i) {
+            if(types[i] != type) {
+                type = -1;
+                break;
+            }
+        }
+        s32 count = width * channels;
+        s32 srcStep = width * getBytesPerPixel(channels, types);
+        u8* dr = dst;
+        const u8* sr = reinterpret_cast<const u8*>(src);
+        for(s32 i = 0; i < height; ++i) {
+            const f32* samples;
+            switch(type) {
+            case static_cast<s32>(Type::UINT):
+                samples = loadRow<Type::UINT>(row, sr, count);
+                break;
+            case static_cast<s32>(Type::HALF):
+                samples = loadRow<Type::HALF>(row, sr, count);
+                break;
+            case static_cast<s32>(Type::FLOAT):
+                samples = loadRow<Type::FLOAT>(row, sr, count);
+                break;
+            default:
+                samples = loadMixedRow(row, sr, width, channels, types);
+                break;
+            }
+            store(dr, samples, count, alpha, scale);
+            dr += count;
+            sr += srcStep;
+        }
     }
+} // namespace
+
+bool convert(s32 width, s32 height, s32 channels, u8* dst, const void* src, const s32* types)
+{
+    return convert(width, height, channels, dst, src, types, Convert_None, 0.0f);
 }
 
-void convertGrayToRGB(s32 width, s32 height, u8* dst, const u8* src)
+bool convert(s32 width, s32 height, s32 channels, u8* dst, const void* src, const s32* types, s32 options, f32 exposure)
 {
     CPPIMG_ASSERT(0 <= width);
     CPPIMG_ASSERT(0 <= height);
+    CPPIMG_ASSERT(0 <= channels);
     CPPIMG_ASSERT(CPPIMG_NULL != dst);
     CPPIMG_ASSERT(CPPIMG_NULL != src);
+    CPPIMG_ASSERT(CPPIMG_NULL != types);
 
-    for(s32 i = 0; i < height; ++i) {
-        for(s32 j = 0; j < width; ++j) {
-            const u8* s = src + i * width + j;
-            u8* d = dst + (i * width + j) * 3;
-            d[0] = s[0];
-            d[1] = s[0];
-            d[2] = s[0];
+    f32* row = reinterpret_cast<f32*>(CPPIMG_MALLOC(sizeof(f32) * maximum(width * channels, 1)));
+    if(CPPIMG_NULL == row) {
+        return false;
+    }
+    convertToU8(width, height, channels, dst, src, types, options, exposure, row);
+    CPPIMG_FREE(row);
+    return true;
+}
+
+namespace
+{
+    /**
+        @brief Fixed point weights of colors, which sum up to 256
+        */
+    struct LumaWeights
+    {
+        LumaWeights(Luma luma)
+        {
+            if(Luma::BT709 == luma) {
+                r_ = 54;
+                g_ = 183;
+                b_ = 19;
+            } else {
+                r_ = 77;
+                g_ = 150;
+                b_ = 29;
+            }
         }
+
+        u8 operator()(u8 r, u8 g, u8 b) const
+        {
+            return static_cast<u8>((r_ * r + g_ * g + b_ * b + 128) >> 8);
+        }
+
+        s32 r_;
+        s32 g_;
+        s32 b_;
+    };
+
+#    if !defined(CPPIMG_DISABLE_AVX)
+    inline __m128i loadu128(const u8* src)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    }
+
+    inline void storeu128(u8* dst, __m128i x)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), x);
+    }
+
+    inline s32 countTrailingZeros(u32 x)
+    {
+        CPPIMG_ASSERT(0 != x);
+#        ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, x);
+        return static_cast<s32>(index);
+#        else
+        return __builtin_ctz(x);
+#        endif
+    }
+
+    inline __m128i luma16(__m128i r, __m128i g, __m128i b, const LumaWeights& weights)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i wr = _mm_set1_epi16(static_cast<s16>(weights.r_));
+        const __m128i wg = _mm_set1_epi16(static_cast<s16>(weights.g_));
+        const __m128i wb = _mm_set1_epi16(static_cast<s16>(weights.b_));
+        const __m128i round = _mm_set1_epi16(128);
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(r, zero), wr), _mm_mullo_epi16(_mm_unpacklo_epi8(g, zero), wg));
+        lo = _mm_add_epi16(_mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), wb)), round);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(r, zero), wr), _mm_mullo_epi16(_mm_unpackhi_epi8(g, zero), wg));
+        hi = _mm_add_epi16(_mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), wb)), round);
+        return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+    }
+#    endif
+} // namespace
+
+// Expansions run from the back, and compactions from the front, so that dst can be src.
+// Vector loops read and write whole 16 pixels, never beyond the images
+void convertGrayToRGB(s32 width, s32 height, u8* dst, const u8* src)
+{
+    CPPIMG_ASSERT(0 <= width);
+    CPPIMG_ASSERT(0 <= height);
+    CPPIMG_ASSERT(CPPIMG_NULL != dst);
+    CPPIMG_ASSERT(CPPIMG_NULL != src);
+
+    s32 count = width * height;
+    s32 blocks = 0;
+#if !defined(CPPIMG_DISABLE_AVX)
+    blocks = count >> 4;
+#endif
+    for(s32 i = count - 1; (blocks << 4) <= i; --i) {
+        u8 x = src[i];
+        dst[i * 3 + 0] = x;
+        dst[i * 3 + 1] = x;
+        dst[i * 3 + 2] = x;
+    }
+#if !defined(CPPIMG_DISABLE_AVX)
+    const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    for(s32 i = blocks - 1; 0 <= i; --i) {
+        __m128i x = loadu128(src + i * 16);
+        u8* d = dst + i * 48;
+        storeu128(d, _mm_shuffle_epi8(x, m0));
+        storeu128(d + 16, _mm_shuffle_epi8(x, m1));
+        storeu128(d + 32, _mm_shuffle_epi8(x, m2));
     }
+#endif
 }
 
 void convertGrayToRGBA(s32 width, s32 height, u8* dst, const u8* src)
@@ -2780,31 +4204,66 @@ void convertGrayToRGBA(s32 width, s32 height, u8* dst, const u8* src)
     CPPIMG_ASSERT(CPPIMG_NULL != dst);
     CPPIMG_ASSERT(CPPIMG_NULL != src);
 
-    for(s32 i = 0; i < height; ++i) {
-        for(s32 j = 0; j < width; ++j) {
-            const u8* s = src + i * width + j;
-            u8* d = dst + (i * width + j) * 4;
-            d[0] = s[0];
-            d[1] = s[0];
-            d[2] = s[0];
-            d[3] = 255;
-        }
+    s32 count = width * height;
+    s32 blocks = 0;
+#if !defined(CPPIMG_DISABLE_AVX)
+    blocks = count >> 4;
+#endif
+    for(s32 i = count - 1; (blocks << 4) <= i; --i) {
+        u8 x = src[i];
+        dst[i * 4 + 0] = x;
+        dst[i * 4 + 1] = x;
+        dst[i * 4 + 2] = x;
+        dst[i * 4 + 3] = 255;
+    }
+#if !defined(CPPIMG_DISABLE_AVX)
+    const __m128i alpha = _mm_set1_epi32(static_cast<s32>(0xFF000000U));
+    for(s32 i = blocks - 1; 0 <= i; --i) {
+        __m128i x = loadu128(src + i * 16);
+        u8* d = dst + i * 64;
+        storeu128(d, _mm_or_si128(_mm_shuffle_epi8(x, _mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1)), alpha));
+        storeu128(d + 16, _mm_or_si128(_mm_shuffle_epi8(x, _mm_setr_epi8(4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1)), alpha));
+        storeu128(d + 32, _mm_or_si128(_mm_shuffle_epi8(x, _mm_setr_epi8(8, 8, 8, -1, 9, 9, 9, -1, 10, 10, 10, -1, 11, 11, 11, -1)), alpha));
+        storeu128(d + 48, _mm_or_si128(_mm_shuffle_epi8(x, _mm_setr_epi8(12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1)), alpha));
     }
+#endif
 }
 
-void convertRGBToGray(s32 width, s32 height, u8* dst, const u8* src)
+void convertRGBToGray(s32 width, s32 height, u8* dst, const u8* src, Luma luma)
 {
     CPPIMG_ASSERT(0 <= width);
     CPPIMG_ASSERT(0 <= height);
     CPPIMG_ASSERT(CPPIMG_NULL != dst);
     CPPIMG_ASSERT(CPPIMG_NULL != src);
 
-    for(s32 i = 0; i < height; ++i) {
-        for(s32 j = 0; j < width; ++j) {
-            const u8* s = src + (i * width + j) * 3;
-            u8* d = dst + (i * width + j);
-            d[0] = Color::toGray(src[0], s[1], s[2]);
-        }
+    LumaWeights weights(luma);
+    s32 count = width * height;
+    s32 i = 0;
+#if !defined(CPPIMG_DISABLE_AVX)
+    // Gather each color from 3 vectors
+    const __m128i r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    for(; (i + 16) <= count; i += 16) {
+        const u8* s = src + i * 3;
+        __m128i x0 = loadu128(s);
+        __m128i x1 = loadu128(s + 16);
+        __m128i x2 = loadu128(s + 32);
+        __m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x0, r0), _mm_shuffle_epi8(x1, r1)), _mm_shuffle_epi8(x2, r2));
+        __m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x0, g0), _mm_shuffle_epi8(x1, g1)), _mm_shuffle_epi8(x2, g2));
+        __m128i b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x0, b0), _mm_shuffle_epi8(x1, b1)), _mm_shuffle_epi8(x2, b2));
+        storeu128(dst + i, luma16(r, g, b, weights));
+    }
+#endif
+    for(; i < count; ++i) {
+        const u8* s = src + i * 3;
+        dst[i] = weights(s[0], s[1], s[2]);
     }
 }
 
@@ -2815,31 +4274,71 @@ void convertRGBToRGBA(s32 width, s32 height, u8* dst, const u8* src)
     CPPIMG_ASSERT(CPPIMG_NULL != dst);
     CPPIMG_ASSERT(CPPIMG_NULL != src);
 
-    for(s32 i = 0; i < height; ++i) {
-        for(s32 j = 0; j < width; ++j) {
-            const u8* s = src + (i * width + j) * 3;
-            u8* d = dst + (i * width + j) * 4;
-            d[0] = s[0];
-            d[1] = s[1];
-            d[2] = s[2];
-            d[3] = 255;
-        }
+    s32 count = width * height;
+    s32 blocks = 0;
+#if !defined(CPPIMG_DISABLE_AVX)
+    blocks = count >> 4;
+#endif
+    for(s32 i = count - 1; (blocks << 4) <= i; --i) {
+        const u8* s = src + i * 3;
+        u8* d = dst + i * 4;
+        u8 r = s[0];
+        u8 g = s[1];
+        u8 b = s[2];
+        d[0] = r;
+        d[1] = g;
+        d[2] = b;
+        d[3] = 255;
+    }
+#if !defined(CPPIMG_DISABLE_AVX)
+    const __m128i alpha = _mm_set1_epi32(static_cast<s32>(0xFF000000U));
+    const __m128i m = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    for(s32 i = blocks - 1; 0 <= i; --i) {
+        const u8* s = src + i * 48;
+        __m128i x0 = loadu128(s);
+        __m128i x1 = loadu128(s + 16);
+        __m128i x2 = loadu128(s + 32);
+        u8* d = dst + i * 64;
+        storeu128(d, _mm_or_si128(_mm_shuffle_epi8(x0, m), alpha));
+        storeu128(d + 16, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(x1, x0, 12), m), alpha));
+        storeu128(d + 32, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(x2, x1, 8), m), alpha));
+        storeu128(d + 48, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(x2, 4), m), alpha));
     }
+#endif
 }
 
-void convertRGBAToGray(s32 width, s32 height, u8* dst, const u8* src)
+void convertRGBAToGray(s32 width, s32 height, u8* dst, const u8* src, Luma luma)
 {
     CPPIMG_ASSERT(0 <= width);
     CPPIMG_ASSERT(0 <= height);
     CPPIMG_ASSERT(CPPIMG_NULL != dst);
     CPPIMG_ASSERT(CPPIMG_NULL != src);
 
-    for(s32 i = 0; i < height; ++i) {
-        for(s32 j = 0; j < width; ++j) {
-            const u8* s = src + (i * width + j) * 4;
-            u8* d = dst + (i * width + j);
-            d[0] = Color::toGray(src[0], s[1], s[2]);
-        }
+    LumaWeights weights(luma);
+    s32 count = width * height;
+    s32 i = 0;
+#if !defined(CPPIMG_DISABLE_AVX)
+    // Group colors of 4 pixels, then transpose 4 vectors
+    const __m128i m = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    for(; (i + 16) <= count; i += 16) {
+        const u8* s = src + i * 4;
+        __m128i x0 = _mm_shuffle_epi8(loadu128(s), m);
+        __m128i x1 = _mm_shuffle_epi8(loadu128(s + 16), m);
+        __m128i x2 = _mm_shuffle_epi8(loadu128(s + 32), m);
+        __m128i x3 = _mm_shuffle_epi8(loadu128(s + 48), m);
+        __m128i t0 = _mm_unpacklo_epi32(x0, x1);
+        __m128i t1 = _mm_unpackhi_epi32(x0, x1);
+        __m128i t2 = _mm_unpacklo_epi32(x2, x3);
+        __m128i t3 = _mm_unpackhi_epi32(x2, x3);
+        __m128i r = _mm_unpacklo_epi64(t0, t2);
+        __m128i g = _mm_unpackhi_epi64(t0, t2);
+        __m128i b = _mm_unpacklo_epi64(t1, t3);
+        storeu128(dst + i, luma16(r, g, b, weights));
+    }
+#endif
+    for(; i < count; ++i) {
+        const u8* s = src + i * 4;
+        dst[i] = weights(s[0], s[1], s[2]);
     }
 }
 
@@ -2850,42 +4349,333 @@ void convertRGBAToRGB(s32 width, s32 height, u8* dst, const u8* src)
     CPPIMG_ASSERT(CPPIMG_NULL != dst);
     CPPIMG_ASSERT(CPPIMG_NULL != src);
 
-    for(s32 i = 0; i < height; ++i) {
-        for(s32 j = 0; j < width; ++j) {
-            const u8* s = src + (i * width + j) * 4;
-            u8* d = dst + (i * width + j) * 3;
-            d[0] = s[0];
-            d[1] = s[1];
-            d[2] = s[2];
-        }
+    s32 count = width * height;
+    s32 i = 0;
+#if !defined(CPPIMG_DISABLE_AVX)
+    const __m128i m = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for(; (i + 16) <= count; i += 16) {
+        const u8* s = src + i * 4;
+        __m128i x0 = _mm_shuffle_epi8(loadu128(s), m);
+        __m128i x1 = _mm_shuffle_epi8(loadu128(s + 16), m);
+        __m128i x2 = _mm_shuffle_epi8(loadu128(s + 32), m);
+        __m128i x3 = _mm_shuffle_epi8(loadu128(s + 48), m);
+        u8* d = dst + i * 3;
+        storeu128(d, _mm_or_si128(x0, _mm_slli_si128(x1, 12)));
+        storeu128(d + 16, _mm_or_si128(_mm_srli_si128(x1, 4), _mm_slli_si128(x2, 8)));
+        storeu128(d + 32, _mm_or_si128(_mm_srli_si128(x2, 8), _mm_slli_si128(x3, 4)));
+    }
+#endif
+    for(; i < count; ++i) {
+        const u8* s = src + i * 4;
+        u8* d = dst + i * 3;
+        d[0] = s[0];
+        d[1] = s[1];
+        d[2] = s[2];
     }
 }
 
 namespace
 {
-    //----------------------------------------------------
-    //--- CRC32
-    //----------------------------------------------------
-    // clang-format off
-    u32 CRC32Table[] =
-    {
-        0x0U,0x77073096U,0xEE0E612CU,0x990951BAU,0x76DC419U,0x706AF48FU,0xE963A535U,0x9E6495A3U,0xEDB8832U,0x79DCB8A4U,0xE0D5E91EU,0x97D2D988U,0x9B64C2BU,0x7EB17CBDU,0xE7B82D07U,0x90BF1D91U,0x1DB71064U,0x6AB020F2U,0xF3B97148U,0x84BE41DEU,0x1ADAD47DU,0x6DDDE4EBU,0xF4D4B551U,0x83D385C7U,0x136C9856U,0x646BA8C0U,0xFD62F97AU,0x8A65C9ECU,0x14015C4FU,0x63066CD9U,0xFA0F3D63U,0x8D080DF5U,0x3B6E20C8U,0x4C69105EU,0xD56041E4U,0xA2677172U,0x3C03E4D1U,0x4B04D447U,0xD20D85FDU,0xA50AB56BU,0x35B5A8FAU,0x42B2986CU,0xDBBBC9D6U,0xACBCF940U,0x32D86CE3U,0x45DF5C75U,0xDCD60DCFU,0xABD13D59U,0x26D930ACU,0x51DE003AU,0xC8D75180U,0xBFD06116U,0x21B4F4B5U,0x56B3C423U,0xCFBA9599U,0xB8BDA50FU,0x2802B89EU,0x5F058808U,0xC60CD9B2U,0xB10BE924U,0x2F6F7C87U,0x58684C11U,0xC1611DABU,0xB6662D3DU,
-        0x76DC4190U,0x1DB7106U,0x98D220BCU,0xEFD5102AU,0x71B18589U,0x6B6B51FU,0x9FBFE4A5U,0xE8B8D433U,0x7807C9A2U,0xF00F934U,0x9609A88EU,0xE10E9818U,0x7F6A0DBBU,0x86D3D2DU,0x91646C97U,0xE6635C01U,0x6B6B51F4U,0x1C6C6162U,0x856530D8U,0xF262004EU,0x6C0695EDU,0x1B01A57BU,0x8208F4C1U,0xF50FC457U,0x65B0D9C6U,0x12B7E950U,0x8BBEB8EAU,0xFCB9887CU,0x62DD1DDFU,0x15DA2D49U,0x8CD37CF3U,0xFBD44C65U,0x4DB26158U,0x3AB551CEU,0xA3BC0074U,0xD4BB30E2U,0x4ADFA541U,0x3DD895D7U,0xA4D1C46DU,0xD3D6F4FBU,0x4369E96AU,0x346ED9FCU,0xAD678846U,0xDA60B8D0U,0x44042D73U,0x33031DE5U,0xAA0A4C5FU,0xDD0D7CC9U,0x5005713CU,0x270241AAU,0xBE0B1010U,0xC90C2086U,0x5768B525U,0x206F85B3U,0xB966D409U,0xCE61E49FU,0x5EDEF90EU,0x29D9C998U,0xB0D09822U,0xC7D7A8B4U,0x59B33D17U,0x2EB40D81U,0xB7BD5C3BU,0xC0BA6CADU,
-        0xEDB88320U,0x9ABFB3B6U,0x3B6E20CU,0x74B1D29AU,0xEAD54739U,0x9DD277AFU,0x4DB2615U,0x73DC1683U,0xE3630B12U,0x94643B84U,0xD6D6A3EU,0x7A6A5AA8U,0xE40ECF0BU,0x9309FF9DU,0xA00AE27U,0x7D079EB1U,0xF00F9344U,0x8708A3D2U,0x1E01F268U,0x6906C2FEU,0xF762575DU,0x806567CBU,0x196C3671U,0x6E6B06E7U,0xFED41B76U,0x89D32BE0U,0x10DA7A5AU,0x67DD4ACCU,0xF9B9DF6FU,0x8EBEEFF9U,0x17B7BE43U,0x60B08ED5U,0xD6D6A3E8U,0xA1D1937EU,0x38D8C2C4U,0x4FDFF252U,0xD1BB67F1U,0xA6BC5767U,0x3FB506DDU,0x48B2364BU,0xD80D2BDAU,0xAF0A1B4CU,0x36034AF6U,0x41047A60U,0xDF60EFC3U,0xA867DF55U,0x316E8EEFU,0x4669BE79U,0xCB61B38CU,0xBC66831AU,0x256FD2A0U,0x5268E236U,0xCC0C7795U,0xBB0B4703U,0x220216B9U,0x5505262FU,0xC5BA3BBEU,0xB2BD0B28U,0x2BB45A92U,0x5CB36A04U,0xC2D7FFA7U,0xB5D0CF31U,0x2CD99E8BU,0x5BDEAE1DU,
-        0x9B64C2B0U,0xEC63F226U,0x756AA39CU,0x26D930AU,0x9C0906A9U,0xEB0E363FU,0x72076785U,0x5005713U,0x95BF4A82U,0xE2B87A14U,0x7BB12BAEU,0xCB61B38U,0x92D28E9BU,0xE5D5BE0DU,0x7CDCEFB7U,0xBDBDF21U,0x86D3D2D4U,0xF1D4E242U,0x68DDB3F8U,0x1FDA836EU,0x81BE16CDU,0xF6B9265BU,0x6FB077E1U,0x18B74777U,0x88085AE6U,0xFF0F6A70U,0x66063BCAU,0x11010B5CU,0x8F659EFFU,0xF862AE69U,0x616BFFD3U,0x166CCF45U,0xA00AE278U,0xD70DD2EEU,0x4E048354U,0x3903B3C2U,0xA7672661U,0xD06016F7U,0x4969474DU,0x3E6E77DBU,0xAED16A4AU,0xD9D65ADCU,0x40DF0B66U,0x37D83BF0U,0xA9BCAE53U,0xDEBB9EC5U,0x47B2CF7FU,0x30B5FFE9U,0xBDBDF21CU,0xCABAC28AU,0x53B39330U,0x24B4A3A6U,0xBAD03605U,0xCDD70693U,0x54DE5729U,0x23D967BFU,0xB3667A2EU,0xC4614AB8U,0x5D681B02U,0x2A6F2B94U,0xB40BBE37U,0xC30C8EA1U,0x5A05DF1BU,0x2D02EF8DU,
-    };
-    // clang-format on
-
-    u32 updateCRC32(u32 crc, u32 len, const u8* buffer)
+    /**
+        @brief Convert the type of a row, keeping channels
+        @param scratch ... count floats, if needsScratchRow
+        */
+    void convertRowType(u8* dst, PixelFormat dstFormat, const u8* src, PixelFormat srcFormat, s32 count, s32 channels, f32* scratch, s32 options, f32 exposure)
     {
-        for(u32 i = 0; i < len; ++i) {
-            crc = CRC32Table[(crc ^ buffer[i]) & 0xFFU] ^ (crc >> 8);
+        s32 dstSize = getBytesPerSample(dstFormat);
+        s32 srcSize = getBytesPerSample(srcFormat);
+        if(1 == dstSize) {
+            s32 types[MaxChannels];
+            for(s32 i = 0; i < channels; ++i) {
+                types[i] = static_cast<s32>((sizeof(u16) == srcSize) ? Type::HALF : Type::FLOAT);
+            }
+            convertToU8(count / channels, 1, channels, dst, src, types, options, exposure, scratch);
+            return;
         }
-        return crc;
-    }
-
-#if 0 // unused
-    u32 CRC32(u32 len, const u8* buffer)
+        if(1 == srcSize) {
+            if(sizeof(u16) == dstSize) {
+                // Through floats of a chunk
+                static const s32 ChunkSize = 64;
+                f32 chunk[ChunkSize];
+                u16* d = reinterpret_cast<u16*>(dst);
+                for(s32 i = 0; i < count; i += ChunkSize) {
+                    s32 size = minimum(ChunkSize, count - i);
+                    for(s32 j = 0; j < size; ++j) {
+                        chunk[j] = Color::toFloat(src[i + j]);
+                    }
+                    convertF32ToF16(size, d + i, chunk);
+                }
+            } else {
+                f32* d = reinterpret_cast<f32*>(dst);
+                for(s32 i = 0; i < count; ++i) {
+                    d[i] = Color::toFloat(src[i]);
+                }
+            }
+            return;
+        }
+        if(sizeof(u16) == srcSize) {
+            convertF16ToF32(count, reinterpret_cast<f32*>(dst), reinterpret_cast<const u16*>(src));
+        } else {
+            convertF32ToF16(count, reinterpret_cast<u16*>(dst), reinterpret_cast<const f32*>(src));
+        }
+    }
+
+    template<class T, class U>
+    void convertLayout(T* dst, s32 dstChannels, const T* src, s32 srcChannels, s32 width, T one, U toLuma)
+    {
+        for(s32 i = 0; i < width; ++i, dst += dstChannels, src += srcChannels) {
+            if(1 == dstChannels) {
+                dst[0] = (1 == srcChannels) ? src[0] : toLuma(src[0], src[1], src[2]);
+                continue;
+            }
+            if(1 == srcChannels) {
+                dst[0] = dst[1] = dst[2] = src[0];
+            } else {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+            }
+            if(4 == dstChannels) {
+                dst[3] = (4 == srcChannels) ? src[3] : one;
+            }
+        }
+    }
+
+    struct F32Luma
+    {
+        f32 operator()(f32 r, f32 g, f32 b) const
+        {
+            return 0.299f * r + 0.587f * g + 0.114f * b;
+        }
+    };
+
+    struct F16Luma
+    {
+        u16 operator()(u16 r, u16 g, u16 b) const
+        {
+            return toFloat16(F32Luma()(toFloat32(r), toFloat32(g), toFloat32(b)));
+        }
+    };
+
+    /**
+        @brief Convert the channels of a row, keeping the type
+        */
+    void convertRowLayout(u8* dst, ColorType dstColorType, const u8* src, ColorType srcColorType, s32 width, s32 size)
+    {
+        s32 dstChannels = getNumChannels(dstColorType);
+        s32 srcChannels = getNumChannels(srcColorType);
+        if(dstChannels == srcChannels) {
+            memcpy(dst, src, width * dstChannels * size);
+            return;
+        }
+        if(sizeof(u16) == size) {
+            convertLayout(reinterpret_cast<u16*>(dst), dstChannels, reinterpret_cast<const u16*>(src), srcChannels, width, static_cast<u16>(0x3C00U), F16Luma());
+            return;
+        }
+        if(sizeof(f32) == size) {
+            convertLayout(reinterpret_cast<f32*>(dst), dstChannels, reinterpret_cast<const f32*>(src), srcChannels, width, 1.0f, F32Luma());
+            return;
+        }
+        switch(srcColorType) {
+        case ColorType::GRAY:
+            if(ColorType::RGB == dstColorType) {
+                convertGrayToRGB(width, 1, dst, src);
+            } else {
+                convertGrayToRGBA(width, 1, dst, src);
+            }
+            break;
+        case ColorType::RGB:
+            if(ColorType::GRAY == dstColorType) {
+                convertRGBToGray(width, 1, dst, src);
+            } else {
+                convertRGBToRGBA(width, 1, dst, src);
+            }
+            break;
+        default:
+            if(ColorType::GRAY == dstColorType) {
+                convertRGBAToGray(width, 1, dst, src);
+            } else {
+                convertRGBAToRGB(width, 1, dst, src);
+            }
+            break;
+        }
+    }
+
+    /**
+        @brief Whether a row needs an intermediate row to convert both of the type and the layout
+        */
+    bool needsWorkRow(PixelFormat dstFormat, PixelFormat srcFormat)
+    {
+        return getBytesPerSample(dstFormat) != getBytesPerSample(srcFormat)
+               && getColorType(dstFormat) != getColorType(srcFormat);
+    }
+
+    /**
+        @brief Whether a row needs floats to convert samples to 8 bits
+        */
+    bool needsScratchRow(PixelFormat dstFormat, PixelFormat srcFormat)
+    {
+        return 1 == getBytesPerSample(dstFormat) && 1 != getBytesPerSample(srcFormat);
+    }
+
+    /**
+        @brief Convert types first to the work row, then layouts
+        @param work ... a row of the source layout in floats, if needsWorkRow
+        @param scratch ... a row of the source layout in floats, if needsScratchRow
+        */
+    void convertRow(u8* dst, PixelFormat dstFormat, const u8* src, PixelFormat srcFormat, s32 width, u8* work, f32* scratch, s32 options, f32 exposure)
+    {
+        if(dstFormat == srcFormat) {
+            memcpy(dst, src, width * getBytesPerPixel(dstFormat));
+            return;
+        }
+        ColorType dstColorType = getColorType(dstFormat);
+        ColorType srcColorType = getColorType(srcFormat);
+        s32 srcChannels = getNumChannels(srcColorType);
+        bool convertType = getBytesPerSample(dstFormat) != getBytesPerSample(srcFormat);
+        bool convertLayout = dstColorType != srcColorType;
+        if(convertType) {
+            PixelFormat format = convertLayout ? static_cast<PixelFormat>(static_cast<s32>(dstFormat) - static_cast<s32>(dstColorType) + static_cast<s32>(srcColorType)) : dstFormat;
+            u8* typed = convertLayout ? work : dst;
+            convertRowType(typed, format, src, srcFormat, width * srcChannels, srcChannels, scratch, options, exposure);
+            src = typed;
+        }
+        if(convertLayout) {
+            convertRowLayout(dst, dstColorType, src, srcColorType, width, getBytesPerSample(dstFormat));
+        }
+    }
+} // namespace
+
+bool convert(const ImageView& dst, const ImageView& src, s32 options, f32 exposure)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != dst.data_);
+    CPPIMG_ASSERT(CPPIMG_NULL != src.data_);
+    if(dst.width_ != src.width_ || dst.height_ != src.height_) {
+        return false;
+    }
+    s32 width = src.width_;
+    s64 rowSize = sizeof(f32) * maximum(width * getNumChannels(src.format_), 1);
+    u8* work = CPPIMG_NULL;
+    f32* scratch = CPPIMG_NULL;
+    if(needsWorkRow(dst.format_, src.format_)) {
+        work = reinterpret_cast<u8*>(CPPIMG_MALLOC(rowSize));
+        if(CPPIMG_NULL == work) {
+            return false;
+        }
+    }
+    if(needsScratchRow(dst.format_, src.format_)) {
+        scratch = reinterpret_cast<f32*>(CPPIMG_MALLOC(rowSize));
+        if(CPPIMG_NULL == scratch) {
+            CPPIMG_FREE(work);
+            return false;
+        }
+    }
+    for(s32 y = 0; y < src.height_; ++y) {
+        convertRow(dst.getRow(y), dst.format_, src.getRow(y), src.format_, width, work, scratch, options, exposure);
+    }
+    CPPIMG_FREE(scratch);
+    CPPIMG_FREE(work);
+    return true;
+}
+
+//----------------------------------------------------
+RowConverter::RowConverter()
+    : srcFormat_(PixelFormat::RGBA8)
+    , options_(Convert_None)
+    , exposure_(0.0f)
+    , row_(CPPIMG_NULL)
+    , work_(CPPIMG_NULL)
+    , scratch_(CPPIMG_NULL)
+{
+    dst_.data_ = CPPIMG_NULL;
+    dst_.width_ = dst_.height_ = 0;
+    dst_.pitch_ = 0;
+    dst_.format_ = PixelFormat::RGBA8;
+}
+
+RowConverter::~RowConverter()
+{
+    terminate();
+}
+
+void RowConverter::initialize(void* image, s64 pitch)
+{
+    terminate();
+    dst_.data_ = reinterpret_cast<u8*>(image);
+    dst_.pitch_ = pitch;
+}
+
+bool RowConverter::initialize(const ImageView& dst, PixelFormat srcFormat, s32 options, f32 exposure)
+{
+    terminate();
+    dst_ = dst;
+    srcFormat_ = srcFormat;
+    options_ = options;
+    exposure_ = exposure;
+    if(dst.format_ == srcFormat) {
+        return true;
+    }
+    row_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(static_cast<s64>(dst.width_) * getBytesPerPixel(srcFormat)));
+    if(CPPIMG_NULL == row_) {
+        return false;
+    }
+    if(needsWorkRow(dst.format_, srcFormat)) {
+        work_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(sizeof(f32) * dst.width_ * getNumChannels(srcFormat)));
+        if(CPPIMG_NULL == work_) {
+            terminate();
+            return false;
+        }
+    }
+    if(needsScratchRow(dst.format_, srcFormat)) {
+        scratch_ = reinterpret_cast<f32*>(CPPIMG_MALLOC(sizeof(f32) * dst.width_ * getNumChannels(srcFormat)));
+        if(CPPIMG_NULL == scratch_) {
+            terminate();
+            return false;
+        }
+    }
+    return true;
+}
+
+void RowConverter::terminate()
+{
+    CPPIMG_FREE(scratch_);
+    CPPIMG_FREE(work_);
+    CPPIMG_FREE(row_);
+}
+
+void RowConverter::end(s32 y)
+{
+    if(isDirect()) {
+        return;
+    }
+    convertRow(dst_.data_ + y * dst_.pitch_, dst_.format_, row_, srcFormat_, dst_.width_, work_, scratch_, options_, exposure_);
+}
+
+namespace
+{
+    //----------------------------------------------------
+    //--- CRC32
+    //----------------------------------------------------
+    // clang-format off
+    u32 CRC32Table[] =
+    {
+        0x0U,0x77073096U,0xEE0E612CU,0x990951BAU,0x76DC419U,0x706AF48FU,0xE963A535U,0x9E6495A3U,0xEDB8832U,0x79DCB8A4U,0xE0D5E91EU,0x97D2D988U,0x9B64C2BU,0x7EB17CBDU,0xE7B82D07U,0x90BF1D91U,0x1DB71064U,0x6AB020F2U,0xF3B97148U,0x84BE41DEU,0x1ADAD47DU,0x6DDDE4EBU,0xF4D4B551U,0x83D385C7U,0x136C9856U,0x646BA8C0U,0xFD62F97AU,0x8A65C9ECU,0x14015C4FU,0x63066CD9U,0xFA0F3D63U,0x8D080DF5U,0x3B6E20C8U,0x4C69105EU,0xD56041E4U,0xA2677172U,0x3C03E4D1U,0x4B04D447U,0xD20D85FDU,0xA50AB56BU,0x35B5A8FAU,0x42B2986CU,0xDBBBC9D6U,0xACBCF940U,0x32D86CE3U,0x45DF5C75U,0xDCD60DCFU,0xABD13D59U,0x26D930ACU,0x51DE003AU,0xC8D75180U,0xBFD06116U,0x21B4F4B5U,0x56B3C423U,0xCFBA9599U,0xB8BDA50FU,0x2802B89EU,0x5F058808U,0xC60CD9B2U,0xB10BE924U,0x2F6F7C87U,0x58684C11U,0xC1611DABU,0xB6662D3DU,
+        0x76DC4190U,0x1DB7106U,0x98D220BCU,0xEFD5102AU,0x71B18589U,0x6B6B51FU,0x9FBFE4A5U,0xE8B8D433U,0x7807C9A2U,0xF00F934U,0x9609A88EU,0xE10E9818U,0x7F6A0DBBU,0x86D3D2DU,0x91646C97U,0xE6635C01U,0x6B6B51F4U,0x1C6C6162U,0x856530D8U,0xF262004EU,0x6C0695EDU,0x1B01A57BU,0x8208F4C1U,0xF50FC457U,0x65B0D9C6U,0x12B7E950U,0x8BBEB8EAU,0xFCB9887CU,0x62DD1DDFU,0x15DA2D49U,0x8CD37CF3U,0xFBD44C65U,0x4DB26158U,0x3AB551CEU,0xA3BC0074U,0xD4BB30E2U,0x4ADFA541U,0x3DD895D7U,0xA4D1C46DU,0xD3D6F4FBU,0x4369E96AU,0x346ED9FCU,0xAD678846U,0xDA60B8D0U,0x44042D73U,0x33031DE5U,0xAA0A4C5FU,0xDD0D7CC9U,0x5005713CU,0x270241AAU,0xBE0B1010U,0xC90C2086U,0x5768B525U,0x206F85B3U,0xB966D409U,0xCE61E49FU,0x5EDEF90EU,0x29D9C998U,0xB0D09822U,0xC7D7A8B4U,0x59B33D17U,0x2EB40D81U,0xB7BD5C3BU,0xC0BA6CADU,
+        0xEDB88320U,0x9ABFB3B6U,0x3B6E20CU,0x74B1D29AU,0xEAD54739U,0x9DD277AFU,0x4DB2615U,0x73DC1683U,0xE3630B12U,0x94643B84U,0xD6D6A3EU,0x7A6A5AA8U,0xE40ECF0BU,0x9309FF9DU,0xA00AE27U,0x7D079EB1U,0xF00F9344U,0x8708A3D2U,0x1E01F268U,0x6906C2FEU,0xF762575DU,0x806567CBU,0x196C3671U,0x6E6B06E7U,0xFED41B76U,0x89D32BE0U,0x10DA7A5AU,0x67DD4ACCU,0xF9B9DF6FU,0x8EBEEFF9U,0x17B7BE43U,0x60B08ED5U,0xD6D6A3E8U,0xA1D1937EU,0x38D8C2C4U,0x4FDFF252U,0xD1BB67F1U,0xA6BC5767U,0x3FB506DDU,0x48B2364BU,0xD80D2BDAU,0xAF0A1B4CU,0x36034AF6U,0x41047A60U,0xDF60EFC3U,0xA867DF55U,0x316E8EEFU,0x4669BE79U,0xCB61B38CU,0xBC66831AU,0x256FD2A0U,0x5268E236U,0xCC0C7795U,0xBB0B4703U,0x220216B9U,0x5505262FU,0xC5BA3BBEU,0xB2BD0B28U,0x2BB45A92U,0x5CB36A04U,0xC2D7FFA7U,0xB5D0CF31U,0x2CD99E8BU,0x5BDEAE1DU,
+        0x9B64C2B0U,0xEC63F226U,0x756AA39CU,0x26D930AU,0x9C0906A9U,0xEB0E363FU,0x72076785U,0x5005713U,0x95BF4A82U,0xE2B87A14U,0x7BB12BAEU,0xCB61B38U,0x92D28E9BU,0xE5D5BE0DU,0x7CDCEFB7U,0xBDBDF21U,0x86D3D2D4U,0xF1D4E242U,0x68DDB3F8U,0x1FDA836EU,0x81BE16CDU,0xF6B9265BU,0x6FB077E1U,0x18B74777U,0x88085AE6U,0xFF0F6A70U,0x66063BCAU,0x11010B5CU,0x8F659EFFU,0xF862AE69U,0x616BFFD3U,0x166CCF45U,0xA00AE278U,0xD70DD2EEU,0x4E048354U,0x3903B3C2U,0xA7672661U,0xD06016F7U,0x4969474DU,0x3E6E77DBU,0xAED16A4AU,0xD9D65ADCU,0x40DF0B66U,0x37D83BF0U,0xA9BCAE53U,0xDEBB9EC5U,0x47B2CF7FU,0x30B5FFE9U,0xBDBDF21CU,0xCABAC28AU,0x53B39330U,0x24B4A3A6U,0xBAD03605U,0xCDD70693U,0x54DE5729U,0x23D967BFU,0xB3667A2EU,0xC4614AB8U,0x5D681B02U,0x2A6F2B94U,0xB40BBE37U,0xC30C8EA1U,0x5A05DF1BU,0x2D02EF8DU,
+    };
+    // clang-format on
+
+    u32 updateCRC32(u32 crc, u32 len, const u8* buffer)
+    {
+        for(u32 i = 0; i < len; ++i) {
+            crc = CRC32Table[(crc ^ buffer[i]) & 0xFFU] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#if 0 // unused
+    u32 CRC32(u32 len, const u8* buffer)
     {
         return updateCRC32(0xFFFFFFFFUL, len, buffer)^0xFFFFFFFFUL;
     }
@@ -2968,93 +4758,90 @@ OFStream& OFStream::operator=(OFStream&& rhs)
     return *this;
 }
 
+namespace
+{
+    /**
+        @brief Decode rows into a view in any format, or into a tightly packed image in the native format
+        */
+    bool initializeRows(RowConverter& rows, s32 width, s32 height, PixelFormat format, void* image, const ImageView* view)
+    {
+        if(CPPIMG_NULL == view) {
+            rows.initialize(image, static_cast<s64>(width) * getBytesPerPixel(format));
+            return true;
+        }
+        if(view->width_ != width || view->height_ != height) {
+            return false;
+        }
+        return rows.initialize(*view, format);
+    }
+} // namespace
+
 //----------------------------------------------------
 //---
 //--- BMP
 //---
 //----------------------------------------------------
-bool BMP::read24(u8* image, s32 width, s32 height, bool leftBottom, Stream& stream)
+bool BMP::read24(RowConverter& rows, s32 width, s32 height, bool leftBottom, Stream& stream)
 {
     s32 pitch = width * 3;
     s32 diff = (pitch + 0x03U) & (~0x03U);
     diff -= pitch;
     u8 tmp[3];
 
-    if(leftBottom) {
-        image += pitch * (height - 1);
-        for(s32 i = 0; i < height; ++i) {
-            u8* b = image;
-            for(s32 j = 0; j < width; ++j) {
-                if(stream.read(3, tmp) <= 0) {
-                    return false;
-                }
-                b[0] = tmp[2];
-                b[1] = tmp[1];
-                b[2] = tmp[0];
-                b += 3;
-            }
-            if(stream.read(diff, tmp) <= 0) {
+    for(s32 i = 0; i < height; ++i) {
+        s32 y = leftBottom ? height - 1 - i : i;
+        u8* b = rows.begin(y);
+        for(s32 j = 0; j < width; ++j) {
+            if(stream.read(3, tmp) <= 0) {
                 return false;
             }
-            image -= pitch;
+            b[0] = tmp[2];
+            b[1] = tmp[1];
+            b[2] = tmp[0];
+            b += 3;
         }
-
-    } else {
-        for(s32 i = 0; i < height; ++i) {
-            for(s32 j = 0; j < width; ++j) {
-                if(stream.read(3, tmp) <= 0) {
-                    return false;
-                }
-                image[0] = tmp[2];
-                image[1] = tmp[1];
-                image[2] = tmp[0];
-                image += 3;
-            }
-            if(stream.read(diff, tmp) <= 0) {
-                return false;
-            }
+        if(stream.read(diff, tmp) <= 0) {
+            return false;
         }
+        rows.end(y);
     }
     return true;
 }
 
-bool BMP::read32(u8* image, s32 width, s32 height, bool leftBottom, Stream& stream)
+bool BMP::read32(RowConverter& rows, s32 width, s32 height, bool leftBottom, Stream& stream)
 {
     s32 pitch = width * 4;
 
-    if(leftBottom) {
-        image += pitch * (height - 1);
-        for(s32 i = 0; i < height; ++i) {
-            if(stream.read(pitch, image) <= 0) {
-                return false;
-            }
-            u8* b = image;
-            for(s32 j = 0; j < width; ++j) {
-                cppimg::swap(b[0], b[3]);
-                cppimg::swap(b[1], b[2]);
-                b += 4;
-            }
-            image -= pitch;
+    for(s32 i = 0; i < height; ++i) {
+        s32 y = leftBottom ? height - 1 - i : i;
+        u8* row = rows.begin(y);
+        if(stream.read(pitch, row) <= 0) {
+            return false;
         }
-
-    } else {
-        for(s32 i = 0; i < height; ++i) {
-            if(stream.read(pitch, image) <= 0) {
-                return false;
-            }
-            u8* b = image;
-            for(s32 j = 0; j < width; ++j) {
-                cppimg::swap(b[0], b[3]);
-                cppimg::swap(b[1], b[2]);
-                b += 4;
-            }
-            image += pitch;
+        u8* b = row;
+        for(s32 j = 0; j < width; ++j) {
+            cppimg::swap(b[0], b[3]);
+            cppimg::swap(b[1], b[2]);
+            b += 4;
         }
+        rows.end(y);
     }
     return true;
 }
 
 bool BMP::read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream)
+{
+    return readImage(width, height, colorType, image, CPPIMG_NULL, stream);
+}
+
+bool BMP::read(const ImageView& image, Stream& stream)
+{
+    s32 width, height;
+    ColorType colorType;
+    return readImage(width, height, colorType, CPPIMG_NULL, &image, stream);
+}
+
+bool BMP::readImage(s32& width, s32& height, ColorType& colorType, void* image, const ImageView* view, Stream& stream)
 {
     if(!stream.valid()) {
         return false;
@@ -3121,19 +4908,23 @@ bool BMP::read(s32& width, s32& height, ColorType& colorType, void* image, Strea
     width = static_cast<u32>(infoHeader.width_);
     height = static_cast<u32>(infoHeader.height_);
     colorType = 24 == infoHeader.bitCount_ ? ColorType::RGB : ColorType::RGBA;
-    if(CPPIMG_NULL == image) {
+    if(CPPIMG_NULL == image && CPPIMG_NULL == view) {
         return true;
     }
+    RowConverter rows;
+    if(!initializeRows(rows, width, height, getPixelFormat(colorType), image, view)) {
+        return false;
+    }
 
     bool leftBottom = (0 <= infoHeader.height_);
     switch(infoHeader.bitCount_) {
     case 24:
-        if(!read24(reinterpret_cast<u8*>(image), width, height, leftBottom, stream)) {
+        if(!read24(rows, width, height, leftBottom, stream)) {
             return false;
         }
         break;
     case 32:
-        if(!read32(reinterpret_cast<u8*>(image), width, height, leftBottom, stream)) {
+        if(!read32(rows, width, height, leftBottom, stream)) {
             return false;
         }
         break;
@@ -3148,9 +4939,18 @@ bool BMP::read(s32& width, s32& height, ColorType& colorType, void* image, Strea
 bool BMP::write(Stream& stream, s32 width, s32 height, ColorType colorType, const void* image)
 {
     CPPIMG_ASSERT(CPPIMG_NULL != image);
-    if(!stream.valid()) {
+    return write(stream, ImageView::create(const_cast<void*>(image), width, height, getPixelFormat(colorType)));
+}
+
+bool BMP::write(Stream& stream, const ImageView& image)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != image.data_);
+    if(!stream.valid() || 1 != getBytesPerSample(image.format_)) {
         return false;
     }
+    s32 width = image.width_;
+    s32 height = image.height_;
+    ColorType colorType = getColorType(image.format_);
     SeekSet seekSet(stream.tell(), &stream);
     HEADER header = {0};
     INFOHEADER infoHeader = {0};
@@ -3207,12 +5007,10 @@ bool BMP::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
 
     s32 diff = dstPitch - pitch;
     u8 tmp[4];
-    const u8* buffer = reinterpret_cast<const u8*>(image);
     switch(colorType) {
     case ColorType::GRAY:
-        buffer += width * (height - 1);
         for(s32 i = 0; i < height; ++i) {
-            const u8* b = buffer;
+            const u8* b = image.getRow(height - 1 - i);
             for(s32 j = 0; j < width; ++j) {
                 tmp[0] = tmp[1] = tmp[2] = b[0];
                 if(stream.write(3, tmp) <= 0) {
@@ -3224,13 +5022,11 @@ bool BMP::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
             if(stream.write(diff, tmp) <= 0) {
                 return false;
             }
-            buffer -= width;
         }
         break;
     case ColorType::RGB:
-        buffer += pitch * (height - 1);
         for(s32 i = 0; i < height; ++i) {
-            const u8* b = buffer;
+            const u8* b = image.getRow(height - 1 - i);
             for(s32 j = 0; j < width; ++j) {
                 tmp[0] = b[2];
                 tmp[1] = b[1];
@@ -3244,13 +5040,11 @@ bool BMP::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
             if(stream.write(diff, tmp) <= 0) {
                 return false;
             }
-            buffer -= pitch;
         }
         break;
     case ColorType::RGBA:
-        buffer += pitch * (height - 1);
         for(s32 i = 0; i < height; ++i) {
-            const u8* b = buffer;
+            const u8* b = image.getRow(height - 1 - i);
             for(s32 j = 0; j < width; ++j) {
                 tmp[0] = b[2];
                 tmp[1] = b[1];
@@ -3261,7 +5055,6 @@ bool BMP::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
                 }
                 b += 4;
             }
-            buffer -= pitch;
         }
         break;
     default:
@@ -3276,147 +5069,264 @@ bool BMP::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
 //--- TGA
 //---
 //----------------------------------------------------
-bool TGA::readInternal(s32 width, s32 height, u8 bpp, u8* image, Stream& stream)
+namespace
 {
-    // transpose
-    s32 rowBytes = width * bpp;
-    image += rowBytes * (height - 1);
-
-    u8 tmp[4];
-    for(s32 i = 0; i < height; ++i) {
-        u8* row = image;
-        for(s32 j = 0; j < width; ++j) {
-            if(stream.read(bpp, tmp) <= 0) {
-                return false;
-            }
-            row[0] = tmp[2];
-            row[1] = tmp[1];
-            row[2] = tmp[0];
-            if(3 < bpp) {
-                row[3] = tmp[3];
-            }
-            row += bpp;
+    /**
+        @brief Swap the first and the third samples of pixels, dst can be src
+        */
+    void swapRB24(u8* dst, const u8* src, s32 count)
+    {
+        s32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        // 5 pixels in 16 bytes, the last byte is kept, and overwritten by the next pixels
+        const __m128i m = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+        for(; (i + 6) <= count; i += 5) {
+            storeu128(dst + i * 3, _mm_shuffle_epi8(loadu128(src + i * 3), m));
+        }
+#    endif
+        for(; i < count; ++i) {
+            u8 r = src[i * 3 + 2];
+            u8 g = src[i * 3 + 1];
+            u8 b = src[i * 3 + 0];
+            dst[i * 3 + 0] = r;
+            dst[i * 3 + 1] = g;
+            dst[i * 3 + 2] = b;
         }
-        image -= rowBytes;
     }
-    return true;
-}
 
-bool TGA::readRLEInternal(s32 width, s32 height, u8 bpp, u8* image, Stream& stream)
-{
-    // transpose
-    s32 rowBytes = width * bpp;
-    image += rowBytes * (height - 1);
-    u8* row = image;
-    s32 x = 0;
-    s32 pixels = width * height;
-    u8 tmp[4];
-    for(s32 i = 0; i < pixels;) {
-        u8 byte;
-        if(stream.read(1, &byte) <= 0) {
-            return false;
+    void swapRB32(u8* dst, const u8* src, s32 count)
+    {
+        s32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        const __m128i m = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for(; (i + 4) <= count; i += 4) {
+            storeu128(dst + i * 4, _mm_shuffle_epi8(loadu128(src + i * 4), m));
         }
-        // If MSB is 1 then consecutive, else no-consecutive data
-        s32 count = (byte & 0x7FU) + 1;
-        if(0 != (byte & 0x80U)) {
-            // consecutive data
-            if(stream.read(bpp, tmp) <= 0) {
-                return false;
-            }
-            for(s32 j = 0; j < count; ++j) {
-                row[0] = tmp[2];
-                row[1] = tmp[1];
-                row[2] = tmp[0];
-                if(3 < bpp) {
-                    row[3] = tmp[3];
-                }
-                row += bpp;
-                if(width <= ++x) {
-                    x = 0;
-                    image -= rowBytes;
-                    row = image;
-                }
-            }
-        } else {
-            // no-consecutive data
-            for(s32 j = 0; j < count; ++j) {
-                if(stream.read(bpp, tmp) <= 0) {
-                    return false;
-                }
-                row[0] = tmp[2];
-                row[1] = tmp[1];
-                row[2] = tmp[0];
-                if(3 < bpp) {
-                    row[3] = tmp[3];
-                }
-                row += bpp;
-                if(width <= ++x) {
-                    x = 0;
-                    image -= rowBytes;
-                    row = image;
-                }
-            }
+#    endif
+        for(; i < count; ++i) {
+            u8 r = src[i * 4 + 2];
+            u8 g = src[i * 4 + 1];
+            u8 b = src[i * 4 + 0];
+            u8 a = src[i * 4 + 3];
+            dst[i * 4 + 0] = r;
+            dst[i * 4 + 1] = g;
+            dst[i * 4 + 2] = b;
+            dst[i * 4 + 3] = a;
         }
-        i += count;
     }
-    return true;
-}
 
-u8 TGA::calcRunLength(u8 bpp, s32 x, s32 y, s32 width, const u8* image)
-{
-    static const u32 maxCount = 0x80U;
-    if(0 == y && x == (width - 1)) {
-        return 0x80U;
+    void swapRB(u8* dst, const u8* src, s32 count, s32 bpp)
+    {
+        if(3 == bpp) {
+            swapRB24(dst, src, count);
+        } else {
+            swapRB32(dst, src, count);
+        }
     }
-    u8 count = 1;
-    s32 nx = x + 1;
-    s32 ny = (width <= nx) ? y - 1 : y;
 
-    const u8* current = image + (x + y * width) * bpp;
-    const u8* next = image + (nx + ny * width) * bpp;
-    if(check(bpp, current, next)) {
-        while(0 <= ny) {
-            x = nx;
-            y = ny;
-            current = next;
-            if(width <= ++nx) {
-                if(--ny < 0) {
-                    break;
-                }
-                nx = 0;
-            }
-            next = image + (nx + ny * width) * bpp;
-            if(!check(bpp, current, next)) {
-                break;
+    /**
+        @brief Repeat a pixel
+        */
+    void fillPixels(u8* dst, const u8* pixel, s32 count, s32 bpp)
+    {
+        s32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        if(3 == bpp) {
+            // 16 pixels in 48 bytes, those begin at the first, the second, and the third samples
+            __m128i x = _mm_cvtsi32_si128(pixel[0] | (pixel[1] << 8) | (pixel[2] << 16));
+            __m128i x0 = _mm_shuffle_epi8(x, _mm_setr_epi8(0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0));
+            __m128i x1 = _mm_shuffle_epi8(x, _mm_setr_epi8(1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1));
+            __m128i x2 = _mm_shuffle_epi8(x, _mm_setr_epi8(2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2));
+            for(; (i + 16) <= count; i += 16) {
+                u8* d = dst + i * 3;
+                storeu128(d, x0);
+                storeu128(d + 16, x1);
+                storeu128(d + 32, x2);
             }
-            if(maxCount <= ++count) {
-                break;
+        } else {
+            u32 value;
+            memcpy(&value, pixel, sizeof(u32));
+            __m128i x = _mm_set1_epi32(static_cast<s32>(value));
+            for(; (i + 4) <= count; i += 4) {
+                storeu128(dst + i * 4, x);
             }
         }
-        return 0x80U | (count - 1);
+#    endif
+        for(; i < count; ++i) {
+            memcpy(dst + i * bpp, pixel, bpp);
+        }
+    }
 
-    } else {
-        while(0 <= ny) {
-            x = nx;
-            y = ny;
-            current = next;
-            if(width <= ++nx) {
-                if(--ny < 0) {
+    inline bool equalPixels(const u8* x0, const u8* x1, s32 bpp)
+    {
+        return x0[0] == x1[0] && x0[1] == x1[1] && x0[2] == x1[2] && (3 == bpp || x0[3] == x1[3]);
+    }
+
+#    if !defined(CPPIMG_DISABLE_AVX)
+    /**
+        @brief Load 4 pixels as 32 bits values, 16 bytes are read for both 24 and 32 bits pixels
+        */
+    inline __m128i loadPixels4(const u8* src, s32 bpp)
+    {
+        __m128i x = loadu128(src);
+        if(3 == bpp) {
+            x = _mm_shuffle_epi8(x, _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+        }
+        return x;
+    }
+
+    /**
+        @brief Compare 16 pixels from x0 and x1, and return a bit per pixel
+        */
+    inline u32 comparePixels16(const u8* x0, const u8* x1, s32 bpp)
+    {
+        u32 mask = 0;
+        for(s32 i = 0; i < 4; ++i) {
+            __m128i c = _mm_cmpeq_epi32(loadPixels4(x0 + i * 4 * bpp, bpp), loadPixels4(x1 + i * 4 * bpp, bpp));
+            mask |= static_cast<u32>(_mm_movemask_ps(_mm_castsi128_ps(c))) << (i * 4);
+        }
+        return mask;
+    }
+#    endif
+
+    /**
+        @brief Count pixels same as the first one
+        @param size ... the maximum to count
+        */
+    s32 getPixelRunLength(const u8* src, s32 size, s32 bpp)
+    {
+        s32 count = 1;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        // Compare with the previous pixels, the last load must not exceed the pixels
+        for(; (count + 16) <= size && ((count + 12) * bpp + 16) <= (size * bpp); count += 16) {
+            u32 mask = comparePixels16(src + count * bpp, src + (count - 1) * bpp, bpp);
+            if(0xFFFFU != mask) {
+                return count + countTrailingZeros(~mask);
+            }
+        }
+#    endif
+        while(count < size && equalPixels(src, src + count * bpp, bpp)) {
+            ++count;
+        }
+        return count;
+    }
+
+    /**
+        @brief Find the first pixel same as the next one
+        @return Number of pixels before the pixel, or maxSize if not found
+        @param maxSize ... maximum number of pixels before the pixel
+        @param size ... pixels available
+        */
+    s32 findPixelRun(const u8* src, s32 maxSize, s32 size, s32 bpp)
+    {
+        s32 i = 1;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        for(; i < maxSize && (i + 17) <= size && ((i + 13) * bpp + 16) <= (size * bpp); i += 16) {
+            u32 mask = comparePixels16(src + i * bpp, src + (i + 1) * bpp, bpp);
+            if(0 != mask) {
+                return minimum(i + countTrailingZeros(mask), maxSize);
+            }
+        }
+#    endif
+        for(; i < maxSize && (i + 1) < size; ++i) {
+            if(equalPixels(src + i * bpp, src + (i + 1) * bpp, bpp)) {
+                return i;
+            }
+        }
+        return minimum(maxSize, size);
+    }
+} // namespace
+
+bool TGA::readInternal(RowConverter& rows, s32 width, s32 height, u8 bpp, Stream& stream)
+{
+    // transpose
+    s32 rowSize = width * bpp;
+    for(s32 i = 0; i < height; ++i) {
+        s32 y = height - 1 - i;
+        u8* row = rows.begin(y);
+        if(stream.read(rowSize, row) <= 0) {
+            return false;
+        }
+        swapRB(row, row, width, bpp);
+        rows.end(y);
+    }
+    return true;
+}
+
+bool TGA::readRLEInternal(RowConverter& rows, s32 width, s32 height, u8 bpp, Stream& stream)
+{
+    // Packets are decoded from a buffer, which is refilled before a packet if it may not have the whole packet
+    static const s32 BufferSize = 64 * 1024;
+    static const s32 MaxPacketSize = 1 + 128 * 4;
+    s64 remain = stream.size() - stream.tell();
+    u8* buffer = reinterpret_cast<u8*>(CPPIMG_MALLOC(BufferSize));
+    if(CPPIMG_NULL == buffer) {
+        return false;
+    }
+    const u8* src = buffer;
+    const u8* end = buffer;
+
+    // Packets can continue to the next row
+    u8 packet = 0;
+    s32 count = 0;
+    u8 pixel[4];
+    bool result = true;
+    for(s32 i = 0; result && i < height; ++i) {
+        // transpose
+        s32 y = height - 1 - i;
+        u8* dst = rows.begin(y);
+        for(s32 x = 0; x < width;) {
+            if(count <= 0) {
+                s32 size = static_cast<s32>(end - src);
+                if(size < MaxPacketSize && 0 < remain) {
+                    memmove(buffer, src, size);
+                    s32 readSize = static_cast<s32>(minimum(static_cast<s64>(BufferSize - size), remain));
+                    if(stream.read(readSize, buffer + size) <= 0) {
+                        result = false;
+                        break;
+                    }
+                    remain -= readSize;
+                    src = buffer;
+                    end = buffer + size + readSize;
+                }
+                // If MSB is 1 then consecutive, else no-consecutive data
+                if(end <= src) {
+                    result = false;
                     break;
                 }
-                nx = 0;
-            }
-            next = image + (nx + ny * width) * bpp;
-            if(check(bpp, current, next)) {
-                break;
+                packet = *src++;
+                count = (packet & 0x7FU) + 1;
+                s32 packetSize = (0 != (packet & 0x80U)) ? bpp : count * bpp;
+                if((end - src) < packetSize) {
+                    result = false;
+                    break;
+                }
+                if(0 != (packet & 0x80U)) {
+                    swapRB(pixel, src, 1, bpp);
+                    src += bpp;
+                }
             }
-            if(maxCount <= ++count) {
-                break;
+            s32 n = minimum(count, width - x);
+            if(0 != (packet & 0x80U)) {
+                fillPixels(dst, pixel, n, bpp);
+            } else {
+                swapRB(dst, src, n, bpp);
+                src += n * bpp;
             }
+            dst += n * bpp;
+            x += n;
+            count -= n;
         }
-        return count - 1;
+        rows.end(y);
     }
+    CPPIMG_FREE(buffer);
+    // Leave the stream just after the pixels
+    if(result && src < end) {
+        stream.seek(-static_cast<off_t>(end - src), SEEK_CUR);
+    }
+    return result;
 }
+
 #if 0
     bool TGA::write32(Stream& stream, s32 width, s32 height, const u8* image)
     {
@@ -3437,14 +5347,14 @@ u8 TGA::calcRunLength(u8 bpp, s32 x, s32 y, s32 width, const u8* image)
     }
 #endif
 
-bool TGA::writeUncompress(Stream& stream, s32 width, s32 height, u8 bpp, const u8* image)
+bool TGA::writeUncompress(Stream& stream, const ImageView& image, u8 bpp)
 {
     u8 tmp[4];
-    s32 line = width * bpp;
-    image += line * (height - 1);
+    s32 width = image.width_;
+    s32 height = image.height_;
     if(bpp < 4) {
         for(s32 i = height - 1; 0 <= i; --i) {
-            const u8* scan = image;
+            const u8* scan = image.getRow(i);
             for(s32 j = 0; j < width; ++j) {
                 tmp[0] = scan[2];
                 tmp[1] = scan[1];
@@ -3454,11 +5364,10 @@ bool TGA::writeUncompress(Stream& stream, s32 width, s32 height, u8 bpp, const u
                 }
                 scan += bpp;
             }
-            image -= line;
         }
     } else {
         for(s32 i = height - 1; 0 <= i; --i) {
-            const u8* scan = image;
+            const u8* scan = image.getRow(i);
             for(s32 j = 0; j < width; ++j) {
                 tmp[0] = scan[2];
                 tmp[1] = scan[1];
@@ -3469,63 +5378,71 @@ bool TGA::writeUncompress(Stream& stream, s32 width, s32 height, u8 bpp, const u
                 }
                 scan += bpp;
             }
-            image -= line;
         }
     }
     return true;
 }
 
-bool TGA::writeRLE(Stream& stream, s32 width, s32 height, u8 bpp, const u8* image)
+bool TGA::writeRLE(Stream& stream, const ImageView& image, u8 bpp)
 {
-    u8 tmp[4];
-    s32 x = 0, y = height - 1;
-    while(0 <= y) {
-        u8 run = calcRunLength(bpp, x, y, width, image);
-        u8 count = (run & 0x7FU) + 1;
-
-        if(stream.write(1, &run) <= 0) {
-            return false;
-        }
-
-        if(0 != (run & 0x80U)) {
-            const u8* dst = image + (x + y * width) * bpp;
-            tmp[0] = dst[2];
-            tmp[1] = dst[1];
-            tmp[2] = dst[0];
-            if(4 <= bpp) {
-                tmp[3] = dst[3];
-            }
-            if(stream.write(bpp, tmp) <= 0) {
-                return false;
-            }
-            x += count;
-            while(width <= x) {
-                x -= width;
-                --y;
-            }
-        } else {
-            for(u8 i = 0; i < count; ++i) {
-                const u8* dst = image + (x + y * width) * bpp;
-                tmp[0] = dst[2];
-                tmp[1] = dst[1];
-                tmp[2] = dst[0];
-                if(4 <= bpp) {
-                    tmp[3] = dst[3];
-                }
-                if(stream.write(bpp, tmp) <= 0) {
-                    return false;
-                }
-                if(width <= ++x) {
-                    x -= width;
-                    --y;
+    // Packets are written to a buffer, which is flushed before a packet if it may not have space for the whole packet
+    static const s32 BufferSize = 64 * 1024;
+    static const s32 MaxPacketSize = 1 + 128 * 4;
+    static const s32 MaxCount = 128;
+    u8* buffer = reinterpret_cast<u8*>(CPPIMG_MALLOC(BufferSize));
+    if(CPPIMG_NULL == buffer) {
+        return false;
+    }
+    u8* dst = buffer;
+    bool result = true;
+    s32 width = image.width_;
+    // Packets do not continue to the next row
+    for(s32 y = image.height_ - 1; result && 0 <= y; --y) {
+        const u8* row = image.getRow(y);
+        for(s32 x = 0; x < width;) {
+            if((BufferSize - static_cast<s32>(dst - buffer)) < MaxPacketSize) {
+                if(stream.write(static_cast<s32>(dst - buffer), buffer) <= 0) {
+                    result = false;
+                    break;
                 }
+                dst = buffer;
+            }
+            const u8* src = row + x * bpp;
+            s32 size = width - x;
+            s32 count = getPixelRunLength(src, minimum(size, MaxCount), bpp);
+            if(1 < count) {
+                *dst++ = static_cast<u8>(0x80U | (count - 1));
+                swapRB(dst, src, 1, bpp);
+                dst += bpp;
+            } else {
+                count = findPixelRun(src, MaxCount, size, bpp);
+                *dst++ = static_cast<u8>(count - 1);
+                swapRB(dst, src, count, bpp);
+                dst += count * bpp;
             }
-        } // if(0 != (run & 0x80U)
-    } // while(0<=y)
-    return true;
+            x += count;
+        }
+    }
+    if(result && buffer < dst) {
+        result = (0 < stream.write(static_cast<s32>(dst - buffer), buffer));
+    }
+    CPPIMG_FREE(buffer);
+    return result;
 }
 
 bool TGA::read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream)
+{
+    return readImage(width, height, colorType, image, CPPIMG_NULL, stream);
+}
+
+bool TGA::read(const ImageView& image, Stream& stream)
+{
+    s32 width, height;
+    ColorType colorType;
+    return readImage(width, height, colorType, CPPIMG_NULL, &image, stream);
+}
+
+bool TGA::readImage(s32& width, s32& height, ColorType& colorType, void* image, const ImageView* view, Stream& stream)
 {
     if(!stream.valid()) {
         return false;
@@ -3556,9 +5473,13 @@ bool TGA::read(s32& width, s32& height, ColorType& colorType, void* image, Strea
     }
 
     colorType = (24 == bpp) ? ColorType::RGB : ColorType::RGBA;
-    if(CPPIMG_NULL == image) {
+    if(CPPIMG_NULL == image && CPPIMG_NULL == view) {
         return true;
     }
+    RowConverter rows;
+    if(!initializeRows(rows, width, height, getPixelFormat(colorType), image, view)) {
+        return false;
+    }
     // Skip string, if it exists
     if(0 < tgaHeader[Offset_IDLeng]) {
         stream.seek(tgaHeader[Offset_IDLeng], SEEK_CUR);
@@ -3574,16 +5495,20 @@ bool TGA::read(s32& width, s32& height, ColorType& colorType, void* image, Strea
     switch(bpp) {
     case 24: {
         if(Type_FullColorRLE == type) {
-            readRLEInternal(width, height, 3, reinterpret_cast<u8*>(image), stream);
-        } else {
-            readInternal(width, height, 3, reinterpret_cast<u8*>(image), stream);
+            if(!readRLEInternal(rows, width, height, 3, stream)) {
+                return false;
+            }
+        } else if(!readInternal(rows, width, height, 3, stream)) {
+            return false;
         }
     } break;
     case 32: {
         if(Type_FullColorRLE == type) {
-            readRLEInternal(width, height, 4, reinterpret_cast<u8*>(image), stream);
-        } else {
-            readInternal(width, height, 4, reinterpret_cast<u8*>(image), stream);
+            if(!readRLEInternal(rows, width, height, 4, stream)) {
+                return false;
+            }
+        } else if(!readInternal(rows, width, height, 4, stream)) {
+            return false;
         }
     } break;
     default:
@@ -3596,9 +5521,18 @@ bool TGA::read(s32& width, s32& height, ColorType& colorType, void* image, Strea
 bool TGA::write(Stream& stream, s32 width, s32 height, ColorType colorType, const void* image, s32 options)
 {
     CPPIMG_ASSERT(CPPIMG_NULL != image);
-    if(!stream.valid()) {
+    return write(stream, ImageView::create(const_cast<void*>(image), width, height, getPixelFormat(colorType)), options);
+}
+
+bool TGA::write(Stream& stream, const ImageView& image, s32 options)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != image.data_);
+    if(!stream.valid() || 1 != getBytesPerSample(image.format_)) {
         return false;
     }
+    s32 width = image.width_;
+    s32 height = image.height_;
+    ColorType colorType = getColorType(image.format_);
     SeekSet seekSet(stream.tell(), &stream);
     u8 tgaHeader[TGA_HEADER_SIZE] = {0};
 
@@ -3621,12 +5555,12 @@ bool TGA::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
     if(Type_FullColorRLE == tgaHeader[Offset_ImageType]) {
         switch(colorType) {
         case ColorType::RGB:
-            if(!writeRLE(stream, width, height, 3, reinterpret_cast<const u8*>(image))) {
+            if(!writeRLE(stream, image, 3)) {
                 return false;
             }
             break;
         case ColorType::RGBA:
-            if(!writeRLE(stream, width, height, 4, reinterpret_cast<const u8*>(image))) {
+            if(!writeRLE(stream, image, 4)) {
                 return false;
             }
             break;
@@ -3636,12 +5570,12 @@ bool TGA::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
     } else {
         switch(colorType) {
         case ColorType::RGB:
-            if(!writeUncompress(stream, width, height, 3, reinterpret_cast<const u8*>(image))) {
+            if(!writeUncompress(stream, image, 3)) {
                 return false;
             }
             break;
         case ColorType::RGBA:
-            if(!writeUncompress(stream, width, height, 4, reinterpret_cast<const u8*>(image))) {
+            if(!writeUncompress(stream, image, 4)) {
                 return false;
             }
             break;
@@ -3661,9 +5595,18 @@ bool TGA::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
 bool PPM::write(Stream& stream, s32 width, s32 height, ColorType colorType, const void* image)
 {
     CPPIMG_ASSERT(CPPIMG_NULL != image);
-    if(!stream.valid()) {
+    return write(stream, ImageView::create(const_cast<void*>(image), width, height, getPixelFormat(colorType)));
+}
+
+bool PPM::write(Stream& stream, const ImageView& image)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != image.data_);
+    if(!stream.valid() || 1 != getBytesPerSample(image.format_)) {
         return false;
     }
+    s32 width = image.width_;
+    s32 height = image.height_;
+    ColorType colorType = getColorType(image.format_);
     Char buffer[64];
     s32 scomponents, dcomponents;
     switch(colorType) {
@@ -3698,10 +5641,11 @@ bool PPM::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
         if(0 < i && stream.write(1, "\n") <= 0) {
             return false;
         }
+        const u8* row = image.getRow(i);
         for(s32 j = 0; j < width; ++j) {
-            s32 index = scomponents * (i * width + j);
+            s32 index = scomponents * j;
             for(s32 k = 0; k < dcomponents; ++k) {
-                len = CPPIMG_SPRINTF(buffer, "%d ", reinterpret_cast<const u8*>(image)[index + k]);
+                len = CPPIMG_SPRINTF(buffer, "%d ", row[index + k]);
                 if(stream.write(len, buffer) <= 0) {
                     return false;
                 }
@@ -3717,3164 +5661,7324 @@ bool PPM::write(Stream& stream, s32 width, s32 height, ColorType colorType, cons
 //--- PNG
 //---
 //----------------------------------------------------
-bool PNG::read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream)
+namespace
 {
-    if(!stream.valid()) {
-        return false;
+    //----------------------------------------------------
+    //--- PNG unfilter kernels
+    //----------------------------------------------------
+    inline u8 paethPredictor(s32 a, s32 b, s32 c)
+    {
+        s32 pa = absolute(b - c);
+        s32 pb = absolute(a - c);
+        s32 pc = absolute(a + b - c - c);
+        if(pa <= pb && pa <= pc) {
+            return static_cast<u8>(a);
+        }
+        return static_cast<u8>((pb <= pc) ? b : c);
     }
 
-    SeekSet seekSet(stream.tell(), &stream);
-    if(!readHeader(stream)) {
-        return false;
+    void unfilterUp(u32 size, u8* scanline, const u8* upper)
+    {
+        u32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        for(; (i + 16) <= size; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(scanline + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(upper + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(scanline + i), _mm_add_epi8(x, b));
+        }
+#    endif
+        for(; i < size; ++i) {
+            scanline[i] = static_cast<u8>(scanline[i] + upper[i]);
+        }
     }
 
-    ChunkIHDR chunkIHDR;
-    if(!readHeader(chunkIHDR, stream)
-       || !chunkIHDR.read(stream)
-       || MaxWidth < chunkIHDR.width_
-       || MaxHeight < chunkIHDR.height_) {
-        return false;
-    }
-    width = static_cast<s32>(chunkIHDR.width_);
-    height = static_cast<s32>(chunkIHDR.height_);
+#    if defined(CPPIMG_DISABLE_AVX)
+#        define CPPIMG_PNG_UNFILTER_SIMD(BPP) false
+#    else
+#        define CPPIMG_PNG_UNFILTER_SIMD(BPP) (3 <= (BPP))
+#    endif
 
-    s32 color;
-    s32 alpha = 0;
-    switch(chunkIHDR.colorType_) {
-    case PNG::ColorType_Gray:
-        colorType = ColorType::GRAY;
-        color = 1;
-        break;
-    case PNG::ColorType_True:
-        colorType = ColorType::RGB;
-        color = 3;
-        break;
-    case PNG::ColorType_Index:
-        colorType = ColorType::RGB;
-        color = 1;
-        break;
-    case PNG::ColorType_GrayAlpha:
-        colorType = ColorType::RGBA;
-        color = 1;
-        alpha = 1;
-        break;
-    case PNG::ColorType_TrueAlpha:
-        colorType = ColorType::RGBA;
-        color = 3;
-        alpha = 1;
-        break;
-    default:
-        return false;
-    }
-    if(CPPIMG_NULL == image) {
-        return true;
-    }
+    /**
+    @brief Scalar kernels, the first pixel of a scanline is processed before the inner loops
+    */
+    template<u32 BPP, bool SIMD = CPPIMG_PNG_UNFILTER_SIMD(BPP)>
+    struct Unfilter
+    {
+        static void sub(u32 size, u8* scanline)
+        {
+            for(u32 i = BPP; i < size; ++i) {
+                scanline[i] = static_cast<u8>(scanline[i] + scanline[i - BPP]);
+            }
+        }
 
-    Chunk chunk;
-    cppimg::off_t start = stream.tell();
-    bool loop = true;
-    u32 totalIDAT = 0;
-    // sum size of IDAT
-    do {
-        if(!readHeader(chunk, stream)) {
-            return false;
+        static void avgFirst(u32 size, u8* scanline)
+        {
+            for(u32 i = BPP; i < size; ++i) {
+                scanline[i] = static_cast<u8>(scanline[i] + (scanline[i - BPP] >> 1));
+            }
         }
-        // Support only critical chunks
-        switch(chunk.type_) {
-        case ChunkIDAT::Type:
-            totalIDAT += chunk.length_;
-            if(!skipChunk(chunk, stream)) {
-                return false;
+
+        static void avg(u32 size, u8* scanline, const u8* upper)
+        {
+            for(u32 i = 0; i < BPP; ++i) {
+                scanline[i] = static_cast<u8>(scanline[i] + (upper[i] >> 1));
             }
-            break;
-        case ChunkIEND::Type:
-            loop = false;
-            break;
-        default:
-            if(!skipChunk(chunk, stream)) {
-                return false;
+            for(u32 i = BPP; i < size; ++i) {
+                s32 x = (static_cast<s32>(scanline[i - BPP]) + upper[i]) >> 1;
+                scanline[i] = static_cast<u8>(scanline[i] + x);
             }
-            break;
         }
-    } while(loop);
 
-    ChunkPLTE chunkPLTE;
-    ChunkIDAT chunkIDAT(totalIDAT, chunkIHDR.width_, chunkIHDR.height_, color, alpha);
-    if(!chunkIDAT.initialize()) {
-        return false;
-    }
-    stream.seek(start, SEEK_SET);
-    loop = true;
-    do {
-        if(!readHeader(chunk, stream)) {
-            return false;
-        }
-        // Support only critical chunks
-        switch(chunk.type_) {
-        case ChunkPLTE::Type:
-            setChunkHeader(chunkPLTE, chunk);
-            if(!chunkPLTE.read(stream)) {
-                return false;
-            }
-            break;
-        case ChunkIDAT::Type:
-            setChunkHeader(chunkIDAT, chunk);
-            if(!chunkIDAT.read(stream)) {
-                return false;
+        static void paeth(u32 size, u8* scanline, const u8* upper)
+        {
+            for(u32 i = 0; i < BPP; ++i) {
+                scanline[i] = static_cast<u8>(scanline[i] + upper[i]);
             }
-            break;
-        case ChunkIEND::Type:
-            loop = false;
-            break;
-        default:
-            if(!skipChunk(chunk, stream)) {
-                return false;
+            for(u32 i = BPP; i < size; ++i) {
+                u8 x = paethPredictor(scanline[i - BPP], upper[i], upper[i - BPP]);
+                scanline[i] = static_cast<u8>(scanline[i] + x);
             }
-            break;
         }
-    } while(loop);
+    };
 
-    bool result = chunkIDAT.decode(image);
-    chunkIDAT.terminate();
+#    if !defined(CPPIMG_DISABLE_AVX)
+    template<u32 N>
+    inline __m128i loadPixel(const u8* src)
+    {
+        u64 x = 0;
+        memcpy(&x, src, N);
+        return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&x));
+    }
 
-    if(result) {
-        u8* uimage = reinterpret_cast<u8*>(image);
-        switch(chunkIHDR.colorType_) {
-        case PNG::ColorType_Index:
-            for(s32 i = 0; i < height; ++i) {
-                for(s32 j = 0; j < width; ++j) {
-                    s32 index = (i * width + j) * 3;
-                    uimage[index + 0] = chunkPLTE.r_[uimage[index + 0]];
-                    uimage[index + 1] = chunkPLTE.g_[uimage[index + 1]];
-                    uimage[index + 2] = chunkPLTE.b_[uimage[index + 2]];
-                }
-            }
-            break;
-        }
+    template<u32 N>
+    inline void storePixel(u8* dst, __m128i x)
+    {
+        u64 t;
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(&t), x);
+        memcpy(dst, &t, N);
     }
-    seekSet.clear();
-    return result;
-}
 
-#    if 0
-    bool PNG::write(Stream& stream, s32 width, s32 height, ColorType colorType, const void* image)
+    /**
+    @brief Truncated average (a+b)>>1 for each byte
+    */
+    inline __m128i averageFloor(__m128i a, __m128i b)
     {
-        CPPIMG_ASSERT(CPPIMG_NULL != image);
-        if(!stream.valid()){
-            return false;
+        __m128i round = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+        return _mm_sub_epi8(_mm_avg_epu8(a, b), round);
+    }
+
+    /**
+    @brief SSE kernels for 3, 4, 6, and 8 bytes per pixel, one pixel per iteration.
+    Paeth works on 16 bit lanes, high bytes are kept zero across _mm_add_epi8.
+    */
+    template<u32 BPP>
+    struct Unfilter<BPP, true>
+    {
+        static void sub(u32 size, u8* scanline)
+        {
+            __m128i a = loadPixel<BPP>(scanline);
+            for(u32 i = BPP; i < size; i += BPP) {
+                a = _mm_add_epi8(loadPixel<BPP>(scanline + i), a);
+                storePixel<BPP>(scanline + i, a);
+            }
         }
 
-        SeekSet seekSet(stream.tell(), &stream);
+        static void avgFirst(u32 size, u8* scanline)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i a = loadPixel<BPP>(scanline);
+            for(u32 i = BPP; i < size; i += BPP) {
+                a = _mm_add_epi8(loadPixel<BPP>(scanline + i), averageFloor(a, zero));
+                storePixel<BPP>(scanline + i, a);
+            }
+        }
 
-        //Write signature
-        u64 signature = Signature;
-        if(stream.write(sizeof(u64), &signature)<0){
-            return false;
+        static void avg(u32 size, u8* scanline, const u8* upper)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i a = _mm_add_epi8(loadPixel<BPP>(scanline), averageFloor(zero, loadPixel<BPP>(upper)));
+            storePixel<BPP>(scanline, a);
+            for(u32 i = BPP; i < size; i += BPP) {
+                __m128i b = loadPixel<BPP>(upper + i);
+                a = _mm_add_epi8(loadPixel<BPP>(scanline + i), averageFloor(a, b));
+                storePixel<BPP>(scanline + i, a);
+            }
         }
 
-        //Write header
-        ChunkIHDR chunkIHDR;
-        chunkIHDR.width_ = reverse(static_cast<u32>(width));
-        chunkIHDR.height_ = reverse(static_cast<u32>(height));
-        chunkIHDR.bitDepth_ = 8;
-        chunkIHDR.compression_ = 0;
-        chunkIHDR.filter_ = 0;
-        chunkIHDR.interlace_ = 0;
+        static void paeth(u32 size, u8* scanline, const u8* upper)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i c = _mm_unpacklo_epi8(loadPixel<BPP>(upper), zero);
+            __m128i a = _mm_add_epi8(_mm_unpacklo_epi8(loadPixel<BPP>(scanline), zero), c);
+            storePixel<BPP>(scanline, _mm_packus_epi16(a, a));
+            for(u32 i = BPP; i < size; i += BPP) {
+                __m128i b = _mm_unpacklo_epi8(loadPixel<BPP>(upper + i), zero);
+                __m128i d = _mm_unpacklo_epi8(loadPixel<BPP>(scanline + i), zero);
+                // p = a+b-c, |p-a| = |b-c|, |p-b| = |a-c|, |p-c| = |(b-c)+(a-c)|
+                __m128i pa = _mm_sub_epi16(b, c);
+                __m128i pb = _mm_sub_epi16(a, c);
+                __m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+                pa = _mm_abs_epi16(pa);
+                pb = _mm_abs_epi16(pb);
+                __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+                __m128i nearest = _mm_blendv_epi8(c, b, _mm_cmpeq_epi16(smallest, pb));
+                nearest = _mm_blendv_epi8(nearest, a, _mm_cmpeq_epi16(smallest, pa));
+                a = _mm_add_epi8(d, nearest);
+                storePixel<BPP>(scanline + i, _mm_packus_epi16(a, a));
+                c = b;
+            }
+        }
+    };
+#    endif
+#    undef CPPIMG_PNG_UNFILTER_SIMD
 
-        s32 color;
-        s32 alpha = 0;
-        switch(colorType)
+    /// Scale factors from sub-byte gray samples to 8 bits
+    const u8 GrayScale[9] = {0, 0xFFU, 0x55U, 0, 0x11U, 0, 0, 0, 1};
+
+    /**
+        @brief Unpack 1, 2, or 4 bits samples packed from MSB to one byte per sample
+        */
+    void unpackBits(u32 samples, u32 bitDepth, u8 scale, u8* dst, const u8* src)
+    {
+        const u32 shift = 8 - bitDepth;
+        const u8 mask = static_cast<u8>((0x01U << bitDepth) - 1);
+        const u32 perByte = 8 / bitDepth;
+        u32 i = 0;
+        for(; (i + perByte) <= samples; ++src) {
+            u32 bits = src[0];
+            for(u32 j = 0; j < perByte; ++j, ++i) {
+                dst[i] = static_cast<u8>(((bits >> shift) & mask) * scale);
+                bits <<= bitDepth;
+            }
+        }
+        for(u32 bits = src[0]; i < samples; ++i) {
+            dst[i] = static_cast<u8>(((bits >> shift) & mask) * scale);
+            bits <<= bitDepth;
+        }
+    }
+
+    /**
+        @brief Convert big endian 16 bits samples to native ones
+        */
+    void swapBytes16(u32 samples, u16* dst, const u8* src)
+    {
+        u32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        for(; (i + 8) <= samples; i += 8) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+            x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), x);
+        }
+#    endif
+        for(; i < samples; ++i) {
+            dst[i] = static_cast<u16>((src[i * 2] << 8) | src[i * 2 + 1]);
+        }
+    }
+
+    /**
+        @brief Reduce big endian 16 bits samples to 8 bits by taking the most significant bytes
+        */
+    void pickHighBytes16(u32 samples, u8* dst, const u8* src)
+    {
+        u32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        const __m128i mask = _mm_set1_epi16(0x00FF);
+        for(; (i + 16) <= samples; i += 16) {
+            __m128i x0 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2)), mask);
+            __m128i x1 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2 + 16)), mask);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(x0, x1));
+        }
+#    endif
+        for(; i < samples; ++i) {
+            dst[i] = src[i * 2];
+        }
+    }
+
+    struct Sample8
+    {
+        typedef u8 value_type;
+        static const u32 Stride = 1;
+        static inline u8 get(const u8* src)
         {
-        case ColorType_GRAY:
-            chunkIHDR.colorType_ = PNG::ColorType_Gray;
-            color = 1;
+            return src[0];
+        }
+    };
+
+    struct Sample16
+    {
+        typedef u16 value_type;
+        static const u32 Stride = 2;
+        static inline u16 get(const u8* src)
+        {
+            return static_cast<u16>((src[0] << 8) | src[1]);
+        }
+    };
+
+    struct Sample16To8
+    {
+        typedef u8 value_type;
+        static const u32 Stride = 2;
+        static inline u8 get(const u8* src)
+        {
+            return src[0];
+        }
+    };
+
+    /**
+        @brief Expand gray and alpha samples to RGBA
+        */
+    template<class T>
+    void expandGrayAlpha(u32 width, typename T::value_type* dst, const u8* src)
+    {
+        for(u32 i = 0; i < width; ++i, dst += 4, src += T::Stride * 2) {
+            typename T::value_type gray = T::get(src);
+            dst[0] = dst[1] = dst[2] = gray;
+            dst[3] = T::get(src + T::Stride);
+        }
+    }
+
+    /**
+        @brief Expand palette indices to RGB through a RGBA lookup table
+        */
+    void expandPaletteRGB(u32 width, u8* dst, const u8* indices, const u32* lut)
+    {
+        u32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        // Drop alpha of four entries, a 16 bytes store overruns 4 bytes that the next one overwrites
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        for(; (i + 6) <= width; i += 4, dst += 12) {
+            __m128i x = _mm_setr_epi32(lut[indices[i]], lut[indices[i + 1]], lut[indices[i + 2]], lut[indices[i + 3]]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi8(x, shuffle));
+        }
+#    endif
+        for(; i < width; ++i, dst += 3) {
+            memcpy(dst, &lut[indices[i]], 3);
+        }
+    }
+
+    /**
+        @brief Expand palette indices to RGBA through a RGBA lookup table
+        */
+    void expandPaletteRGBA(u32 width, u8* dst, const u8* indices, const u32* lut)
+    {
+        u32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        for(; (i + 4) <= width; i += 4, dst += 16) {
+            __m128i x = _mm_setr_epi32(lut[indices[i]], lut[indices[i + 1]], lut[indices[i + 2]], lut[indices[i + 3]]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), x);
+        }
+#    endif
+        for(; i < width; ++i, dst += 4) {
+            memcpy(dst, &lut[indices[i]], 4);
+        }
+    }
+
+    /**
+        @brief Copy contiguous pixels of an interlaced pass to every Step pixels of the destination
+        */
+    template<u32 Size, u32 Step>
+    void scatterPixels(u32 count, u8* dst, const u8* src)
+    {
+        for(u32 i = 0; i < count; ++i, dst += Size * Step, src += Size) {
+            memcpy(dst, src, Size);
+        }
+    }
+
+    template<u32 Size>
+    void scatterPixels(u32 step, u32 count, u8* dst, const u8* src)
+    {
+        switch(step) {
+        case 2:
+            scatterPixels<Size, 2>(count, dst, src);
             break;
-        case ColorType_RGB:
-            chunkIHDR.colorType_ = PNG::ColorType_True;
-            color = 3;
+        case 4:
+            scatterPixels<Size, 4>(count, dst, src);
             break;
-        case ColorType_RGBA:
-            chunkIHDR.colorType_ = PNG::ColorType_TrueAlpha;
-            color = 3;
-            alpha = 1;
+        case 8:
+            scatterPixels<Size, 8>(count, dst, src);
             break;
         default:
-            return false;
-        }
-        if(!writeChunk(stream, ChunkIHDR::Type, ChunkIHDR::Size, &chunkIHDR.width_)){
-            return false;
+            CPPIMG_ASSERT(false);
+            break;
         }
+    }
+} // namespace
 
-        ChunkIDAT chunkIDAT(true, width, height, color, alpha);
-        if(!chunkIDAT.initialize()){
-            return false;
-        }
-        if(!chunkIDAT.write(stream, height, reinterpret_cast<const u8*>(image))){
+bool PNG::read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream)
+{
+    s32 bitDepth;
+    return read(width, height, colorType, bitDepth, image, stream, Option_None);
+}
+
+bool PNG::read(s32& width, s32& height, ColorType& colorType, s32& bitDepth, void* image, Stream& stream, s32 options, PassCallback callback, void* userData)
+{
+    return readImage(width, height, colorType, bitDepth, image, CPPIMG_NULL, stream, options, callback, userData);
+}
+
+bool PNG::read(const ImageView& image, Stream& stream)
+{
+    s32 width, height, bitDepth;
+    ColorType colorType;
+    return readImage(width, height, colorType, bitDepth, CPPIMG_NULL, &image, stream, Option_None, CPPIMG_NULL, CPPIMG_NULL);
+}
+
+bool PNG::readImage(s32& width, s32& height, ColorType& colorType, s32& bitDepth, void* image, const ImageView* view, Stream& stream, s32 options, PassCallback callback, void* userData)
+{
+    if(!stream.valid()) {
+        return false;
+    }
+
+    SeekSet seekSet(stream.tell(), &stream);
+    ChunkIHDR chunkIHDR;
+    cppimg::off_t start;
+    u32 totalIDAT;
+    bool transparency;
+    if(!readImageHeader(chunkIHDR, start, totalIDAT, transparency, stream)
+       || !getColorType(colorType, chunkIHDR, transparency)) {
+        return false;
+    }
+    width = static_cast<s32>(chunkIHDR.width_);
+    height = static_cast<s32>(chunkIHDR.height_);
+    bitDepth = (16 == chunkIHDR.bitDepth_ && 0 != (options & Option_Keep16Bits)) ? 16 : 8;
+    if(CPPIMG_NULL == image && CPPIMG_NULL == view) {
+        return true;
+    }
+
+    ChunkPLTE chunkPLTE;
+    chunkPLTE.size_ = 0;
+    chunkPLTE.hasAlpha_ = PNG::ColorType_Index == chunkIHDR.colorType_ && transparency;
+    ChunkIDAT chunkIDAT(chunkPLTE);
+    if(!chunkIDAT.initialize(totalIDAT, chunkIHDR, options)) {
+        return false;
+    }
+    stream.seek(start, SEEK_SET);
+    if(!readImageData(chunkPLTE, chunkIDAT, stream)) {
+        return false;
+    }
+
+    // Rows are converted into a view while they are stored
+    PixelFormat format = getPixelFormat(colorType);
+    RowConverter rows;
+    ImageView interlaced = {CPPIMG_NULL, width, height, 0, format};
+    if(CPPIMG_NULL == view) {
+        rows.initialize(image, static_cast<s64>(width) * getNumChannels(colorType) * (bitDepth >> 3));
+    } else if(Interlace_None != chunkIHDR.interlace_ && view->format_ != format) {
+        // Rows of passes are completed at the last pass, so convert the whole image at the end
+        if(view->width_ != width || view->height_ != height) {
             return false;
         }
-        chunkIDAT.terminate();
-        if(!writeChunk(stream, ChunkIEND::Type, 0, CPPIMG_NULL)){
+        interlaced.pitch_ = static_cast<s64>(width) * getBytesPerPixel(format);
+        interlaced.data_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(interlaced.pitch_ * height));
+        if(CPPIMG_NULL == interlaced.data_) {
             return false;
         }
-        seekSet.clear();
-        return true;
+        rows.initialize(interlaced.data_, interlaced.pitch_);
+    } else if(view->width_ != width || view->height_ != height || !rows.initialize(*view, format)) {
+        return false;
     }
-#    endif
+    bool result = chunkIDAT.decode(rows, callback, userData);
+    chunkIDAT.terminate();
+    if(CPPIMG_NULL != interlaced.data_) {
+        result = result && convert(*view, interlaced);
+        CPPIMG_FREE(interlaced.data_);
+    }
+    seekSet.clear();
+    return result;
+}
 
-//--- PNG::ChunkIHDR
-//----------------------------------------------------
-bool PNG::ChunkIHDR::read(Stream& istream)
+bool PNG::readImageHeader(ChunkIHDR& header, cppimg::off_t& start, u32& totalIDAT, bool& transparency, Stream& stream)
 {
-    if(istream.read(Size, &width_) < 0) {
+    if(!readHeader(stream)) {
         return false;
     }
-    u32 crc;
-    if(istream.read(sizeof(u32), &crc) < 0) {
+
+    if(!readHeader(header, stream)
+       || !header.read(stream)
+       || MaxWidth < header.width_
+       || MaxHeight < header.height_) {
         return false;
     }
-    width_ = reverse(width_);
-    height_ = reverse(height_);
 
-    // Support only 8 bit depth
-#    if 0
-        switch(color_){
-        case PNG::ColorType_Gray:
-            if(1!=bitDepth_
-                && 2 != bitDepth_
-                && 4 != bitDepth_
-                && 8 != bitDepth_
-                && 16 != bitDepth_){
-                return false;
-            }
-            break;
-        case PNG::ColorType_True:
-            if(8 != bitDepth_ && 16 != bitDepth_){
+    Chunk chunk;
+    start = stream.tell();
+    totalIDAT = 0;
+    transparency = false;
+    bool loop = true;
+    // sum size of IDAT, and find transparency
+    do {
+        if(!readHeader(chunk, stream)) {
+            return false;
+        }
+        // Support only critical chunks
+        switch(chunk.type_) {
+        case ChunkIDAT::Type:
+            totalIDAT += chunk.length_;
+            if(!skipChunk(chunk, stream)) {
                 return false;
             }
             break;
-        case PNG::ColorType_Index:
-            if(1!=bitDepth_
-                && 2 != bitDepth_
-                && 4 != bitDepth_
-                && 8 != bitDepth_){
+        case ChunkTRNS::Type:
+            transparency = true;
+            if(!skipChunk(chunk, stream)) {
                 return false;
             }
             break;
-        case PNG::ColorType_GrayAlpha:
-            if(8 != bitDepth_ && 16 != bitDepth_){
-                return false;
-            }
+        case ChunkIEND::Type:
+            loop = false;
             break;
-        case PNG::ColorType_TrueAlpha:
-            if(8 != bitDepth_ && 16 != bitDepth_){
+        default:
+            if(!skipChunk(chunk, stream)) {
                 return false;
             }
             break;
-        default:
-            return false;
         }
-#    else
-    switch(colorType_) {
+    } while(loop);
+    return true;
+}
+
+bool PNG::getColorType(ColorType& colorType, const ChunkIHDR& header, bool transparency)
+{
+    switch(header.colorType_) {
     case PNG::ColorType_Gray:
-        if(8 != bitDepth_) {
-            return false;
-        }
+        colorType = ColorType::GRAY;
         break;
     case PNG::ColorType_True:
-        if(8 != bitDepth_) {
-            return false;
-        }
+        colorType = ColorType::RGB;
         break;
     case PNG::ColorType_Index:
-        if(8 != bitDepth_) {
-            return false;
-        }
+        // Palette with transparency is expanded to RGBA
+        colorType = transparency ? ColorType::RGBA : ColorType::RGB;
         break;
     case PNG::ColorType_GrayAlpha:
-        if(8 != bitDepth_) {
-            return false;
-        }
+        colorType = ColorType::RGBA;
         break;
     case PNG::ColorType_TrueAlpha:
-        if(8 != bitDepth_) {
-            return false;
-        }
+        colorType = ColorType::RGBA;
         break;
     default:
         return false;
     }
-#    endif
-
-    // Don't support interlace
-    if(0 < interlace_) {
-        return false;
-    }
     return true;
 }
 
-//--- PNG::ChunkPLTE
-//----------------------------------------------------
-bool PNG::ChunkPLTE::read(Stream& stream)
+bool PNG::readImageData(ChunkPLTE& palette, ChunkIDAT& data, Stream& stream)
 {
-    // It's assumed that (chunk size mod 3) equals zero
-    if(0 != (length_ % 3)) {
-        return false;
-    }
-
-    u8 rgb[3];
-    u32 length = length_ / 3;
-    for(u32 i = 0; i < length; ++i) {
-        if(stream.read(3, rgb) < 0) {
+    Chunk chunk;
+    bool loop = true;
+    do {
+        if(!readHeader(chunk, stream)) {
             return false;
         }
-        r_[i] = rgb[0];
-        g_[i] = rgb[1];
-        b_[i] = rgb[2];
-    }
-    size_ = length;
-    u32 crc;
-    if(stream.read(sizeof(u32), &crc) < 0) {
+        // Support only critical chunks
+        switch(chunk.type_) {
+        case ChunkPLTE::Type:
+            setChunkHeader(palette, chunk);
+            if(!palette.read(stream)) {
+                return false;
+            }
+            break;
+        case ChunkIDAT::Type:
+            setChunkHeader(data, chunk);
+            if(!data.read(stream)) {
+                return false;
+            }
+            break;
+        case ChunkTRNS::Type:
+            if(palette.hasAlpha_) {
+                if(!palette.readTransparency(chunk.length_, stream)) {
+                    return false;
+                }
+            } else if(!skipChunk(chunk, stream)) {
+                return false;
+            }
+            break;
+        case ChunkIEND::Type:
+            loop = false;
+            break;
+        default:
+            if(!skipChunk(chunk, stream)) {
+                return false;
+            }
+            break;
+        }
+    } while(loop);
+
+    if(PNG::ColorType_Index == data.colorType_ && palette.size_ <= 0) {
         return false;
     }
     return true;
 }
 
-//--- ChunkIDAT
+//--- PNG::Decoder
 //----------------------------------------------------
-PNG::ChunkIDAT::ChunkIDAT(u32 totalSrcSize, u32 width, u32 height, s32 color, s32 alpha)
-    : src_(CPPIMG_NULL)
-    , totalSrcSize_(totalSrcSize)
-    , srcSize_(0)
-    , totalSize_(width * height * (color + alpha))
-    , totalCount_(0)
-    , color_(color)
-    , alpha_(alpha)
-    , width_(width)
-    , height_(height)
+PNG::Decoder::Decoder()
+    : colorType_(ColorType::GRAY)
+    , bitDepth_(8)
+    , row_(0)
+    , opened_(false)
+    , palette_()
+    , data_(palette_)
 {
 }
 
-PNG::ChunkIDAT::~ChunkIDAT()
+PNG::Decoder::~Decoder()
 {
-    terminate();
+    close();
 }
 
-bool PNG::ChunkIDAT::initialize()
+bool PNG::Decoder::open(Stream& stream, s32 options)
 {
-    srcSize_ = 0;
-    CPPIMG_FREE(src_);
-    src_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(totalSrcSize_));
-    if(CPPIMG_NULL == src_) {
+    close();
+    if(!stream.valid()) {
+        return false;
+    }
+    ChunkIHDR chunkIHDR;
+    cppimg::off_t start;
+    u32 totalIDAT;
+    bool transparency;
+    if(!readImageHeader(chunkIHDR, start, totalIDAT, transparency, stream)
+       || !PNG::getColorType(colorType_, chunkIHDR, transparency)
+       || Interlace_None != chunkIHDR.interlace_) {
+        return false;
+    }
+    bitDepth_ = (16 == chunkIHDR.bitDepth_ && 0 != (options & Option_Keep16Bits)) ? 16 : 8;
+
+    palette_.size_ = 0;
+    palette_.hasAlpha_ = PNG::ColorType_Index == chunkIHDR.colorType_ && transparency;
+    if(!data_.initialize(totalIDAT, chunkIHDR, options)) {
+        data_.terminate();
+        return false;
+    }
+    stream.seek(start, SEEK_SET);
+    if(!readImageData(palette_, data_, stream) || !data_.begin()) {
+        data_.terminate();
         return false;
     }
+    row_ = 0;
+    opened_ = true;
     return true;
 }
 
-bool PNG::ChunkIDAT::terminate()
+void PNG::Decoder::close()
 {
-    CPPIMG_FREE(src_);
-    return true;
+    if(opened_) {
+        data_.end();
+        opened_ = false;
+    }
+    data_.terminate();
 }
 
-bool PNG::ChunkIDAT::read(Stream& stream)
+s32 PNG::Decoder::getWidth() const
 {
-    u8* src = src_ + srcSize_;
-    if(stream.read(length_, src) < 0) {
-        return false;
-    }
-    u32 crc;
-    if(stream.read(sizeof(u32), &crc) < 0) {
-        return false;
-    }
+    return static_cast<s32>(data_.width_);
+}
 
-    srcSize_ += length_;
-    return srcSize_ <= totalSrcSize_;
+s32 PNG::Decoder::getHeight() const
+{
+    return static_cast<s32>(data_.height_);
 }
 
-bool PNG::ChunkIDAT::decode(void* image)
+ColorType PNG::Decoder::getColorType() const
 {
-    szlib::szContext context;
-    if(szlib::SZ_OK != szlib::initInflate(&context, totalSrcSize_, src_)) {
-        return false;
-    }
+    return colorType_;
+}
 
-    u32 scanlineSize = width_ * (color_ + alpha_);
-    u8* scanline = reinterpret_cast<u8*>(image);
-    u32 scanlineOffset = 0;
-    s32 filterFlag = -1;
-    u8 buffer[BufferSize];
-    s32 result;
-    do {
-        context.availOut_ = BufferSize;
-        context.nextOut_ = buffer;
-        result = szlib::inflate(&context);
+s32 PNG::Decoder::getBitDepth() const
+{
+    return bitDepth_;
+}
 
-        switch(result) {
-        case szlib::SZ_ERROR_MEMORY:
-        case szlib::SZ_ERROR_FORMAT:
-            szlib::termInflate(&context);
-            return false;
-        default:
-            break;
-        };
-        u32 outSize = static_cast<u32>(context.thisTimeOut_);
-        u8* dst = buffer;
-        // Copy inflated data to scanline
-        while(0 < outSize && totalCount_ < totalSize_) {
-            if(scanlineOffset <= 0 && filterFlag < 0) {
-                --outSize;
-                filterFlag = dst[0];
-                ++dst;
-                CPPIMG_ASSERT(FilterType_None <= filterFlag && filterFlag <= FilterType_Paeth);
-            }
+s32 PNG::Decoder::getRowSize() const
+{
+    return static_cast<s32>(data_.dstScanlineSize_);
+}
 
-            u32 copySize = ((scanlineOffset + outSize) <= scanlineSize) ? outSize : scanlineSize - scanlineOffset;
-            memcpy(scanline + scanlineOffset, dst, copySize);
-            scanlineOffset += copySize;
+s32 PNG::Decoder::getRow() const
+{
+    return row_;
+}
 
-            // Scanline have been filled up, apply filter
-            if(scanlineSize <= scanlineOffset) {
-                CPPIMG_ASSERT(scanlineSize == scanlineOffset);
-                CPPIMG_ASSERT(FilterType_None <= filterFlag && filterFlag <= FilterType_Paeth);
-                filter(scanlineSize, filterFlag, scanline, reinterpret_cast<u8*>(image));
-                filterFlag = -1;
-                scanline += scanlineSize;
-                scanlineOffset -= scanlineSize;
-            }
-            totalCount_ += copySize;
-            outSize -= copySize;
-            dst += copySize;
-        }
-    } while(szlib::SZ_END != result && totalCount_ < totalSize_);
-    szlib::termInflate(&context);
+bool PNG::Decoder::readRow(void* row)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != row);
+    if(!opened_ || data_.height_ <= static_cast<u32>(row_) || !data_.nextScanline()) {
+        return false;
+    }
+    data_.store(data_.width_, reinterpret_cast<u8*>(row), data_.scanline_);
+    ++row_;
     return true;
 }
 
+s32 PNG::Decoder::readRows(s32 count, void** rows)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != rows);
+    s32 i = 0;
+    for(; i < count; ++i) {
+        if(!readRow(rows[i])) {
+            break;
+        }
+    }
+    return i;
+}
+
+
 #    if 0
-    bool PNG::ChunkIDAT::write(Stream& stream, s32 height, const u8* image)
+    bool PNG::write(Stream& stream, s32 width, s32 height, ColorType colorType, const void* image)
     {
-        struct ReleaseMemory
-        {
-            ReleaseMemory(u8* ptr)
-                :ptr_(ptr)
-            {}
-            ~ReleaseMemory()
-            {
-                CPPIMG_FREE(ptr_);
-            }
-            u8* ptr_;
-        };
-
-        s32 lenPos = stream.tell();
-        u32 outCount = 0;
-        if(stream.write(sizeof(u32), &outCount)<=0){
+        CPPIMG_ASSERT(CPPIMG_NULL != image);
+        if(!stream.valid()){
             return false;
         }
-        u32 type = Type;
-        if(stream.write(sizeof(u32), &type)<=0){
+
+        SeekSet seekSet(stream.tell(), &stream);
+
+        //Write signature
+        u64 signature = Signature;
+        if(stream.write(sizeof(u64), &signature)<0){
             return false;
         }
-        u32 crc = 0xFFFFFFFFUL;
-        crc = updateCRC32(crc, sizeof(u32), reinterpret_cast<const u8*>(&type));
-
-        //Add 1 byte of filter type for each scanlines
-        //---------------------------------
-        u32 totalSize = totalSize_ + height;
 
-        u8* in = reinterpret_cast<u8*>(CPPIMG_MALLOC(totalSize));
-        ReleaseMemory releaseInMemory(in);
+        //Write header
+        ChunkIHDR chunkIHDR;
+        chunkIHDR.width_ = reverse(static_cast<u32>(width));
+        chunkIHDR.height_ = reverse(static_cast<u32>(height));
+        chunkIHDR.bitDepth_ = 8;
+        chunkIHDR.compression_ = 0;
+        chunkIHDR.filter_ = 0;
+        chunkIHDR.interlace_ = 0;
 
+        s32 color;
+        s32 alpha = 0;
+        switch(colorType)
         {
-            u8 filter = 0;
-            const u8* src = image;
-            u8* dst = in;
-            for(s32 i=0; i<height; ++i){
-                dst[0] = filter;
-                ++dst;
-                memcpy(dst, src, scanlineSize_);
-                src += scanlineSize_;
-                dst += scanlineSize_;
-            }
+        case ColorType_GRAY:
+            chunkIHDR.colorType_ = PNG::ColorType_Gray;
+            color = 1;
+            break;
+        case ColorType_RGB:
+            chunkIHDR.colorType_ = PNG::ColorType_True;
+            color = 3;
+            break;
+        case ColorType_RGBA:
+            chunkIHDR.colorType_ = PNG::ColorType_TrueAlpha;
+            color = 3;
+            alpha = 1;
+            break;
+        default:
+            return false;
+        }
+        if(!writeChunk(stream, ChunkIHDR::Type, ChunkIHDR::Size, &chunkIHDR.width_)){
+            return false;
         }
 
-        //---------------------------------
-        u32 inCount = 0;
-        s32 result;
-        s32 flush;
-        do{
-            if(totalSize<=inCount){
-                break;
-            }
-            u32 size = totalSize;
-            if(totalSize<(inCount+size)){
-                size = totalSize-inCount;
-            }
-            stream_.avail_in = size;
-            stream_.next_in = in+inCount;
-            inCount += size;
-            flush = (totalSize<=inCount)? MZ_FINISH : MZ_NO_FLUSH;
-            do{
-                stream_.avail_out = BufferSize;
-                stream_.next_out = dst_;
-                u64 totalOut = stream_.total_out;
-                result = mz_deflate(&stream_, flush);
-                if(MZ_OK != result && MZ_STREAM_END != result){
-                    return false;
-                }
-                u32 outSize = static_cast<u32>(stream_.total_out - totalOut);
-                if(0<outSize){
-                    crc = updateCRC32(crc, outSize, dst_);
-                    if(stream.write(outSize, dst_)<=0){
-                        return false;
-                    }
-                }
-                outCount += outSize;
-            }while(MZ_STREAM_END != result);
-        }while(flush != MZ_FINISH);
-
-        s32 crcPos = stream.tell();
-        stream.seek(lenPos, SEEK_SET);
-        outCount = reverse(outCount);
-        if(stream.write(sizeof(u32), &outCount)<=0){
+        ChunkIDAT chunkIDAT(true, width, height, color, alpha);
+        if(!chunkIDAT.initialize()){
             return false;
         }
-        stream.seek(crcPos, SEEK_SET);
-        crc ^= 0xFFFFFFFFUL;
-        crc = reverse(crc);
-        return stream.write(sizeof(u32), &crc)<=0;
+        if(!chunkIDAT.write(stream, height, reinterpret_cast<const u8*>(image))){
+            return false;
+        }
+        chunkIDAT.terminate();
+        if(!writeChunk(stream, ChunkIEND::Type, 0, CPPIMG_NULL)){
+            return false;
+        }
+        seekSet.clear();
+        return true;
     }
 #    endif
 
-void PNG::ChunkIDAT::filter(u32 scanlineSize, s32 filterFlag, u8* scanline, u8* image)
+//--- PNG::ChunkIHDR
+//----------------------------------------------------
+bool PNG::ChunkIHDR::read(Stream& istream)
 {
-    CPPIMG_ASSERT(image <= scanline && scanline < (image + totalSize_));
-    u32 components = color_ + alpha_;
-    CPPIMG_ASSERT(scanlineSize == (width_ * components));
+    if(istream.read(Size, &width_) < 0) {
+        return false;
+    }
+    u32 crc;
+    if(istream.read(sizeof(u32), &crc) < 0) {
+        return false;
+    }
+    width_ = reverse(width_);
+    height_ = reverse(height_);
 
-    switch(filterFlag) {
-    case FilterType_Sub:
-        for(u32 p = components; p < scanlineSize;) {
-            for(u32 j = 0; j < components; ++j, ++p) {
-                s32 x = scanline[p] + scanline[p - components];
-                scanline[p] = static_cast<u8>(x & 255);
-            }
+    switch(colorType_) {
+    case PNG::ColorType_Gray:
+        if(1 != bitDepth_
+           && 2 != bitDepth_
+           && 4 != bitDepth_
+           && 8 != bitDepth_
+           && 16 != bitDepth_) {
+            return false;
         }
         break;
-    case FilterType_Up:
-        if(image < scanline) {
-            u8* upper = scanline - scanlineSize;
-            for(u32 p = 0; p < scanlineSize;) {
-                for(u32 j = 0; j < components; ++j, ++p) {
-                    s32 x = upper[p] + scanline[p];
-                    scanline[p] = static_cast<u8>(x & 255);
-                }
-            }
+    case PNG::ColorType_True:
+        if(8 != bitDepth_ && 16 != bitDepth_) {
+            return false;
         }
         break;
-    case FilterType_Avg: {
-        u8* upper = scanline - scanlineSize;
-        for(u32 p = 0; p < scanlineSize;) {
-            for(u32 j = 0; j < components; ++j, ++p) {
-                s32 left = (components <= p) ? scanline[p - components] : 0;
-                s32 up = (image < scanline) ? upper[p] : 0;
-                s32 x = ((left + up) >> 1) + scanline[p];
-                scanline[p] = static_cast<u8>(x & 255);
-            }
+    case PNG::ColorType_Index:
+        if(1 != bitDepth_
+           && 2 != bitDepth_
+           && 4 != bitDepth_
+           && 8 != bitDepth_) {
+            return false;
         }
-    } break;
-    case FilterType_Paeth: {
-        u8* upper = scanline - scanlineSize;
-        for(u32 p = 0; p < scanlineSize;) {
-            for(u32 j = 0; j < components; ++j, ++p) {
-                s32 a = (components <= p) ? scanline[p - components] : 0;
-                s32 b = (image < scanline) ? upper[p] : 0;
-                s32 c = (components <= p && image < scanline) ? upper[p - components] : 0;
-
-                s32 x = a + b - c;
-                s32 xa = absolute(x - a);
-                s32 xb = absolute(x - b);
-                s32 xc = absolute(x - c);
-                if(xa <= xb && xa <= xc) {
-                    x = a;
-                } else {
-                    x = (xb <= xc) ? b : c;
-                }
-                // scanline[p] = clamp(x+scanline[p], 0, 255);
-                scanline[p] = static_cast<u8>((x + scanline[p]) & 255);
-            }
+        break;
+    case PNG::ColorType_GrayAlpha:
+        if(8 != bitDepth_ && 16 != bitDepth_) {
+            return false;
         }
-    } break;
-    default:
         break;
-    }
-}
-
-//--- PNG
-//----------------------------------------------------
-inline u16 PNG::reverse(u16 x)
-{
-    return ((x >> 8) & 0xFFU) | ((x << 8) & 0xFF00U);
-}
-
-inline u32 PNG::reverse(u32 x)
-{
-    return ((x >> 24)) | ((x >> 8) & 0xFF00U) | ((x & 0xFF00U) << 8) | ((x & 0xFFU) << 24);
-}
-
-bool PNG::readHeader(Stream& stream)
-{
-    u64 signature;
-    if(stream.read(sizeof(u64), &signature) < 0) {
+    case PNG::ColorType_TrueAlpha:
+        if(8 != bitDepth_ && 16 != bitDepth_) {
+            return false;
+        }
+        break;
+    default:
         return false;
     }
-    if(Signature != signature) {
+
+    // Support no interlace or Adam7
+    if(Interlace_Adam7 < interlace_) {
         return false;
     }
     return true;
 }
 
-bool PNG::checkCRC32(const Chunk& chunk, Stream& stream)
-{
-    static const u32 BufferSize = 1024;
-    u8 buffer[BufferSize];
-
-    u32 crc = 0xFFFFFFFFUL;
-    crc = updateCRC32(crc, sizeof(u32), reinterpret_cast<const u8*>(&chunk.type_));
-    off_t pos = stream.tell();
-    u32 remain = chunk.length_;
-    while(0 < remain) {
-        u32 size = (remain < BufferSize) ? remain : BufferSize;
-        if(stream.read(size, buffer) < 0) {
-            break;
-        }
-        crc = updateCRC32(crc, size, buffer);
-        remain -= size;
-    }
-
-    // Check whether calculated crc equals loaded crc
-    u32 readCrc = 0;
-    s32 ret = (remain <= 0) ? stream.read(sizeof(u32), &readCrc) : 0;
-    stream.seek(pos, SEEK_SET);
-    if(ret < 0) {
+//--- PNG::ChunkPLTE
+//----------------------------------------------------
+bool PNG::ChunkPLTE::read(Stream& stream)
+{
+    // It's assumed that (chunk size mod 3) equals zero
+    if(0 != (length_ % 3)) {
         return false;
     }
-    crc ^= 0xFFFFFFFFUL;
-    readCrc = reverse(readCrc);
-    return readCrc == crc;
-}
-
-bool PNG::skipChunk(const Chunk& chunk, Stream& stream)
-{
-    u32 size = chunk.length_ + 4; // chunk data size + crc size
-    return stream.seek(size, SEEK_CUR);
-}
-
-template<class T>
-void PNG::setChunkHeader(T& dst, const Chunk& src)
-{
-    dst.type_ = src.type_;
-    dst.length_ = src.length_;
-}
 
-template<class T>
-bool PNG::readHeader(T& chunk, Stream& stream)
-{
-    if(stream.read(sizeof(u32) * 2, &chunk) < 0) {
+    u8 rgba[4] = {0, 0, 0, 0xFFU};
+    u32 length = length_ / 3;
+    if(MaxSize < length) {
         return false;
     }
-    chunk.length_ = reverse(chunk.length_);
-    if(!checkCRC32(chunk, stream)) {
+    for(u32 i = 0; i < length; ++i) {
+        if(stream.read(3, rgba) < 0) {
+            return false;
+        }
+        memcpy(&rgba_[i], rgba, sizeof(u32));
+    }
+    rgba[0] = rgba[1] = rgba[2] = 0;
+    for(u32 i = length; i < MaxSize; ++i) {
+        memcpy(&rgba_[i], rgba, sizeof(u32));
+    }
+    size_ = length;
+    u32 crc;
+    if(stream.read(sizeof(u32), &crc) < 0) {
         return false;
     }
     return true;
 }
 
-bool PNG::writeChunk(Stream& stream, u32 type, u32 size, const void* data)
+bool PNG::ChunkPLTE::readTransparency(u32 length, Stream& stream)
 {
-    u32 crc = 0xFFFFFFFFUL;
-    crc = updateCRC32(crc, sizeof(u32), reinterpret_cast<const u8*>(&type));
-    crc = updateCRC32(crc, size, reinterpret_cast<const u8*>(data));
-    crc ^= 0xFFFFFFFFUL;
-
-    u32 rcrc = reverse(crc);
-    u32 rsize = reverse(size);
-
-    if(stream.write(sizeof(u32), &rsize) <= 0) {
+    // Alphas for the first entries, the rest are opaque
+    u8 alphas[MaxSize];
+    if(size_ < length || stream.read(length, alphas) < 0) {
         return false;
     }
-    if(stream.write(sizeof(u32), &type) <= 0) {
-        return false;
-    }
-    if(0 < size) {
-        if(stream.write(size, data) <= 0) {
-            return false;
-        }
+    for(u32 i = 0; i < length; ++i) {
+        reinterpret_cast<u8*>(&rgba_[i])[3] = alphas[i];
     }
-    if(stream.write(sizeof(u32), &rcrc) <= 0) {
+    u32 crc;
+    if(stream.read(sizeof(u32), &crc) < 0) {
         return false;
     }
     return true;
 }
-#endif
 
+//--- ChunkIDAT
 //----------------------------------------------------
-//---
-//--- JPEG
-//---
-//----------------------------------------------------
-inline void JPEG::ByteStream::reset()
+PNG::ChunkIDAT::ChunkIDAT(const ChunkPLTE& palette)
+    : src_(CPPIMG_NULL)
+    , totalSrcSize_(0)
+    , srcSize_(0)
+    , totalSize_(0)
+    , totalCount_(0)
+    , width_(0)
+    , height_(0)
+    , row_(CPPIMG_NULL)
+    , scanlines_(CPPIMG_NULL)
+    , indices_(CPPIMG_NULL)
+    , palette_(palette)
 {
-    bits_ = 0;
-    byte_ = 0;
 }
 
-inline s32 JPEG::ByteStream::read(size_t size, void* bytes)
+PNG::ChunkIDAT::~ChunkIDAT()
 {
-    return stream_->read(size, bytes);
+    terminate();
 }
 
-inline s32 JPEG::ByteStream::write(size_t size, void* bytes)
+bool PNG::ChunkIDAT::initialize(u32 totalSrcSize, const ChunkIHDR& header, s32 options)
 {
-    return stream_->write(size, bytes);
+    totalSrcSize_ = totalSrcSize;
+    totalCount_ = 0;
+    width_ = header.width_;
+    height_ = header.height_;
+    colorType_ = header.colorType_;
+    bitDepth_ = header.bitDepth_;
+    keep16Bits_ = 16 == header.bitDepth_ && 0 != (options & Option_Keep16Bits);
+    interlace_ = header.interlace_;
+    samplesPerPixel_ = getSamplesPerPixel(header.colorType_);
+
+    bitsPerPixel_ = samplesPerPixel_ * bitDepth_;
+    bytesPerPixel_ = (bitsPerPixel_ < 8) ? 1 : (bitsPerPixel_ >> 3);
+    scanlineSize_ = (width_ * bitsPerPixel_ + 7) >> 3;
+    u32 dstSamples = (ColorType_Gray == colorType_) ? 1 : ((ColorType_True == colorType_ || (ColorType_Index == colorType_ && !palette_.hasAlpha_)) ? 3 : 4);
+    dstBytesPerPixel_ = dstSamples * (keep16Bits_ ? 2 : 1);
+    dstScanlineSize_ = width_ * dstBytesPerPixel_;
+
+    // Sum sizes of all passes
+    totalSize_ = 0;
+    u32 passWidth, passHeight;
+    for(u32 pass = getNextPass(0, passWidth, passHeight); pass < Adam7Passes; pass = getNextPass(pass + 1, passWidth, passHeight)) {
+        totalSize_ += ((passWidth * bitsPerPixel_ + 7) >> 3) * passHeight;
+    }
+
+    srcSize_ = 0;
+    CPPIMG_FREE(src_);
+    CPPIMG_FREE(row_);
+    src_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(totalSrcSize_));
+    if(CPPIMG_NULL == src_) {
+        return false;
+    }
+    // A converted row for interlaced scatter, current and previous scanlines, and unpacked palette indices
+    u32 rowSize = (Interlace_Adam7 == interlace_) ? dstScanlineSize_ : 0;
+    row_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(rowSize + scanlineSize_ * 2 + width_));
+    if(CPPIMG_NULL == row_) {
+        return false;
+    }
+    scanlines_ = row_ + rowSize;
+    indices_ = scanlines_ + scanlineSize_ * 2;
+    return true;
 }
 
-inline bool JPEG::ByteStream::skip(size_t size)
+bool PNG::ChunkIDAT::terminate()
 {
-    return stream_->seek(size, SEEK_CUR);
+    CPPIMG_FREE(src_);
+    CPPIMG_FREE(row_);
+    scanlines_ = CPPIMG_NULL;
+    indices_ = CPPIMG_NULL;
+    return true;
 }
 
-s32 JPEG::ByteStream::readByte()
+bool PNG::ChunkIDAT::read(Stream& stream)
 {
-    u8 b = 0;
-    if(stream_->read(1, &b) <= 0) {
-        return -1;
-    }
-    if(b != 0xFFU) {
-        return b;
+    u8* src = src_ + srcSize_;
+    if(stream.read(length_, src) < 0) {
+        return false;
     }
-    do {
-        if(stream_->read(1, &b) <= 0) {
-            return -1;
-        }
-    } while(b == 0xFFU);
-    if(0 == b) {
-        return 0xFFU;
+    u32 crc;
+    if(stream.read(sizeof(u32), &crc) < 0) {
+        return false;
     }
-    return b;
+
+    srcSize_ += length_;
+    return srcSize_ <= totalSrcSize_;
 }
 
-s32 JPEG::ByteStream::readBits(s32 bits)
+bool PNG::ChunkIDAT::decode(RowConverter& rows, PassCallback callback, void* userData)
 {
-    u16 result = 0;
-    while(0 < bits) {
-        if(bits_ <= 0) {
-            s32 b = readByte();
-            if(b < 0) {
-                return -1;
-            }
-            byte_ = static_cast<u8>(b);
-            bits_ = 8;
+    CPPIMG_ASSERT(Interlace_None == interlace_ || rows.isDirect());
+    if(!begin()) {
+        return false;
+    }
+    // Fail before the end of the last pass, if data are broken
+    while(nextScanline()) {
+        // Convert to the output format
+        const Pass& info = getPass(pass_);
+        s32 y = static_cast<s32>(info.y_ + y_ * info.stepY_);
+        u8* dstScanline = rows.begin(y);
+        if(1 == info.stepX_) {
+            store(passWidth_, dstScanline, scanline_);
+        } else {
+            store(passWidth_, row_, scanline_);
+            scatter(pass_, passWidth_, dstScanline + info.x_ * dstBytesPerPixel_, row_);
+        }
+        rows.end(y);
+        if(passHeight_ <= (y_ + 1) && CPPIMG_NULL != callback) {
+            callback(static_cast<s32>(pass_), rows.begin(0), userData);
         }
-        s32 n = minimum(bits_, bits);
-        bits -= n;
-        bits_ -= n;
-        result = (result << n) | (byte_ >> (8 - n));
-        byte_ <<= n;
     }
-    return result;
+    end();
+    return Adam7Passes <= pass_;
 }
 
-//----------------------------------------------------
-s32 JPEG::ByteStream::writeBits(s32 bits, s32 value)
+bool PNG::ChunkIDAT::begin()
 {
-    while(0 < bits) {
-        if(bits_ <= 0) {
-            if(stream_->write(1, &byte_) <= 0) {
-                return -1;
-            }
-            if(0xFFU == byte_) {
-                byte_ = 0;
-                if(stream_->write(1, &byte_) <= 0) {
-                    return -1;
-                }
-            } else {
-                byte_ = 0;
-            }
-            bits_ = 8;
-        }
-        s32 n = minimum(bits_, bits);
-        bits -= n;
-        bits_ -= n;
-        u8 mask = static_cast<u8>((1 << n) - 1);
-        byte_ = (byte_ << n) | (value & mask);
-        value >>= n;
+    if(szlib::SZ_OK != szlib::initInflate(&context_, totalSrcSize_, src_)) {
+        return false;
     }
-    return 1;
+    status_ = szlib::SZ_OK;
+    bufferOffset_ = bufferSize_ = 0;
+    totalCount_ = 0;
+    pass_ = getNextPass(0, passWidth_, passHeight_);
+    passScanlineSize_ = (passWidth_ * bitsPerPixel_ + 7) >> 3;
+    y_ = 0;
+    filterFlag_ = -1;
+    scanlineOffset_ = 0;
+    upper_ = CPPIMG_NULL;
+    scanline_ = scanlines_;
+    return true;
 }
 
-s32 JPEG::ByteStream::fillByte()
+void PNG::ChunkIDAT::end()
 {
-    if(bits_ <= 0) {
-        return 1;
-    }
-    s32 n = bits_;
-    s32 value = (1 << n) - 1;
-    return writeBits(n, value);
+    szlib::termInflate(&context_);
 }
 
-bool JPEG::ByteStream::readSegment(Segment& segment)
+bool PNG::ChunkIDAT::nextScanline()
 {
-    if(stream_->read(4, &segment) <= 0) {
-        return false;
+    // Step to the next scanline, if the previous one have been returned
+    if(passScanlineSize_ <= scanlineOffset_) {
+        filterFlag_ = -1;
+        scanlineOffset_ = 0;
+        if(++y_ < passHeight_) {
+            upper_ = scanline_;
+            scanline_ = (scanline_ == scanlines_) ? scanlines_ + scanlineSize_ : scanlines_;
+        } else {
+            pass_ = getNextPass(pass_ + 1, passWidth_, passHeight_);
+            passScanlineSize_ = (passWidth_ * bitsPerPixel_ + 7) >> 3;
+            y_ = 0;
+            upper_ = CPPIMG_NULL;
+        }
     }
-    if(0xFFU != segment.ff_) {
+    if(Adam7Passes <= pass_) {
         return false;
     }
-    segment.length_ = swapEndian(segment.length_);
-    return 2 <= segment.length_;
-}
 
-bool JPEG::ByteStream::readMarker(u8& marker)
-{
-    if(stream_->read(sizeof(u8), &marker) < 0) {
-        return false;
-    }
-    if(0xFFU != marker) {
-        return false;
+    for(;;) {
+        if(bufferSize_ <= bufferOffset_) {
+            if(szlib::SZ_END == status_) {
+                return false;
+            }
+            context_.availOut_ = BufferSize;
+            context_.nextOut_ = buffer_;
+            status_ = szlib::inflate(&context_);
+            if(status_ < 0) {
+                return false;
+            }
+            bufferOffset_ = 0;
+            bufferSize_ = static_cast<u32>(context_.thisTimeOut_);
+            continue;
+        }
+        if(filterFlag_ < 0) {
+            filterFlag_ = buffer_[bufferOffset_];
+            ++bufferOffset_;
+            if(FilterType_Paeth < filterFlag_) {
+                return false;
+            }
+            continue;
+        }
+
+        // Copy inflated data to scanline
+        u32 copySize = bufferSize_ - bufferOffset_;
+        if((passScanlineSize_ - scanlineOffset_) < copySize) {
+            copySize = passScanlineSize_ - scanlineOffset_;
+        }
+        memcpy(scanline_ + scanlineOffset_, buffer_ + bufferOffset_, copySize);
+        scanlineOffset_ += copySize;
+        bufferOffset_ += copySize;
+        totalCount_ += copySize;
+        if(passScanlineSize_ <= scanlineOffset_) {
+            unfilter(bytesPerPixel_, static_cast<u8>(filterFlag_), passScanlineSize_, scanline_, upper_);
+            return true;
+        }
     }
-    return 0 <= stream_->read(sizeof(u8), &marker);
 }
 
-bool JPEG::ByteStream::read16(u16& x)
+const PNG::Pass& PNG::ChunkIDAT::getPass(u32 pass) const
 {
-    if(0 <= stream_->read(sizeof(u16), &x)) {
-        x = swapEndian(x);
-        return true;
-    }
-    return false;
+    CPPIMG_ASSERT(pass < Adam7Passes);
+    return (Interlace_Adam7 == interlace_) ? Adam7[pass] : NoInterlace;
 }
 
-inline bool JPEG::ByteStream::skipSegment(const Segment& segment)
+u32 PNG::ChunkIDAT::getNextPass(u32 pass, u32& width, u32& height) const
 {
-    CPPIMG_ASSERT(2 <= segment.length_);
-    return stream_->seek(segment.length_ - 2, SEEK_CUR);
+    u32 passes = (Interlace_Adam7 == interlace_) ? Adam7Passes : 1;
+    // Skip empty passes, those have no scanlines in the stream
+    for(; pass < passes; ++pass) {
+        const Pass& info = getPass(pass);
+        width = (info.x_ < width_) ? (width_ - info.x_ + info.stepX_ - 1) / info.stepX_ : 0;
+        height = (info.y_ < height_) ? (height_ - info.y_ + info.stepY_ - 1) / info.stepY_ : 0;
+        if(0 < width && 0 < height) {
+            return pass;
+        }
+    }
+    width = height = 0;
+    return Adam7Passes;
 }
 
-//----------------------------------------------------
-bool JPEG::FrameHeader::getMaxSampling()
+void PNG::ChunkIDAT::scatter(u32 pass, u32 width, u8* dst, const u8* src)
 {
-    maxVerticalSampling_ = 0;
-    maxHorizontalSampling_ = 0;
-    for(s32 i = 0; i < numComponents_; ++i) {
-        maxVerticalSampling_ = maximum(maxVerticalSampling_, components_[i].getVertical());
-        maxHorizontalSampling_ = maximum(maxHorizontalSampling_, components_[i].getHorizontal());
+    u32 step = getPass(pass).stepX_;
+    switch(dstBytesPerPixel_) {
+    case 1:
+        scatterPixels<1>(step, width, dst, src);
+        break;
+    case 2:
+        scatterPixels<2>(step, width, dst, src);
+        break;
+    case 3:
+        scatterPixels<3>(step, width, dst, src);
+        break;
+    case 4:
+        scatterPixels<4>(step, width, dst, src);
+        break;
+    case 6:
+        scatterPixels<6>(step, width, dst, src);
+        break;
+    case 8:
+        scatterPixels<8>(step, width, dst, src);
+        break;
+    default:
+        CPPIMG_ASSERT(false);
+        break;
     }
-    return 0 < maxVerticalSampling_ && 0 < maxHorizontalSampling_;
 }
 
-//----------------------------------------------------
-const u8 JPEG::ZigZag[BLOCK_SIZE] =
+void PNG::ChunkIDAT::store(u32 width, u8* dst, const u8* scanline)
+{
+    u32 samples = width * samplesPerPixel_;
+    switch(colorType_) {
+    case ColorType_Gray:
+        if(bitDepth_ < 8) {
+            unpackBits(samples, bitDepth_, GrayScale[bitDepth_], dst, scanline);
+            break;
+        }
+    // fall through
+    case ColorType_True:
+    case ColorType_TrueAlpha:
+        if(8 == bitDepth_) {
+            memcpy(dst, scanline, samples);
+        } else if(keep16Bits_) {
+            swapBytes16(samples, reinterpret_cast<u16*>(dst), scanline);
+        } else {
+            pickHighBytes16(samples, dst, scanline);
+        }
+        break;
+    case ColorType_GrayAlpha:
+        if(8 == bitDepth_) {
+            expandGrayAlpha<Sample8>(width, dst, scanline);
+        } else if(keep16Bits_) {
+            expandGrayAlpha<Sample16>(width, reinterpret_cast<u16*>(dst), scanline);
+        } else {
+            expandGrayAlpha<Sample16To8>(width, dst, scanline);
+        }
+        break;
+    case ColorType_Index: {
+        const u8* indices = scanline;
+        if(bitDepth_ < 8) {
+            unpackBits(samples, bitDepth_, 1, indices_, scanline);
+            indices = indices_;
+        }
+        if(palette_.hasAlpha_) {
+            expandPaletteRGBA(width, dst, indices, palette_.rgba_);
+        } else {
+            expandPaletteRGB(width, dst, indices, palette_.rgba_);
+        }
+    } break;
+    default:
+        CPPIMG_ASSERT(false);
+        break;
+    }
+}
+
+#    if 0
+    bool PNG::ChunkIDAT::write(Stream& stream, s32 height, const u8* image)
     {
-        0,
-        1,
-        8,
-        16,
-        9,
-        2,
-        3,
-        10,
-        17,
-        24,
-        32,
-        25,
-        18,
-        11,
-        4,
-        5,
-        12,
-        19,
-        26,
-        33,
-        40,
-        48,
-        41,
-        34,
-        27,
-        20,
-        13,
-        6,
-        7,
-        14,
-        21,
-        28,
-        35,
-        42,
-        49,
-        56,
-        57,
-        50,
-        43,
-        36,
-        29,
-        22,
-        15,
-        23,
-        30,
-        37,
-        44,
-        51,
-        58,
-        59,
-        52,
-        45,
-        38,
-        31,
-        39,
-        46,
-        53,
-        60,
-        61,
-        54,
-        47,
-        55,
-        62,
-        63,
+        struct ReleaseMemory
+        {
+            ReleaseMemory(u8* ptr)
+                :ptr_(ptr)
+            {}
+            ~ReleaseMemory()
+            {
+                CPPIMG_FREE(ptr_);
+            }
+            u8* ptr_;
+        };
+
+        s32 lenPos = stream.tell();
+        u32 outCount = 0;
+        if(stream.write(sizeof(u32), &outCount)<=0){
+            return false;
+        }
+        u32 type = Type;
+        if(stream.write(sizeof(u32), &type)<=0){
+            return false;
+        }
+        u32 crc = 0xFFFFFFFFUL;
+        crc = updateCRC32(crc, sizeof(u32), reinterpret_cast<const u8*>(&type));
+
+        //Add 1 byte of filter type for each scanlines
+        //---------------------------------
+        u32 totalSize = totalSize_ + height;
+
+        u8* in = reinterpret_cast<u8*>(CPPIMG_MALLOC(totalSize));
+        ReleaseMemory releaseInMemory(in);
+
+        {
+            u8 filter = 0;
+            const u8* src = image;
+            u8* dst = in;
+            for(s32 i=0; i<height; ++i){
+                dst[0] = filter;
+                ++dst;
+                memcpy(dst, src, scanlineSize_);
+                src += scanlineSize_;
+                dst += scanlineSize_;
+            }
+        }
+
+        //---------------------------------
+        u32 inCount = 0;
+        s32 result;
+        s32 flush;
+        do{
+            if(totalSize<=inCount){
+                break;
+            }
+            u32 size = totalSize;
+            if(totalSize<(inCount+size)){
+                size = totalSize-inCount;
+            }
+            stream_.avail_in = size;
+            stream_.next_in = in+inCount;
+            inCount += size;
+            flush = (totalSize<=inCount)? MZ_FINISH : MZ_NO_FLUSH;
+            do{
+                stream_.avail_out = BufferSize;
+                stream_.next_out = dst_;
+                u64 totalOut = stream_.total_out;
+                result = mz_deflate(&stream_, flush);
+                if(MZ_OK != result && MZ_STREAM_END != result){
+                    return false;
+                }
+                u32 outSize = static_cast<u32>(stream_.total_out - totalOut);
+                if(0<outSize){
+                    crc = updateCRC32(crc, outSize, dst_);
+                    if(stream.write(outSize, dst_)<=0){
+                        return false;
+                    }
+                }
+                outCount += outSize;
+            }while(MZ_STREAM_END != result);
+        }while(flush != MZ_FINISH);
+
+        s32 crcPos = stream.tell();
+        stream.seek(lenPos, SEEK_SET);
+        outCount = reverse(outCount);
+        if(stream.write(sizeof(u32), &outCount)<=0){
+            return false;
+        }
+        stream.seek(crcPos, SEEK_SET);
+        crc ^= 0xFFFFFFFFUL;
+        crc = reverse(crc);
+        return stream.write(sizeof(u32), &crc)<=0;
+    }
+#    endif
+
+//--- PNG
+//----------------------------------------------------
+const PNG::Pass PNG::Adam7[Adam7Passes] =
+{
+    {0, 0, 8, 8},
+    {4, 0, 8, 8},
+    {0, 4, 4, 8},
+    {2, 0, 4, 4},
+    {0, 2, 2, 4},
+    {1, 0, 2, 2},
+    {0, 1, 1, 2},
 };
 
-bool JPEG::read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream)
+const PNG::Pass PNG::NoInterlace = {0, 0, 1, 1};
+
+inline u16 PNG::reverse(u16 x)
 {
-    if(!stream.valid()) {
+    return ((x >> 8) & 0xFFU) | ((x << 8) & 0xFF00U);
+}
+
+inline u32 PNG::reverse(u32 x)
+{
+    return ((x >> 24)) | ((x >> 8) & 0xFF00U) | ((x & 0xFF00U) << 8) | ((x & 0xFFU) << 24);
+}
+
+void PNG::unfilter(u32 bytesPerPixel, u8 filterType, u32 size, u8* scanline, const u8* upper)
+{
+    switch(bytesPerPixel) {
+    case 1:
+        unfilter<1>(filterType, size, scanline, upper);
+        break;
+    case 2:
+        unfilter<2>(filterType, size, scanline, upper);
+        break;
+    case 3:
+        unfilter<3>(filterType, size, scanline, upper);
+        break;
+    case 4:
+        unfilter<4>(filterType, size, scanline, upper);
+        break;
+    case 6:
+        unfilter<6>(filterType, size, scanline, upper);
+        break;
+    case 8:
+        unfilter<8>(filterType, size, scanline, upper);
+        break;
+    default:
+        CPPIMG_ASSERT(false);
+        break;
+    }
+}
+
+template<u32 BPP>
+void PNG::unfilter(u8 filterType, u32 size, u8* scanline, const u8* upper)
+{
+    CPPIMG_ASSERT(0 == (size % BPP));
+    if(size <= 0) {
+        return;
+    }
+    switch(filterType) {
+    case FilterType_Sub:
+        Unfilter<BPP>::sub(size, scanline);
+        break;
+    case FilterType_Up:
+        // The upper scanline of the first one is zero
+        if(CPPIMG_NULL != upper) {
+            unfilterUp(size, scanline, upper);
+        }
+        break;
+    case FilterType_Avg:
+        if(CPPIMG_NULL != upper) {
+            Unfilter<BPP>::avg(size, scanline, upper);
+        } else {
+            Unfilter<BPP>::avgFirst(size, scanline);
+        }
+        break;
+    case FilterType_Paeth:
+        // Paeth predictor equals the left pixel without the upper scanline
+        if(CPPIMG_NULL != upper) {
+            Unfilter<BPP>::paeth(size, scanline, upper);
+        } else {
+            Unfilter<BPP>::sub(size, scanline);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+bool PNG::readHeader(Stream& stream)
+{
+    u64 signature;
+    if(stream.read(sizeof(u64), &signature) < 0) {
+        return false;
+    }
+    if(Signature != signature) {
         return false;
     }
+    return true;
+}
+
+bool PNG::checkCRC32(const Chunk& chunk, Stream& stream)
+{
+    static const u32 BufferSize = 1024;
+    u8 buffer[BufferSize];
+
+    u32 crc = 0xFFFFFFFFUL;
+    crc = updateCRC32(crc, sizeof(u32), reinterpret_cast<const u8*>(&chunk.type_));
+    off_t pos = stream.tell();
+    u32 remain = chunk.length_;
+    while(0 < remain) {
+        u32 size = (remain < BufferSize) ? remain : BufferSize;
+        if(stream.read(size, buffer) < 0) {
+            break;
+        }
+        crc = updateCRC32(crc, size, buffer);
+        remain -= size;
+    }
+
+    // Check whether calculated crc equals loaded crc
+    u32 readCrc = 0;
+    s32 ret = (remain <= 0) ? stream.read(sizeof(u32), &readCrc) : 0;
+    stream.seek(pos, SEEK_SET);
+    if(ret < 0) {
+        return false;
+    }
+    crc ^= 0xFFFFFFFFUL;
+    readCrc = reverse(readCrc);
+    return readCrc == crc;
+}
+
+bool PNG::skipChunk(const Chunk& chunk, Stream& stream)
+{
+    u32 size = chunk.length_ + 4; // chunk data size + crc size
+    return stream.seek(size, SEEK_CUR);
+}
+
+template<class T>
+void PNG::setChunkHeader(T& dst, const Chunk& src)
+{
+    dst.type_ = src.type_;
+    dst.length_ = src.length_;
+}
+
+template<class T>
+bool PNG::readHeader(T& chunk, Stream& stream)
+{
+    if(stream.read(sizeof(u32) * 2, &chunk) < 0) {
+        return false;
+    }
+    chunk.length_ = reverse(chunk.length_);
+    if(!checkCRC32(chunk, stream)) {
+        return false;
+    }
+    return true;
+}
+
+bool PNG::writeChunk(Stream& stream, u32 type, u32 size, const void* data)
+{
+    u32 crc = 0xFFFFFFFFUL;
+    crc = updateCRC32(crc, sizeof(u32), reinterpret_cast<const u8*>(&type));
+    crc = updateCRC32(crc, size, reinterpret_cast<const u8*>(data));
+    crc ^= 0xFFFFFFFFUL;
+
+    u32 rcrc = reverse(crc);
+    u32 rsize = reverse(size);
+
+    if(stream.write(sizeof(u32), &rsize) <= 0) {
+        return false;
+    }
+    if(stream.write(sizeof(u32), &type) <= 0) {
+        return false;
+    }
+    if(0 < size) {
+        if(stream.write(size, data) <= 0) {
+            return false;
+        }
+    }
+    if(stream.write(sizeof(u32), &rcrc) <= 0) {
+        return false;
+    }
+    return true;
+}
+#endif
+
+//----------------------------------------------------
+//---
+//--- JPEG
+//---
+//----------------------------------------------------
+inline void JPEG::ByteStream::reset()
+{
+    bits_ = 0;
+    byte_ = 0;
+}
+
+inline s32 JPEG::ByteStream::read(size_t size, void* bytes)
+{
+    return stream_->read(size, bytes);
+}
+
+inline s32 JPEG::ByteStream::write(size_t size, void* bytes)
+{
+    return stream_->write(size, bytes);
+}
+
+inline bool JPEG::ByteStream::skip(size_t size)
+{
+    return stream_->seek(size, SEEK_CUR);
+}
+
+s32 JPEG::ByteStream::readByte()
+{
+    u8 b = 0;
+    if(stream_->read(1, &b) <= 0) {
+        return -1;
+    }
+    if(b != 0xFFU) {
+        return b;
+    }
+    do {
+        if(stream_->read(1, &b) <= 0) {
+            return -1;
+        }
+    } while(b == 0xFFU);
+    if(0 == b) {
+        return 0xFFU;
+    }
+    return b;
+}
+
+s32 JPEG::ByteStream::readBits(s32 bits)
+{
+    u16 result = 0;
+    while(0 < bits) {
+        if(bits_ <= 0) {
+            s32 b = readByte();
+            if(b < 0) {
+                return -1;
+            }
+            byte_ = static_cast<u8>(b);
+            bits_ = 8;
+        }
+        s32 n = minimum(bits_, bits);
+        bits -= n;
+        bits_ -= n;
+        result = (result << n) | (byte_ >> (8 - n));
+        byte_ <<= n;
+    }
+    return result;
+}
+
+//----------------------------------------------------
+s32 JPEG::ByteStream::writeBits(s32 bits, s32 value)
+{
+    while(0 < bits) {
+        if(bits_ <= 0) {
+            if(stream_->write(1, &byte_) <= 0) {
+                return -1;
+            }
+            if(0xFFU == byte_) {
+                byte_ = 0;
+                if(stream_->write(1, &byte_) <= 0) {
+                    return -1;
+                }
+            } else {
+                byte_ = 0;
+            }
+            bits_ = 8;
+        }
+        s32 n = minimum(bits_, bits);
+        bits -= n;
+        bits_ -= n;
+        u8 mask = static_cast<u8>((1 << n) - 1);
+        byte_ = (byte_ << n) | (value & mask);
+        value >>= n;
+    }
+    return 1;
+}
+
+s32 JPEG::ByteStream::fillByte()
+{
+    if(bits_ <= 0) {
+        return 1;
+    }
+    s32 n = bits_;
+    s32 value = (1 << n) - 1;
+    return writeBits(n, value);
+}
+
+bool JPEG::ByteStream::readSegment(Segment& segment)
+{
+    if(stream_->read(4, &segment) <= 0) {
+        return false;
+    }
+    if(0xFFU != segment.ff_) {
+        return false;
+    }
+    segment.length_ = swapEndian(segment.length_);
+    return 2 <= segment.length_;
+}
+
+bool JPEG::ByteStream::readMarker(u8& marker)
+{
+    if(stream_->read(sizeof(u8), &marker) < 0) {
+        return false;
+    }
+    if(0xFFU != marker) {
+        return false;
+    }
+    return 0 <= stream_->read(sizeof(u8), &marker);
+}
+
+bool JPEG::ByteStream::read16(u16& x)
+{
+    if(0 <= stream_->read(sizeof(u16), &x)) {
+        x = swapEndian(x);
+        return true;
+    }
+    return false;
+}
+
+inline bool JPEG::ByteStream::skipSegment(const Segment& segment)
+{
+    CPPIMG_ASSERT(2 <= segment.length_);
+    return stream_->seek(segment.length_ - 2, SEEK_CUR);
+}
+
+//----------------------------------------------------
+bool JPEG::FrameHeader::getMaxSampling()
+{
+    maxVerticalSampling_ = 0;
+    maxHorizontalSampling_ = 0;
+    for(s32 i = 0; i < numComponents_; ++i) {
+        maxVerticalSampling_ = maximum(maxVerticalSampling_, components_[i].getVertical());
+        maxHorizontalSampling_ = maximum(maxHorizontalSampling_, components_[i].getHorizontal());
+    }
+    return 0 < maxVerticalSampling_ && 0 < maxHorizontalSampling_;
+}
+
+//----------------------------------------------------
+const u8 JPEG::ZigZag[BLOCK_SIZE] =
+    {
+        0,
+        1,
+        8,
+        16,
+        9,
+        2,
+        3,
+        10,
+        17,
+        24,
+        32,
+        25,
+        18,
+        11,
+        4,
+        5,
+        12,
+        19,
+        26,
+        33,
+        40,
+        48,
+        41,
+        34,
+        27,
+        20,
+        13,
+        6,
+        7,
+        14,
+        21,
+        28,
+        35,
+        42,
+        49,
+        56,
+        57,
+        50,
+        43,
+        36,
+        29,
+        22,
+        15,
+        23,
+        30,
+        37,
+        44,
+        51,
+        58,
+        59,
+        52,
+        45,
+        38,
+        31,
+        39,
+        46,
+        53,
+        60,
+        61,
+        54,
+        47,
+        55,
+        62,
+        63,
+};
+
+bool JPEG::read(s32& width, s32& height, ColorType& colorType, void* image, Stream& stream)
+{
+    return readImage(width, height, colorType, image, CPPIMG_NULL, stream);
+}
+
+bool JPEG::read(const ImageView& image, Stream& stream)
+{
+    s32 width, height;
+    ColorType colorType;
+    return readImage(width, height, colorType, CPPIMG_NULL, &image, stream);
+}
+
+bool JPEG::readImage(s32& width, s32& height, ColorType& colorType, void* image, const ImageView* view, Stream& stream)
+{
+    if(!stream.valid()) {
+        return false;
+    }
+
+    SeekSet seekSet(stream.tell(), &stream);
+    {
+        Segment soi;
+        if(stream.read(sizeof(u16), &soi.ff_) <= 0) {
+            return false;
+        }
+        if(MARKER_SOI != soi.marker_) {
+            return false;
+        }
+    }
+
+    colorType = ColorType::RGB;
+    Context* context = reinterpret_cast<Context*>(CPPIMG_MALLOC(sizeof(Context)));
+    AutoFree autoFree(context);
+    CPPIMG_MEMSET(context, 0, sizeof(Context));
+    context->flags_ |= Flag_SOI;
+    context->byteStream_ = ByteStream(&stream);
+    bool loop = true;
+    Segment segment;
+    while(loop) {
+        if(!context->byteStream_.readSegment(segment)) {
+            return false;
+        }
+        if(MARKER_EOI == segment.marker_) {
+            loop = false;
+            break;
+        }
+
+        switch(segment.marker_) {
+        case MARKER_SOI:
+            return false;
+
+        case MARKER_DQT:
+            if(!readDQT(*context, segment)) {
+                return false;
+            }
+            context->flags_ |= Flag_DQT;
+            break;
+        case MARKER_DHT:
+            if(!readDHT(*context, segment)) {
+                return false;
+            }
+            context->flags_ |= Flag_DHT;
+            break;
+        case MARKER_DRI:
+            if(!readDRI(*context, segment)) {
+                return false;
+            }
+            break;
+        case MARKER_DNL:
+            if(!readDNL(*context, segment)) {
+                return false;
+            }
+            break;
+        case MARKER_SOF0:
+        case MARKER_SOF1:
+        case MARKER_SOF2:
+        case MARKER_SOF3:
+        case MARKER_SOF5:
+        case MARKER_SOF6:
+        case MARKER_SOF7:
+        case MARKER_SOF9:
+        case MARKER_SOFA:
+        case MARKER_SOFB:
+        case MARKER_SOFD:
+        case MARKER_SOFE:
+        case MARKER_SOFF:
+            if(!readSOF(*context, segment)) {
+                return false;
+            }
+            break;
+        case MARKER_APP0:
+            if(!readJFXX(*context, segment)) {
+                return false;
+            }
+            break;
+        case MARKER_SOS:
+            if(!readSOS(*context, segment)) {
+                return false;
+            }
+            loop = false;
+            context->flags_ |= Flag_SOS;
+            break;
+        default:
+            if(!context->byteStream_.skipSegment(segment)) {
+                return false;
+            }
+            break;
+        }
+    };
+    if(Flag_NEEDS != (context->flags_ & Flag_NEEDS)) {
+        return false;
+    }
+
+    width = context->frame_.width_;
+    height = context->frame_.height_;
+    // Support only gray and YCrCb formats
+    switch(context->frame_.numComponents_) {
+    case 1:
+        colorType = ColorType::GRAY;
+        break;
+    case 3:
+        colorType = ColorType::RGB;
+        break;
+    default:
+        return false;
+    }
+    if(CPPIMG_NULL == image && CPPIMG_NULL == view) {
+        return true;
+    }
+
+    RowConverter rows;
+    if(!initializeRows(rows, width, height, getPixelFormat(colorType), image, view)) {
+        return false;
+    }
+    context->rows_ = &rows;
+    context->createCosTable();
+    context->work_ = reinterpret_cast<s16*>(CPPIMG_MALLOC(sizeof(s16) * width * height * context->frame_.numComponents_));
+    if(!decode(*context)) {
+        return false;
+    }
+    switch(context->frame_.numComponents_) {
+    case 1:
+        toGray(*context);
+        break;
+    case 3:
+        toRGB(*context);
+        break;
+    default:
+        return false;
+    }
+    seekSet.clear();
+    return true;
+}
+
+bool JPEG::readDQT(Context& context, const Segment& segment)
+{
+    ByteStream& stream = context.byteStream_;
+
+    s32 size = 2;
+    while(size < segment.length_) {
+        u8 precisionAndNumber;
+        if(stream.read(1, &precisionAndNumber) <= 0) {
+            return false;
+        }
+        ++size;
+        s32 precision = (precisionAndNumber >> 4) & 0xFU;
+        if(1 < precision) {
+            return false;
+        }
+        s32 id = precisionAndNumber & 0xFU;
+        if(4 <= id) {
+            return false;
+        }
+
+        QuantizationTable& quantization = context.quantization_[id];
+        quantization.precisionAndNumber_ = precisionAndNumber;
+
+        if(precision < 1) {
+            u8 factors8[QT_SIZE];
+            if(stream.read(QT_SIZE, factors8) <= 0) {
+                return false;
+            }
+            for(s32 i = 0; i < QT_SIZE; ++i) {
+                quantization.factors_[ZigZag[i]] = factors8[i];
+            }
+            size += QT_SIZE;
+        } else {
+            u16 factors16[QT_SIZE];
+            if(stream.read(QT_SIZE * 2, factors16) <= 0) {
+                return false;
+            }
+            for(s32 i = 0; i < QT_SIZE; ++i) {
+                quantization.factors_[ZigZag[i]] = swapEndian(factors16[i]);
+            }
+            size += QT_SIZE * 2;
+        }
+    }
+    return size == segment.length_;
+}
+
+bool JPEG::readDHT(Context& context, const Segment& segment)
+{
+    ByteStream& stream = context.byteStream_;
+
+    u8 bits[HT_BITS_TABLE];
+    s32 size = 2;
+    while(size < segment.length_) {
+        u8 classAndId; // upper:precision, lower:id of huffman table
+        if(stream.read(1, &classAndId) <= 0) {
+            return false;
+        }
+        ++size;
+        s32 huffmanClass = (classAndId >> 4) & 0xFU;
+        if(2 <= huffmanClass) {
+            return false;
+        }
+        s32 id = classAndId & 0xFU;
+        if(4 <= id) {
+            return false;
+        }
+
+        if(stream.read(HT_BITS_TABLE, bits) <= 0) {
+            return false;
+        }
+        size += HT_BITS_TABLE;
+
+        HuffmanTable& table = context.huffman_[huffmanClass][id];
+        // Count number of elements
+        table.number_ = 0;
+        for(s32 i = 0; i < HT_BITS_TABLE; ++i) {
+            table.number_ += bits[i];
+        }
+        if(HT_MAX_SIZE < table.number_) {
+            return false;
+        }
+
+        // Generate size table
+        s32 k = 0;
+        for(u8 i = 1; i <= HT_BITS_TABLE; ++i) {
+            for(u8 j = 1; j <= bits[i - 1]; ++j, ++k) {
+                table.size_[k] = i;
+            }
+        }
+
+        // Generate code table
+        k = 0;
+        u16 code = 0;
+        u8 si = table.size_[0];
+        for(;;) {
+            for(; table.size_[k] == si; ++k, ++code) {
+                table.code_[k] = code;
+            }
+            if(table.number_ <= k) {
+                break;
+            }
+            do {
+                code <<= 1;
+                ++si;
+            } while(table.size_[k] != si);
+        }
+        if(stream.read(table.number_, table.value_) <= 0) {
+            return false;
+        }
+        size += table.number_;
+
+    } // while(size<segment.length_)
+    return size == segment.length_;
+}
+
+bool JPEG::readDRI(Context& context, const Segment& segment)
+{
+    ByteStream& stream = context.byteStream_;
+
+    s32 size = 2;
+    while(size < segment.length_) {
+        if(!stream.read16(context.restartInterval_)) {
+            return false;
+        }
+        size += 2;
+    }
+    return size == segment.length_;
+}
+
+bool JPEG::readDNL(Context& context, const Segment& segment)
+{
+    ByteStream& stream = context.byteStream_;
+    s32 size = 2;
+    while(size < segment.length_) {
+        if(!stream.read16(context.numberOfLines_)) {
+            return false;
+        }
+        size += 2;
+    }
+    return size == segment.length_;
+}
+
+bool JPEG::readSOF(Context& context, const Segment& segment)
+{
+    ByteStream& stream = context.byteStream_;
+    if(stream.read(1, &context.frame_.precision_) <= 0) {
+        return false;
+    }
+    if(!stream.read16(context.frame_.height_)) {
+        return false;
+    }
+    if(!stream.read16(context.frame_.width_)) {
+        return false;
+    }
+    if(stream.read(1, &context.frame_.numComponents_) <= 0) {
+        return false;
+    }
+
+    if(context.frame_.numComponents_ <= 0 || MAX_COMPONENTS < context.frame_.numComponents_) {
+        return false;
+    }
+    s32 count = 0;
+    s32 size = 8;
+    while(size < segment.length_ && count < context.frame_.numComponents_) {
+        if(stream.read(3, &context.frame_.components_[count]) <= 0) {
+            return false;
+        }
+        if(context.frame_.components_[count].getVertical() <= 0 || context.frame_.components_[count].getHorizontal() <= 0) {
+            return false;
+        }
+        ++count;
+        size += 3;
+    }
+    return size == segment.length_;
+}
+
+bool JPEG::readSOS(Context& context, const Segment& segment)
+{
+    ByteStream& stream = context.byteStream_;
+    if(stream.read(1, &context.scan_.numComponents_) <= 0) {
+        return false;
+    }
+    s32 size = 3;
+    s32 segmentSize = segment.length_ - 3;
+    s32 count = 0;
+    while(size < segmentSize && count < context.scan_.numComponents_) {
+        if(stream.read(sizeof(Scan::Component), &context.scan_.components_[count]) <= 0) {
+            return false;
+        }
+        ++count;
+        size += sizeof(Scan::Component);
+    }
+    if(stream.read(1, &context.scan_.startSpectra_) <= 0) {
+        return false;
+    }
+    if(stream.read(1, &context.scan_.endSpectra_) <= 0) {
+        return false;
+    }
+    if(stream.read(1, &context.scan_.pointTransform_) <= 0) {
+        return false;
+    }
+    size += 3;
+    return size == segment.length_;
+}
+
+bool JPEG::readJFXX(Context& context, const Segment& segment)
+{
+    ByteStream& stream = context.byteStream_;
+    s32 size = 2;
+    if(stream.read(5, context.jfxx_.id_) <= 0) {
+        return false;
+    }
+    context.jfxx_.id_[4] = CPPIMG_NULLCHAR;
+    size += 5;
+
+    if(0 == strcmp(reinterpret_cast<const char*>(context.jfxx_.id_), "JFIF")) {
+        JFXX::IF& jfif = context.jfxx_.format_.jfif_;
+        if(stream.read(2, &jfif.version_) <= 0) {
+            return false;
+        }
+        if(stream.read(1, &jfif.unit_) <= 0) {
+            return false;
+        }
+        if(stream.read(2, &jfif.xdensity_) <= 0) {
+            return false;
+        }
+        if(stream.read(2, &jfif.ydensity_) <= 0) {
+            return false;
+        }
+        if(stream.read(1, &jfif.xthumb_) <= 0) {
+            return false;
+        }
+        if(stream.read(1, &jfif.ythumb_) <= 0) {
+            return false;
+        }
+        size += 9;
+        s32 thumbSize = 3 * jfif.xthumb_ * jfif.ythumb_;
+        if(!stream.skip(thumbSize)) {
+            return false;
+        }
+        size += thumbSize;
+
+    } else if(0 == strcmp(reinterpret_cast<const char*>(context.jfxx_.id_), "JFXX")) {
+        JFXX::XX& jfxx = context.jfxx_.format_.jfxx_;
+        if(stream.read(1, &jfxx.type_) <= 0) {
+            return false;
+        }
+        size += (segment.length_ - (2 + 5 + 1));
+    }
+    return size == segment.length_;
+}
+
+bool JPEG::decode(Context& context)
+{
+    START_TIMER;
+
+    s32 vblocks = blocks(context.frame_.height_);
+    s32 hblocks = blocks(context.frame_.width_);
+    if(!context.frame_.getMaxSampling()) {
+        return false;
+    }
+
+    s32 maxVSampling = context.frame_.maxVerticalSampling_;
+    s32 maxHSampling = context.frame_.maxHorizontalSampling_;
+    s32 vUnits = vblocks / maxVSampling;
+    s32 hUnits = hblocks / maxHSampling;
+    if(0 < (vblocks - (maxVSampling * vUnits))) {
+        ++vUnits;
+    }
+    if(0 < (hblocks - (maxHSampling * hUnits))) {
+        ++hUnits;
+    }
+
+    s32 unitSize = maxVSampling * maxHSampling * BLOCK_SIZE;
+    CPPIMG_MEMSET(&context.components_[0], 0x00U, sizeof(u8) * unitSize);
+    CPPIMG_MEMSET(&context.components_[1], 0x00U, sizeof(s16) * unitSize);
+    CPPIMG_MEMSET(&context.components_[2], 0x00U, sizeof(s16) * unitSize);
+    CPPIMG_MEMSET(&context.components_[3], 0x00U, sizeof(s16) * unitSize);
+
+    context.directCurrents_[0] = 0;
+    context.directCurrents_[1] = 0;
+    context.directCurrents_[2] = 0;
+    context.directCurrents_[3] = 0;
+
+    ByteStream& stream = context.byteStream_;
+
+    s32 restartCount = 0;
+    for(s32 uy = 0; uy < vUnits; ++uy) {
+        for(s32 ux = 0; ux < hUnits; ++ux) {
+            if(!decodeMCU(context)) {
+                return false;
+            }
+            copyComponents(context, ux, uy);
+            if(0 < context.restartInterval_) {
+                if(context.restartInterval_ <= ++restartCount) {
+                    restartCount = 0;
+                    stream.reset();
+                    u8 marker;
+                    if(!stream.readMarker(marker)) {
+                        return false;
+                    }
+                    if(MARKER_RST0 <= marker && marker <= MARKER_RST7) {
+                        // Reset DC
+                        context.directCurrents_[0] = 0;
+                        context.directCurrents_[1] = 0;
+                        context.directCurrents_[2] = 0;
+                        context.directCurrents_[3] = 0;
+                    }
+                }
+            }
+        }
+    }
+    STOP_TIMER("JPEG::decode");
+    return true;
+}
+
+bool JPEG::decodeMCU(Context& context)
+{
+    s32 unitWidth = context.frame_.maxHorizontalSampling_ << BLOCK_SHIFT;
+
+    for(s32 i = 0; i < context.frame_.numComponents_; ++i) {
+        s32 vSampling = context.frame_.components_[i].getVertical();
+        s32 hSampling = context.frame_.components_[i].getHorizontal();
+        s32 vDuplicate = context.frame_.maxVerticalSampling_ / vSampling;
+        s32 hDuplicate = context.frame_.maxHorizontalSampling_ / hSampling;
+        s32 vCopy = vDuplicate << BLOCK_SHIFT;
+        s32 hCopy = hDuplicate << BLOCK_SHIFT;
+        for(s32 v = 0; v < vSampling; ++v) {
+            for(s32 h = 0; h < hSampling; ++h) {
+                if(!decodeHuffmanBlock(context, i)) {
+                    return false;
+                }
+                inverseQuantization(context, i);
+                inverseDCT(context);
+                s16* component = context.components_[i] + unitWidth * (v << BLOCK_SHIFT) + (h << BLOCK_SHIFT);
+                for(s32 j = 0; j < vCopy; ++j) {
+                    for(s32 k = 0; k < hCopy; ++k) {
+                        component[j * unitWidth + k] = context.block_[((j / vDuplicate) << BLOCK_SHIFT) + (k / hDuplicate)];
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+s32 JPEG::decodeHuffmanCode(Context& context, s32 type, s32 table)
+{
+    ByteStream& stream = context.byteStream_;
+
+    const HuffmanTable& huffmanTable = context.huffman_[type][table];
+    u16 code = 0;
+    u16 length = 0;
+    s32 next = 0;
+    s32 k = 0;
+    while(k < huffmanTable.number_ && length < HT_BITS_TABLE) {
+        ++length;
+        code <<= 1;
+        next = stream.readBits(1);
+        if(next < 0) {
+            return -1;
+        }
+        code |= next;
+        for(; huffmanTable.size_[k] == length; ++k) {
+            if(huffmanTable.code_[k] == code) {
+                return huffmanTable.value_[k];
+            }
+        }
+    }
+    return -1;
+}
+
+bool JPEG::decodeHuffmanBlock(Context& context, s32 component)
+{
+    ByteStream& stream = context.byteStream_;
+
+    // DC
+    s32 category = decodeHuffmanCode(context, 0, context.scan_.components_[component].getDCHuffman());
+    if(category < 0) {
+        return false;
+    } else if(0 < category) {
+        s16 difference = static_cast<s16>(stream.readBits(category));
+        if(0 == (difference & (1 << (category - 1)))) {
+            difference -= (1 << category) - 1;
+        }
+        context.directCurrents_[component] += difference;
+    }
+    context.dct_[0] = context.directCurrents_[component];
+
+    // AC
+    for(s32 k = 1; k < BLOCK_SIZE;) {
+        s32 runCategory = decodeHuffmanCode(context, 1, context.scan_.components_[component].getACHuffman());
+        if(runCategory < 0) {
+            return false;
+        } else if(0 == runCategory) {
+            while(k < BLOCK_SIZE) {
+                context.dct_[ZigZag[k++]] = 0;
+            }
+            break;
+        }
+        s32 runLength = runCategory >> 4;
+        category = runCategory & 0x0FU;
+        s16 ac = 0;
+        if(0 != category) {
+            ac = static_cast<s16>(stream.readBits(category));
+            if(0 == (ac & (1 << (category - 1)))) {
+                ac -= (1 << category) - 1;
+            }
+        } else if(15 != runLength) {
+            return false;
+        }
+        if(BLOCK_SIZE <= (runLength + k)) {
+            // runLength = (BLOCK_SIZE - k - 1);
+            return false;
+        }
+        while(0 < runLength) {
+            context.dct_[ZigZag[k++]] = 0;
+            --runLength;
+        }
+        context.dct_[ZigZag[k++]] = ac;
+    }
+    return true;
+}
+
+void JPEG::inverseQuantization(Context& context, s32 component)
+{
+    s32 qt = context.frame_.components_[component].quantizationTable_;
+    const QuantizationTable& table = context.quantization_[qt];
+
+#if defined(CPPIMG_DISABLE_AVX)
+    for(s32 i = 0; i < BLOCK_SIZE; ++i) {
+        context.dct_[i] *= table.factors_[i];
+    }
+#else
+    __m128i dct = _mm_loadu_si128(reinterpret_cast<const __m128i*>(context.dct_));
+    __m128i factors = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table.factors_));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(context.dct_), _mm_mullo_epi16(dct, factors));
+#endif
+}
+
+void JPEG::inverseDCT(Context& context)
+{
+#if defined(CPPIMG_DISABLE_AVX)
+    s32 levelShift = context.frame_.precision_ <= 8 ? 128 : 2048;
+    levelShift <<= FIXED_POINT_SHIFT2;
+    for(s32 y = 0; y < BLOCK_WIDTH; ++y) {
+        s16* block = context.block_ + y * BLOCK_WIDTH;
+        for(s32 x = 0; x < BLOCK_WIDTH; ++x) {
+            const s16* csy = &context.cosine_[y][0];
+            const s16* csx = &context.cosine_[x][0];
+            s32 sum = 0;
+            for(s32 v = 0; v < BLOCK_WIDTH; ++v) {
+                s32 tcsy = csy[v];
+                const s16* dct = context.dct_ + v * BLOCK_WIDTH;
+                for(s32 u = 0; u < BLOCK_WIDTH; ++u) {
+                    s32 c = fixedPointRound(tcsy * csx[u], FIXED_POINT_SHIFT);
+                    sum += dct[u] * c;
+                }
+            }
+            block[x] = static_cast<s16>(fixedPointRound(sum, FIXED_POINT_SHIFT2 + 2) + levelShift);
+        }
+    }
+#else
+    s32 levelShift = context.frame_.precision_ <= 8 ? 128 : 2048;
+    levelShift <<= FIXED_POINT_SHIFT2;
+
+    __m128i RoundOffset0 = _mm_set1_epi32((1 << FIXED_POINT_SHIFT) - 1);
+    __m128i RoundOffset1 = _mm_set1_epi32((1 << (FIXED_POINT_SHIFT2 + 2)) - 1);
+    __m128i Zero = _mm_setzero_si128();
+    __m128i LevelShift = _mm_set1_epi32(levelShift);
+
+    __m128i csx[BLOCK_WIDTH];
+    __m128i csy[BLOCK_WIDTH][BLOCK_WIDTH];
+    __m128i tdct[BLOCK_WIDTH];
+    const s16* ttdct = context.dct_;
+    for(s32 i = 0; i < BLOCK_WIDTH; ++i, ttdct += BLOCK_WIDTH) {
+        csx[i] = _mm_loadu_si128(reinterpret_cast<__m128i*>(&context.cosine_[i][0]));
+        tdct[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ttdct));
+        for(s32 j = 0; j < BLOCK_WIDTH; ++j) {
+            csy[i][j] = _mm_set1_epi16(context.cosine_[i][j]);
+        }
+    }
+
+    for(s32 y = 0; y < BLOCK_WIDTH; ++y) {
+        s16* block = context.block_ + y * BLOCK_WIDTH;
+        for(s32 x = 0; x < BLOCK_WIDTH; ++x) {
+            __m128i sum = _mm_setzero_si128();
+            for(s32 v = 0; v < BLOCK_WIDTH; ++v) {
+                const __m128i& dct = tdct[v];
+                __m128i dct0 = _mm_cvtepi16_epi32(dct);
+                __m128i dct1 = _mm_cvtepi16_epi32(_mm_srli_si128(dct, 8));
+
+                const __m128i& tcsy = csy[y][v];
+                __m128i cl = _mm_mullo_epi16(tcsy, csx[x]); // lower 8 bits of tcsy*csx
+                __m128i ch = _mm_mulhi_epi16(tcsy, csx[x]); // upper 8 bits of tcsy*csx
+
+                __m128i c0 = _mm_unpacklo_epi16(cl, ch);
+                __m128i c1 = _mm_unpackhi_epi16(cl, ch);
+                // Round fixed point values
+                c0 = _mm_srai_epi32(_mm_add_epi32(c0, RoundOffset0), FIXED_POINT_SHIFT);
+                c1 = _mm_srai_epi32(_mm_add_epi32(c1, RoundOffset0), FIXED_POINT_SHIFT);
+
+                c0 = _mm_mullo_epi32(c0, dct0);
+                c1 = _mm_mullo_epi32(c1, dct1);
+
+                sum = _mm_add_epi32(sum, c0);
+                sum = _mm_add_epi32(sum, c1);
+            }
+
+            sum = _mm_hadd_epi32(sum, sum);
+            sum = _mm_hadd_epi32(sum, sum);
+
+            // Round fixed point values
+            sum = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(sum, RoundOffset1), FIXED_POINT_SHIFT2 + 2), LevelShift);
+            // sum = _mm_packs_epi32(sum, sum);
+            // sum = _mm_slli_si128(sum, 14);
+            // tblock = _mm_or_si128(tblock, sum);
+            // tblock = _mm_srli_si128(tblock, 2);
+            block[x] = static_cast<u16>(_mm_cvtsi128_si32(sum));
+        }
+    }
+#endif
+}
+
+void JPEG::copyComponents(Context& context, s32 ux, s32 uy)
+{
+    s16* C[4];
+    C[0] = context.components_[0];
+    C[1] = context.components_[1];
+    C[2] = context.components_[2];
+    C[3] = context.components_[3];
+
+    s32 pixelV = uy * (context.frame_.maxVerticalSampling_ << 3);
+    s32 pixelH = ux * (context.frame_.maxHorizontalSampling_ << 3);
+
+    CPPIMG_ASSERT(pixelV < context.frame_.height_);
+    CPPIMG_ASSERT(pixelH < context.frame_.width_);
+
+    s32 endy = context.frame_.maxVerticalSampling_ << 3;
+    s32 endx = context.frame_.maxHorizontalSampling_ << 3;
+    s32 stepx = endx;
+    if(context.frame_.height_ <= (pixelV + endy)) {
+        endy = context.frame_.height_ - pixelV;
+    }
+    if(context.frame_.width_ <= (pixelH + endx)) {
+        endx = context.frame_.width_ - pixelH;
+    }
+
+    s32 offset = (pixelV * context.frame_.width_ + pixelH) * context.frame_.numComponents_;
+    s16* work = context.work_ + offset;
+
+    for(s32 y = 0; y < endy; ++y) {
+        for(s32 x = 0; x < endx; ++x) {
+            s32 index = (y * context.frame_.width_ + x) * context.frame_.numComponents_;
+            for(s32 c = 0; c < context.frame_.numComponents_; ++c) {
+                work[index + c] = C[c][x];
+            }
+        }
+        C[0] += stepx;
+        C[1] += stepx;
+        C[2] += stepx;
+        C[3] += stepx;
+    }
+}
+
+void JPEG::toGray(Context& context)
+{
+    s32 repeatH = context.frame_.maxHorizontalSampling_ / context.frame_.components_[0].getHorizontal();
+    s32 repeatV = context.frame_.maxVerticalSampling_ / context.frame_.components_[0].getVertical();
+    s32 endX = (context.frame_.width_ / repeatH) * repeatH;
+    s32 endY = (context.frame_.height_ / repeatV) * repeatV;
+    s16 ratioH = static_cast<s16>(1.0f / repeatH * (f32)(1 << FIXED_POINT_SHIFT));
+    s16 ratioV = static_cast<s16>(1.0f / repeatV * (f32)(1 << FIXED_POINT_SHIFT));
+    s32 step = context.frame_.width_;
+
+    if(1 < repeatH || 1 < repeatV) {
+        s16* Y = context.work_;
+        for(s32 y = 0; y < context.frame_.height_; y += repeatV) {
+            for(s32 x = 0; x < endX; x += repeatH) {
+                for(s32 c = 1; c < repeatH; ++c) {
+                    s32 value = Y[x] * ratioH * (repeatH - c) + Y[x + repeatH] * ratioH * (c);
+                    Y[x + c] = fixedPointRound<s16>(value, FIXED_POINT_SHIFT);
+                }
+            }
+            if(y < endY) {
+                for(s32 x = 0; x < context.frame_.width_; ++x) {
+                    s16* NY = Y + step * repeatV;
+                    for(s32 c = 1; c < repeatV; ++c) {
+                        s32 value = Y[x] * ratioV * (repeatV - c) + NY[x] * ratioV * (c);
+                        Y[x + c * step] = fixedPointRound<s16>(value, FIXED_POINT_SHIFT);
+                    }
+                }
+            }
+        }
+    }
+    for(s32 y = 0; y < context.frame_.height_; ++y) {
+        u8* dst = context.rows_->begin(y);
+        for(s32 x = 0; x < context.frame_.width_; ++x) {
+            s32 index = (y * context.frame_.width_ + x);
+            s32 ty = fixedPointRound(context.work_[index], FIXED_POINT_SHIFT2);
+            dst[x] = clamp8bits(ty);
+        }
+        context.rows_->end(y);
+    }
+}
+
+void JPEG::toRGB(Context& context)
+{
+    for(s32 c = 0; c < context.frame_.numComponents_; ++c) {
+        filter(context, c);
+    }
+
+    s32 step = context.frame_.width_ * context.frame_.numComponents_;
+    s16* C = context.work_;
+    for(s32 y = 0; y < context.frame_.height_; ++y) {
+        s32 row = y * step;
+        u8* dst = context.rows_->begin(y);
+        for(s32 x = 0; x < context.frame_.width_; ++x) {
+            s32 index = row + x * context.frame_.numComponents_;
+            s32 ty = C[index + 0] << FIXED_POINT_SHIFT2;
+            s32 tcb = C[index + 1];
+            s32 tcr = C[index + 2];
+            s32 tr = ty + fixedPointShift((tcr - 0x2000) * 0x166E, FIXED_POINT_SHIFT2);                           // Y + (Cr-128)*1.4020
+            s32 tg = ty - fixedPointShift((tcb - 0x2000) * 0x0581 + (tcr - 0x2000) * 0x0B6C, FIXED_POINT_SHIFT2); // Y - (Cb-128)*0.3441 - (Cbr-128)*0.7139;
+            s32 tb = ty + fixedPointShift((tcb - 0x2000) * 0x1C59, FIXED_POINT_SHIFT2);                           // Y - (Cb-128)*1.7718;
+            tr = fixedPointRound(tr, FIXED_POINT_SHIFT);
+            tg = fixedPointRound(tg, FIXED_POINT_SHIFT);
+            tb = fixedPointRound(tb, FIXED_POINT_SHIFT);
+
+            dst[0] = clamp8bits(tr);
+            dst[1] = clamp8bits(tg);
+            dst[2] = clamp8bits(tb);
+            dst += 3;
+        }
+        context.rows_->end(y);
+    }
+}
+
+void JPEG::filter(Context& context, s32 component)
+{
+    s32 repeatH = context.frame_.maxHorizontalSampling_ / context.frame_.components_[component].getHorizontal();
+    s32 repeatV = context.frame_.maxVerticalSampling_ / context.frame_.components_[component].getVertical();
+    if(repeatH <= 1 && repeatV <= 1) {
+        return;
+    }
+    s32 endX = (context.frame_.width_ / repeatH) * repeatH;
+    s32 endY = (context.frame_.height_ / repeatV) * repeatV;
+    s16 ratioH = static_cast<s16>(1.0f / repeatH * (f32)(1 << FIXED_POINT_SHIFT));
+    s16 ratioV = static_cast<s16>(1.0f / repeatV * (f32)(1 << FIXED_POINT_SHIFT));
+    s32 numComponents = context.frame_.numComponents_;
+    s32 step = context.frame_.width_ * numComponents;
+
+    s16* C = context.work_ + component;
+    for(s32 y = 0; y < context.frame_.height_; y += repeatV) {
+        s32 row = y * step;
+        for(s32 x = 0; x < endX; x += repeatH) {
+            s32 i0 = row + x * numComponents;
+            s32 i1 = i0 + repeatH * numComponents;
+            for(s32 c = 1; c < repeatH; ++c) {
+                s32 value = C[i0] * ratioH * (repeatH - c) + C[i1] * ratioH * (c);
+                C[i0 + c * numComponents] = fixedPointRound<s16>(value, FIXED_POINT_SHIFT);
+            }
+        }
+        if(y < endY) {
+            for(s32 x = 0; x < context.frame_.width_; ++x) {
+                s32 i0 = row + x * numComponents;
+                s32 i1 = i0 + repeatV * step;
+                for(s32 c = 1; c < repeatV; ++c) {
+                    s32 value = C[i0] * ratioV * (repeatV - c) + C[i1] * ratioV * (c);
+                    C[i0 + c * step] = fixedPointRound<s16>(value, FIXED_POINT_SHIFT);
+                }
+            }
+        }
+    } // for(s32 y=0;
+}
+
+#    ifndef CPPIMG_DISABLE_OPENEXR
+//----------------------------------------------------
+//---
+//--- OpenEXR
+//---
+//----------------------------------------------------
+OpenEXR::Version OpenEXR::Version::create(
+    bool tile,
+    bool longName,
+    bool deepData,
+    bool multiPart)
+{
+    Version version;
+    version.version_ = 0x02U;
+    if(tile) {
+        version.version_ |= Flag_TileFormat;
+    }
+    if(longName) {
+        version.version_ |= Flag_LongName;
+    }
+    if(deepData) {
+        version.version_ |= Flag_DeepData;
+    }
+    if(multiPart) {
+        version.version_ |= Flag_MultiPart;
+    }
+    return version;
+}
+
+OpenEXR::Preview::Preview()
+    : width_(0)
+    , height_(0)
+    , image_(CPPIMG_NULL)
+{
+}
+
+OpenEXR::Preview::~Preview()
+{
+    CPPIMG_FREE(image_);
+}
+
+bool OpenEXR::Preview::read(Stream& stream)
+{
+    if(stream.read(sizeof(s32), &width_) <= 0) {
+        return false;
+    }
+    if(stream.read(sizeof(s32), &height_) <= 0) {
+        return false;
+    }
+    s32 size = width_ * height_ * 4;
+    CPPIMG_DELETE_ARRAY(image_);
+    image_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(size));
+    if(stream.read(size, image_) <= 0) {
+        return false;
+    }
+    return true;
+}
+
+void OpenEXR::Preview::swap(Preview& rhs)
+{
+    cppimg::swap(width_, rhs.width_);
+    cppimg::swap(height_, rhs.height_);
+    cppimg::swap(image_, rhs.image_);
+}
+
+//----------------------------------------------------
+void OpenEXR::Header::initialize()
+{
+    numChannels_ = 0;
+    channels_[0].name_[0] = CPPIMG_NULLCHAR;
+    chromaticities_ = {0.6400f, 0.3300f, 0.3000f, 0.6000f, 0.1500f, 0.0600f, 0.3127f, 0.3290f};
+    hasChromaticities_ = false;
+}
+
+bool OpenEXR::Header::getColorType(ColorType& colorType) const
+{
+    const Channel* channels[4];
+    channels[0] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::R)]);
+    channels[1] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::G)]);
+    channels[2] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::B)]);
+    channels[3] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::A)]);
+
+    if(CPPIMG_NULL != channels[0]
+       && CPPIMG_NULL != channels[1]
+       && CPPIMG_NULL != channels[2]) {
+
+        colorType = (CPPIMG_NULL != channels[3]) ? ColorType::RGBA : ColorType::RGB;
+
+    } else {
+        channels[0] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::Y)]);
+        colorType = ColorType::GRAY;
+        if(CPPIMG_NULL == channels[0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void OpenEXR::Header::getTypes(s32 types[MaxInChannels]) const
+{
+    CPPIMG_ASSERT(numChannels_ <= MaxInChannels);
+    for(s32 i = 0; i < numChannels_; ++i) {
+        types[i] = channels_[i].pixelType_;
+    }
+}
+
+s32 OpenEXR::Header::getBytesPerPixel() const
+{
+    s32 bytesPerPixel = 0;
+    for(s32 i = 0; i < numChannels_; ++i) {
+        bytesPerPixel += cppimg::getSize(static_cast<Type>(channels_[i].pixelType_));
+    }
+    return bytesPerPixel;
+}
+
+const OpenEXR::Channel* OpenEXR::Header::findChannel(const Char* name) const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != name);
+    for(s32 i = 0; i < numChannels_; ++i) {
+        if(0 == strcmp(channels_[i].name_, name)) {
+            return &channels_[i];
+        }
+    }
+    return CPPIMG_NULL;
+}
+
+void OpenEXR::Header::sortChannels()
+{
+    for(s32 i = 0; i < numChannels_; ++i) {
+        s32 index = i;
+        for(s32 j = i + 1; j < numChannels_; ++j) {
+            if(strcmp(channels_[j].name_, channels_[index].name_) < 0) {
+                index = j;
+            }
+        }
+        if(index != i) {
+            cppimg::swap(channels_[i], channels_[index]);
+        }
+    }
+}
+
+//----------------------------------------------------
+OpenEXR::Buffer::Buffer()
+    : capacity_(0)
+    , buffer_(CPPIMG_NULL)
+{
+}
+
+OpenEXR::Buffer::Buffer(s64 capacity)
+    : capacity_(capacity)
+{
+    buffer_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(capacity_));
+}
+
+OpenEXR::Buffer::~Buffer()
+{
+    CPPIMG_FREE(buffer_);
+}
+
+bool OpenEXR::Buffer::reserve(s64 capacity)
+{
+    if(capacity <= capacity_) {
+        return true;
+    }
+    CPPIMG_FREE(buffer_);
+    capacity_ = capacity;
+    buffer_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(capacity_));
+    return CPPIMG_NULL != buffer_;
+}
+
+bool OpenEXR::Buffer::expand(s64 newCapacity)
+{
+    CPPIMG_ASSERT(0 < newCapacity);
+    CPPIMG_ASSERT(capacity_ <= newCapacity);
+    newCapacity = (newCapacity + 7) & ~7;
+    u8* buffer = REINTERPRET_CAST(u8*, CPPIMG_MALLOC(newCapacity));
+    if(CPPIMG_NULL == buffer) {
+        return false;
+    }
+    if(CPPIMG_NULL != buffer_) {
+        memcpy(buffer, buffer_, capacity_);
+    }
+    CPPIMG_FREE(buffer_);
+    capacity_ = newCapacity;
+    buffer_ = buffer;
+    return true;
+}
+
+//----------------------------------------------------
+OpenEXR::StreamBuffer::StreamBuffer()
+    : size_(0)
+    , increments_(1024)
+{
+}
+
+OpenEXR::StreamBuffer::StreamBuffer(s64 increments)
+    : size_(0)
+    , increments_(increments)
+{
+}
+
+OpenEXR::StreamBuffer::StreamBuffer(s64 increments, s64 capacity)
+    : size_(0)
+    , increments_(increments)
+    , buffer_(capacity)
+{
+}
+
+OpenEXR::StreamBuffer::~StreamBuffer()
+{
+}
+
+bool OpenEXR::StreamBuffer::write(s64 size, const void* data)
+{
+    CPPIMG_ASSERT(0 <= size);
+    CPPIMG_ASSERT(CPPIMG_NULL != data);
+    CPPIMG_ASSERT(0 < increments_);
+    s64 capacity = size_ + size;
+    if(buffer_.capacity() < capacity) {
+        while(capacity < buffer_.capacity()) {
+            capacity += increments_;
+        }
+        if(!buffer_.expand(capacity)) {
+            return false;
+        }
+    }
+    memcpy(buffer_.begin() + size_, data, size);
+    size_ += size;
+    return true;
+}
+
+//----------------------------------------------------
+namespace
+{
+    static const s32 WaveletOffset = 1 << 15;
+    static const s32 WaveletMask = (1 << 16) - 1;
+
+    /**
+        @brief Lifting of 14 bits values, which never overflow in 16 bits
+        */
+    struct Wavelet14
+    {
+        static inline void encode(u16 a, u16 b, u16& l, u16& h)
+        {
+            s32 as = static_cast<s16>(a);
+            s32 bs = static_cast<s16>(b);
+            l = static_cast<u16>((as + bs) >> 1);
+            h = static_cast<u16>(as - bs);
+        }
+
+        static inline void decode(u16 l, u16 h, u16& a, u16& b)
+        {
+            s32 ls = static_cast<s16>(l);
+            s32 hs = static_cast<s16>(h);
+            s32 ai = ls + (hs & 1) + (hs >> 1);
+            a = static_cast<u16>(ai);
+            b = static_cast<u16>(ai - hs);
+        }
+
+#    if !defined(CPPIMG_DISABLE_AVX)
+        static inline void encode(__m128i a, __m128i b, __m128i& l, __m128i& h)
+        {
+            // floor((a+b)/2) without overflow
+            l = _mm_add_epi16(_mm_and_si128(a, b), _mm_srai_epi16(_mm_xor_si128(a, b), 1));
+            h = _mm_sub_epi16(a, b);
+        }
+
+        static inline void decode(__m128i l, __m128i h, __m128i& a, __m128i& b)
+        {
+            const __m128i one = _mm_set1_epi16(1);
+            a = _mm_add_epi16(_mm_add_epi16(l, _mm_and_si128(h, one)), _mm_srai_epi16(h, 1));
+            b = _mm_sub_epi16(a, h);
+        }
+#    endif
+    };
+
+    /**
+        @brief Lifting of full 16 bits values modulo 2^16
+        */
+    struct Wavelet16
+    {
+        static inline void encode(u16 a, u16 b, u16& l, u16& h)
+        {
+            s32 ao = (a + WaveletOffset) & WaveletMask;
+            s32 m = (ao + b) >> 1;
+            s32 d = ao - b;
+            if(d < 0) {
+                m = (m + WaveletOffset) & WaveletMask;
+            }
+            l = static_cast<u16>(m);
+            h = static_cast<u16>(d & WaveletMask);
+        }
+
+        static inline void decode(u16 l, u16 h, u16& a, u16& b)
+        {
+            s32 m = l;
+            s32 d = h;
+            s32 bb = (m - (d >> 1)) & WaveletMask;
+            s32 aa = (d + bb - WaveletOffset) & WaveletMask;
+            a = static_cast<u16>(aa);
+            b = static_cast<u16>(bb);
+        }
+
+#    if !defined(CPPIMG_DISABLE_AVX)
+        static inline void encode(__m128i a, __m128i b, __m128i& l, __m128i& h)
+        {
+            const __m128i offset = _mm_set1_epi16(static_cast<s16>(0x8000));
+            __m128i ao = _mm_xor_si128(a, offset);
+            __m128i m = _mm_add_epi16(_mm_and_si128(ao, b), _mm_srli_epi16(_mm_xor_si128(ao, b), 1));
+            __m128i less = _mm_xor_si128(_mm_cmpeq_epi16(_mm_max_epu16(ao, b), ao), _mm_set1_epi16(-1));
+            l = _mm_xor_si128(m, _mm_and_si128(less, offset));
+            h = _mm_sub_epi16(ao, b);
+        }
+
+        static inline void decode(__m128i l, __m128i h, __m128i& a, __m128i& b)
+        {
+            const __m128i offset = _mm_set1_epi16(static_cast<s16>(0x8000));
+            b = _mm_sub_epi16(l, _mm_srli_epi16(h, 1));
+            a = _mm_xor_si128(_mm_add_epi16(h, b), offset);
+        }
+#    endif
+    };
+
+#    if !defined(CPPIMG_DISABLE_AVX)
+    inline void loadEvenOdd(__m128i& even, __m128i& odd, const u16* src)
+    {
+        const __m128i mask = _mm_set1_epi32(0xFFFF);
+        __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 8));
+        even = _mm_packus_epi32(_mm_and_si128(x0, mask), _mm_and_si128(x1, mask));
+        odd = _mm_packus_epi32(_mm_srli_epi32(x0, 16), _mm_srli_epi32(x1, 16));
+    }
+
+    inline void storeEvenOdd(u16* dst, __m128i even, __m128i odd)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(even, odd));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), _mm_unpackhi_epi16(even, odd));
+    }
+#    endif
+
+    /**
+        @brief Forward 2D Haar wavelet transform in place
+        @param in
+        @param nx ... number of columns
+        @param ox ... stride of columns
+        @param ny ... number of rows
+        @param oy ... stride of rows
+        */
+    template<class T>
+    void encodeWavelet(u16* in, s32 nx, s32 ox, s32 ny, s32 oy)
+    {
+        s32 n = (nx > ny) ? ny : nx;
+        s32 p = 1;
+        s32 p2 = 2;
+        u16 i00, i01, i10, i11;
+        while(p2 <= n) {
+            u16* py = in;
+            u16* ey = in + oy * (ny - p2);
+            s32 oy1 = oy * p;
+            s32 oy2 = oy * p2;
+            s32 ox1 = ox * p;
+            s32 ox2 = ox * p2;
+            for(; py <= ey; py += oy2) {
+                u16* px = py;
+                u16* ex = py + ox * (nx - p2);
+#    if !defined(CPPIMG_DISABLE_AVX)
+                // The finest level of packed samples, 8 blocks of 2x2 at once
+                if(1 == ox1) {
+                    for(; (px + 15) <= (ex + 1); px += 16) {
+                        __m128i e0, o0, e1, o1;
+                        __m128i v00, v01, v10, v11;
+                        loadEvenOdd(e0, o0, px);
+                        loadEvenOdd(e1, o1, px + oy1);
+                        T::encode(e0, o0, v00, v01);
+                        T::encode(e1, o1, v10, v11);
+                        T::encode(v00, v10, e0, e1);
+                        T::encode(v01, v11, o0, o1);
+                        storeEvenOdd(px, e0, o0);
+                        storeEvenOdd(px + oy1, e1, o1);
+                    }
+                }
+#    endif
+                for(; px <= ex; px += ox2) {
+                    u16* p01 = px + ox1;
+                    u16* p10 = px + oy1;
+                    u16* p11 = p10 + ox1;
+                    T::encode(*px, *p01, i00, i01);
+                    T::encode(*p10, *p11, i10, i11);
+                    T::encode(i00, i10, *px, *p10);
+                    T::encode(i01, i11, *p01, *p11);
+                }
+                // Odd column
+                if(nx & p) {
+                    u16* p10 = px + oy1;
+                    T::encode(*px, *p10, i00, *p10);
+                    *px = i00;
+                }
+            }
+            // Odd line
+            if(ny & p) {
+                u16* px = py;
+                u16* ex = py + ox * (nx - p2);
+                for(; px <= ex; px += ox2) {
+                    u16* p01 = px + ox1;
+                    T::encode(*px, *p01, i00, *p01);
+                    *px = i00;
+                }
+            }
+            p = p2;
+            p2 <<= 1;
+        }
+    }
+
+    /**
+        @brief Inverse 2D Haar wavelet transform in place
+        @param in
+        @param nx ... number of columns
+        @param ox ... stride of columns
+        @param ny ... number of rows
+        @param oy ... stride of rows
+        */
+    template<class T>
+    void decodeWavelet(u16* in, s32 nx, s32 ox, s32 ny, s32 oy)
+    {
+        s32 n = (nx > ny) ? ny : nx;
+        s32 p = 1;
+        while(p <= n) {
+            p <<= 1;
+        }
+        p >>= 1;
+        s32 p2 = p;
+        p >>= 1;
+        u16 i00, i01, i10, i11;
+        while(1 <= p) {
+            u16* py = in;
+            u16* ey = in + oy * (ny - p2);
+            s32 oy1 = oy * p;
+            s32 oy2 = oy * p2;
+            s32 ox1 = ox * p;
+            s32 ox2 = ox * p2;
+            for(; py <= ey; py += oy2) {
+                u16* px = py;
+                u16* ex = py + ox * (nx - p2);
+#    if !defined(CPPIMG_DISABLE_AVX)
+                // The finest level of packed samples, 8 blocks of 2x2 at once
+                if(1 == ox1) {
+                    for(; (px + 15) <= (ex + 1); px += 16) {
+                        __m128i e0, o0, e1, o1;
+                        __m128i v00, v01, v10, v11;
+                        loadEvenOdd(e0, o0, px);
+                        loadEvenOdd(e1, o1, px + oy1);
+                        T::decode(e0, e1, v00, v10);
+                        T::decode(o0, o1, v01, v11);
+                        T::decode(v00, v01, e0, o0);
+                        T::decode(v10, v11, e1, o1);
+                        storeEvenOdd(px, e0, o0);
+                        storeEvenOdd(px + oy1, e1, o1);
+                    }
+                }
+#    endif
+                for(; px <= ex; px += ox2) {
+                    u16* p01 = px + ox1;
+                    u16* p10 = px + oy1;
+                    u16* p11 = p10 + ox1;
+                    T::decode(*px, *p10, i00, i10);
+                    T::decode(*p01, *p11, i01, i11);
+                    T::decode(i00, i01, *px, *p01);
+                    T::decode(i10, i11, *p10, *p11);
+                }
+                // Odd column
+                if(nx & p) {
+                    u16* p10 = px + oy1;
+                    T::decode(*px, *p10, i00, *p10);
+                    *px = i00;
+                }
+            }
+            // Odd line
+            if(ny & p) {
+                u16* px = py;
+                u16* ex = py + ox * (nx - p2);
+                for(; px <= ex; px += ox2) {
+                    u16* p01 = px + ox1;
+                    T::decode(*px, *p01, i00, *p01);
+                    *px = i00;
+                }
+            }
+            p2 = p;
+            p >>= 1;
+        }
+    }
+
+    inline u32 readU32LittleEndian(const u8* src)
+    {
+        return src[0] | (static_cast<u32>(src[1]) << 8) | (static_cast<u32>(src[2]) << 16) | (static_cast<u32>(src[3]) << 24);
+    }
+
+    inline void writeU32LittleEndian(u8* dst, u32 x)
+    {
+        dst[0] = static_cast<u8>(x);
+        dst[1] = static_cast<u8>(x >> 8);
+        dst[2] = static_cast<u8>(x >> 16);
+        dst[3] = static_cast<u8>(x >> 24);
+    }
+
+    inline s32 getHuffmanLength(s64 code)
+    {
+        return static_cast<s32>(code & 63);
+    }
+
+    inline s64 getHuffmanCode(s64 code)
+    {
+        return code >> 6;
+    }
+
+    struct BitWriter
+    {
+        inline void put(s32 count, u64 bits)
+        {
+            bits_ = (bits_ << count) | bits;
+            length_ += count;
+            while(8 <= length_) {
+                length_ -= 8;
+                *dst_++ = static_cast<u8>(bits_ >> length_);
+            }
+        }
+
+        inline void putCode(s64 code)
+        {
+            put(getHuffmanLength(code), getHuffmanCode(code));
+        }
+
+        inline void flush()
+        {
+            if(0 < length_) {
+                *dst_++ = static_cast<u8>(bits_ << (8 - length_));
+            }
+        }
+
+        u64 bits_;
+        s32 length_;
+        u8* dst_;
+    };
+
+    inline s32 getBits(s32 count, u64& bits, s32& length, const u8*& src)
+    {
+        while(length < count) {
+            bits = (bits << 8) | *src++;
+            length += 8;
+        }
+        length -= count;
+        return static_cast<s32>((bits >> length) & ((1 << count) - 1));
+    }
+
+    /**
+        @brief Output a symbol, or a run of it
+        */
+    inline bool getHuffmanSymbol(s32 symbol, s32 rlc, u64& bits, s32& length, const u8*& src, u16*& dst, const u16* begin, const u16* end)
+    {
+        if(symbol == rlc) {
+            if(length < 8) {
+                bits = (bits << 8) | *src++;
+                length += 8;
+            }
+            length -= 8;
+            s32 count = static_cast<u8>(bits >> length);
+            if(end < (dst + count) || dst <= begin) {
+                return false;
+            }
+            u16 s = dst[-1];
+            while(0 < count--) {
+                *dst++ = s;
+            }
+        } else if(dst < end) {
+            *dst++ = static_cast<u16>(symbol);
+        } else {
+            return false;
+        }
+        return true;
+    }
+} // namespace
+
+OpenEXR::PIZ::PIZ()
+{
+}
+
+OpenEXR::PIZ::~PIZ()
+{
+}
+
+s32 OpenEXR::PIZ::getPlanes(s32 width, s32 lines, s32 numChannels, const s32* sizes, s32 starts[MaxInChannels])
+{
+    s32 total = 0;
+    for(s32 i = 0; i < numChannels; ++i) {
+        starts[i] = total;
+        total += width * lines * (sizes[i] >> 1);
+    }
+    if(!planes_.reserve(static_cast<s64>(total) * sizeof(u16) + sizeof(u16))) {
+        return -1;
+    }
+    return total;
+}
+
+s32 OpenEXR::PIZ::compress(Buffer& dst, s32 width, s32 lines, s32 numChannels, const s32* sizes, const u8* src)
+{
+    // Gather each channel into a plane of 16 bits values
+    s32 starts[MaxInChannels];
+    s32 total = getPlanes(width, lines, numChannels, sizes, starts);
+    if(total <= 0) {
+        return -1;
+    }
+    u16* planes = reinterpret_cast<u16*>(planes_.begin());
+    for(s32 i = 0; i < lines; ++i) {
+        for(s32 j = 0; j < numChannels; ++j) {
+            s32 count = width * (sizes[j] >> 1);
+            memcpy(planes + starts[j] + i * count, src, count * sizeof(u16));
+            src += count * sizeof(u16);
+        }
+    }
+
+    // Map the used values to a dense range
+    memset(bitmap_, 0, sizeof(bitmap_));
+    for(s32 i = 0; i < total; ++i) {
+        bitmap_[planes[i] >> 3] |= static_cast<u8>(1U << (planes[i] & 7));
+    }
+    bitmap_[0] &= ~1U;
+    u16 minNonZero = BitmapSize - 1;
+    u16 maxNonZero = 0;
+    for(s32 i = 0; i < BitmapSize; ++i) {
+        if(bitmap_[i]) {
+            minNonZero = minimum(minNonZero, static_cast<u16>(i));
+            maxNonZero = maximum(maxNonZero, static_cast<u16>(i));
+        }
+    }
+    s32 maxValue = 0;
+    for(s32 i = 0; i < UShortRange; ++i) {
+        if(0 == i || (bitmap_[i >> 3] & (1U << (i & 7)))) {
+            lut_[i] = static_cast<u16>(maxValue++);
+        } else {
+            lut_[i] = 0;
+        }
+    }
+    maxValue -= 1;
+    for(s32 i = 0; i < total; ++i) {
+        planes[i] = lut_[planes[i]];
+    }
+
+    for(s32 i = 0; i < numChannels; ++i) {
+        s32 count = sizes[i] >> 1;
+        for(s32 j = 0; j < count; ++j) {
+            if(maxValue < (1 << 14)) {
+                encodeWavelet<Wavelet14>(planes + starts[i] + j, width, count, lines, width * count);
+            } else {
+                encodeWavelet<Wavelet16>(planes + starts[i] + j, width, count, lines, width * count);
+            }
+        }
+    }
+
+    s64 capacity = sizeof(u16) * 2 + BitmapSize + sizeof(s32) + (static_cast<s64>(total) * 3) + 65536 + 8192;
+    if(!dst.reserve(capacity)) {
+        return -1;
+    }
+    u8* d = dst.begin();
+    memcpy(d, &minNonZero, sizeof(u16));
+    memcpy(d + sizeof(u16), &maxNonZero, sizeof(u16));
+    d += sizeof(u16) * 2;
+    if(minNonZero <= maxNonZero) {
+        memcpy(d, bitmap_ + minNonZero, maxNonZero - minNonZero + 1);
+        d += maxNonZero - minNonZero + 1;
+    }
+    s32 length = compressHuffman(d + sizeof(s32), total, planes);
+    if(length < 0) {
+        return -1;
+    }
+    memcpy(d, &length, sizeof(s32));
+    d += sizeof(s32) + length;
+    return static_cast<s32>(d - dst.begin());
+}
+
+bool OpenEXR::PIZ::uncompress(u8* dst, s32 width, s32 lines, s32 numChannels, const s32* sizes, s32 srcSize, const u8* src)
+{
+    s32 starts[MaxInChannels];
+    s32 total = getPlanes(width, lines, numChannels, sizes, starts);
+    if(total <= 0) {
+        return false;
+    }
+    const u8* end = src + srcSize;
+    u16 minNonZero;
+    u16 maxNonZero;
+    if(srcSize < static_cast<s32>(sizeof(u16) * 2)) {
+        return false;
+    }
+    memcpy(&minNonZero, src, sizeof(u16));
+    memcpy(&maxNonZero, src + sizeof(u16), sizeof(u16));
+    src += sizeof(u16) * 2;
+    if(BitmapSize <= maxNonZero) {
+        return false;
+    }
+    memset(bitmap_, 0, sizeof(bitmap_));
+    if(minNonZero <= maxNonZero) {
+        s32 size = maxNonZero - minNonZero + 1;
+        if((end - src) < size) {
+            return false;
+        }
+        memcpy(bitmap_ + minNonZero, src, size);
+        src += size;
+    }
+    s32 maxValue = 0;
+    for(s32 i = 0; i < UShortRange; ++i) {
+        if(0 == i || (bitmap_[i >> 3] & (1U << (i & 7)))) {
+            lut_[maxValue++] = static_cast<u16>(i);
+        }
+    }
+    for(s32 i = maxValue; i < UShortRange; ++i) {
+        lut_[i] = 0;
+    }
+    maxValue -= 1;
+
+    s32 length;
+    if((end - src) < static_cast<s32>(sizeof(s32))) {
+        return false;
+    }
+    memcpy(&length, src, sizeof(s32));
+    src += sizeof(s32);
+    if(length < 0 || (end - src) < length) {
+        return false;
+    }
+    u16* planes = reinterpret_cast<u16*>(planes_.begin());
+    if(!uncompressHuffman(planes, total, length, src)) {
+        return false;
+    }
+
+    for(s32 i = 0; i < numChannels; ++i) {
+        s32 count = sizes[i] >> 1;
+        for(s32 j = 0; j < count; ++j) {
+            if(maxValue < (1 << 14)) {
+                decodeWavelet<Wavelet14>(planes + starts[i] + j, width, count, lines, width * count);
+            } else {
+                decodeWavelet<Wavelet16>(planes + starts[i] + j, width, count, lines, width * count);
+            }
+        }
+    }
+    for(s32 i = 0; i < total; ++i) {
+        planes[i] = lut_[planes[i]];
+    }
+
+    for(s32 i = 0; i < lines; ++i) {
+        for(s32 j = 0; j < numChannels; ++j) {
+            s32 count = width * (sizes[j] >> 1);
+            memcpy(dst, planes + starts[j] + i * count, count * sizeof(u16));
+            dst += count * sizeof(u16);
+        }
+    }
+    return true;
+}
+
+s32 OpenEXR::PIZ::compressHuffman(u8* dst, s32 size, const u16* src)
+{
+    if(size <= 0) {
+        return 0;
+    }
+    memset(codes_, 0, sizeof(codes_));
+    for(s32 i = 0; i < size; ++i) {
+        ++codes_[src[i]];
+    }
+    s32 minIndex = 0;
+    s32 maxIndex = 0;
+    if(!buildEncodeTable(minIndex, maxIndex)) {
+        return -1;
+    }
+    u8* table = dst + 20;
+    u8* data = packEncodeTable(table, codes_, minIndex, maxIndex);
+    s32 bits = 0;
+    u8* end = encodeHuffman(data, codes_, maxIndex, size, src, bits);
+
+    writeU32LittleEndian(dst, minIndex);
+    writeU32LittleEndian(dst + 4, maxIndex);
+    writeU32LittleEndian(dst + 8, static_cast<u32>(data - table));
+    writeU32LittleEndian(dst + 12, bits);
+    writeU32LittleEndian(dst + 16, 0);
+    return static_cast<s32>(end - dst);
+}
+
+bool OpenEXR::PIZ::uncompressHuffman(u16* dst, s32 size, s32 srcSize, const u8* src)
+{
+    if(srcSize <= 0) {
+        return 0 == size;
+    }
+    if(srcSize < 20) {
+        return false;
+    }
+    s32 minIndex = static_cast<s32>(readU32LittleEndian(src));
+    s32 maxIndex = static_cast<s32>(readU32LittleEndian(src + 4));
+    s32 bits = static_cast<s32>(readU32LittleEndian(src + 12));
+    if(minIndex < 0 || HufEncSize <= minIndex || maxIndex < 0 || HufEncSize <= maxIndex || bits < 0) {
+        return false;
+    }
+    const u8* end = src + srcSize;
+    const u8* p = src + 20;
+    if(!unpackEncodeTable(p, static_cast<s32>(end - p), minIndex, maxIndex)) {
+        return false;
+    }
+    if((static_cast<s64>(end - p) * 8) < bits) {
+        return false;
+    }
+    if(!buildDecodeTable(minIndex, maxIndex)) {
+        return false;
+    }
+    return decodeHuffman(maxIndex, bits, p, size, dst);
+}
+
+void OpenEXR::PIZ::pushHeap(s32 size, s32 index)
+{
+    s32 n = size;
+    while(0 < n) {
+        s32 parent = (n - 1) >> 1;
+        if(codes_[heap_[parent]] <= codes_[index]) {
+            break;
+        }
+        heap_[n] = heap_[parent];
+        n = parent;
+    }
+    heap_[n] = index;
+}
+
+s32 OpenEXR::PIZ::popHeap(s32 size)
+{
+    s32 top = heap_[0];
+    s32 last = heap_[size - 1];
+    --size;
+    s32 n = 0;
+    for(;;) {
+        s32 child = (n << 1) + 1;
+        if(size <= child) {
+            break;
+        }
+        if((child + 1) < size && codes_[heap_[child + 1]] < codes_[heap_[child]]) {
+            ++child;
+        }
+        if(codes_[last] <= codes_[heap_[child]]) {
+            break;
+        }
+        heap_[n] = heap_[child];
+        n = child;
+    }
+    heap_[n] = last;
+    return top;
+}
+
+bool OpenEXR::PIZ::buildEncodeTable(s32& minIndex, s32& maxIndex)
+{
+    // codes_ have frequencies of symbols at first, then canonical codes
+    minIndex = 0;
+    while(0 == codes_[minIndex]) {
+        ++minIndex;
+    }
+    s32 size = 0;
+    for(s32 i = minIndex; i < HufEncSize; ++i) {
+        links_[i] = i;
+        if(codes_[i]) {
+            pushHeap(size, i);
+            ++size;
+            maxIndex = i;
+        }
+    }
+    // The pseudo symbol for run length
+    ++maxIndex;
+    codes_[maxIndex] = 1;
+    pushHeap(size, maxIndex);
+    ++size;
+
+    memset(lengths_, 0, sizeof(lengths_));
+    while(1 < size) {
+        s32 mm = popHeap(size);
+        --size;
+        s32 m = popHeap(size);
+        --size;
+        codes_[m] += codes_[mm];
+        pushHeap(size, m);
+        ++size;
+
+        for(s32 j = m;; j = links_[j]) {
+            ++lengths_[j];
+            if(links_[j] == j) {
+                links_[j] = mm;
+                break;
+            }
+        }
+        for(s32 j = mm;; j = links_[j]) {
+            ++lengths_[j];
+            if(links_[j] == j) {
+                break;
+            }
+        }
+    }
+    if(!buildCanonicalCodes(lengths_)) {
+        return false;
+    }
+    memcpy(codes_, lengths_, sizeof(codes_));
+    return true;
+}
+
+bool OpenEXR::PIZ::buildCanonicalCodes(s64* codes)
+{
+    s64 n[HufMaxCodeLength + 1];
+    memset(n, 0, sizeof(n));
+    for(s32 i = 0; i < HufEncSize; ++i) {
+        if(HufMaxCodeLength < codes[i]) {
+            return false;
+        }
+        ++n[codes[i]];
+    }
+    s64 c = 0;
+    for(s32 i = HufMaxCodeLength; 0 < i; --i) {
+        s64 nc = (c + n[i]) >> 1;
+        n[i] = c;
+        c = nc;
+    }
+    for(s32 i = 0; i < HufEncSize; ++i) {
+        s32 l = static_cast<s32>(codes[i]);
+        if(0 < l) {
+            codes[i] = l | (n[l]++ << 6);
+        }
+    }
+    return true;
+}
+
+u8* OpenEXR::PIZ::packEncodeTable(u8* dst, const s64* codes, s32 minIndex, s32 maxIndex)
+{
+    BitWriter writer = {0, 0, dst};
+    for(; minIndex <= maxIndex; ++minIndex) {
+        s32 l = getHuffmanLength(codes[minIndex]);
+        if(0 == l) {
+            s32 zeros = 1;
+            while(minIndex < maxIndex && zeros < LongestLongRun) {
+                if(0 < getHuffmanLength(codes[minIndex + 1])) {
+                    break;
+                }
+                ++minIndex;
+                ++zeros;
+            }
+            if(2 <= zeros) {
+                if(ShortestLongRun <= zeros) {
+                    writer.put(6, LongZeroCodeRun);
+                    writer.put(8, zeros - ShortestLongRun);
+                } else {
+                    writer.put(6, ShortZeroCodeRun + zeros - 2);
+                }
+                continue;
+            }
+        }
+        writer.put(6, l);
+    }
+    writer.flush();
+    return writer.dst_;
+}
+
+bool OpenEXR::PIZ::unpackEncodeTable(const u8*& src, s32 srcSize, s32 minIndex, s32 maxIndex)
+{
+    memset(codes_, 0, sizeof(codes_));
+    const u8* p = src;
+    u64 bits = 0;
+    s32 length = 0;
+    for(; minIndex <= maxIndex; ++minIndex) {
+        if(srcSize <= (p - src)) {
+            return false;
+        }
+        s64 l = codes_[minIndex] = getBits(6, bits, length, p);
+        if(LongZeroCodeRun == l) {
+            if(srcSize < (p - src)) {
+                return false;
+            }
+            s32 zeros = getBits(8, bits, length, p) + ShortestLongRun;
+            if((maxIndex + 1) < (minIndex + zeros)) {
+                return false;
+            }
+            while(0 < zeros--) {
+                codes_[minIndex++] = 0;
+            }
+            --minIndex;
+        } else if(ShortZeroCodeRun <= l) {
+            s32 zeros = static_cast<s32>(l) - ShortZeroCodeRun + 2;
+            if((maxIndex + 1) < (minIndex + zeros)) {
+                return false;
+            }
+            while(0 < zeros--) {
+                codes_[minIndex++] = 0;
+            }
+            --minIndex;
+        }
+    }
+    src = p;
+    return buildCanonicalCodes(codes_);
+}
+
+bool OpenEXR::PIZ::buildDecodeTable(s32 minIndex, s32 maxIndex)
+{
+    memset(table_, 0, sizeof(table_));
+    // Count long codes of each entry, and fill short codes
+    for(s32 i = minIndex; i <= maxIndex; ++i) {
+        s64 c = getHuffmanCode(codes_[i]);
+        s32 l = getHuffmanLength(codes_[i]);
+        if(c >> l) {
+            return false;
+        }
+        if(HufDecBits < l) {
+            HufDec& entry = table_[c >> (l - HufDecBits)];
+            if(entry.length_) {
+                return false;
+            }
+            ++entry.literal_;
+        } else if(l) {
+            HufDec* entry = table_ + (c << (HufDecBits - l));
+            for(s64 j = s64(1) << (HufDecBits - l); 0 < j; --j, ++entry) {
+                if(entry->length_ || entry->literal_) {
+                    return false;
+                }
+                entry->length_ = l;
+                entry->literal_ = i;
+            }
+        }
+    }
+    s32 offset = 0;
+    for(s32 i = 0; i < HufDecSize; ++i) {
+        if(0 == table_[i].length_) {
+            table_[i].offset_ = offset;
+            offset += table_[i].literal_;
+            table_[i].literal_ = 0;
+        }
+    }
+    for(s32 i = minIndex; i <= maxIndex; ++i) {
+        s32 l = getHuffmanLength(codes_[i]);
+        if(HufDecBits < l) {
+            HufDec& entry = table_[getHuffmanCode(codes_[i]) >> (l - HufDecBits)];
+            longCodes_[entry.offset_ + entry.literal_] = i;
+            ++entry.literal_;
+        }
+    }
+    return true;
+}
+
+u8* OpenEXR::PIZ::encodeHuffman(u8* dst, const s64* codes, s32 rlc, s32 size, const u16* src, s32& bits)
+{
+    BitWriter writer = {0, 0, dst};
+    s32 s = src[0];
+    s32 count = 0;
+    for(s32 i = 1; i <= size; ++i) {
+        if(i < size && s == src[i] && count < 255) {
+            ++count;
+            continue;
+        }
+        // Send a run of a symbol, if it is shorter than repeating it
+        s64 code = codes[s];
+        s64 runCode = codes[rlc];
+        if((getHuffmanLength(code) + getHuffmanLength(runCode) + 8) < (getHuffmanLength(code) * count)) {
+            writer.putCode(code);
+            writer.putCode(runCode);
+            writer.put(8, count);
+        } else {
+            while(0 <= count--) {
+                writer.putCode(code);
+            }
+        }
+        count = 0;
+        if(i < size) {
+            s = src[i];
+        }
+    }
+    bits = static_cast<s32>(writer.dst_ - dst) * 8 + writer.length_;
+    writer.flush();
+    return writer.dst_;
+}
+
+bool OpenEXR::PIZ::decodeHuffman(s32 rlc, s32 bits, const u8* src, s32 size, u16* dst) const
+{
+    u64 c = 0;
+    s32 lc = 0;
+    u16* begin = dst;
+    u16* end = dst + size;
+    const u8* srcEnd = src + (bits + 7) / 8;
+    while(src < srcEnd) {
+        c = (c << 8) | *src++;
+        lc += 8;
+        while(HufDecBits <= lc) {
+            const HufDec& entry = table_[(c >> (lc - HufDecBits)) & HufDecMask];
+            if(entry.length_) {
+                lc -= entry.length_;
+                if(!getHuffmanSymbol(entry.literal_, rlc, c, lc, src, dst, begin, end)) {
+                    return false;
+                }
+                continue;
+            }
+            // Search a code longer than the table
+            s32 j = 0;
+            for(; j < entry.literal_; ++j) {
+                s32 symbol = longCodes_[entry.offset_ + j];
+                s32 l = getHuffmanLength(codes_[symbol]);
+                while(lc < l && src < srcEnd) {
+                    c = (c << 8) | *src++;
+                    lc += 8;
+                }
+                if(l <= lc && static_cast<u64>(getHuffmanCode(codes_[symbol])) == ((c >> (lc - l)) & ((u64(1) << l) - 1))) {
+                    lc -= l;
+                    if(!getHuffmanSymbol(symbol, rlc, c, lc, src, dst, begin, end)) {
+                        return false;
+                    }
+                    break;
+                }
+            }
+            if(j == entry.literal_) {
+                return false;
+            }
+        }
+    }
 
-    SeekSet seekSet(stream.tell(), &stream);
-    {
-        Segment soi;
-        if(stream.read(sizeof(u16), &soi.ff_) <= 0) {
+    // The remaining bits, which are shorter than the table
+    s32 i = (8 - bits) & 7;
+    c >>= i;
+    lc -= i;
+    while(0 < lc) {
+        const HufDec& entry = table_[(c << (HufDecBits - lc)) & HufDecMask];
+        if(0 == entry.length_) {
             return false;
         }
-        if(MARKER_SOI != soi.marker_) {
+        lc -= entry.length_;
+        if(!getHuffmanSymbol(entry.literal_, rlc, c, lc, src, dst, begin, end)) {
             return false;
         }
     }
+    return (end - begin) == (dst - begin);
+}
 
-    colorType = ColorType::RGB;
-    Context* context = reinterpret_cast<Context*>(CPPIMG_MALLOC(sizeof(Context)));
-    AutoFree autoFree(context);
-    CPPIMG_MEMSET(context, 0, sizeof(Context));
-    context->flags_ |= Flag_SOI;
-    context->byteStream_ = ByteStream(&stream);
-    bool loop = true;
-    Segment segment;
-    while(loop) {
-        if(!context->byteStream_.readSegment(segment)) {
+//----------------------------------------------------
+OpenEXR::Context::Context()
+    : part_(0)
+    , numXLevels_(1)
+    , numYLevels_(1)
+    , offsetTable_(CPPIMG_NULL)
+{
+    version_.version_ = 0;
+    memset(&header_, 0, sizeof(Header));
+    header_.initialize();
+}
+
+OpenEXR::Context::~Context()
+{
+    CPPIMG_FREE(offsetTable_);
+}
+
+bool OpenEXR::Context::readVersion(Stream& stream)
+{
+    return 0 < stream.read(4, &version_);
+}
+
+bool OpenEXR::Context::readHeader(Stream& stream)
+{
+    static const u32 CommonFlags = (0x01U << AttrName_Channels)
+                                   | (0x01U << AttrName_Compression)
+                                   | (0x01U << AttrName_DataWindow)
+                                   | (0x01U << AttrName_DisplayWindow)
+                                   | (0x01U << AttrName_LineOrder)
+                                   | (0x01U << AttrName_PixelAspectRatio)
+                                   | (0x01U << AttrName_ScreenWindowCenter)
+                                   | (0x01U << AttrName_ScreenWindowWidth);
+
+    static const u32 TiledFlags = (0x01U << AttrName_Tiles);
+
+    static const u32 MultiPartFlags = (0x01U << AttrName_Name)
+                                      | (0x01U << AttrName_Type)
+                                      | (0x01U << AttrName_ChunkCount);
+
+    static const u32 DeepDataFlags = (0x01U << AttrName_Name)
+                                     | (0x01U << AttrName_Type)
+                                     | (0x01U << AttrName_Version)
+                                     | (0x01U << AttrName_ChunkCount)
+                                     | (0x01U << AttrName_Tiles)
+                                     | (0x01U << AttrName_MaxSamplesPerPixel);
+
+    u32 flags = 0;
+    for(;;) {
+        Status status = readAttribute(flags, stream);
+        if(Error == status) {
             return false;
         }
-        if(MARKER_EOI == segment.marker_) {
-            loop = false;
+        if(End == status) {
+            break;
+        }
+    }
+
+    if(CommonFlags != (flags & CommonFlags)) {
+        return false;
+    }
+    // A part of a multi-part file tells its kind by the type attribute
+    if(version_.isMultiPart() && 0 != (flags & (0x01U << AttrName_Type))) {
+        if(0 == strcmp(header_.type_, "tiledimage") || 0 == strcmp(header_.type_, "deeptile")) {
+            version_.version_ |= Version::Flag_TileFormat;
+        } else {
+            version_.version_ &= ~Version::Flag_TileFormat;
+        }
+        if(0 == strcmp(header_.type_, "deepscanline") || 0 == strcmp(header_.type_, "deeptile")) {
+            version_.version_ |= Version::Flag_DeepData;
+        }
+    }
+    if(version_.isTile() && (TiledFlags != (flags & TiledFlags))) {
+        return false;
+    }
+    if(version_.isMultiPart() && (MultiPartFlags != (flags & MultiPartFlags))) {
+        return false;
+    }
+    if(version_.isDeepData() && (DeepDataFlags != (flags & DeepDataFlags))) {
+        return false;
+    }
+
+    if(0 == (flags & (0x01U << AttrName_ChunkCount))) {
+        if(0 == (flags & (0x01U << AttrName_Tiles))) {
+            switch(header_.compression_) {
+            case NO_COMPRESSION:
+            case RLE_COMPRESSION:
+            case ZIPS_COMPRESSION:
+            case ZIP_COMPRESSION:
+            case PIZ_COMPRESSION:
+            case PXR24_COMPRESSION:
+            case B44_COMPRESSION:
+            case B44A_COMPRESSION: {
+                s32 lines = (header_.dataWindow_.yMax_ - header_.dataWindow_.yMin_ + 1);
+                s32 linesPerBlock = getLinesPerBlock(header_.compression_);
+                header_.chunkCount_ = (lines + (linesPerBlock - 1)) / linesPerBlock;
+            } break;
+            }
+        }
+    }
+    if(version_.isTile() && !initializeLevels()) {
+        return false;
+    }
+    return true;
+}
+
+OpenEXR::Context::Status OpenEXR::Context::readAttribute(u32& flags, Stream& stream)
+{
+    AttributeName attributeName;
+    AttributeType attributeType;
+    Char str[MaxStringSize];
+
+    // Read attribute name
+    if(OpenEXR::read(str, stream) <= 0) {
+        return Error;
+    }
+    attributeName = findAttributeName(str);
+    // End of an attribute list
+    if(AttrName_End == attributeName) {
+        return End;
+    }
+    if(AttrName_Max == attributeName) {
+        skipUnknownName(stream);
+        return Success;
+    }
+
+    // Read attribute type
+    if(OpenEXR::read(str, stream) <= 0) {
+        return Error;
+    }
+    attributeType = findAttributeType(str);
+    if(AttrType_Max == attributeType) {
+        skipUnknownType(stream);
+        return Success;
+    }
+
+    s32 size;
+    if(stream.read(sizeof(s32), &size) <= 0) {
+        return Error;
+    }
+    switch(attributeName) {
+    case AttrName_Channels:
+        if(!readChannels(stream, size)) {
+            return Error;
+        }
+        break;
+    case AttrName_Compression:
+        if(stream.read(sizeof(u8), &header_.compression_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_DataWindow:
+        if(stream.read(sizeof(Box2i), &header_.dataWindow_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_DisplayWindow:
+        if(stream.read(sizeof(Box2i), &header_.displayWindow_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_LineOrder:
+        if(stream.read(sizeof(u8), &header_.lineOrder_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_PixelAspectRatio:
+        if(stream.read(sizeof(f32), &header_.pixelAspectRatio_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_ScreenWindowCenter:
+        if(stream.read(sizeof(Vector2f), &header_.screenWindowCenter_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_ScreenWindowWidth:
+        if(stream.read(sizeof(f32), &header_.screenWindowWidth_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_Tiles: {
+        u8 mode;
+        if(stream.read(sizeof(u32), &header_.tiles_.xSize_) <= 0
+           || stream.read(sizeof(u32), &header_.tiles_.ySize_) <= 0
+           || stream.read(sizeof(u8), &mode) <= 0) {
+            return Error;
+        }
+        if(0 == header_.tiles_.xSize_ || 0x7FFFFFFFU < header_.tiles_.xSize_
+           || 0 == header_.tiles_.ySize_ || 0x7FFFFFFFU < header_.tiles_.ySize_) {
+            return Error;
+        }
+        header_.tiles_.levelMode_ = mode & 0x0FU;
+        header_.tiles_.roundingMode_ = mode >> 4;
+    } break;
+    case AttrName_View:
+        if(readString(header_.view_, size, stream) < 0) {
+            return Error;
+        }
+        break;
+    case AttrName_Name:
+        if(readString(header_.name_, size, stream) < 0) {
+            return Error;
+        }
+        break;
+    case AttrName_Type:
+        if(readString(header_.type_, size, stream) < 0) {
+            return Error;
+        }
+        break;
+    case AttrName_Version:
+        if(stream.read(sizeof(s32), &header_.version_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_ChunkCount:
+        if(stream.read(sizeof(s32), &header_.chunkCount_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_MaxSamplesPerPixel:
+        if(stream.read(sizeof(s32), &header_.maxSamplesPerPixel_) <= 0) {
+            return Error;
+        }
+        break;
+    case AttrName_Chromaticities:
+        if(stream.read(sizeof(Chromaticities), &header_.chromaticities_) <= 0) {
+            return Error;
+        }
+        header_.hasChromaticities_ = true;
+        break;
+    default:
+        return Success;
+    }
+    flags |= 0x01U << attributeName;
+    return Success;
+}
+
+void OpenEXR::Context::skipUnknownName(Stream& stream)
+{
+    // Skip type string
+    s32 length = 0;
+    Char c;
+    while(length < MaxStringSize) {
+        if(stream.read(1, &c) <= 0) {
+            return;
+        }
+        if(CPPIMG_NULLCHAR == c) {
             break;
         }
+        ++length;
+    }
+
+    skipUnknownType(stream);
+}
+
+void OpenEXR::Context::skipUnknownType(Stream& stream)
+{
+    s32 size = 0;
+    if(stream.read(sizeof(s32), &size) <= 0) {
+        return;
+    }
+    stream.seek(size, SEEK_CUR);
+}
 
-        switch(segment.marker_) {
-        case MARKER_SOI:
+bool OpenEXR::Context::readChannel(Channel& channel, Stream& stream)
+{
+    s32 length = 0;
+    channel.name_[length] = CPPIMG_NULLCHAR;
+    while(length < MaxStringSize) {
+        Char c;
+        if(stream.read(1, &c) <= 0) {
             return false;
-
-        case MARKER_DQT:
-            if(!readDQT(*context, segment)) {
-                return false;
-            }
-            context->flags_ |= Flag_DQT;
-            break;
-        case MARKER_DHT:
-            if(!readDHT(*context, segment)) {
-                return false;
-            }
-            context->flags_ |= Flag_DHT;
-            break;
-        case MARKER_DRI:
-            if(!readDRI(*context, segment)) {
-                return false;
-            }
-            break;
-        case MARKER_DNL:
-            if(!readDNL(*context, segment)) {
-                return false;
-            }
-            break;
-        case MARKER_SOF0:
-        case MARKER_SOF1:
-        case MARKER_SOF2:
-        case MARKER_SOF3:
-        case MARKER_SOF5:
-        case MARKER_SOF6:
-        case MARKER_SOF7:
-        case MARKER_SOF9:
-        case MARKER_SOFA:
-        case MARKER_SOFB:
-        case MARKER_SOFD:
-        case MARKER_SOFE:
-        case MARKER_SOFF:
-            if(!readSOF(*context, segment)) {
-                return false;
-            }
-            break;
-        case MARKER_APP0:
-            if(!readJFXX(*context, segment)) {
-                return false;
-            }
-            break;
-        case MARKER_SOS:
-            if(!readSOS(*context, segment)) {
-                return false;
-            }
-            loop = false;
-            context->flags_ |= Flag_SOS;
-            break;
-        default:
-            if(!context->byteStream_.skipSegment(segment)) {
-                return false;
-            }
+        }
+        channel.name_[length] = c;
+        if(c == CPPIMG_NULLCHAR) {
             break;
         }
-    };
-    if(Flag_NEEDS != (context->flags_ & Flag_NEEDS)) {
-        return false;
+        ++length;
     }
-
-    width = context->frame_.width_;
-    height = context->frame_.height_;
-    // Support only gray and YCrCb formats
-    switch(context->frame_.numComponents_) {
-    case 1:
-        colorType = ColorType::GRAY;
-        break;
-    case 3:
-        colorType = ColorType::RGB;
-        break;
-    default:
+    if(MaxStringSize <= length) {
         return false;
     }
-    if(CPPIMG_NULL == image) {
+    if(length <= 0) {
         return true;
     }
-
-    context->rgb_ = reinterpret_cast<u8*>(image);
-    context->createCosTable();
-    context->work_ = reinterpret_cast<s16*>(CPPIMG_MALLOC(sizeof(s16) * width * height * context->frame_.numComponents_));
-    if(!decode(*context)) {
+    if(stream.read(sizeof(s32), &channel.pixelType_) <= 0) {
         return false;
     }
-    switch(context->frame_.numComponents_) {
-    case 1:
-        toGray(*context);
-        break;
-    case 3:
-        toRGB(*context);
-        break;
-    default:
+    if(stream.read(4, channel.flags_) <= 0) {
+        return false;
+    }
+    if(stream.read(sizeof(s32), &channel.xSampling_) <= 0) {
+        return false;
+    }
+    if(stream.read(sizeof(s32), &channel.ySampling_) <= 0) {
         return false;
     }
-    seekSet.clear();
     return true;
 }
 
-bool JPEG::readDQT(Context& context, const Segment& segment)
+bool OpenEXR::Context::readChannels(Stream& stream, s32 valueSize)
 {
-    ByteStream& stream = context.byteStream_;
-
-    s32 size = 2;
-    while(size < segment.length_) {
-        u8 precisionAndNumber;
-        if(stream.read(1, &precisionAndNumber) <= 0) {
+    s32 count = 0;
+    s32 size = 0;
+    Channel tmp;
+    for(;;) {
+        Channel* channel = (count < MaxInChannels) ? &header_.channels_[count] : &tmp;
+        if(!readChannel(*channel, stream)) {
             return false;
         }
-        ++size;
-        s32 precision = (precisionAndNumber >> 4) & 0xFU;
-        if(1 < precision) {
+
+        if(channel->name_[0] == CPPIMG_NULLCHAR) {
+            size += 1;
+            break;
+        }
+        if(MaxInChannels <= count) {
+            // All channels are stored in each chunk, so cannot skip some of them
             return false;
         }
-        s32 id = precisionAndNumber & 0xFU;
-        if(4 <= id) {
+        if(channel->pixelType_ < static_cast<s32>(Type::UINT) || static_cast<s32>(Type::FLOAT) < channel->pixelType_) {
             return false;
         }
+        size += static_cast<s32>(sizeof(s32) * 4 + sizeof(Char) * (strlen(channel->name_) + 1));
+        ++count;
+    }
+    header_.numChannels_ = count;
+    header_.sortChannels();
+    return size == valueSize;
+}
 
-        QuantizationTable& quantization = context.quantization_[id];
-        quantization.precisionAndNumber_ = precisionAndNumber;
+bool OpenEXR::Context::readOffsetTable(Stream& stream)
+{
+    CPPIMG_FREE(offsetTable_);
+    u32 size = sizeof(u64) * header_.chunkCount_;
+    offsetTable_ = reinterpret_cast<u64*>(CPPIMG_MALLOC(size));
+    return 0 < stream.read(size, offsetTable_);
+}
 
-        if(precision < 1) {
-            u8 factors8[QT_SIZE];
-            if(stream.read(QT_SIZE, factors8) <= 0) {
-                return false;
-            }
-            for(s32 i = 0; i < QT_SIZE; ++i) {
-                quantization.factors_[ZigZag[i]] = factors8[i];
-            }
-            size += QT_SIZE;
-        } else {
-            u16 factors16[QT_SIZE];
-            if(stream.read(QT_SIZE * 2, factors16) <= 0) {
-                return false;
-            }
-            for(s32 i = 0; i < QT_SIZE; ++i) {
-                quantization.factors_[ZigZag[i]] = swapEndian(factors16[i]);
-            }
-            size += QT_SIZE * 2;
-        }
+bool OpenEXR::Context::readPartNumber(Stream& stream) const
+{
+    if(!version_.isMultiPart()) {
+        return true;
     }
-    return size == segment.length_;
+    s32 part;
+    if(stream.read(sizeof(s32), &part) <= 0) {
+        return false;
+    }
+    return part == part_;
 }
 
-bool JPEG::readDHT(Context& context, const Segment& segment)
+bool OpenEXR::Context::getInformation(Information& information, s32 width, s32 height) const
 {
-    ByteStream& stream = context.byteStream_;
+    if(width <= 0 || height <= 0 || !header_.getColorType(information.colorType_)) {
+        return false;
+    }
+    information.width_ = width;
+    information.height_ = height;
+    information.numChannels_ = cppimg::getNumChannels(information.colorType_);
+    for(s32 i = 0; i < information.numChannels_; ++i) {
+        u32 name = (ColorType::GRAY == information.colorType_) ? static_cast<u32>(cppimg::Channel::Y) : static_cast<u32>(i);
+        information.types_[i] = header_.findChannel(ChannelNames[name])->pixelType_;
+    }
+    return true;
+}
 
-    u8 bits[HT_BITS_TABLE];
-    s32 size = 2;
-    while(size < segment.length_) {
-        u8 classAndId; // upper:precision, lower:id of huffman table
-        if(stream.read(1, &classAndId) <= 0) {
-            return false;
-        }
-        ++size;
-        s32 huffmanClass = (classAndId >> 4) & 0xFU;
-        if(2 <= huffmanClass) {
-            return false;
-        }
-        s32 id = classAndId & 0xFU;
-        if(4 <= id) {
+void OpenEXR::Context::getImageSlices(Slice slices[MaxInChannels], void* image, s64 pitch, const Type* type) const
+{
+    for(s32 i = 0; i < header_.numChannels_; ++i) {
+        slices[i].name_ = header_.channels_[i].name_;
+        slices[i].type_ = (CPPIMG_NULL != type) ? *type : static_cast<Type>(header_.channels_[i].pixelType_);
+        slices[i].base_ = CPPIMG_NULL;
+    }
+    ColorType colorType;
+    if(!header_.getColorType(colorType)) {
+        return;
+    }
+    s32 numChannels = cppimg::getNumChannels(colorType);
+    s32 index[MaxChannels];
+    s32 bytesPerPixel = 0;
+    for(s32 i = 0; i < numChannels; ++i) {
+        u32 name = (ColorType::GRAY == colorType) ? static_cast<u32>(cppimg::Channel::Y) : static_cast<u32>(i);
+        index[i] = static_cast<s32>(header_.findChannel(ChannelNames[name]) - header_.channels_);
+        bytesPerPixel += cppimg::getSize(slices[index[i]].type_);
+    }
+    // Channels can have different types, so accumulate sizes in the output order
+    s64 offset = 0;
+    for(s32 i = 0; i < numChannels; ++i) {
+        Slice& slice = slices[index[i]];
+        slice.base_ = reinterpret_cast<u8*>(image) + offset;
+        slice.xStride_ = bytesPerPixel;
+        slice.yStride_ = pitch;
+        offset += cppimg::getSize(slice.type_);
+    }
+}
+
+bool OpenEXR::Context::getSlices(Slice slices[MaxInChannels], s32 numSlices, const Slice* selected) const
+{
+    CPPIMG_ASSERT(0 <= numSlices);
+    CPPIMG_ASSERT(0 == numSlices || CPPIMG_NULL != selected);
+    for(s32 i = 0; i < header_.numChannels_; ++i) {
+        slices[i].base_ = CPPIMG_NULL;
+    }
+    for(s32 i = 0; i < numSlices; ++i) {
+        CPPIMG_ASSERT(CPPIMG_NULL != selected[i].name_);
+        CPPIMG_ASSERT(CPPIMG_NULL != selected[i].base_);
+        const Channel* channel = header_.findChannel(selected[i].name_);
+        if(CPPIMG_NULL == channel) {
             return false;
         }
+        slices[channel - header_.channels_] = selected[i];
+    }
+    return true;
+}
 
-        if(stream.read(HT_BITS_TABLE, bits) <= 0) {
-            return false;
-        }
-        size += HT_BITS_TABLE;
+bool OpenEXR::Context::isInDataWindow(const Box2i& region) const
+{
+    return header_.dataWindow_.xMin_ <= region.xMin_ && region.xMax_ <= header_.dataWindow_.xMax_
+           && header_.dataWindow_.yMin_ <= region.yMin_ && region.yMax_ <= header_.dataWindow_.yMax_;
+}
 
-        HuffmanTable& table = context.huffman_[huffmanClass][id];
-        // Count number of elements
-        table.number_ = 0;
-        for(s32 i = 0; i < HT_BITS_TABLE; ++i) {
-            table.number_ += bits[i];
-        }
-        if(HT_MAX_SIZE < table.number_) {
-            return false;
+bool OpenEXR::Context::readScanlines(Stream& stream, const Slice* slices, const Box2i& region, s32 numThreads)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != slices);
+    const Box2i& dataWindow = header_.dataWindow_;
+    s32 top = maximum(region.yMin_, dataWindow.yMin_);
+    s32 bottom = minimum(region.yMax_, dataWindow.yMax_);
+    if(bottom < top || region.xMax_ < dataWindow.xMin_ || dataWindow.xMax_ < region.xMin_) {
+        return true;
+    }
+    // Chunks in the offset table are sorted by y
+    s32 linesPerChunk = getLinesPerChunk();
+    s32 first = (top - dataWindow.yMin_) / linesPerChunk;
+    s32 count = (bottom - dataWindow.yMin_) / linesPerChunk - first + 1;
+    if(header_.chunkCount_ < first + count) {
+        return false;
+    }
+    bool result = false;
+    switch(header_.compression_) {
+    case NO_COMPRESSION:
+    case RLE_COMPRESSION:
+    case ZIPS_COMPRESSION:
+    case ZIP_COMPRESSION:
+    case PIZ_COMPRESSION:
+    case PXR24_COMPRESSION:
+    case B44_COMPRESSION:
+    case B44A_COMPRESSION:
+        result = readScanlineChunks(stream, slices, region, first, count, numThreads);
+        break;
+    default:
+        break;
+    }
+    return result;
+}
+
+namespace
+{
+#    if !defined(CPPIMG_DISABLE_THREADS)
+    template<class T>
+    struct ParallelFor
+    {
+        static void run(ParallelFor* self, s32 worker)
+        {
+            while(!self->failed_.load()) {
+                s32 index = self->next_.fetch_add(1);
+                if(self->count_ <= index) {
+                    break;
+                }
+                if(!(*self->job_)(worker, index)) {
+                    self->failed_.store(true);
+                }
+            }
         }
 
-        // Generate size table
-        s32 k = 0;
-        for(u8 i = 1; i <= HT_BITS_TABLE; ++i) {
-            for(u8 j = 1; j <= bits[i - 1]; ++j, ++k) {
-                table.size_[k] = i;
+        T* job_;
+        s32 count_;
+        std::atomic<s32> next_;
+        std::atomic<bool> failed_;
+    };
+#    endif
+
+    /**
+        @brief Call job(worker, index) for each index in [0, count), worker is in [0, numThreads)
+        @return Success:true, Fail:false if any of jobs fails
+        */
+    template<class T>
+    bool parallelFor(s32 numThreads, s32 count, T& job)
+    {
+#    if !defined(CPPIMG_DISABLE_THREADS)
+        if(1 < numThreads) {
+            ParallelFor<T> parallel;
+            parallel.job_ = &job;
+            parallel.count_ = count;
+            parallel.next_.store(0);
+            parallel.failed_.store(false);
+            std::thread* threads = CPPIMG_NEW std::thread[numThreads - 1];
+            for(s32 i = 1; i < numThreads; ++i) {
+                threads[i - 1] = std::thread(ParallelFor<T>::run, &parallel, i);
+            }
+            ParallelFor<T>::run(&parallel, 0);
+            for(s32 i = 1; i < numThreads; ++i) {
+                threads[i - 1].join();
+            }
+            CPPIMG_DELETE_ARRAY(threads);
+            return !parallel.failed_.load();
+        }
+#    else
+        (void)numThreads;
+#    endif
+        for(s32 i = 0; i < count; ++i) {
+            if(!job(0, i)) {
+                return false;
             }
         }
+        return true;
+    }
+} // namespace
 
-        // Generate code table
-        k = 0;
-        u16 code = 0;
-        u8 si = table.size_[0];
-        for(;;) {
-            for(; table.size_[k] == si; ++k, ++code) {
-                table.code_[k] = code;
-            }
-            if(table.number_ <= k) {
-                break;
+/**
+    @brief Read chunks one by one under a lock, then decode them in parallel
+    */
+struct OpenEXR::Context::ScanlineChunkJob
+{
+    bool operator()(s32 worker, s32 index)
+    {
+        s32 y;
+        s32 dataSize;
+        {
+#    if !defined(CPPIMG_DISABLE_THREADS)
+            std::lock_guard<std::mutex> lock(mutex_);
+#    endif
+            if(!context_->readScanlineChunk(workers_[worker], first_ + index, *stream_, y, dataSize)) {
+                return false;
             }
-            do {
-                code <<= 1;
-                ++si;
-            } while(table.size_[k] != si);
         }
-        if(stream.read(table.number_, table.value_) <= 0) {
-            return false;
-        }
-        size += table.number_;
+        return context_->decodeScanlineChunk(workers_[worker], slices_, *region_, y, dataSize);
+    }
 
-    } // while(size<segment.length_)
-    return size == segment.length_;
+    Context* context_;
+    Worker* workers_;
+    Stream* stream_;
+    const Slice* slices_;
+    const Box2i* region_;
+    s32 first_;
+#    if !defined(CPPIMG_DISABLE_THREADS)
+    std::mutex mutex_;
+#    endif
+};
+
+OpenEXR::Context::Worker::Worker()
+    : hasContext_(false)
+    , piz_(CPPIMG_NULL)
+{
 }
 
-bool JPEG::readDRI(Context& context, const Segment& segment)
+OpenEXR::Context::Worker::~Worker()
 {
-    ByteStream& stream = context.byteStream_;
+    CPPIMG_DELETE(piz_);
+    if(hasContext_) {
+        szlib::termInflate(&context_);
+    }
+}
 
-    s32 size = 2;
-    while(size < segment.length_) {
-        if(!stream.read16(context.restartInterval_)) {
-            return false;
-        }
-        size += 2;
+bool OpenEXR::Context::Worker::initialize(s32 compression)
+{
+    if(PIZ_COMPRESSION == compression && CPPIMG_NULL == piz_) {
+        piz_ = CPPIMG_NEW PIZ;
     }
-    return size == segment.length_;
+    if(!hasContext_) {
+        hasContext_ = szlib::SZ_OK == szlib::createInflate(&context_);
+    }
+    return hasContext_;
 }
 
-bool JPEG::readDNL(Context& context, const Segment& segment)
+bool OpenEXR::Context::readScanlineChunks(Stream& stream, const Slice* slices, const Box2i& region, s32 first, s32 count, s32 numThreads)
 {
-    ByteStream& stream = context.byteStream_;
-    s32 size = 2;
-    while(size < segment.length_) {
-        if(!stream.read16(context.numberOfLines_)) {
-            return false;
+    numThreads = getNumThreads(numThreads, count);
+    Worker* workers = CPPIMG_NEW Worker[numThreads];
+    s32 width = header_.dataWindow_.xMax_ - header_.dataWindow_.xMin_ + 1;
+    s32 blockSize = width * header_.getBytesPerPixel() * getLinesPerChunk();
+    bool result = true;
+    for(s32 i = 0; i < numThreads; ++i) {
+        if(!workers[i].initialize(header_.compression_)
+           || !workers[i].dst_.reserve(blockSize * 2)
+           || !workers[i].tmp_.reserve(blockSize * 2)) {
+            result = false;
+            break;
         }
-        size += 2;
     }
-    return size == segment.length_;
+    if(result) {
+        ScanlineChunkJob job;
+        job.context_ = this;
+        job.workers_ = workers;
+        job.stream_ = &stream;
+        job.slices_ = slices;
+        job.region_ = &region;
+        job.first_ = first;
+        result = parallelFor(numThreads, count, job);
+    }
+    CPPIMG_DELETE_ARRAY(workers);
+    return result;
 }
 
-bool JPEG::readSOF(Context& context, const Segment& segment)
+bool OpenEXR::Context::readScanlineChunk(Worker& worker, s32 index, Stream& stream, s32& y, s32& dataSize)
 {
-    ByteStream& stream = context.byteStream_;
-    if(stream.read(1, &context.frame_.precision_) <= 0) {
+    if(!stream.seek(offsetTable_[index], SEEK_SET) || !readPartNumber(stream)) {
         return false;
     }
-    if(!stream.read16(context.frame_.height_)) {
-        return false;
-    }
-    if(!stream.read16(context.frame_.width_)) {
+    if(stream.read(sizeof(s32), &y) <= 0) {
         return false;
     }
-    if(stream.read(1, &context.frame_.numComponents_) <= 0) {
+    if(stream.read(sizeof(s32), &dataSize) <= 0) {
         return false;
     }
-
-    if(context.frame_.numComponents_ <= 0 || MAX_COMPONENTS < context.frame_.numComponents_) {
+    if(dataSize <= 0 || !worker.src_.reserve(dataSize)) {
         return false;
     }
-    s32 count = 0;
-    s32 size = 8;
-    while(size < segment.length_ && count < context.frame_.numComponents_) {
-        if(stream.read(3, &context.frame_.components_[count]) <= 0) {
-            return false;
-        }
-        if(context.frame_.components_[count].getVertical() <= 0 || context.frame_.components_[count].getHorizontal() <= 0) {
-            return false;
-        }
-        ++count;
-        size += 3;
-    }
-    return size == segment.length_;
+    return 0 < stream.read(dataSize, &worker.src_[0]);
 }
 
-bool JPEG::readSOS(Context& context, const Segment& segment)
+bool OpenEXR::Context::decodeScanlineChunk(Worker& worker, const Slice* slices, const Box2i& region, s32 y, s32 dataSize)
 {
-    ByteStream& stream = context.byteStream_;
-    if(stream.read(1, &context.scan_.numComponents_) <= 0) {
-        return false;
-    }
-    s32 size = 3;
-    s32 segmentSize = segment.length_ - 3;
-    s32 count = 0;
-    while(size < segmentSize && count < context.scan_.numComponents_) {
-        if(stream.read(sizeof(Scan::Component), &context.scan_.components_[count]) <= 0) {
-            return false;
-        }
-        ++count;
-        size += sizeof(Scan::Component);
-    }
-    if(stream.read(1, &context.scan_.startSpectra_) <= 0) {
+    s32 linesPerChunk = getLinesPerChunk();
+    s32 width = header_.dataWindow_.xMax_ - header_.dataWindow_.xMin_ + 1;
+    // Each chunk writes a disjoint band of the image
+    if(y < header_.dataWindow_.yMin_ || header_.dataWindow_.yMax_ < y) {
         return false;
     }
-    if(stream.read(1, &context.scan_.endSpectra_) <= 0) {
-        return false;
-    }
-    if(stream.read(1, &context.scan_.pointTransform_) <= 0) {
+    s32 lines = minimum(linesPerChunk, header_.dataWindow_.yMax_ - y + 1);
+
+    const u8* data;
+    if(!uncompressChunk(worker, data, width, lines, dataSize)) {
         return false;
     }
-    size += 3;
-    return size == segment.length_;
+    copyChunk(slices, region, header_.dataWindow_.xMin_, y, width, lines, data);
+    return true;
 }
 
-bool JPEG::readJFXX(Context& context, const Segment& segment)
+s32 OpenEXR::Context::getLinesPerChunk() const
 {
-    ByteStream& stream = context.byteStream_;
-    s32 size = 2;
-    if(stream.read(5, context.jfxx_.id_) <= 0) {
-        return false;
+    return getLinesPerBlock(header_.compression_);
+}
+
+bool OpenEXR::Context::uncompressChunk(Worker& worker, const u8*& data, s32 width, s32 lines, s32 dataSize)
+{
+    s32 numChannels = header_.numChannels_;
+    s32 size = width * header_.getBytesPerPixel() * lines;
+    s32 sizes[MaxInChannels];
+    s32 types[MaxInChannels];
+    header_.getTypes(types);
+    for(s32 i = 0; i < numChannels; ++i) {
+        sizes[i] = cppimg::getSize(static_cast<Type>(types[i]));
     }
-    context.jfxx_.id_[4] = CPPIMG_NULLCHAR;
-    size += 5;
 
-    if(0 == strcmp(reinterpret_cast<const char*>(context.jfxx_.id_), "JFIF")) {
-        JFXX::IF& jfif = context.jfxx_.format_.jfif_;
-        if(stream.read(2, &jfif.version_) <= 0) {
-            return false;
-        }
-        if(stream.read(1, &jfif.unit_) <= 0) {
-            return false;
-        }
-        if(stream.read(2, &jfif.xdensity_) <= 0) {
-            return false;
-        }
-        if(stream.read(2, &jfif.ydensity_) <= 0) {
-            return false;
-        }
-        if(stream.read(1, &jfif.xthumb_) <= 0) {
-            return false;
+    // A chunk is stored as is, if compression does not make it smaller
+    data = &worker.src_[0];
+    if(size == dataSize) {
+        return true;
+    }
+    if(size < dataSize) {
+        return false;
+    }
+    s32 uncompressed = -1;
+    switch(header_.compression_) {
+    case RLE_COMPRESSION:
+        uncompressed = uncompressRLE(worker.dst_, worker.tmp_, dataSize, &worker.src_[0]);
+        break;
+    case ZIPS_COMPRESSION:
+    case ZIP_COMPRESSION:
+        uncompressed = uncompressZlib(worker.context_, worker.dst_, worker.tmp_, dataSize, &worker.src_[0]);
+        break;
+    case PIZ_COMPRESSION:
+        if(worker.dst_.reserve(size) && worker.piz_->uncompress(&worker.dst_[0], width, lines, numChannels, sizes, dataSize, &worker.src_[0])) {
+            uncompressed = size;
         }
-        if(stream.read(1, &jfif.ythumb_) <= 0) {
-            return false;
+        break;
+    case PXR24_COMPRESSION:
+        if(worker.dst_.reserve(size) && uncompressPXR24(worker.context_, &worker.dst_[0], worker.tmp_, width, lines, numChannels, types, dataSize, &worker.src_[0])) {
+            uncompressed = size;
         }
-        size += 9;
-        s32 thumbSize = 3 * jfif.xthumb_ * jfif.ythumb_;
-        if(!stream.skip(thumbSize)) {
-            return false;
+        break;
+    case B44_COMPRESSION:
+    case B44A_COMPRESSION: {
+        u8 linears[MaxInChannels];
+        for(s32 i = 0; i < numChannels; ++i) {
+            linears[i] = header_.channels_[i].flags_[0];
         }
-        size += thumbSize;
-
-    } else if(0 == strcmp(reinterpret_cast<const char*>(context.jfxx_.id_), "JFXX")) {
-        JFXX::XX& jfxx = context.jfxx_.format_.jfxx_;
-        if(stream.read(1, &jfxx.type_) <= 0) {
-            return false;
+        if(worker.dst_.reserve(size) && uncompressB44(&worker.dst_[0], worker.tmp_, width, lines, numChannels, types, linears, dataSize, &worker.src_[0])) {
+            uncompressed = size;
         }
-        size += (segment.length_ - (2 + 5 + 1));
+    } break;
+    default:
+        break;
     }
-    return size == segment.length_;
+    data = &worker.dst_[0];
+    return size == uncompressed;
 }
 
-bool JPEG::decode(Context& context)
+namespace
 {
-    START_TIMER;
+    /**
+        @brief SIMD part of transposing planes of N channels to interleaved pixels and back
+        @return Number of processed pixels
+        */
+    template<class T, s32 N>
+    struct Shuffle
+    {
+        static s32 interleave(u8*, const u8* const*, s32)
+        {
+            return 0;
+        }
 
-    s32 vblocks = blocks(context.frame_.height_);
-    s32 hblocks = blocks(context.frame_.width_);
-    if(!context.frame_.getMaxSampling()) {
-        return false;
+        static s32 deinterleave(u8* const*, const u8*, s32)
+        {
+            return 0;
+        }
+    };
+
+#    if !defined(CPPIMG_DISABLE_AVX)
+    inline void transpose16x4(__m128i& x0, __m128i& x1, __m128i& x2, __m128i& x3)
+    {
+        // 2 pixels of 4 channels in each, to 8 samples of a channel in each
+        __m128i t0 = _mm_unpacklo_epi16(x0, x1);
+        __m128i t1 = _mm_unpackhi_epi16(x0, x1);
+        __m128i t2 = _mm_unpacklo_epi16(x2, x3);
+        __m128i t3 = _mm_unpackhi_epi16(x2, x3);
+        __m128i u0 = _mm_unpacklo_epi16(t0, t1);
+        __m128i u1 = _mm_unpackhi_epi16(t0, t1);
+        __m128i u2 = _mm_unpacklo_epi16(t2, t3);
+        __m128i u3 = _mm_unpackhi_epi16(t2, t3);
+        x0 = _mm_unpacklo_epi64(u0, u2);
+        x1 = _mm_unpackhi_epi64(u0, u2);
+        x2 = _mm_unpacklo_epi64(u1, u3);
+        x3 = _mm_unpackhi_epi64(u1, u3);
+    }
+
+    inline void untranspose16x4(__m128i& x0, __m128i& x1, __m128i& x2, __m128i& x3)
+    {
+        __m128i t0 = _mm_unpacklo_epi16(x0, x1);
+        __m128i t1 = _mm_unpackhi_epi16(x0, x1);
+        __m128i t2 = _mm_unpacklo_epi16(x2, x3);
+        __m128i t3 = _mm_unpackhi_epi16(x2, x3);
+        x0 = _mm_unpacklo_epi32(t0, t2);
+        x1 = _mm_unpackhi_epi32(t0, t2);
+        x2 = _mm_unpacklo_epi32(t1, t3);
+        x3 = _mm_unpackhi_epi32(t1, t3);
     }
 
-    s32 maxVSampling = context.frame_.maxVerticalSampling_;
-    s32 maxHSampling = context.frame_.maxHorizontalSampling_;
-    s32 vUnits = vblocks / maxVSampling;
-    s32 hUnits = hblocks / maxHSampling;
-    if(0 < (vblocks - (maxVSampling * vUnits))) {
-        ++vUnits;
+    inline void transpose32x4(__m128i& x0, __m128i& x1, __m128i& x2, __m128i& x3)
+    {
+        __m128i t0 = _mm_unpacklo_epi32(x0, x1);
+        __m128i t1 = _mm_unpacklo_epi32(x2, x3);
+        __m128i t2 = _mm_unpackhi_epi32(x0, x1);
+        __m128i t3 = _mm_unpackhi_epi32(x2, x3);
+        x0 = _mm_unpacklo_epi64(t0, t1);
+        x1 = _mm_unpackhi_epi64(t0, t1);
+        x2 = _mm_unpacklo_epi64(t2, t3);
+        x3 = _mm_unpackhi_epi64(t2, t3);
     }
-    if(0 < (hblocks - (maxHSampling * hUnits))) {
-        ++hUnits;
+
+    inline __m128i load128(const u8* src)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
     }
 
-    s32 unitSize = maxVSampling * maxHSampling * BLOCK_SIZE;
-    CPPIMG_MEMSET(&context.components_[0], 0x00U, sizeof(u8) * unitSize);
-    CPPIMG_MEMSET(&context.components_[1], 0x00U, sizeof(s16) * unitSize);
-    CPPIMG_MEMSET(&context.components_[2], 0x00U, sizeof(s16) * unitSize);
-    CPPIMG_MEMSET(&context.components_[3], 0x00U, sizeof(s16) * unitSize);
+    inline void store128(u8* dst, __m128i x)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), x);
+    }
 
-    context.directCurrents_[0] = 0;
-    context.directCurrents_[1] = 0;
-    context.directCurrents_[2] = 0;
-    context.directCurrents_[3] = 0;
+    template<>
+    struct Shuffle<u16, 4>
+    {
+        static s32 interleave(u8* dst, const u8* const* planes, s32 width)
+        {
+            s32 i = 0;
+            for(; (i + 8) <= width; i += 8, dst += 64) {
+                __m128i x0 = load128(planes[0] + i * 2);
+                __m128i x1 = load128(planes[1] + i * 2);
+                __m128i x2 = load128(planes[2] + i * 2);
+                __m128i x3 = load128(planes[3] + i * 2);
+                untranspose16x4(x0, x1, x2, x3);
+                store128(dst, x0);
+                store128(dst + 16, x1);
+                store128(dst + 32, x2);
+                store128(dst + 48, x3);
+            }
+            return i;
+        }
+
+        static s32 deinterleave(u8* const* planes, const u8* src, s32 width)
+        {
+            s32 i = 0;
+            for(; (i + 8) <= width; i += 8, src += 64) {
+                __m128i x0 = load128(src);
+                __m128i x1 = load128(src + 16);
+                __m128i x2 = load128(src + 32);
+                __m128i x3 = load128(src + 48);
+                transpose16x4(x0, x1, x2, x3);
+                store128(planes[0] + i * 2, x0);
+                store128(planes[1] + i * 2, x1);
+                store128(planes[2] + i * 2, x2);
+                store128(planes[3] + i * 2, x3);
+            }
+            return i;
+        }
+    };
 
-    ByteStream& stream = context.byteStream_;
+    template<>
+    struct Shuffle<u16, 3>
+    {
+        static s32 interleave(u8* dst, const u8* const* planes, s32 width)
+        {
+            // Drop the 4th channel of 2 pixels, a 16 bytes store overruns 4 bytes that the next one overwrites
+            const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+            s32 i = 0;
+            for(; (i + 9) <= width; i += 8, dst += 48) {
+                __m128i x0 = load128(planes[0] + i * 2);
+                __m128i x1 = load128(planes[1] + i * 2);
+                __m128i x2 = load128(planes[2] + i * 2);
+                __m128i x3 = _mm_setzero_si128();
+                untranspose16x4(x0, x1, x2, x3);
+                store128(dst, _mm_shuffle_epi8(x0, shuffle));
+                store128(dst + 12, _mm_shuffle_epi8(x1, shuffle));
+                store128(dst + 24, _mm_shuffle_epi8(x2, shuffle));
+                store128(dst + 36, _mm_shuffle_epi8(x3, shuffle));
+            }
+            return i;
+        }
+
+        static s32 deinterleave(u8* const* planes, const u8* src, s32 width)
+        {
+            // Load 2 pixels at each 12 bytes, and insert the 4th channel
+            const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1);
+            s32 i = 0;
+            for(; (i + 9) <= width; i += 8, src += 48) {
+                __m128i x0 = _mm_shuffle_epi8(load128(src), shuffle);
+                __m128i x1 = _mm_shuffle_epi8(load128(src + 12), shuffle);
+                __m128i x2 = _mm_shuffle_epi8(load128(src + 24), shuffle);
+                __m128i x3 = _mm_shuffle_epi8(load128(src + 36), shuffle);
+                transpose16x4(x0, x1, x2, x3);
+                store128(planes[0] + i * 2, x0);
+                store128(planes[1] + i * 2, x1);
+                store128(planes[2] + i * 2, x2);
+            }
+            return i;
+        }
+    };
 
-    s32 restartCount = 0;
-    for(s32 uy = 0; uy < vUnits; ++uy) {
-        for(s32 ux = 0; ux < hUnits; ++ux) {
-            if(!decodeMCU(context)) {
-                return false;
-            }
-            copyComponents(context, ux, uy);
-            if(0 < context.restartInterval_) {
-                if(context.restartInterval_ <= ++restartCount) {
-                    restartCount = 0;
-                    stream.reset();
-                    u8 marker;
-                    if(!stream.readMarker(marker)) {
-                        return false;
-                    }
-                    if(MARKER_RST0 <= marker && marker <= MARKER_RST7) {
-                        // Reset DC
-                        context.directCurrents_[0] = 0;
-                        context.directCurrents_[1] = 0;
-                        context.directCurrents_[2] = 0;
-                        context.directCurrents_[3] = 0;
-                    }
-                }
+    template<>
+    struct Shuffle<u32, 4>
+    {
+        static s32 interleave(u8* dst, const u8* const* planes, s32 width)
+        {
+            s32 i = 0;
+            for(; (i + 4) <= width; i += 4, dst += 64) {
+                __m128i x0 = load128(planes[0] + i * 4);
+                __m128i x1 = load128(planes[1] + i * 4);
+                __m128i x2 = load128(planes[2] + i * 4);
+                __m128i x3 = load128(planes[3] + i * 4);
+                transpose32x4(x0, x1, x2, x3);
+                store128(dst, x0);
+                store128(dst + 16, x1);
+                store128(dst + 32, x2);
+                store128(dst + 48, x3);
+            }
+            return i;
+        }
+
+        static s32 deinterleave(u8* const* planes, const u8* src, s32 width)
+        {
+            s32 i = 0;
+            for(; (i + 4) <= width; i += 4, src += 64) {
+                __m128i x0 = load128(src);
+                __m128i x1 = load128(src + 16);
+                __m128i x2 = load128(src + 32);
+                __m128i x3 = load128(src + 48);
+                transpose32x4(x0, x1, x2, x3);
+                store128(planes[0] + i * 4, x0);
+                store128(planes[1] + i * 4, x1);
+                store128(planes[2] + i * 4, x2);
+                store128(planes[3] + i * 4, x3);
+            }
+            return i;
+        }
+    };
+
+    template<>
+    struct Shuffle<u32, 3>
+    {
+        static s32 interleave(u8* dst, const u8* const* planes, s32 width)
+        {
+            // A 16 bytes store overruns 4 bytes that the next one overwrites
+            s32 i = 0;
+            for(; (i + 5) <= width; i += 4, dst += 48) {
+                __m128i x0 = load128(planes[0] + i * 4);
+                __m128i x1 = load128(planes[1] + i * 4);
+                __m128i x2 = load128(planes[2] + i * 4);
+                __m128i x3 = _mm_setzero_si128();
+                transpose32x4(x0, x1, x2, x3);
+                store128(dst, x0);
+                store128(dst + 12, x1);
+                store128(dst + 24, x2);
+                store128(dst + 36, x3);
+            }
+            return i;
+        }
+
+        static s32 deinterleave(u8* const* planes, const u8* src, s32 width)
+        {
+            // Load a pixel at each 12 bytes, the 4th channel is ignored
+            s32 i = 0;
+            for(; (i + 5) <= width; i += 4, src += 48) {
+                __m128i x0 = load128(src);
+                __m128i x1 = load128(src + 12);
+                __m128i x2 = load128(src + 24);
+                __m128i x3 = load128(src + 36);
+                transpose32x4(x0, x1, x2, x3);
+                store128(planes[0] + i * 4, x0);
+                store128(planes[1] + i * 4, x1);
+                store128(planes[2] + i * 4, x2);
+            }
+            return i;
+        }
+    };
+#    endif
+
+    template<class T, s32 N>
+    void interleaveSamples(u8* dst, const u8* const* planes, s32 width)
+    {
+        s32 i = Shuffle<T, N>::interleave(dst, planes, width);
+        for(dst += i * N * sizeof(T); i < width; ++i) {
+            for(s32 j = 0; j < N; ++j, dst += sizeof(T)) {
+                memcpy(dst, planes[j] + i * sizeof(T), sizeof(T));
             }
         }
     }
-    STOP_TIMER("JPEG::decode");
-    return true;
-}
 
-bool JPEG::decodeMCU(Context& context)
-{
-    s32 unitWidth = context.frame_.maxHorizontalSampling_ << BLOCK_SHIFT;
-
-    for(s32 i = 0; i < context.frame_.numComponents_; ++i) {
-        s32 vSampling = context.frame_.components_[i].getVertical();
-        s32 hSampling = context.frame_.components_[i].getHorizontal();
-        s32 vDuplicate = context.frame_.maxVerticalSampling_ / vSampling;
-        s32 hDuplicate = context.frame_.maxHorizontalSampling_ / hSampling;
-        s32 vCopy = vDuplicate << BLOCK_SHIFT;
-        s32 hCopy = hDuplicate << BLOCK_SHIFT;
-        for(s32 v = 0; v < vSampling; ++v) {
-            for(s32 h = 0; h < hSampling; ++h) {
-                if(!decodeHuffmanBlock(context, i)) {
-                    return false;
-                }
-                inverseQuantization(context, i);
-                inverseDCT(context);
-                s16* component = context.components_[i] + unitWidth * (v << BLOCK_SHIFT) + (h << BLOCK_SHIFT);
-                for(s32 j = 0; j < vCopy; ++j) {
-                    for(s32 k = 0; k < hCopy; ++k) {
-                        component[j * unitWidth + k] = context.block_[((j / vDuplicate) << BLOCK_SHIFT) + (k / hDuplicate)];
-                    }
-                }
+    template<class T, s32 N>
+    void deinterleaveSamples(u8* const* planes, const u8* src, s32 width)
+    {
+        s32 i = Shuffle<T, N>::deinterleave(planes, src, width);
+        for(src += i * N * sizeof(T); i < width; ++i) {
+            for(s32 j = 0; j < N; ++j, src += sizeof(T)) {
+                memcpy(planes[j] + i * sizeof(T), src, sizeof(T));
             }
         }
     }
-    return true;
-}
 
-s32 JPEG::decodeHuffmanCode(Context& context, s32 type, s32 table)
-{
-    ByteStream& stream = context.byteStream_;
+    template<class T>
+    void interleaveSamples(u8* dst, const u8* const* planes, s32 numChannels, s32 width)
+    {
+        switch(numChannels) {
+        case 1:
+            memcpy(dst, planes[0], sizeof(T) * width);
+            break;
+        case 2:
+            interleaveSamples<T, 2>(dst, planes, width);
+            break;
+        case 3:
+            interleaveSamples<T, 3>(dst, planes, width);
+            break;
+        case 4:
+            interleaveSamples<T, 4>(dst, planes, width);
+            break;
+        default:
+            CPPIMG_ASSERT(false);
+            break;
+        }
+    }
 
-    const HuffmanTable& huffmanTable = context.huffman_[type][table];
-    u16 code = 0;
-    u16 length = 0;
-    s32 next = 0;
-    s32 k = 0;
-    while(k < huffmanTable.number_ && length < HT_BITS_TABLE) {
-        ++length;
-        code <<= 1;
-        next = stream.readBits(1);
-        if(next < 0) {
-            return -1;
+    template<class T>
+    void deinterleaveSamples(u8* const* planes, const u8* src, s32 numChannels, s32 width)
+    {
+        switch(numChannels) {
+        case 1:
+            memcpy(planes[0], src, sizeof(T) * width);
+            break;
+        case 2:
+            deinterleaveSamples<T, 2>(planes, src, width);
+            break;
+        case 3:
+            deinterleaveSamples<T, 3>(planes, src, width);
+            break;
+        case 4:
+            deinterleaveSamples<T, 4>(planes, src, width);
+            break;
+        default:
+            CPPIMG_ASSERT(false);
+            break;
         }
-        code |= next;
-        for(; huffmanTable.size_[k] == length; ++k) {
-            if(huffmanTable.code_[k] == code) {
-                return huffmanTable.value_[k];
-            }
+    }
+
+    /**
+        @brief Transpose planes of channels to interleaved pixels
+        @param planes ... in the order of channels in a pixel
+        @param numChannels ... 1 to 4
+        @param size ... bytes of a sample, 2 or 4
+        */
+    void interleave(u8* dst, const u8* const* planes, s32 numChannels, s32 size, s32 width)
+    {
+        if(2 == size) {
+            interleaveSamples<u16>(dst, planes, numChannels, width);
+        } else {
+            interleaveSamples<u32>(dst, planes, numChannels, width);
         }
     }
-    return -1;
-}
 
-bool JPEG::decodeHuffmanBlock(Context& context, s32 component)
-{
-    ByteStream& stream = context.byteStream_;
+    /**
+        @brief Transpose interleaved pixels to planes of channels
+        @param planes ... in the order of channels in a pixel
+        @param numChannels ... 1 to 4
+        @param size ... bytes of a sample, 2 or 4
+        */
+    void deinterleave(u8* const* planes, const u8* src, s32 numChannels, s32 size, s32 width)
+    {
+        if(2 == size) {
+            deinterleaveSamples<u16>(planes, src, numChannels, width);
+        } else {
+            deinterleaveSamples<u32>(planes, src, numChannels, width);
+        }
+    }
 
-    // DC
-    s32 category = decodeHuffmanCode(context, 0, context.scan_.components_[component].getDCHuffman());
-    if(category < 0) {
-        return false;
-    } else if(0 < category) {
-        s16 difference = static_cast<s16>(stream.readBits(category));
-        if(0 == (difference & (1 << (category - 1)))) {
-            difference -= (1 << category) - 1;
+    template<class T>
+    void copySamples(u8* dst, s64 stride, const u8* src, s32 count)
+    {
+        for(s32 i = 0; i < count; ++i, src += sizeof(T), dst += stride) {
+            memcpy(dst, src, sizeof(T));
         }
-        context.directCurrents_[component] += difference;
     }
-    context.dct_[0] = context.directCurrents_[component];
 
-    // AC
-    for(s32 k = 1; k < BLOCK_SIZE;) {
-        s32 runCategory = decodeHuffmanCode(context, 1, context.scan_.components_[component].getACHuffman());
-        if(runCategory < 0) {
-            return false;
-        } else if(0 == runCategory) {
-            while(k < BLOCK_SIZE) {
-                context.dct_[ZigZag[k++]] = 0;
+    /**
+        @brief Convert samples of a channel, integers are clamped, and NaN is converted to zero
+        */
+    void convertSamples(u8* dst, s64 stride, Type dstType, const u8* src, Type srcType, s32 count)
+    {
+        if(dstType == srcType) {
+            if(Type::HALF == srcType) {
+                copySamples<u16>(dst, stride, src, count);
+            } else {
+                copySamples<u32>(dst, stride, src, count);
             }
-            break;
+            return;
         }
-        s32 runLength = runCategory >> 4;
-        category = runCategory & 0x0FU;
-        s16 ac = 0;
-        if(0 != category) {
-            ac = static_cast<s16>(stream.readBits(category));
-            if(0 == (ac & (1 << (category - 1)))) {
-                ac -= (1 << category) - 1;
-            }
-        } else if(15 != runLength) {
-            return false;
+        if(Type::HALF == srcType && Type::FLOAT == dstType && static_cast<s64>(sizeof(f32)) == stride) {
+            convertF16ToF32(count, reinterpret_cast<f32*>(dst), reinterpret_cast<const u16*>(src));
+            return;
         }
-        if(BLOCK_SIZE <= (runLength + k)) {
-            // runLength = (BLOCK_SIZE - k - 1);
-            return false;
+        if(Type::FLOAT == srcType && Type::HALF == dstType && static_cast<s64>(sizeof(u16)) == stride) {
+            convertF32ToF16(count, reinterpret_cast<u16*>(dst), reinterpret_cast<const f32*>(src));
+            return;
         }
-        while(0 < runLength) {
-            context.dct_[ZigZag[k++]] = 0;
-            --runLength;
+        for(s32 i = 0; i < count; ++i) {
+            f32 f;
+            u32 u;
+            switch(srcType) {
+            case Type::UINT:
+                memcpy(&u, src, sizeof(u32));
+                f = static_cast<f32>(u);
+                src += sizeof(u32);
+                break;
+            case Type::HALF: {
+                u16 h;
+                memcpy(&h, src, sizeof(u16));
+                f = toFloat32(h);
+                src += sizeof(u16);
+            } break;
+            case Type::FLOAT:
+            default:
+                memcpy(&f, src, sizeof(f32));
+                src += sizeof(f32);
+                break;
+            }
+            switch(dstType) {
+            case Type::UINT:
+                u = (0.0f < f) ? ((4294967295.0f <= f) ? 0xFFFFFFFFU : static_cast<u32>(f)) : 0U;
+                memcpy(dst, &u, sizeof(u32));
+                break;
+            case Type::HALF: {
+                u16 h = toFloat16(f);
+                memcpy(dst, &h, sizeof(u16));
+            } break;
+            case Type::FLOAT:
+            default:
+                memcpy(dst, &f, sizeof(f32));
+                break;
+            }
+            dst += stride;
         }
-        context.dct_[ZigZag[k++]] = ac;
     }
-    return true;
-}
+} // namespace
 
-void JPEG::inverseQuantization(Context& context, s32 component)
+u8* OpenEXR::Context::getInterleaved(const Slice* slices, s32& numChannels, s32 channels[MaxChannels]) const
 {
-    s32 qt = context.frame_.components_[component].quantizationTable_;
-    const QuantizationTable& table = context.quantization_[qt];
-
-#if defined(CPPIMG_DISABLE_AVX)
-    for(s32 i = 0; i < BLOCK_SIZE; ++i) {
-        context.dct_[i] *= table.factors_[i];
+    numChannels = 0;
+    u8* base = CPPIMG_NULL;
+    for(s32 i = 0; i < header_.numChannels_; ++i) {
+        const Slice& slice = slices[i];
+        if(CPPIMG_NULL == slice.base_) {
+            continue;
+        }
+        if(MaxChannels <= numChannels || static_cast<s32>(slice.type_) != header_.channels_[i].pixelType_) {
+            return CPPIMG_NULL;
+        }
+        if(0 < numChannels) {
+            const Slice& first = slices[channels[0]];
+            if(cppimg::getSize(slice.type_) != cppimg::getSize(first.type_) || slice.xStride_ != first.xStride_ || slice.yStride_ != first.yStride_) {
+                return CPPIMG_NULL;
+            }
+        }
+        u8* sample = reinterpret_cast<u8*>(slice.base_);
+        base = (CPPIMG_NULL == base || sample < base) ? sample : base;
+        channels[numChannels] = i;
+        ++numChannels;
     }
-#else
-    __m128i dct = _mm_loadu_si128(reinterpret_cast<const __m128i*>(context.dct_));
-    __m128i factors = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table.factors_));
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(context.dct_), _mm_mullo_epi16(dct, factors));
-#endif
+    if(numChannels <= 0) {
+        return CPPIMG_NULL;
+    }
+    s32 size = cppimg::getSize(slices[channels[0]].type_);
+    if(slices[channels[0]].xStride_ != size * numChannels) {
+        return CPPIMG_NULL;
+    }
+    // Sort by the positions in a pixel
+    s32 sorted[MaxChannels] = {-1, -1, -1, -1};
+    for(s32 i = 0; i < numChannels; ++i) {
+        s64 offset = reinterpret_cast<u8*>(slices[channels[i]].base_) - base;
+        if(0 != (offset % size) || numChannels * size <= offset || 0 <= sorted[offset / size]) {
+            return CPPIMG_NULL;
+        }
+        sorted[offset / size] = channels[i];
+    }
+    for(s32 i = 0; i < numChannels; ++i) {
+        channels[i] = sorted[i];
+    }
+    return base;
 }
 
-void JPEG::inverseDCT(Context& context)
+void OpenEXR::Context::copyChunk(const Slice* slices, const Box2i& region, s32 x, s32 y, s32 width, s32 lines, const u8* src) const
 {
-#if defined(CPPIMG_DISABLE_AVX)
-    s32 levelShift = context.frame_.precision_ <= 8 ? 128 : 2048;
-    levelShift <<= FIXED_POINT_SHIFT2;
-    for(s32 y = 0; y < BLOCK_WIDTH; ++y) {
-        s16* block = context.block_ + y * BLOCK_WIDTH;
-        for(s32 x = 0; x < BLOCK_WIDTH; ++x) {
-            const s16* csy = &context.cosine_[y][0];
-            const s16* csx = &context.cosine_[x][0];
-            s32 sum = 0;
-            for(s32 v = 0; v < BLOCK_WIDTH; ++v) {
-                s32 tcsy = csy[v];
-                const s16* dct = context.dct_ + v * BLOCK_WIDTH;
-                for(s32 u = 0; u < BLOCK_WIDTH; ++u) {
-                    s32 c = fixedPointRound(tcsy * csx[u], FIXED_POINT_SHIFT);
-                    sum += dct[u] * c;
-                }
-            }
-            block[x] = static_cast<s16>(fixedPointRound(sum, FIXED_POINT_SHIFT2 + 2) + levelShift);
+    s32 left = maximum(x, region.xMin_);
+    s32 right = minimum(x + width - 1, region.xMax_);
+    s32 top = maximum(y, region.yMin_);
+    s32 bottom = minimum(y + lines - 1, region.yMax_);
+    if(right < left || bottom < top) {
+        return;
+    }
+    s32 lineSize = width * header_.getBytesPerPixel();
+    src += (top - y) * lineSize;
+
+    // Interleaved pixels of the types in the file are transposed at once
+    s32 numInterleaved;
+    s32 interleaved[MaxChannels];
+    u8* pixels = getInterleaved(slices, numInterleaved, interleaved);
+    if(CPPIMG_NULL != pixels) {
+        s32 starts[MaxInChannels];
+        starts[0] = 0;
+        for(s32 k = 1; k < header_.numChannels_; ++k) {
+            starts[k] = starts[k - 1] + cppimg::getSize(static_cast<Type>(header_.channels_[k - 1].pixelType_)) * width;
+        }
+        const Slice& slice = slices[interleaved[0]];
+        s32 size = cppimg::getSize(slice.type_);
+        const u8* planes[MaxChannels];
+        for(s32 j = top; j <= bottom; ++j) {
+            for(s32 k = 0; k < numInterleaved; ++k) {
+                planes[k] = src + starts[interleaved[k]] + (left - x) * size;
+            }
+            u8* dst = pixels + (j - region.yMin_) * slice.yStride_ + (left - region.xMin_) * slice.xStride_;
+            interleave(dst, planes, numInterleaved, size, right - left + 1);
+            src += lineSize;
         }
+        return;
     }
-#else
-    s32 levelShift = context.frame_.precision_ <= 8 ? 128 : 2048;
-    levelShift <<= FIXED_POINT_SHIFT2;
-
-    __m128i RoundOffset0 = _mm_set1_epi32((1 << FIXED_POINT_SHIFT) - 1);
-    __m128i RoundOffset1 = _mm_set1_epi32((1 << (FIXED_POINT_SHIFT2 + 2)) - 1);
-    __m128i Zero = _mm_setzero_si128();
-    __m128i LevelShift = _mm_set1_epi32(levelShift);
 
-    __m128i csx[BLOCK_WIDTH];
-    __m128i csy[BLOCK_WIDTH][BLOCK_WIDTH];
-    __m128i tdct[BLOCK_WIDTH];
-    const s16* ttdct = context.dct_;
-    for(s32 i = 0; i < BLOCK_WIDTH; ++i, ttdct += BLOCK_WIDTH) {
-        csx[i] = _mm_loadu_si128(reinterpret_cast<__m128i*>(&context.cosine_[i][0]));
-        tdct[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ttdct));
-        for(s32 j = 0; j < BLOCK_WIDTH; ++j) {
-            csy[i][j] = _mm_set1_epi16(context.cosine_[i][j]);
+    // Samples of a line are stored channel by channel, skipped channels are not converted
+    for(s32 j = top; j <= bottom; ++j) {
+        const u8* samples = src;
+        for(s32 k = 0; k < header_.numChannels_; ++k) {
+            Type type = static_cast<Type>(header_.channels_[k].pixelType_);
+            s32 size = cppimg::getSize(type);
+            const Slice& slice = slices[k];
+            if(CPPIMG_NULL != slice.base_) {
+                u8* dst = reinterpret_cast<u8*>(slice.base_) + (j - region.yMin_) * slice.yStride_ + (left - region.xMin_) * slice.xStride_;
+                convertSamples(dst, slice.xStride_, slice.type_, samples + (left - x) * size, type, right - left + 1);
+            }
+            samples += size * width;
         }
+        src += lineSize;
     }
+}
 
-    for(s32 y = 0; y < BLOCK_WIDTH; ++y) {
-        s16* block = context.block_ + y * BLOCK_WIDTH;
-        for(s32 x = 0; x < BLOCK_WIDTH; ++x) {
-            __m128i sum = _mm_setzero_si128();
-            for(s32 v = 0; v < BLOCK_WIDTH; ++v) {
-                const __m128i& dct = tdct[v];
-                __m128i dct0 = _mm_cvtepi16_epi32(dct);
-                __m128i dct1 = _mm_cvtepi16_epi32(_mm_srli_si128(dct, 8));
-
-                const __m128i& tcsy = csy[y][v];
-                __m128i cl = _mm_mullo_epi16(tcsy, csx[x]); // lower 8 bits of tcsy*csx
-                __m128i ch = _mm_mulhi_epi16(tcsy, csx[x]); // upper 8 bits of tcsy*csx
-
-                __m128i c0 = _mm_unpacklo_epi16(cl, ch);
-                __m128i c1 = _mm_unpackhi_epi16(cl, ch);
-                // Round fixed point values
-                c0 = _mm_srai_epi32(_mm_add_epi32(c0, RoundOffset0), FIXED_POINT_SHIFT);
-                c1 = _mm_srai_epi32(_mm_add_epi32(c1, RoundOffset0), FIXED_POINT_SHIFT);
-
-                c0 = _mm_mullo_epi32(c0, dct0);
-                c1 = _mm_mullo_epi32(c1, dct1);
-
-                sum = _mm_add_epi32(sum, c0);
-                sum = _mm_add_epi32(sum, c1);
-            }
+namespace
+{
+    s32 roundLog2(s32 x, u8 roundingMode)
+    {
+        s32 y = 0;
+        s32 rounded = 0;
+        while(1 < x) {
+            rounded |= x & 0x01;
+            x >>= 1;
+            ++y;
+        }
+        return (OpenEXR::ROUND_UP == roundingMode) ? y + rounded : y;
+    }
 
-            sum = _mm_hadd_epi32(sum, sum);
-            sum = _mm_hadd_epi32(sum, sum);
+    s32 getLevelSize(s32 size, s32 level, u8 roundingMode)
+    {
+        s32 levelSize = (OpenEXR::ROUND_UP == roundingMode) ? ((size + (1 << level) - 1) >> level) : (size >> level);
+        return maximum(levelSize, 1);
+    }
+} // namespace
 
-            // Round fixed point values
-            sum = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(sum, RoundOffset1), FIXED_POINT_SHIFT2 + 2), LevelShift);
-            // sum = _mm_packs_epi32(sum, sum);
-            // sum = _mm_slli_si128(sum, 14);
-            // tblock = _mm_or_si128(tblock, sum);
-            // tblock = _mm_srli_si128(tblock, 2);
-            block[x] = static_cast<u16>(_mm_cvtsi128_si32(sum));
-        }
+bool OpenEXR::Context::initializeLevels()
+{
+    const TiledDesc& tiles = header_.tiles_;
+    if(0 == tiles.xSize_ || 0x7FFFFFFFU < tiles.xSize_ || 0 == tiles.ySize_ || 0x7FFFFFFFU < tiles.ySize_) {
+        return false;
+    }
+    if(ROUND_DOWN != tiles.roundingMode_ && ROUND_UP != tiles.roundingMode_) {
+        return false;
+    }
+    s32 width = header_.dataWindow_.xMax_ - header_.dataWindow_.xMin_ + 1;
+    s32 height = header_.dataWindow_.yMax_ - header_.dataWindow_.yMin_ + 1;
+    if(width <= 0 || height <= 0) {
+        return false;
     }
-#endif
+    switch(tiles.levelMode_) {
+    case ONE_LEVEL:
+        numXLevels_ = numYLevels_ = 1;
+        break;
+    case MIPMAP_LEVELS:
+        numXLevels_ = numYLevels_ = roundLog2(maximum(width, height), tiles.roundingMode_) + 1;
+        break;
+    case RIPMAP_LEVELS:
+        numXLevels_ = roundLog2(width, tiles.roundingMode_) + 1;
+        numYLevels_ = roundLog2(height, tiles.roundingMode_) + 1;
+        break;
+    default:
+        return false;
+    }
+    if(header_.chunkCount_ <= 0) {
+        header_.chunkCount_ = (RIPMAP_LEVELS == tiles.levelMode_)
+                                  ? getTileIndex(0, 0, 0, numYLevels_)
+                                  : getTileIndex(0, 0, numXLevels_, numXLevels_);
+    }
+    return true;
 }
 
-void JPEG::copyComponents(Context& context, s32 ux, s32 uy)
+s32 OpenEXR::Context::getLevelWidth(s32 lx) const
 {
-    s16* C[4];
-    C[0] = context.components_[0];
-    C[1] = context.components_[1];
-    C[2] = context.components_[2];
-    C[3] = context.components_[3];
+    return getLevelSize(header_.dataWindow_.xMax_ - header_.dataWindow_.xMin_ + 1, lx, header_.tiles_.roundingMode_);
+}
 
-    s32 pixelV = uy * (context.frame_.maxVerticalSampling_ << 3);
-    s32 pixelH = ux * (context.frame_.maxHorizontalSampling_ << 3);
+s32 OpenEXR::Context::getLevelHeight(s32 ly) const
+{
+    return getLevelSize(header_.dataWindow_.yMax_ - header_.dataWindow_.yMin_ + 1, ly, header_.tiles_.roundingMode_);
+}
 
-    CPPIMG_ASSERT(pixelV < context.frame_.height_);
-    CPPIMG_ASSERT(pixelH < context.frame_.width_);
+s32 OpenEXR::Context::getNumXTiles(s32 lx) const
+{
+    s32 tileSize = static_cast<s32>(header_.tiles_.xSize_);
+    return (getLevelWidth(lx) + tileSize - 1) / tileSize;
+}
 
-    s32 endy = context.frame_.maxVerticalSampling_ << 3;
-    s32 endx = context.frame_.maxHorizontalSampling_ << 3;
-    s32 stepx = endx;
-    if(context.frame_.height_ <= (pixelV + endy)) {
-        endy = context.frame_.height_ - pixelV;
-    }
-    if(context.frame_.width_ <= (pixelH + endx)) {
-        endx = context.frame_.width_ - pixelH;
+s32 OpenEXR::Context::getNumYTiles(s32 ly) const
+{
+    s32 tileSize = static_cast<s32>(header_.tiles_.ySize_);
+    return (getLevelHeight(ly) + tileSize - 1) / tileSize;
+}
+
+s32 OpenEXR::Context::getTileDataSize(s32 tx, s32 ty, s32 lx, s32 ly) const
+{
+    // Tile origins are in the level, so those do not overflow
+    s32 width = minimum(static_cast<s32>(header_.tiles_.xSize_), getLevelWidth(lx) - tx * static_cast<s32>(header_.tiles_.xSize_));
+    s32 lines = minimum(static_cast<s32>(header_.tiles_.ySize_), getLevelHeight(ly) - ty * static_cast<s32>(header_.tiles_.ySize_));
+    if(width <= 0 || lines <= 0) {
+        return 0;
     }
+    s64 size = static_cast<s64>(width) * lines * header_.getBytesPerPixel();
+    return (size <= 0x7FFFFFFF) ? static_cast<s32>(size) : 0;
+}
 
-    s32 offset = (pixelV * context.frame_.width_ + pixelH) * context.frame_.numComponents_;
-    s16* work = context.work_ + offset;
+s32 OpenEXR::Context::getMaxTileDataSize(s32 lx, s32 ly) const
+{
+    s64 width = minimum(static_cast<s32>(header_.tiles_.xSize_), getLevelWidth(lx));
+    s64 lines = minimum(static_cast<s32>(header_.tiles_.ySize_), getLevelHeight(ly));
+    s32 bytesPerPixel = header_.getBytesPerPixel();
+    if(bytesPerPixel <= 0 || (0x7FFFFFFF / bytesPerPixel) < (width * lines)) {
+        return -1;
+    }
+    return static_cast<s32>(width * lines * bytesPerPixel);
+}
 
-    for(s32 y = 0; y < endy; ++y) {
-        for(s32 x = 0; x < endx; ++x) {
-            s32 index = (y * context.frame_.width_ + x) * context.frame_.numComponents_;
-            for(s32 c = 0; c < context.frame_.numComponents_; ++c) {
-                work[index + c] = C[c][x];
-            }
+s32 OpenEXR::Context::getTileIndex(s32 tx, s32 ty, s32 lx, s32 ly) const
+{
+    // Tiles are stored level by level, and row by row in a level
+    s32 index = 0;
+    if(RIPMAP_LEVELS == header_.tiles_.levelMode_) {
+        s32 numXTiles = 0;
+        for(s32 i = 0; i < numXLevels_; ++i) {
+            numXTiles += getNumXTiles(i);
+        }
+        for(s32 i = 0; i < ly; ++i) {
+            index += numXTiles * getNumYTiles(i);
+        }
+        for(s32 i = 0; i < lx; ++i) {
+            index += getNumXTiles(i) * getNumYTiles(ly);
+        }
+    } else {
+        for(s32 i = 0; i < lx; ++i) {
+            index += getNumXTiles(i) * getNumYTiles(i);
         }
-        C[0] += stepx;
-        C[1] += stepx;
-        C[2] += stepx;
-        C[3] += stepx;
     }
+    return index + ty * getNumXTiles(lx) + tx;
 }
 
-void JPEG::toGray(Context& context)
+bool OpenEXR::Context::isValidLevel(s32 lx, s32 ly) const
 {
-    s32 repeatH = context.frame_.maxHorizontalSampling_ / context.frame_.components_[0].getHorizontal();
-    s32 repeatV = context.frame_.maxVerticalSampling_ / context.frame_.components_[0].getVertical();
-    s32 endX = (context.frame_.width_ / repeatH) * repeatH;
-    s32 endY = (context.frame_.height_ / repeatV) * repeatV;
-    s16 ratioH = static_cast<s16>(1.0f / repeatH * (f32)(1 << FIXED_POINT_SHIFT));
-    s16 ratioV = static_cast<s16>(1.0f / repeatV * (f32)(1 << FIXED_POINT_SHIFT));
-    s32 step = context.frame_.width_;
+    if(lx < 0 || numXLevels_ <= lx || ly < 0 || numYLevels_ <= ly) {
+        return false;
+    }
+    return RIPMAP_LEVELS == header_.tiles_.levelMode_ || lx == ly;
+}
 
-    if(1 < repeatH || 1 < repeatV) {
-        s16* Y = context.work_;
-        for(s32 y = 0; y < context.frame_.height_; y += repeatV) {
-            for(s32 x = 0; x < endX; x += repeatH) {
-                for(s32 c = 1; c < repeatH; ++c) {
-                    s32 value = Y[x] * ratioH * (repeatH - c) + Y[x + repeatH] * ratioH * (c);
-                    Y[x + c] = fixedPointRound<s16>(value, FIXED_POINT_SHIFT);
-                }
-            }
-            if(y < endY) {
-                for(s32 x = 0; x < context.frame_.width_; ++x) {
-                    s16* NY = Y + step * repeatV;
-                    for(s32 c = 1; c < repeatV; ++c) {
-                        s32 value = Y[x] * ratioV * (repeatV - c) + NY[x] * ratioV * (c);
-                        Y[x + c * step] = fixedPointRound<s16>(value, FIXED_POINT_SHIFT);
-                    }
-                }
+/**
+    @brief Read tiles one by one under a lock, then decode them in parallel
+    */
+struct OpenEXR::Context::TileChunkJob
+{
+    bool operator()(s32 worker, s32 index)
+    {
+        s32 tx = tx_ + index % numXTiles_;
+        s32 ty = ty_ + index / numXTiles_;
+        s32 dataSize;
+        {
+#    if !defined(CPPIMG_DISABLE_THREADS)
+            std::lock_guard<std::mutex> lock(mutex_);
+#    endif
+            if(!context_->readTileChunk(workers_[worker], *stream_, tx, ty, lx_, ly_, dataSize)) {
+                return false;
             }
         }
+        return context_->decodeTileChunk(workers_[worker], slices_, *region_, tx, ty, lx_, ly_, dataSize);
     }
-    for(s32 y = 0; y < context.frame_.height_; ++y) {
-        for(s32 x = 0; x < context.frame_.width_; ++x) {
-            s32 index = (y * context.frame_.width_ + x);
-            s32 ty = fixedPointRound(context.work_[index], FIXED_POINT_SHIFT2);
-            context.rgb_[index] = clamp8bits(ty);
-        }
-    }
+
+    Context* context_;
+    Worker* workers_;
+    Stream* stream_;
+    const Slice* slices_;
+    const Box2i* region_;
+    s32 tx_;
+    s32 ty_;
+    s32 numXTiles_;
+    s32 lx_;
+    s32 ly_;
+#    if !defined(CPPIMG_DISABLE_THREADS)
+    std::mutex mutex_;
+#    endif
+};
+
+bool OpenEXR::Context::readRegion(Stream& stream, const Slice* slices, const Box2i& region, s32 numThreads)
+{
+    return version_.isTile()
+               ? readTiles(stream, slices, region, 0, 0, numThreads)
+               : readScanlines(stream, slices, region, numThreads);
 }
 
-void JPEG::toRGB(Context& context)
+bool OpenEXR::Context::readTiles(Stream& stream, const Slice* slices, const Box2i& region, s32 lx, s32 ly, s32 numThreads)
 {
-    for(s32 c = 0; c < context.frame_.numComponents_; ++c) {
-        filter(context, c);
+    CPPIMG_ASSERT(CPPIMG_NULL != slices);
+    if(!isValidLevel(lx, ly)) {
+        return false;
+    }
+    // A level starts at the top left of the data window
+    const Box2i& dataWindow = header_.dataWindow_;
+    s32 left = maximum(region.xMin_, dataWindow.xMin_) - dataWindow.xMin_;
+    s32 right = minimum(region.xMax_, dataWindow.xMin_ + getLevelWidth(lx) - 1) - dataWindow.xMin_;
+    s32 top = maximum(region.yMin_, dataWindow.yMin_) - dataWindow.yMin_;
+    s32 bottom = minimum(region.yMax_, dataWindow.yMin_ + getLevelHeight(ly) - 1) - dataWindow.yMin_;
+    if(right < left || bottom < top) {
+        return true;
+    }
+    s32 tileWidth = static_cast<s32>(header_.tiles_.xSize_);
+    s32 tileHeight = static_cast<s32>(header_.tiles_.ySize_);
+    s32 numXTiles = right / tileWidth - left / tileWidth + 1;
+    s32 count = numXTiles * (bottom / tileHeight - top / tileHeight + 1);
+    s64 tileSize = getMaxTileDataSize(lx, ly);
+    if(tileSize < 0) {
+        return false;
     }
 
-    s32 step = context.frame_.width_ * context.frame_.numComponents_;
-    s16* C = context.work_;
-    for(s32 y = 0; y < context.frame_.height_; ++y) {
-        s32 row = y * step;
-        for(s32 x = 0; x < context.frame_.width_; ++x) {
-            s32 index = row + x * context.frame_.numComponents_;
-            s32 ty = C[index + 0] << FIXED_POINT_SHIFT2;
-            s32 tcb = C[index + 1];
-            s32 tcr = C[index + 2];
-            s32 tr = ty + fixedPointShift((tcr - 0x2000) * 0x166E, FIXED_POINT_SHIFT2);                           // Y + (Cr-128)*1.4020
-            s32 tg = ty - fixedPointShift((tcb - 0x2000) * 0x0581 + (tcr - 0x2000) * 0x0B6C, FIXED_POINT_SHIFT2); // Y - (Cb-128)*0.3441 - (Cbr-128)*0.7139;
-            s32 tb = ty + fixedPointShift((tcb - 0x2000) * 0x1C59, FIXED_POINT_SHIFT2);                           // Y - (Cb-128)*1.7718;
-            tr = fixedPointRound(tr, FIXED_POINT_SHIFT);
-            tg = fixedPointRound(tg, FIXED_POINT_SHIFT);
-            tb = fixedPointRound(tb, FIXED_POINT_SHIFT);
-
-            context.rgb_[index + 0] = clamp8bits(tr);
-            context.rgb_[index + 1] = clamp8bits(tg);
-            context.rgb_[index + 2] = clamp8bits(tb);
+    numThreads = getNumThreads(numThreads, count);
+    Worker* workers = CPPIMG_NEW Worker[numThreads];
+    bool result = true;
+    for(s32 i = 0; i < numThreads; ++i) {
+        if(!workers[i].initialize(header_.compression_)
+           || !workers[i].dst_.reserve(tileSize * 2)
+           || !workers[i].tmp_.reserve(tileSize * 2)) {
+            result = false;
+            break;
         }
     }
+    if(result) {
+        TileChunkJob job;
+        job.context_ = this;
+        job.workers_ = workers;
+        job.stream_ = &stream;
+        job.slices_ = slices;
+        job.region_ = &region;
+        job.tx_ = left / tileWidth;
+        job.ty_ = top / tileHeight;
+        job.numXTiles_ = numXTiles;
+        job.lx_ = lx;
+        job.ly_ = ly;
+        result = parallelFor(numThreads, count, job);
+    }
+    CPPIMG_DELETE_ARRAY(workers);
+    return result;
 }
 
-void JPEG::filter(Context& context, s32 component)
+bool OpenEXR::Context::readTileChunk(Worker& worker, Stream& stream, s32 tx, s32 ty, s32 lx, s32 ly, s32& dataSize)
 {
-    s32 repeatH = context.frame_.maxHorizontalSampling_ / context.frame_.components_[component].getHorizontal();
-    s32 repeatV = context.frame_.maxVerticalSampling_ / context.frame_.components_[component].getVertical();
-    if(repeatH <= 1 && repeatV <= 1) {
-        return;
+    s32 index = getTileIndex(tx, ty, lx, ly);
+    if(index < 0 || header_.chunkCount_ <= index) {
+        return false;
     }
-    s32 endX = (context.frame_.width_ / repeatH) * repeatH;
-    s32 endY = (context.frame_.height_ / repeatV) * repeatV;
-    s16 ratioH = static_cast<s16>(1.0f / repeatH * (f32)(1 << FIXED_POINT_SHIFT));
-    s16 ratioV = static_cast<s16>(1.0f / repeatV * (f32)(1 << FIXED_POINT_SHIFT));
-    s32 numComponents = context.frame_.numComponents_;
-    s32 step = context.frame_.width_ * numComponents;
+    if(!stream.seek(offsetTable_[index], SEEK_SET) || !readPartNumber(stream)) {
+        return false;
+    }
+    s32 coordinates[4];
+    if(stream.read(sizeof(s32) * 4, coordinates) <= 0) {
+        return false;
+    }
+    if(coordinates[0] != tx || coordinates[1] != ty || coordinates[2] != lx || coordinates[3] != ly) {
+        return false;
+    }
+    if(stream.read(sizeof(s32), &dataSize) <= 0) {
+        return false;
+    }
+    // Tiles are stored uncompressed if compression does not make those smaller
+    if(dataSize <= 0 || getTileDataSize(tx, ty, lx, ly) < dataSize || !worker.src_.reserve(dataSize)) {
+        return false;
+    }
+    return 0 < stream.read(dataSize, &worker.src_[0]);
+}
 
-    s16* C = context.work_ + component;
-    for(s32 y = 0; y < context.frame_.height_; y += repeatV) {
-        s32 row = y * step;
-        for(s32 x = 0; x < endX; x += repeatH) {
-            s32 i0 = row + x * numComponents;
-            s32 i1 = i0 + repeatH * numComponents;
-            for(s32 c = 1; c < repeatH; ++c) {
-                s32 value = C[i0] * ratioH * (repeatH - c) + C[i1] * ratioH * (c);
-                C[i0 + c * numComponents] = fixedPointRound<s16>(value, FIXED_POINT_SHIFT);
-            }
+bool OpenEXR::Context::decodeTileChunk(Worker& worker, const Slice* slices, const Box2i& region, s32 tx, s32 ty, s32 lx, s32 ly, s32 dataSize)
+{
+    // Tiles at the right and bottom edges are cropped to the level
+    s32 x = tx * static_cast<s32>(header_.tiles_.xSize_);
+    s32 y = ty * static_cast<s32>(header_.tiles_.ySize_);
+    s32 width = minimum(static_cast<s32>(header_.tiles_.xSize_), getLevelWidth(lx) - x);
+    s32 lines = minimum(static_cast<s32>(header_.tiles_.ySize_), getLevelHeight(ly) - y);
+    if(width <= 0 || lines <= 0) {
+        return false;
+    }
+    const u8* data;
+    if(!uncompressChunk(worker, data, width, lines, dataSize)) {
+        return false;
+    }
+    copyChunk(slices, region, header_.dataWindow_.xMin_ + x, header_.dataWindow_.yMin_ + y, width, lines, data);
+    return true;
+}
+
+s32 OpenEXR::Context::uncompressRLE(Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src)
+{
+    s32 total = 0;
+    for(s32 in = 0; in < srcSize;) {
+        s32 c = static_cast<s8>(src[in]);
+        ++in;
+        // consecutive or non-consecutive
+        s32 count = (0 <= c) ? c + 1 : -c;
+        s32 size = (0 <= c) ? 1 : count;
+        if(srcSize < (in + size)) {
+            return -1;
         }
-        if(y < endY) {
-            for(s32 x = 0; x < context.frame_.width_; ++x) {
-                s32 i0 = row + x * numComponents;
-                s32 i1 = i0 + repeatV * step;
-                for(s32 c = 1; c < repeatV; ++c) {
-                    s32 value = C[i0] * ratioV * (repeatV - c) + C[i1] * ratioV * (c);
-                    C[i0 + c * step] = fixedPointRound<s16>(value, FIXED_POINT_SHIFT);
-                }
-            }
+        if(tmp.capacity() < (total + count) && !tmp.expand(maximum(tmp.capacity() * 2, static_cast<s64>(total + count)))) {
+            return -1;
         }
-    } // for(s32 y=0;
+        if(0 <= c) {
+            memset(&tmp[total], src[in], count);
+        } else {
+            memcpy(&tmp[total], src + in, count);
+        }
+        in += size;
+        total += count;
+    }
+    if(!dst.reserve(total)) {
+        return -1;
+    }
+    postprocess(total, &dst[0], &tmp[0]);
+    return total;
+}
+
+//----------------------------------------------------
+OpenEXR::WriteContext::WriteContext()
+    : numChunks_(0)
+    , offsetTable_(CPPIMG_NULL)
+{
+}
+
+OpenEXR::WriteContext::~WriteContext()
+{
+    CPPIMG_FREE(offsetTable_);
 }
 
-#    ifndef CPPIMG_DISABLE_OPENEXR
-//----------------------------------------------------
-//---
-//--- OpenEXR
-//---
-//----------------------------------------------------
-OpenEXR::Version OpenEXR::Version::create(
-    bool tile,
-    bool longName,
-    bool deepData,
-    bool multiPart)
+//----------------------------------------------------
+const Char* OpenEXR::AttributeNames[AttrName_Max] =
+    {
+        "channels",
+        "compression",
+        "dataWindow",
+        "displayWindow",
+        "lineOrder",
+        "pixelAspectRatio",
+        "screenWindowCenter",
+        "screenWindowWidth",
+        "tiles",
+        "view",
+        "name",
+        "type",
+        "version",
+        "chunkCount",
+        "maxSamplesPerPixel",
+        "chromaticities",
+        "",
+};
+
+const Char* OpenEXR::TypeNames[AttrType_Max] =
+    {
+        "box2i",
+        "box2f",
+        "chlist",
+        "chromaticities",
+        "compression",
+        "double",
+        "envmap",
+        "float",
+        "int",
+        "keycode",
+        "lineOrder",
+        "m33f",
+        "m44f",
+        "preview",
+        "rational",
+        "string",
+        "stringvector",
+        "tiledesc",
+        "timecode",
+        "v2i",
+        "v2f",
+        "v3i",
+        "v3f",
+};
+
+OpenEXR::AttributeName OpenEXR::findAttributeName(const Char* str)
 {
-    Version version;
-    version.version_ = 0x02U;
-    if(tile) {
-        version.version_ |= Flag_TileFormat;
-    }
-    if(longName) {
-        version.version_ |= Flag_LongName;
-    }
-    if(deepData) {
-        version.version_ |= Flag_DeepData;
-    }
-    if(multiPart) {
-        version.version_ |= Flag_MultiPart;
+    CPPIMG_ASSERT(CPPIMG_NULL != str);
+    for(s32 name = AttrName_Channels; name < AttrName_Max; ++name) {
+        if(0 == strcmp(AttributeNames[name], str)) {
+            return (AttributeName)name;
+        }
     }
-    return version;
+    return AttrName_Max;
 }
 
-OpenEXR::Preview::Preview()
-    : width_(0)
-    , height_(0)
-    , image_(CPPIMG_NULL)
+OpenEXR::AttributeType OpenEXR::findAttributeType(const Char* str)
 {
+    CPPIMG_ASSERT(CPPIMG_NULL != str);
+    for(s32 type = AttrType_Box2i; type < AttrType_Max; ++type) {
+        if(0 == strcmp(TypeNames[type], str)) {
+            return (AttributeType)type;
+        }
+    }
+
+    return AttrType_Max;
 }
 
-OpenEXR::Preview::~Preview()
+s32 OpenEXR::read(Char str[MaxStringSize], Stream& stream)
 {
-    CPPIMG_FREE(image_);
+    s32 length = 0;
+    str[length] = CPPIMG_NULLCHAR;
+    Char c;
+    while(length < MaxStringSize) {
+        if(stream.read(1, &c) <= 0) {
+            return -1;
+        }
+        str[length] = c;
+        if(CPPIMG_NULLCHAR == c) {
+            return 1;
+        }
+        ++length;
+    }
+    return -1;
 }
 
-bool OpenEXR::Preview::read(Stream& stream)
+s32 OpenEXR::readString(Char str[MaxStringSize], s32 size, Stream& stream)
 {
-    if(stream.read(sizeof(s32), &width_) <= 0) {
-        return false;
+    // A string attribute is not terminated by null
+    if(size < 0) {
+        return -1;
     }
-    if(stream.read(sizeof(s32), &height_) <= 0) {
-        return false;
+    s32 length = minimum(size, MaxStringSize - 1);
+    if(0 < length && stream.read(length, str) <= 0) {
+        return -1;
     }
-    s32 size = width_ * height_ * 4;
-    CPPIMG_DELETE_ARRAY(image_);
-    image_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(size));
-    if(stream.read(size, image_) <= 0) {
-        return false;
+    str[length] = CPPIMG_NULLCHAR;
+    if(length < size && !stream.seek(size - length, SEEK_CUR)) {
+        return -1;
     }
-    return true;
-}
-
-void OpenEXR::Preview::swap(Preview& rhs)
-{
-    cppimg::swap(width_, rhs.width_);
-    cppimg::swap(height_, rhs.height_);
-    cppimg::swap(image_, rhs.image_);
-}
-
-//----------------------------------------------------
-void OpenEXR::Header::initialize()
-{
-    numChannels_ = 0;
-    channels_[0].name_[0] = CPPIMG_NULLCHAR;
-    chromaticities_ = {0.6400f, 0.3300f, 0.3000f, 0.6000f, 0.1500f, 0.0600f, 0.3127f, 0.3290f};
-    hasChromaticities_ = false;
+    return length;
 }
 
-bool OpenEXR::Header::getColorType(ColorType& colorType) const
+s32 OpenEXR::writeAttribute(Stream& stream, AttributeName name, AttributeType type, s32 size, const void* data)
 {
-    const Channel* channels[4];
-    channels[0] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::R)]);
-    channels[1] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::G)]);
-    channels[2] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::B)]);
-    channels[3] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::A)]);
-
-    if(CPPIMG_NULL != channels[0]
-       && CPPIMG_NULL != channels[1]
-       && CPPIMG_NULL != channels[2]) {
-
-        colorType = (CPPIMG_NULL != channels[3]) ? ColorType::RGBA : ColorType::RGB;
-
-    } else {
-        channels[0] = findChannel(ChannelNames[static_cast<u32>(cppimg::Channel::Y)]);
-        colorType = ColorType::GRAY;
-        if(CPPIMG_NULL == channels[0]) {
-            return false;
-        }
+    if(stream.write(strlen(AttributeNames[name]) + 1, AttributeNames[name]) <= 0) {
+        return 0;
     }
-    return true;
+    if(stream.write(strlen(TypeNames[type]) + 1, TypeNames[type]) <= 0) {
+        return 0;
+    }
+    if(stream.write(sizeof(s32), &size) <= 0) {
+        return 0;
+    }
+    return stream.write(size, data);
 }
 
-void OpenEXR::Header::getTypes(s32 types[MaxInChannels]) const
+s32 OpenEXR::writeChannels(Stream& stream, ColorType colorType, Type pixelType)
 {
-    CPPIMG_ASSERT(numChannels_ <= MaxInChannels);
-    for(s32 i = 0; i < numChannels_; ++i) {
-        types[i] = channels_[i].pixelType_;
+    static const Char* Names[5] = {"A", "B", "G", "R", "Y"};
+    switch(colorType) {
+    case ColorType::GRAY:
+        return writeChannels(stream, 1, &Names[4], pixelType, 0, 1, 1);
+    case ColorType::RGB:
+        return writeChannels(stream, 3, &Names[1], pixelType, 0, 1, 1);
+    case ColorType::RGBA:
+        return writeChannels(stream, 4, &Names[0], pixelType, 0, 1, 1);
+    default:
+        CPPIMG_ASSERT(false);
+        return 0;
     }
 }
 
-const OpenEXR::Channel* OpenEXR::Header::findChannel(const Char* name) const
+s32 OpenEXR::writeChannels(Stream& stream, s32 size, const Char** names, Type pixelType, u8 linear, s32 xSampling, s32 ySampling)
 {
-    CPPIMG_ASSERT(CPPIMG_NULL != name);
-    for(s32 i = 0; i < numChannels_; ++i) {
-        if(0 == strcmp(channels_[i].name_, name)) {
-            return &channels_[i];
-        }
+    CPPIMG_ASSERT(CPPIMG_NULL != names);
+    if(stream.write(strlen(AttributeNames[AttrName_Channels]) + 1, AttributeNames[AttrName_Channels]) <= 0) {
+        return 0;
+    }
+    if(stream.write(strlen(TypeNames[AttrType_Chlist]) + 1, TypeNames[AttrType_Chlist]) <= 0) {
+        return 0;
     }
-    return CPPIMG_NULL;
-}
 
-void OpenEXR::Header::sortChannels()
-{
-    for(s32 i = 0; i < numChannels_; ++i) {
-        s32 index = i;
-        for(s32 j = i + 1; j < numChannels_; ++j) {
-            if(strcmp(channels_[j].name_, channels_[index].name_) < 0) {
-                index = j;
-            }
+    static const s32 SizePerChannel = 18;
+    s32 total = SizePerChannel * size + 1;
+    if(stream.write(sizeof(s32), &total) <= 0) {
+        return 0;
+    }
+    for(s32 i = 0; i < size; ++i) {
+        if(stream.write(strlen(names[i]) + 1, names[i]) <= 0) {
+            return 0;
         }
-        if(index != i) {
-            cppimg::swap(channels_[i], channels_[index]);
+        s32 channel[4] = {static_cast<s32>(pixelType), linear, xSampling, ySampling};
+        if(stream.write(4 * sizeof(s32), channel) <= 0) {
+            return 0;
         }
     }
+    return writeNull(stream);
 }
 
-void OpenEXR::Header::getChannelAssign(s32 assign[MaxInChannels]) const
+s32 OpenEXR::writeNull(Stream& stream)
 {
-    for(s32 i = 0; i < numChannels_; ++i) {
-        if(0 == strcmp(channels_[i].name_, ChannelNames[static_cast<u32>(cppimg::Channel::R)])) {
-            assign[i] = 0;
-        } else if(0 == strcmp(channels_[i].name_, ChannelNames[static_cast<u32>(cppimg::Channel::G)])) {
-            assign[i] = 1;
-        } else if(0 == strcmp(channels_[i].name_, ChannelNames[static_cast<u32>(cppimg::Channel::B)])) {
-            assign[i] = 2;
-        } else if(0 == strcmp(channels_[i].name_, ChannelNames[static_cast<u32>(cppimg::Channel::A)])) {
-            assign[i] = 3;
-        } else if(0 == strcmp(channels_[i].name_, ChannelNames[static_cast<u32>(cppimg::Channel::Y)])) {
-            assign[i] = 0;
-        }
-    }
+    u8 nul = 0x00U;
+    return stream.write(1, &nul);
 }
 
-//----------------------------------------------------
-OpenEXR::Buffer::Buffer()
-    : capacity_(0)
-    , buffer_(CPPIMG_NULL)
+bool OpenEXR::read(Information& information, void* image, Stream& stream, s32 numThreads)
 {
+    return readImage(information, image, CPPIMG_NULL, stream, numThreads);
 }
 
-OpenEXR::Buffer::Buffer(s64 capacity)
-    : capacity_(capacity)
+bool OpenEXR::read(Information& information, const ImageView& image, Stream& stream, s32 numThreads)
 {
-    buffer_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(capacity_));
+    return readImage(information, CPPIMG_NULL, &image, stream, numThreads);
 }
 
-OpenEXR::Buffer::~Buffer()
+bool OpenEXR::readImage(Information& information, void* image, const ImageView* view, Stream& stream, s32 numThreads)
 {
-    CPPIMG_FREE(buffer_);
-}
+    if(!stream.valid()) {
+        return false;
+    }
 
-bool OpenEXR::Buffer::reserve(s64 capacity)
-{
-    if(capacity <= capacity_) {
+    off_t begin = stream.tell();
+    SeekSet seekSet(begin, &stream);
+
+    u32 magic;
+    if(stream.read(4, &magic) <= 0) {
+        return false;
+    }
+    if(MAGIC != magic) {
+        return false;
+    }
+    Context* context = CPPIMG_NEW Context;
+    if(!context->readVersion(stream)) {
+        CPPIMG_DELETE(context);
+        return false;
+    }
+    if(context->version_.isMultiPart()) {
+        CPPIMG_DELETE(context);
+        MultiPartReader reader;
+        if(!stream.seek(begin, SEEK_SET)
+           || !reader.open(stream)
+           || !reader.getInformation(information, 0)) {
+            return false;
+        }
+        Rect displayWindow;
+        reader.getDisplayWindow(displayWindow, 0);
+        information.width_ = displayWindow.width_;
+        information.height_ = displayWindow.height_;
+        if(CPPIMG_NULL == image && CPPIMG_NULL == view) {
+            return true;
+        }
+        if(CPPIMG_NULL != view) {
+            if(!reader.read(*view, 0, displayWindow, numThreads)) {
+                return false;
+            }
+        } else if(!reader.read(image, 0, displayWindow, numThreads)) {
+            return false;
+        }
+        seekSet.clear();
         return true;
     }
-    CPPIMG_FREE(buffer_);
-    capacity_ = capacity;
-    buffer_ = reinterpret_cast<u8*>(CPPIMG_MALLOC(capacity_));
-    return CPPIMG_NULL != buffer_;
-}
+    if(!context->readHeader(stream)) {
+        CPPIMG_DELETE(context);
+        return false;
+    }
 
-bool OpenEXR::Buffer::expand(s64 newCapacity)
-{
-    CPPIMG_ASSERT(0 < newCapacity);
-    CPPIMG_ASSERT(capacity_ <= newCapacity);
-    newCapacity = (newCapacity + 7) & ~7;
-    u8* buffer = REINTERPRET_CAST(u8*, CPPIMG_MALLOC(newCapacity));
-    if(CPPIMG_NULL == buffer) {
+    s32 width = context->header_.displayWindow_.xMax_ - context->header_.displayWindow_.xMin_ + 1;
+    s32 height = context->header_.displayWindow_.yMax_ - context->header_.displayWindow_.yMin_ + 1;
+    if(!context->getInformation(information, width, height)) {
+        CPPIMG_DELETE(context);
         return false;
     }
-    memcpy(buffer, buffer_, newCapacity);
-    CPPIMG_FREE(buffer_);
-    capacity_ = newCapacity;
-    buffer_ = buffer;
+    if(CPPIMG_NULL == image && CPPIMG_NULL == view) {
+        CPPIMG_DELETE(context);
+        return true;
+    }
+    if((CPPIMG_NULL != view && (view->width_ != width || view->height_ != height))
+       || !context->readOffsetTable(stream)) {
+        CPPIMG_DELETE(context);
+        return false;
+    }
+
+    // The image has the size of the display window, and pixels out of the data window are zero
+    const Box2i& displayWindow = context->header_.displayWindow_;
+    bool result;
+    if(CPPIMG_NULL != view) {
+        result = readView(*context, stream, *view, information.colorType_, displayWindow, numThreads);
+    } else {
+        Slice slices[MaxInChannels];
+        s64 pitch = static_cast<s64>(information.width_) * information.getBytesPerPixel();
+        context->getImageSlices(slices, image, pitch);
+        if(!context->isInDataWindow(displayWindow)) {
+            memset(image, 0, pitch * information.height_);
+        }
+        result = context->readRegion(stream, slices, displayWindow, numThreads);
+    }
+    if(!result) {
+        CPPIMG_DELETE(context);
+        return false;
+    }
+    seekSet.clear();
+    CPPIMG_DELETE(context);
     return true;
 }
 
-//----------------------------------------------------
-OpenEXR::StreamBuffer::StreamBuffer()
-    : size_(0)
-    , increments_(1024)
+bool OpenEXR::write(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, const void* image, Compression compression, s32 numThreads)
 {
+    return write(stream, width, height, colorType, pixelType, pixelType, image, compression, numThreads);
 }
 
-OpenEXR::StreamBuffer::StreamBuffer(s64 increments)
-    : size_(0)
-    , increments_(increments)
+bool OpenEXR::write(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const void* image, Compression compression, s32 numThreads)
 {
+    s64 pitch = static_cast<s64>(width) * getNumChannels(colorType) * getSize(imageType);
+    return writeImage(stream, width, height, colorType, pixelType, imageType, image, pitch, compression, numThreads);
 }
 
-OpenEXR::StreamBuffer::StreamBuffer(s64 increments, s64 capacity)
-    : size_(0)
-    , increments_(increments)
-    , buffer_(capacity)
+bool OpenEXR::write(Stream& stream, const ImageView& image, Type pixelType, Compression compression, s32 numThreads)
 {
+    Type imageType;
+    if(!getViewType(imageType, image.format_)) {
+        return false;
+    }
+    return writeImage(stream, image.width_, image.height_, getColorType(image.format_), pixelType, imageType, image.data_, image.pitch_, compression, numThreads);
 }
 
-OpenEXR::StreamBuffer::~StreamBuffer()
+bool OpenEXR::writeImage(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const void* image, s64 pitch, Compression compression, s32 numThreads)
 {
-}
+    CPPIMG_ASSERT(1 <= width);
+    CPPIMG_ASSERT(1 <= height);
+    CPPIMG_ASSERT(CPPIMG_NULL != image);
 
-bool OpenEXR::StreamBuffer::write(s64 size, const void* data)
-{
-    CPPIMG_ASSERT(0 <= size);
-    CPPIMG_ASSERT(CPPIMG_NULL != data);
-    CPPIMG_ASSERT(0 < increments_);
-    s64 capacity = size_ + size;
-    if(buffer_.capacity() < capacity) {
-        while(capacity < buffer_.capacity()) {
-            capacity += increments_;
-        }
-        if(!buffer_.expand(capacity)) {
-            return false;
-        }
+    if(!stream.valid() || !isSupportedConversion(pixelType, imageType)) {
+        return false;
     }
-    memcpy(buffer_.begin() + size_, data, size);
-    size_ += size;
+    switch(compression) {
+    case NO_COMPRESSION:
+    case RLE_COMPRESSION:
+    case ZIPS_COMPRESSION:
+    case ZIP_COMPRESSION:
+    case PIZ_COMPRESSION:
+    case PXR24_COMPRESSION:
+        break;
+    default:
+        return false;
+    }
+
+    SeekSet seekSet(stream.tell(), &stream);
+
+    u64 begin = stream.tell();
+
+    if(!writeHeader(stream, width, height, colorType, pixelType, compression, CPPIMG_NULL)) {
+        return false;
+    }
+    WriteContext writeContext;
+    u64 offset = stream.tell() - begin;
+    if(!writeScanlineBlocks(writeContext, offset, width, height, colorType, pixelType, imageType, compression, image, pitch, numThreads)) {
+        return false;
+    }
+    if(stream.write(sizeof(u64) * writeContext.numChunks_, writeContext.offsetTable_) <= 0) {
+        return false;
+    }
+    if(stream.write(writeContext.size(), writeContext.begin()) <= 0) {
+        return false;
+    }
+    seekSet.clear();
     return true;
 }
 
-//----------------------------------------------------
-OpenEXR::Context::Context()
-    : offsetTable_(CPPIMG_NULL)
-    , information_(CPPIMG_NULL)
-    , image_(CPPIMG_NULL)
+bool OpenEXR::writeTiled(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, const void* image, s32 tileWidth, s32 tileHeight, LevelMode levelMode, RoundingMode roundingMode, Compression compression, s32 numThreads)
 {
-    version_.version_ = 0;
-    memset(&header_, 0, sizeof(Header));
-    header_.initialize();
+    return writeTiled(stream, width, height, colorType, pixelType, pixelType, image, tileWidth, tileHeight, levelMode, roundingMode, compression, numThreads);
 }
 
-OpenEXR::Context::~Context()
+bool OpenEXR::writeTiled(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const void* image, s32 tileWidth, s32 tileHeight, LevelMode levelMode, RoundingMode roundingMode, Compression compression, s32 numThreads)
 {
-    CPPIMG_FREE(offsetTable_);
+    s64 pitch = static_cast<s64>(width) * getNumChannels(colorType) * getSize(imageType);
+    return writeTiledImage(stream, width, height, colorType, pixelType, imageType, image, pitch, tileWidth, tileHeight, levelMode, roundingMode, compression, numThreads);
 }
 
-bool OpenEXR::Context::readVersion(Stream& stream)
+bool OpenEXR::writeTiled(Stream& stream, const ImageView& image, Type pixelType, s32 tileWidth, s32 tileHeight, LevelMode levelMode, RoundingMode roundingMode, Compression compression, s32 numThreads)
 {
-    return 0 < stream.read(4, &version_);
+    Type imageType;
+    if(!getViewType(imageType, image.format_)) {
+        return false;
+    }
+    return writeTiledImage(stream, image.width_, image.height_, getColorType(image.format_), pixelType, imageType, image.data_, image.pitch_, tileWidth, tileHeight, levelMode, roundingMode, compression, numThreads);
 }
 
-bool OpenEXR::Context::readHeader(Stream& stream)
+bool OpenEXR::writeTiledImage(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const void* image, s64 pitch, s32 tileWidth, s32 tileHeight, LevelMode levelMode, RoundingMode roundingMode, Compression compression, s32 numThreads)
 {
-    static const u32 CommonFlags = (0x01U << AttrName_Channels)
-                                   | (0x01U << AttrName_Compression)
-                                   | (0x01U << AttrName_DataWindow)
-                                   | (0x01U << AttrName_DisplayWindow)
-                                   | (0x01U << AttrName_LineOrder)
-                                   | (0x01U << AttrName_PixelAspectRatio)
-                                   | (0x01U << AttrName_ScreenWindowCenter)
-                                   | (0x01U << AttrName_ScreenWindowWidth);
-
-    static const u32 TiledFlags = (0x01U << AttrName_Tiles);
+    CPPIMG_ASSERT(1 <= width);
+    CPPIMG_ASSERT(1 <= height);
+    CPPIMG_ASSERT(CPPIMG_NULL != image);
+    CPPIMG_ASSERT(1 <= tileWidth);
+    CPPIMG_ASSERT(1 <= tileHeight);
 
-    static const u32 MultiPartFlags = (0x01U << AttrName_View)
-                                      | (0x01U << AttrName_Name)
-                                      | (0x01U << AttrName_Type)
-                                      | (0x01U << AttrName_Version)
-                                      | (0x01U << AttrName_ChunkCount)
-                                      | (0x01U << AttrName_Tiles);
+    if(!stream.valid() || !isSupportedConversion(pixelType, imageType)) {
+        return false;
+    }
+    switch(levelMode) {
+    case ONE_LEVEL:
+    case MIPMAP_LEVELS:
+    case RIPMAP_LEVELS:
+        break;
+    default:
+        return false;
+    }
+    switch(compression) {
+    case NO_COMPRESSION:
+    case RLE_COMPRESSION:
+    case ZIPS_COMPRESSION:
+    case ZIP_COMPRESSION:
+    case PIZ_COMPRESSION:
+    case PXR24_COMPRESSION:
+        break;
+    default:
+        return false;
+    }
 
-    static const u32 DeepDataFlags = (0x01U << AttrName_Name)
-                                     | (0x01U << AttrName_Type)
-                                     | (0x01U << AttrName_Version)
-                                     | (0x01U << AttrName_ChunkCount)
-                                     | (0x01U << AttrName_Tiles)
-                                     | (0x01U << AttrName_MaxSamplesPerPixel);
+    SeekSet seekSet(stream.tell(), &stream);
 
-    u32 flags = 0;
-    for(;;) {
-        Status status = readAttribute(flags, stream);
-        if(Error == status) {
-            return false;
-        }
-        if(End == status) {
-            break;
-        }
-    }
+    u64 begin = stream.tell();
 
-    if(CommonFlags != (flags & CommonFlags)) {
+    TiledDesc tiles;
+    tiles.xSize_ = static_cast<u32>(tileWidth);
+    tiles.ySize_ = static_cast<u32>(tileHeight);
+    tiles.levelMode_ = static_cast<u8>(levelMode);
+    tiles.roundingMode_ = static_cast<u8>(roundingMode);
+    if(!writeHeader(stream, width, height, colorType, pixelType, compression, &tiles)) {
         return false;
     }
-    if(version_.isTile() && (TiledFlags != (flags & TiledFlags))) {
+    WriteContext writeContext;
+    u64 offset = stream.tell() - begin;
+    if(!writeTileBlocks(writeContext, offset, width, height, colorType, pixelType, imageType, tiles, compression, image, pitch, numThreads)) {
         return false;
     }
-    if(version_.isMultiPart() && (MultiPartFlags != (flags & MultiPartFlags))) {
+    if(stream.write(sizeof(u64) * writeContext.numChunks_, writeContext.offsetTable_) <= 0) {
         return false;
     }
-    if(version_.isDeepData() && (DeepDataFlags != (flags & DeepDataFlags))) {
+    if(stream.write(writeContext.size(), writeContext.begin()) <= 0) {
         return false;
     }
-
-    if(0 == (flags & (0x01U << AttrName_ChunkCount))) {
-        if(0 == (flags & (0x01U << AttrName_Tiles))) {
-            switch(header_.compression_) {
-            case NO_COMPRESSION:
-            case RLE_COMPRESSION:
-            case ZIPS_COMPRESSION:
-                header_.chunkCount_ = (header_.dataWindow_.yMax_ - header_.dataWindow_.yMin_ + 1);
-                break;
-            case ZIP_COMPRESSION: {
-                s32 lines = (header_.dataWindow_.yMax_ - header_.dataWindow_.yMin_ + 1);
-                header_.chunkCount_ = (lines + (LinesPerBlock - 1)) / LinesPerBlock;
-            } break;
-            case PIZ_COMPRESSION:
-            case PXR24_COMPRESSION:
-            case B44_COMPRESSION:
-            case B44A_COMPRESSION:
-                header_.chunkCount_ = 0;
-                return false;
-            }
-        } else {
-            header_.chunkCount_ = header_.tiles_.xSize_ * header_.tiles_.ySize_;
-        }
-    }
+    seekSet.clear();
     return true;
 }
 
-OpenEXR::Context::Status OpenEXR::Context::readAttribute(u32& flags, Stream& stream)
+bool OpenEXR::writeHeader(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, Compression compression, const TiledDesc* tiles)
 {
-    AttributeName attributeName;
-    AttributeType attributeType;
-    Char str[MaxStringSize];
-
-    // Read attribute name
-    if(OpenEXR::read(str, stream) <= 0) {
-        return Error;
-    }
-    attributeName = findAttributeName(str);
-    // End of an attribute list
-    if(AttrName_End == attributeName) {
-        return End;
+    // Write common header
+    u32 magic = MAGIC;
+    if(stream.write(4, &magic) <= 0) {
+        return false;
     }
-    if(AttrName_Max == attributeName) {
-        skipUnknownName(stream);
-        return Success;
+    Version version = Version::create(CPPIMG_NULL != tiles, false, false, false);
+    if(stream.write(4, &version.version_) <= 0) {
+        return false;
     }
 
-    // Read attribute type
-    if(OpenEXR::read(str, stream) <= 0) {
-        return Error;
-    }
-    attributeType = findAttributeType(str);
-    if(AttrType_Max == attributeType) {
-        skipUnknownType(stream);
-        return Success;
+    // Write channels
+    if(writeChannels(stream, colorType, pixelType) <= 0) {
+        return false;
     }
 
-    s32 size;
-    if(stream.read(sizeof(s32), &size) <= 0) {
-        return Error;
+    // Write compression
+    u8 compressionType = static_cast<u8>(compression);
+    if(writeAttribute(stream, AttrName_Compression, AttrType_Compression, 1, &compressionType) <= 0) {
+        return false;
     }
-    switch(attributeName) {
-    case AttrName_Channels:
-        if(!readChannels(stream, size)) {
-            return Error;
-        }
-        break;
-    case AttrName_Compression:
-        if(stream.read(sizeof(u8), &header_.compression_) <= 0) {
-            return Error;
-        }
-        break;
-    case AttrName_DataWindow:
-        if(stream.read(sizeof(Box2i), &header_.dataWindow_) <= 0) {
-            return Error;
-        }
-        break;
-    case AttrName_DisplayWindow:
-        if(stream.read(sizeof(Box2i), &header_.displayWindow_) <= 0) {
-            return Error;
-        }
-        break;
-    case AttrName_LineOrder:
-        if(stream.read(sizeof(u8), &header_.lineOrder_) <= 0) {
-            return Error;
-        }
-        break;
-    case AttrName_PixelAspectRatio:
-        if(stream.read(sizeof(f32), &header_.pixelAspectRatio_) <= 0) {
-            return Error;
-        }
-        break;
-    case AttrName_ScreenWindowCenter:
-        if(stream.read(sizeof(Vector2f), &header_.screenWindowCenter_) <= 0) {
-            return Error;
-        }
-        break;
-    case AttrName_ScreenWindowWidth:
-        if(stream.read(sizeof(f32), &header_.screenWindowWidth_) <= 0) {
-            return Error;
-        }
-        break;
-    case AttrName_Tiles:
-        if(stream.read(sizeof(TiledDesc), &header_.tiles_) <= 0) {
-            return Error;
-        }
-        break;
-    case AttrName_View:
-        if(readString(header_.view_, stream) < 0) {
-            return Error;
-        }
-        break;
-    case AttrName_Name:
-        if(readString(header_.name_, stream) < 0) {
-            return Error;
-        }
-        break;
-    case AttrName_Type:
-        if(readString(header_.type_, stream) < 0) {
-            return Error;
-        }
-        break;
-    case AttrName_Version:
-        if(stream.read(sizeof(s32), &header_.version_) <= 0) {
-            return Error;
-        }
-        break;
-    case AttrName_ChunkCount:
-        if(stream.read(sizeof(s32), &header_.chunkCount_) <= 0) {
-            return Error;
+
+    // Write dataWindow
+    Box2i dataWindow = {0, 0, width - 1, height - 1};
+    if(writeAttribute(stream, AttrName_DataWindow, AttrType_Box2i, sizeof(Box2i), &dataWindow) <= 0) {
+        return false;
+    }
+
+    // Write displayWindow
+    Box2i displayWindow = {0, 0, width - 1, height - 1};
+    if(writeAttribute(stream, AttrName_DisplayWindow, AttrType_Box2i, sizeof(Box2i), &displayWindow) <= 0) {
+        return false;
+    }
+
+    // Write lineOrder
+    u8 lineOrder = INCREASING_Y;
+    if(writeAttribute(stream, AttrName_LineOrder, AttrType_LineOrder, sizeof(u8), &lineOrder) <= 0) {
+        return false;
+    }
+
+    // Write pixelAspectRatio
+    f32 pixelRatio = 1.0f;
+    if(writeAttribute(stream, AttrName_PixelAspectRatio, AttrType_Float, sizeof(f32), &pixelRatio) <= 0) {
+        return false;
+    }
+
+    // Write screenWindowCenter
+    Vector2f screenWindowCenter = {0.0f, 0.0f};
+    if(writeAttribute(stream, AttrName_ScreenWindowCenter, AttrType_V2f, sizeof(Vector2f), &screenWindowCenter) <= 0) {
+        return false;
+    }
+
+    // Write screenWindowWidth
+    f32 screenWindotWidth = 1.0f;
+    if(writeAttribute(stream, AttrName_ScreenWindowWidth, AttrType_Float, sizeof(f32), &screenWindotWidth) <= 0) {
+        return false;
+    }
+
+    // Write tiles
+    if(CPPIMG_NULL != tiles) {
+        u8 tileDesc[9];
+        memcpy(tileDesc, &tiles->xSize_, sizeof(u32));
+        memcpy(tileDesc + 4, &tiles->ySize_, sizeof(u32));
+        tileDesc[8] = static_cast<u8>(tiles->levelMode_ | (tiles->roundingMode_ << 4));
+        if(writeAttribute(stream, AttrName_Tiles, AttrType_TileDesc, sizeof(tileDesc), tileDesc) <= 0) {
+            return false;
         }
+    }
+
+    return 0 < writeNull(stream);
+}
+
+void OpenEXR::getChannelInformation(s32 offsets[MaxOutChannels], ColorType colorType, Type pixelType)
+{
+    s32 bytesPerChannel = getSize(pixelType);
+    switch(colorType) {
+    case ColorType::GRAY:
+        offsets[0] = 0;
         break;
-    case AttrName_MaxSamplesPerPixel:
-        if(stream.read(sizeof(s32), &header_.maxSamplesPerPixel_) <= 0) {
-            return Error;
-        }
+    case ColorType::RGB:
+        offsets[0] = (bytesPerChannel << 1);
+        offsets[1] = bytesPerChannel;
+        offsets[2] = 0;
         break;
-    case AttrName_Chromaticities:
-        if(stream.read(sizeof(Chromaticities), &header_.chromaticities_) <= 0) {
-            return Error;
-        }
-        header_.hasChromaticities_ = true;
+    case ColorType::RGBA:
+        offsets[0] = (bytesPerChannel << 1) + bytesPerChannel;
+        offsets[1] = (bytesPerChannel << 1);
+        offsets[2] = bytesPerChannel;
+        offsets[3] = 0;
         break;
     default:
-        return Success;
+        return;
     }
-    flags |= 0x01U << attributeName;
-    return Success;
 }
 
-void OpenEXR::Context::skipUnknownName(Stream& stream)
+void OpenEXR::preprocess(s32 size, u8* dst, const u8* src)
 {
-    // Skip type string
-    s32 length = 0;
-    Char c;
-    while(length < MaxStringSize) {
-        if(stream.read(1, &c) <= 0) {
-            return;
-        }
-        if(CPPIMG_NULLCHAR == c) {
-            break;
+    if(size <= 0) {
+        return;
+    }
+    // Split into even and odd bytes, and take differences of neighbors in the split order at once
+    s32 half = (size + 1) >> 1;
+    s32 pairs = size >> 1;
+    u8* t0 = dst;
+    u8* t1 = dst + half;
+    u8 e = src[0];
+    u8 o = 0;
+    s32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+    const __m128i mask = _mm_set1_epi16(0xFF);
+    const __m128i bias = _mm_set1_epi8(static_cast<s8>(0x80));
+    __m128i prevEven = _mm_set1_epi8(static_cast<s8>(e));
+    __m128i prevOdd = _mm_setzero_si128();
+    for(; (i + 16) <= pairs; i += 16) {
+        __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2 + 16));
+        __m128i even = _mm_packus_epi16(_mm_and_si128(x0, mask), _mm_and_si128(x1, mask));
+        __m128i odd = _mm_packus_epi16(_mm_srli_epi16(x0, 8), _mm_srli_epi16(x1, 8));
+        __m128i deltaEven = _mm_sub_epi8(even, _mm_alignr_epi8(even, prevEven, 15));
+        __m128i deltaOdd = _mm_sub_epi8(odd, _mm_alignr_epi8(odd, prevOdd, 15));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(t0 + i), _mm_add_epi8(deltaEven, bias));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(t1 + i), _mm_add_epi8(deltaOdd, bias));
+        prevEven = even;
+        prevOdd = odd;
+    }
+    if(0 < i) {
+        e = src[i * 2 - 2];
+        o = src[i * 2 - 1];
+    }
+#    endif
+    for(; i < pairs; ++i) {
+        u8 x0 = src[i * 2];
+        u8 x1 = src[i * 2 + 1];
+        t0[i] = static_cast<u8>(x0 - e + 128);
+        t1[i] = static_cast<u8>(x1 - o + 128);
+        e = x0;
+        o = x1;
+    }
+    if(pairs < half) {
+        u8 x0 = src[pairs * 2];
+        t0[pairs] = static_cast<u8>(x0 - e + 128);
+        e = x0;
+    }
+    // The first byte is stored as is, and the first odd byte follows the last even byte
+    dst[0] = src[0];
+    if(1 < size) {
+        dst[half] = static_cast<u8>(src[1] - e + 128);
+    }
+}
+
+void OpenEXR::postprocess(s32 size, u8* dst, const u8* src)
+{
+    if(size <= 0) {
+        return;
+    }
+    // Prefix sums of the even half and the odd half at once, and interleave them.
+    // The odd half starts from the last value of the even half, which is the sum of the even half
+    s32 half = (size + 1) >> 1;
+    s32 pairs = size >> 1;
+    const u8* t0 = src;
+    const u8* t1 = src + half;
+    u32 sum = 0;
+    s32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+    {
+        __m128i total = _mm_setzero_si128();
+        for(; (i + 16) <= half; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t0 + i));
+            total = _mm_add_epi64(total, _mm_sad_epu8(x, _mm_setzero_si128()));
         }
-        ++length;
+        sum = static_cast<u32>(_mm_cvtsi128_si32(total)) + static_cast<u32>(_mm_cvtsi128_si32(_mm_srli_si128(total, 8)));
+    }
+#    endif
+    for(; i < half; ++i) {
+        sum += t0[i];
+    }
+    // 128 before the first byte, so that the first byte is decoded as is
+    u8 e = 128;
+    u8 o = static_cast<u8>(sum - 128 * (half - 1));
+
+    i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+    const __m128i bias = _mm_set1_epi8(static_cast<s8>(0x80));
+    const __m128i last = _mm_set1_epi8(15);
+    __m128i carryEven = _mm_set1_epi8(static_cast<s8>(e));
+    __m128i carryOdd = _mm_set1_epi8(static_cast<s8>(o));
+    for(; (i + 16) <= pairs; i += 16) {
+        __m128i even = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t0 + i)), bias);
+        __m128i odd = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t1 + i)), bias);
+        // Log-step prefix sums
+        even = _mm_add_epi8(even, _mm_slli_si128(even, 1));
+        odd = _mm_add_epi8(odd, _mm_slli_si128(odd, 1));
+        even = _mm_add_epi8(even, _mm_slli_si128(even, 2));
+        odd = _mm_add_epi8(odd, _mm_slli_si128(odd, 2));
+        even = _mm_add_epi8(even, _mm_slli_si128(even, 4));
+        odd = _mm_add_epi8(odd, _mm_slli_si128(odd, 4));
+        even = _mm_add_epi8(even, _mm_slli_si128(even, 8));
+        odd = _mm_add_epi8(odd, _mm_slli_si128(odd, 8));
+        even = _mm_add_epi8(even, carryEven);
+        odd = _mm_add_epi8(odd, carryOdd);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), _mm_unpacklo_epi8(even, odd));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2 + 16), _mm_unpackhi_epi8(even, odd));
+        carryEven = _mm_shuffle_epi8(even, last);
+        carryOdd = _mm_shuffle_epi8(odd, last);
+    }
+    if(0 < i) {
+        e = dst[i * 2 - 2];
+        o = dst[i * 2 - 1];
+    }
+#    endif
+    for(; i < pairs; ++i) {
+        e = static_cast<u8>(e + t0[i] - 128);
+        o = static_cast<u8>(o + t1[i] - 128);
+        dst[i * 2] = e;
+        dst[i * 2 + 1] = o;
     }
+    if(pairs < half) {
+        dst[pairs * 2] = static_cast<u8>(e + t0[pairs] - 128);
+    }
+}
 
-    skipUnknownType(stream);
+s32 OpenEXR::getNumThreads(s32 numThreads, s32 count)
+{
+#    if defined(CPPIMG_DISABLE_THREADS)
+    numThreads = 1;
+#    else
+    if(numThreads <= 0) {
+        numThreads = static_cast<s32>(std::thread::hardware_concurrency());
+    }
+#    endif
+    return clamp(numThreads, 1, maximum(count, 1));
 }
 
-void OpenEXR::Context::skipUnknownType(Stream& stream)
+s32 OpenEXR::getLinesPerBlock(s32 compression)
 {
-    s32 size = 0;
-    if(stream.read(sizeof(s32), &size) <= 0) {
-        return;
+    switch(compression) {
+    case ZIP_COMPRESSION:
+    case PXR24_COMPRESSION:
+        return 16;
+    case PIZ_COMPRESSION:
+    case B44_COMPRESSION:
+    case B44A_COMPRESSION:
+        return 32;
+    default:
+        return 1;
     }
-    stream.seek(size, SEEK_CUR);
 }
 
-bool OpenEXR::Context::readChannel(Channel& channel, Stream& stream)
+s32 OpenEXR::deflateZlib(szlib::szContext& context, Buffer& dst, s32 srcSize, const u8* src)
 {
-    s32 length = 0;
-    channel.name_[length] = CPPIMG_NULLCHAR;
-    while(length < MaxStringSize) {
-        Char c;
-        if(stream.read(1, &c) <= 0) {
-            return false;
-        }
-        channel.name_[length] = c;
-        if(c == CPPIMG_NULLCHAR) {
+    szlib::resetDeflate(&context, srcSize, src, szlib::SZ_Level_Fixed);
+    static const s32 ChunkSize = 512;
+    u8 chunk[ChunkSize];
+
+    s32 total = 0;
+    for(;;) {
+        context.availOut_ = ChunkSize;
+        context.nextOut_ = chunk;
+        s32 ret = szlib::deflate(&context);
+        switch(ret) {
+        case szlib::SZ_ERROR_MEMORY:
+        case szlib::SZ_ERROR_FORMAT:
+            return -1;
+        default:
+            s32 outCount = total;
+            total += context.thisTimeOut_;
+            if(dst.capacity() < total && !dst.expand(maximum(dst.capacity() * 2, static_cast<s64>(total)))) {
+                return -1;
+            }
+            if(0 < context.thisTimeOut_) {
+                memcpy(&dst[outCount], chunk, context.thisTimeOut_);
+            }
+            if(szlib::SZ_END != ret) {
+                continue;
+            }
             break;
-        }
-        ++length;
+        };
+        break;
     }
-    if(MaxStringSize <= length) {
-        return false;
+    return total;
+}
+
+s32 OpenEXR::inflateZlib(szlib::szContext& context, Buffer& dst, s32 srcSize, const u8* src)
+{
+    szlib::resetInflate(&context, srcSize, src);
+    static const s32 ChunkSize = 512;
+    u8 chunk[ChunkSize];
+
+    s32 total = 0;
+    for(;;) {
+        context.availOut_ = ChunkSize;
+        context.nextOut_ = chunk;
+        s32 ret = szlib::inflate(&context);
+        switch(ret) {
+        case szlib::SZ_ERROR_MEMORY:
+        case szlib::SZ_ERROR_FORMAT:
+            return -1;
+        default:
+            s32 current = total;
+            total += context.thisTimeOut_;
+            if(dst.capacity() < total && !dst.expand(maximum(dst.capacity() * 2, static_cast<s64>(total)))) {
+                return -1;
+            }
+            if(0 < context.thisTimeOut_) {
+                memcpy(&dst[current], chunk, context.thisTimeOut_);
+            }
+            if(szlib::SZ_END != ret) {
+                continue;
+            }
+            break;
+        };
+        break;
     }
-    if(length <= 0) {
-        return true;
+    return total;
+}
+
+s32 OpenEXR::compressZlib(szlib::szContext& context, Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src)
+{
+    if(!tmp.reserve(srcSize)) {
+        return -1;
     }
-    if(stream.read(sizeof(s32), &channel.pixelType_) <= 0) {
-        return false;
+    preprocess(srcSize, &tmp[0], src);
+    return deflateZlib(context, dst, srcSize, &tmp[0]);
+}
+
+namespace
+{
+    /**
+        @brief Count bytes same as the first one
+        @param size ... the maximum to count
+        */
+    s32 getRunLength(const u8* src, s32 size)
+    {
+        s32 count = 1;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        const __m128i first = _mm_set1_epi8(static_cast<s8>(src[0]));
+        for(; (count + 16) <= size; count += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + count));
+            u32 mask = static_cast<u32>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, first)));
+            if(0xFFFFU != mask) {
+                return count + countTrailingZeros(~mask);
+            }
+        }
+#    endif
+        while(count < size && src[count] == src[0]) {
+            ++count;
+        }
+        return count;
     }
-    if(stream.read(4, channel.flags_) <= 0) {
-        return false;
+
+    /**
+        @brief Find the next run of 3 same bytes
+        @return Number of bytes before the run, or maxSize if not found
+        @param maxSize ... maximum number of bytes before the run
+        @param size ... bytes available
+        */
+    s32 findRun(const u8* src, s32 maxSize, s32 size)
+    {
+        s32 i = 1;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        for(; i < maxSize && (i + 18) <= size; i += 16) {
+            __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 1));
+            __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 2));
+            u32 mask = static_cast<u32>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x0, x1), _mm_cmpeq_epi8(x1, x2))));
+            if(0 != mask) {
+                return minimum(i + countTrailingZeros(mask), maxSize);
+            }
+        }
+#    endif
+        for(; i < maxSize && (i + 2) < size; ++i) {
+            if(src[i] == src[i + 1] && src[i + 1] == src[i + 2]) {
+                return i;
+            }
+        }
+        return minimum(maxSize, size);
     }
-    if(stream.read(sizeof(s32), &channel.xSampling_) <= 0) {
-        return false;
+
+    /**
+        @brief Encode runs of 3 to 128 bytes as (count - 1, byte), and others as (-count, bytes)
+        */
+    s32 encodeRLE(u8* dst, s32 size, const u8* src)
+    {
+        static const s32 MinRunLength = 3;
+        static const s32 MaxRunLength = 128;
+        static const s32 MaxLiteralLength = 127;
+        u8* d = dst;
+        for(s32 i = 0; i < size;) {
+            s32 count = getRunLength(src + i, minimum(size - i, MaxRunLength));
+            if(MinRunLength <= count) {
+                d[0] = static_cast<u8>(count - 1);
+                d[1] = src[i];
+                d += 2;
+            } else {
+                count = findRun(src + i, MaxLiteralLength, size - i);
+                d[0] = static_cast<u8>(-count);
+                memcpy(d + 1, src + i, count);
+                d += count + 1;
+            }
+            i += count;
+        }
+        return static_cast<s32>(d - dst);
     }
-    if(stream.read(sizeof(s32), &channel.ySampling_) <= 0) {
-        return false;
+} // namespace
+
+s32 OpenEXR::compressRLE(Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src)
+{
+    // Each 127 bytes of literals take a byte of the count
+    if(!tmp.reserve(srcSize) || !dst.reserve(srcSize + (srcSize + 126) / 127)) {
+        return -1;
     }
-    return true;
+    preprocess(srcSize, &tmp[0], src);
+    return encodeRLE(&dst[0], srcSize, &tmp[0]);
 }
 
-bool OpenEXR::Context::readChannels(Stream& stream, s32 valueSize)
+s32 OpenEXR::uncompressZlib(szlib::szContext& context, Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src)
 {
-    s32 count = 0;
-    s32 size = 0;
-    Channel tmp;
-    for(;;) {
-        Channel* channel = (count < MaxInChannels) ? &header_.channels_[count] : &tmp;
-        if(!readChannel(*channel, stream)) {
-            return false;
+    s32 total = inflateZlib(context, tmp, srcSize, src);
+    if(total <= 0 || !dst.reserve(total)) {
+        return -1;
+    }
+    postprocess(total, &dst[0], &tmp[0]);
+    return total;
+}
+
+namespace
+{
+    /**
+        @brief Round a float to 24 bits, 1 sign, 8 exponent, and 15 significand bits
+        */
+    u32 toFloat24(f32 f)
+    {
+        UnionU32F32 t;
+        t.f32_ = f;
+        u32 s = t.u32_ & 0x80000000U;
+        u32 e = t.u32_ & 0x7F800000U;
+        u32 m = t.u32_ & 0x007FFFFFU;
+        u32 i;
+        if(0x7F800000U == e) {
+            if(m) {
+                // NaN, keep the leftmost bits of the significand
+                m >>= 8;
+                i = (e >> 8) | m | (0 == m);
+            } else {
+                // Infinity
+                i = e >> 8;
+            }
+        } else {
+            i = ((e | m) + (m & 0x00000080U)) >> 8;
+            if(0x7F8000U <= i) {
+                // Truncate instead of rounding to infinity
+                i = (e | m) >> 8;
+            }
         }
+        return (s >> 8) | i;
+    }
 
-        if(channel->name_[0] == CPPIMG_NULLCHAR) {
-            size += 1;
-            break;
+    inline s32 getPXR24Size(s32 type)
+    {
+        switch(static_cast<Type>(type)) {
+        case Type::UINT:
+            return 4;
+        case Type::HALF:
+            return 2;
+        case Type::FLOAT:
+        default:
+            return 3;
         }
-        size += static_cast<s32>(sizeof(s32) * 4 + sizeof(Char) * (strlen(channel->name_) + 1));
-        ++count;
     }
-    header_.numChannels_ = minimum(count, MaxInChannels);
-    header_.sortChannels();
-    return size == valueSize;
-}
+} // namespace
 
-bool OpenEXR::Context::readOffsetTable(Stream& stream)
+s32 OpenEXR::compressPXR24(szlib::szContext& context, Buffer& dst, Buffer& tmp, s32 width, s32 lines, s32 numChannels, const s32* types, const u8* src)
 {
-    CPPIMG_FREE(offsetTable_);
-    u32 size = sizeof(u64) * header_.chunkCount_;
-    offsetTable_ = reinterpret_cast<u64*>(CPPIMG_MALLOC(size));
-    return 0 < stream.read(size, offsetTable_);
-}
+    s32 size = 0;
+    for(s32 i = 0; i < numChannels; ++i) {
+        size += width * getPXR24Size(types[i]);
+    }
+    size *= lines;
+    if(!tmp.reserve(size)) {
+        return -1;
+    }
 
-bool OpenEXR::Context::readScanlines(Stream& stream)
-{
-    CPPIMG_ASSERT(CPPIMG_NULL != image_);
-    bool result = false;
-    switch(header_.compression_) {
-    case NO_COMPRESSION:
-        result = readScanlines_NO_COMPRESSION(stream);
-        break;
-    case RLE_COMPRESSION:
-        result = readScanlines_RLE_COMPRESSION(stream);
-        break;
-    case ZIPS_COMPRESSION:
-    case ZIP_COMPRESSION:
-        result = readScanlines_ZIP_COMPRESSION(stream);
-        break;
-    case PIZ_COMPRESSION:
-    case PXR24_COMPRESSION:
-    case B44_COMPRESSION:
-    case B44A_COMPRESSION:
-    default:
-        break;
+    // Split differences of samples into byte planes of each line and channel
+    u8* d = &tmp[0];
+    for(s32 i = 0; i < lines; ++i) {
+        for(s32 j = 0; j < numChannels; ++j) {
+            u32 previous = 0;
+            switch(static_cast<Type>(types[j])) {
+            case Type::UINT: {
+                u8* p0 = d;
+                u8* p1 = p0 + width;
+                u8* p2 = p1 + width;
+                u8* p3 = p2 + width;
+                d = p3 + width;
+                for(s32 k = 0; k < width; ++k) {
+                    u32 pixel;
+                    memcpy(&pixel, src, sizeof(u32));
+                    src += sizeof(u32);
+                    u32 diff = pixel - previous;
+                    previous = pixel;
+                    p0[k] = static_cast<u8>(diff >> 24);
+                    p1[k] = static_cast<u8>(diff >> 16);
+                    p2[k] = static_cast<u8>(diff >> 8);
+                    p3[k] = static_cast<u8>(diff);
+                }
+            } break;
+            case Type::HALF: {
+                u8* p0 = d;
+                u8* p1 = p0 + width;
+                d = p1 + width;
+                for(s32 k = 0; k < width; ++k) {
+                    u16 pixel;
+                    memcpy(&pixel, src, sizeof(u16));
+                    src += sizeof(u16);
+                    u32 diff = pixel - previous;
+                    previous = pixel;
+                    p0[k] = static_cast<u8>(diff >> 8);
+                    p1[k] = static_cast<u8>(diff);
+                }
+            } break;
+            case Type::FLOAT: {
+                u8* p0 = d;
+                u8* p1 = p0 + width;
+                u8* p2 = p1 + width;
+                d = p2 + width;
+                for(s32 k = 0; k < width; ++k) {
+                    f32 value;
+                    memcpy(&value, src, sizeof(f32));
+                    src += sizeof(f32);
+                    u32 pixel = toFloat24(value);
+                    u32 diff = pixel - previous;
+                    previous = pixel;
+                    p0[k] = static_cast<u8>(diff >> 16);
+                    p1[k] = static_cast<u8>(diff >> 8);
+                    p2[k] = static_cast<u8>(diff);
+                }
+            } break;
+            }
+        }
     }
-    return result;
+    return deflateZlib(context, dst, size, &tmp[0]);
 }
 
-bool OpenEXR::Context::readScanlines_NO_COMPRESSION(Stream& stream)
+bool OpenEXR::uncompressPXR24(szlib::szContext& context, u8* dst, Buffer& tmp, s32 width, s32 lines, s32 numChannels, const s32* types, s32 srcSize, const u8* src)
 {
-    s32 bytesPerPixel = information_->getBytesPerPixel();
-    s32 lineSize = information_->width_ * bytesPerPixel;
-    s32 sizes[MaxInChannels];
-    s32 offsets[MaxInChannels];
-    getChannelInformation(sizes, offsets);
-
-    s32 y = 0;
-    s32 dataSize = 0;
-    for(s32 i = 0; i < header_.chunkCount_; ++i) {
-        stream.seek(offsetTable_[i], SEEK_SET);
-        if(stream.read(sizeof(s32), &y) <= 0) {
-            return false;
-        }
-        if(stream.read(sizeof(s32), &dataSize) <= 0) {
-            return false;
-        }
+    s32 size = 0;
+    for(s32 i = 0; i < numChannels; ++i) {
+        size += width * getPXR24Size(types[i]);
+    }
+    size *= lines;
+    if(size != inflateZlib(context, tmp, srcSize, src)) {
+        return false;
+    }
 
-        for(s32 j = 0; j < information_->numChannels_; ++j) {
-            u8* pixel = reinterpret_cast<u8*>(image_) + y * lineSize + offsets[j];
-            for(s32 k = 0; k < information_->width_; ++k) {
-                if(stream.read(sizes[j], pixel) <= 0) {
-                    return false;
+    const u8* s = &tmp[0];
+    for(s32 i = 0; i < lines; ++i) {
+        for(s32 j = 0; j < numChannels; ++j) {
+            u32 pixel = 0;
+            switch(static_cast<Type>(types[j])) {
+            case Type::UINT: {
+                const u8* p0 = s;
+                const u8* p1 = p0 + width;
+                const u8* p2 = p1 + width;
+                const u8* p3 = p2 + width;
+                s = p3 + width;
+                for(s32 k = 0; k < width; ++k) {
+                    pixel += (static_cast<u32>(p0[k]) << 24) | (static_cast<u32>(p1[k]) << 16) | (static_cast<u32>(p2[k]) << 8) | p3[k];
+                    memcpy(dst, &pixel, sizeof(u32));
+                    dst += sizeof(u32);
+                }
+            } break;
+            case Type::HALF: {
+                const u8* p0 = s;
+                const u8* p1 = p0 + width;
+                s = p1 + width;
+                for(s32 k = 0; k < width; ++k) {
+                    pixel += (static_cast<u32>(p0[k]) << 8) | p1[k];
+                    u16 half = static_cast<u16>(pixel);
+                    memcpy(dst, &half, sizeof(u16));
+                    dst += sizeof(u16);
+                }
+            } break;
+            case Type::FLOAT: {
+                const u8* p0 = s;
+                const u8* p1 = p0 + width;
+                const u8* p2 = p1 + width;
+                s = p2 + width;
+                for(s32 k = 0; k < width; ++k) {
+                    pixel += (static_cast<u32>(p0[k]) << 24) | (static_cast<u32>(p1[k]) << 16) | (static_cast<u32>(p2[k]) << 8);
+                    memcpy(dst, &pixel, sizeof(u32));
+                    dst += sizeof(u32);
                 }
-                pixel += bytesPerPixel;
-                dataSize -= sizes[j];
+            } break;
             }
         }
-        CPPIMG_ASSERT(0 == dataSize);
     }
     return true;
 }
 
-bool OpenEXR::Context::readScanlines_RLE_COMPRESSION(Stream& stream)
+namespace
 {
-    s32 bytesPerPixel = information_->getBytesPerPixel();
-    s32 lineSize = information_->width_ * bytesPerPixel;
-    s32 sizes[MaxInChannels];
-    s32 offsets[MaxInChannels];
-    getChannelInformation(sizes, offsets);
+    /**
+        @brief Table to convert logarithmic B44 values of linear channels
+        */
+    struct B44ExpTable
+    {
+        B44ExpTable()
+        {
+            static const f32 HalfMax = 65504.0f;
+            const f32 limit = 8.0f * logf(HalfMax);
+            for(s32 i = 0; i < 0x10000; ++i) {
+                if(0x7C00U == (i & 0x7C00U)) {
+                    table_[i] = 0;
+                    continue;
+                }
+                f32 h = toFloat32(static_cast<u16>(i));
+                table_[i] = (limit <= h) ? toFloat16(HalfMax) : toFloat16(expf(h / 8.0f));
+            }
+        }
 
-    Buffer dst(lineSize * 2);
-    u8* tmp = &dst[0] + lineSize;
+        u16 table_[0x10000];
+    };
 
-    s32 y = 0;
-    s32 dataSize = 0;
-    for(s32 i = 0; i < header_.chunkCount_; ++i) {
-        stream.seek(offsetTable_[i], SEEK_SET);
-        if(stream.read(sizeof(s32), &y) <= 0) {
-            return false;
-        }
-        if(stream.read(sizeof(s32), &dataSize) <= 0) {
-            return false;
+    const u16* getB44ExpTable()
+    {
+        static const B44ExpTable table;
+        return table.table_;
+    }
+
+    /**
+        @brief Unpack a 4x4 block of 14 bytes
+        */
+    inline void unpackB44(u16 s[16], const u8* b)
+    {
+        // Differences more than 16 bits shifted are just zero in 16 bits
+        s32 shift = minimum(b[2] >> 2, 16);
+        s32 bias = 0x20 << shift;
+        s32 t[16];
+        t[0] = (b[0] << 8) | b[1];
+        t[4] = ((((b[2] << 4) | (b[3] >> 4)) & 0x3F) << shift) - bias;
+        t[8] = ((((b[3] << 2) | (b[4] >> 6)) & 0x3F) << shift) - bias;
+        t[12] = ((b[4] & 0x3F) << shift) - bias;
+        t[1] = ((b[5] >> 2) << shift) - bias;
+        t[5] = ((((b[5] << 4) | (b[6] >> 4)) & 0x3F) << shift) - bias;
+        t[9] = ((((b[6] << 2) | (b[7] >> 6)) & 0x3F) << shift) - bias;
+        t[13] = ((b[7] & 0x3F) << shift) - bias;
+        t[2] = ((b[8] >> 2) << shift) - bias;
+        t[6] = ((((b[8] << 4) | (b[9] >> 4)) & 0x3F) << shift) - bias;
+        t[10] = ((((b[9] << 2) | (b[10] >> 6)) & 0x3F) << shift) - bias;
+        t[14] = ((b[10] & 0x3F) << shift) - bias;
+        t[3] = ((b[11] >> 2) << shift) - bias;
+        t[7] = ((((b[11] << 4) | (b[12] >> 4)) & 0x3F) << shift) - bias;
+        t[11] = ((((b[12] << 2) | (b[13] >> 6)) & 0x3F) << shift) - bias;
+        t[15] = ((b[13] & 0x3F) << shift) - bias;
+
+        // The first column accumulates downward, then each row accumulates rightward
+        t[4] += t[0];
+        t[8] += t[4];
+        t[12] += t[8];
+#    if defined(CPPIMG_DISABLE_AVX)
+        for(s32 i = 0; i < 16; i += 4) {
+            s[i] = static_cast<u16>(t[i]);
+            s[i + 1] = static_cast<u16>(s[i] + t[i + 1]);
+            s[i + 2] = static_cast<u16>(s[i + 1] + t[i + 2]);
+            s[i + 3] = static_cast<u16>(s[i + 2] + t[i + 3]);
+        }
+        for(s32 i = 0; i < 16; ++i) {
+            if(s[i] & 0x8000U) {
+                s[i] &= 0x7FFFU;
+            } else {
+                s[i] = static_cast<u16>(~s[i]);
+            }
         }
-        if(!uncompressRLE(stream, lineSize, &dst[0], tmp, dataSize)) {
-            return false;
+#    else
+        __m128i r01 = _mm_packs_epi32(
+            _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t + 0)), 16), 16),
+            _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t + 4)), 16), 16));
+        __m128i r23 = _mm_packs_epi32(
+            _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t + 8)), 16), 16),
+            _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t + 12)), 16), 16));
+        // Prefix sums in each row of 4 lanes
+        const __m128i mask1 = _mm_setr_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+        const __m128i mask2 = _mm_setr_epi16(0, 0, -1, -1, 0, 0, -1, -1);
+        r01 = _mm_add_epi16(r01, _mm_and_si128(_mm_slli_si128(r01, 2), mask1));
+        r23 = _mm_add_epi16(r23, _mm_and_si128(_mm_slli_si128(r23, 2), mask1));
+        r01 = _mm_add_epi16(r01, _mm_and_si128(_mm_slli_si128(r01, 4), mask2));
+        r23 = _mm_add_epi16(r23, _mm_and_si128(_mm_slli_si128(r23, 4), mask2));
+        // Clear the sign of positive values, or flip all bits of negative values
+        const __m128i ones = _mm_set1_epi16(-1);
+        const __m128i magnitude = _mm_set1_epi16(0x7FFF);
+        r01 = _mm_xor_si128(r01, _mm_xor_si128(ones, _mm_and_si128(_mm_srai_epi16(r01, 15), magnitude)));
+        r23 = _mm_xor_si128(r23, _mm_xor_si128(ones, _mm_and_si128(_mm_srai_epi16(r23, 15), magnitude)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(s), r01);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(s + 8), r23);
+#    endif
+    }
+
+    /**
+        @brief Unpack a flat 4x4 block of 3 bytes
+        */
+    inline void unpackB44Flat(u16 s[16], const u8* b)
+    {
+        u16 x = static_cast<u16>((b[0] << 8) | b[1]);
+        x = (x & 0x8000U) ? (x & 0x7FFFU) : static_cast<u16>(~x);
+        for(s32 i = 0; i < 16; ++i) {
+            s[i] = x;
         }
+    }
+} // namespace
+
+bool OpenEXR::uncompressB44(u8* dst, Buffer& tmp, s32 width, s32 lines, s32 numChannels, const s32* types, const u8* linears, s32 srcSize, const u8* src)
+{
+    s32 sizes[MaxInChannels];
+    s32 starts[MaxInChannels];
+    s32 total = 0;
+    for(s32 i = 0; i < numChannels; ++i) {
+        sizes[i] = getSize(static_cast<Type>(types[i]));
+        starts[i] = total;
+        total += width * lines * sizes[i];
+    }
+    if(!tmp.reserve(total)) {
+        return false;
+    }
 
-        const u8* src = &dst[0];
-        for(s32 j = 0; j < information_->numChannels_; ++j) {
-            u8* pixel = reinterpret_cast<u8*>(image_) + y * lineSize + offsets[j];
-            for(s32 k = 0; k < information_->width_; ++k) {
-                memcpy(pixel, src, sizes[j]);
-                pixel += bytesPerPixel;
-                src += sizes[j];
+    const u8* end = src + srcSize;
+    for(s32 i = 0; i < numChannels; ++i) {
+        u8* plane = &tmp[0] + starts[i];
+        // Only half channels are packed in blocks
+        if(Type::HALF != static_cast<Type>(types[i])) {
+            s32 size = width * lines * sizes[i];
+            if((end - src) < size) {
+                return false;
+            }
+            memcpy(plane, src, size);
+            src += size;
+            continue;
+        }
+        const u16* table = linears[i] ? getB44ExpTable() : CPPIMG_NULL;
+        u16* rows = reinterpret_cast<u16*>(plane);
+        for(s32 y = 0; y < lines; y += 4) {
+            s32 numRows = minimum(4, lines - y);
+            for(s32 x = 0; x < width; x += 4) {
+                ALIGNED(16)
+                u16 s[16];
+                if((end - src) < 3) {
+                    return false;
+                }
+                if(0xFCU == src[2]) {
+                    unpackB44Flat(s, src);
+                    src += 3;
+                } else {
+                    if((end - src) < 14) {
+                        return false;
+                    }
+                    unpackB44(s, src);
+                    src += 14;
+                }
+                if(CPPIMG_NULL != table) {
+                    for(s32 j = 0; j < 16; ++j) {
+                        s[j] = table[s[j]];
+                    }
+                }
+                s32 n = minimum(4, width - x);
+                for(s32 j = 0; j < numRows; ++j) {
+                    memcpy(rows + (y + j) * width + x, s + j * 4, n * sizeof(u16));
+                }
             }
         }
     }
+
+    for(s32 i = 0; i < lines; ++i) {
+        for(s32 j = 0; j < numChannels; ++j) {
+            s32 size = width * sizes[j];
+            memcpy(dst, &tmp[0] + starts[j] + i * size, size);
+            dst += size;
+        }
+    }
     return true;
 }
 
-bool OpenEXR::Context::readScanlines_ZIP_COMPRESSION(Stream& stream)
+/**
+    @brief Deinterleave and compress blocks, each into its own buffer
+    */
+struct OpenEXR::CompressBlockJob
 {
-    szlib::szContext context;
-    if(szlib::SZ_OK != szlib::createInflate(&context)) {
-        return false;
-    }
-    s32 numBlocks = header_.chunkCount_;
-    s32 lines = (header_.dataWindow_.yMax_ - header_.dataWindow_.yMin_ + 1);
-    s32 linesPerBlock = (ZIP_COMPRESSION == header_.compression_) ? LinesPerBlock : 1;
-    s32 bytesPerPixel = information_->getBytesPerPixel();
-    s32 lineSize = information_->width_ * bytesPerPixel;
-    s32 blockSize = lineSize * linesPerBlock;
-    s32 sizes[MaxInChannels];
-    s32 offsets[MaxInChannels];
-    getChannelInformation(sizes, offsets);
+    bool operator()(s32 worker, s32 index)
+    {
+        CompressWorker& w = workers_[worker];
+        const BlockRegion& region = regions_[index];
+        s32 width = region.width_;
+        s32 lines = region.lines_;
+        s32 bytesPerPixel = numChannels_ * bytesPerChannel_;
+        s32 bytesPerLine = bytesPerPixel * width;
+        s32 bytesPerChannelLine = bytesPerChannel_ * width;
+        s32 size = lines * bytesPerLine;
+
+        // Planes of a line in the order of channels in a pixel
+        s32 starts[MaxOutChannels];
+        for(s32 k = 0; k < numChannels_; ++k) {
+            starts[offsets_[k] / bytesPerChannel_] = channelOrder_[k] * bytesPerChannelLine;
+        }
+        const u8* src_line = region.src_;
+        u8* dst_line = &w.tmp0_[0];
+        u8* planes[MaxOutChannels];
+        for(s32 j = 0; j < lines; ++j) {
+            for(s32 k = 0; k < numChannels_; ++k) {
+                planes[k] = dst_line + starts[k];
+            }
+            const u8* line = src_line;
+            if(imageType_ != pixelType_) {
+                // Convert while the line is in cache
+                convertF32ToF16(width * numChannels_, reinterpret_cast<u16*>(&w.line_[0]), reinterpret_cast<const f32*>(src_line));
+                line = &w.line_[0];
+            }
+            deinterleave(planes, line, numChannels_, bytesPerChannel_, width);
 
-    Buffer src(blockSize);
-    Buffer dst(blockSize * 2);
-    Buffer tmp(blockSize * 2);
+            src_line += region.pitch_;
+            dst_line += bytesPerLine;
+        }
+        CPPIMG_ASSERT(static_cast<s32>(dst_line - &w.tmp0_[0]) == size);
 
-    bool result = true;
-    s32 y = 0;
-    s32 dataSize = 0;
-    for(s32 i = 0, next = 0; i < numBlocks; ++i) {
-        s32 prev = next;
-        next += linesPerBlock;
-        u64 offset = offsetTable_[i];
-        stream.seek(offset, SEEK_SET);
-        if(stream.read(sizeof(s32), &y) <= 0) {
-            result = false;
+        s32 compressed = -1;
+        switch(compression_) {
+        case NO_COMPRESSION:
+            compressed = size;
             break;
-        }
-        if(stream.read(sizeof(s32), &dataSize) <= 0) {
-            result = false;
+        case RLE_COMPRESSION:
+            compressed = compressRLE(w.dst_, w.tmp1_, size, &w.tmp0_[0]);
             break;
-        }
-        src.reserve(dataSize);
-        if(stream.read(dataSize, &src[0]) <= 0) {
-            result = false;
+        case ZIPS_COMPRESSION:
+        case ZIP_COMPRESSION:
+            compressed = compressZlib(w.context_, w.dst_, w.tmp1_, size, &w.tmp0_[0]);
             break;
-        }
-        if(!uncompressZlib(context, dst, tmp, dataSize, &src[0])) {
-            result = false;
+        case PIZ_COMPRESSION: {
+            s32 sizes[MaxOutChannels];
+            for(s32 i = 0; i < numChannels_; ++i) {
+                sizes[i] = bytesPerChannel_;
+            }
+            compressed = w.piz_->compress(w.dst_, width, lines, numChannels_, sizes, &w.tmp0_[0]);
+        } break;
+        case PXR24_COMPRESSION: {
+            s32 types[MaxOutChannels];
+            for(s32 i = 0; i < numChannels_; ++i) {
+                types[i] = static_cast<s32>(pixelType_);
+            }
+            compressed = compressPXR24(w.context_, w.dst_, w.tmp1_, width, lines, numChannels_, types, &w.tmp0_[0]);
+        } break;
+        default:
             break;
         }
-
-        s32 currentLines = (next < lines) ? linesPerBlock : lines - prev;
-        const u8* s = &dst[0];
-        u8* line = reinterpret_cast<u8*>(image_) + y * lineSize;
-        for(s32 j = 0; j < currentLines; ++j) {
-            for(s32 k = 0; k < information_->numChannels_; ++k) {
-                u8* pixel = line + offsets[k];
-                for(s32 l = 0; l < information_->width_; ++l) {
-                    for(s32 m = 0; m < sizes[k]; ++m) {
-                        pixel[m] = s[m];
-                    }
-                    s += sizes[k];
-                    pixel += bytesPerPixel;
-                }
-            }
-            line += lineSize;
+        if(compressed <= 0) {
+            return false;
+        }
+        // Store as is, if compression does not make it smaller
+        const u8* block = &w.dst_[0];
+        if(size <= compressed) {
+            compressed = size;
+            block = &w.tmp0_[0];
         }
-        CPPIMG_ASSERT((lineSize * currentLines) == static_cast<s32>(s - &dst[0]));
+        if(!blocks_[index].reserve(compressed)) {
+            return false;
+        }
+        memcpy(&blocks_[index][0], block, compressed);
+        sizes_[index] = compressed;
+        return true;
     }
-    szlib::termInflate(&context);
-    return result;
+
+    CompressWorker* workers_;
+    Buffer* blocks_;
+    s32* sizes_;
+    const BlockRegion* regions_;
+    const s8* channelOrder_;
+    const s32* offsets_;
+    Compression compression_;
+    Type pixelType_;
+    Type imageType_;
+    s32 numChannels_;
+    s32 bytesPerChannel_;
+};
+
+OpenEXR::CompressWorker::CompressWorker()
+    : hasContext_(false)
+    , piz_(CPPIMG_NULL)
+{
 }
 
-void OpenEXR::Context::getChannelInformation(s32 sizes[MaxInChannels], s32 offsets[MaxInChannels]) const
+OpenEXR::CompressWorker::~CompressWorker()
 {
-    s32 tmp_offsets[MaxInChannels];
-    s32 channelAssign[MaxInChannels];
-    header_.getChannelAssign(channelAssign);
-    sizes[0] = information_->getSize(0);
-    tmp_offsets[0] = 0;
-    for(s32 i = 1; i < information_->numChannels_; ++i) {
-        sizes[i] = information_->getSize(i);
-        tmp_offsets[i] = tmp_offsets[i - 1] + sizes[i - 1];
-    }
-    for(s32 i = 0; i < information_->numChannels_; ++i) {
-        offsets[i] = tmp_offsets[channelAssign[i]];
+    CPPIMG_DELETE(piz_);
+    if(hasContext_) {
+        szlib::termDeflate(&context_);
     }
 }
 
-bool OpenEXR::Context::uncompressRLE(Stream& stream, s32 dstSize, u8* dst, u8* tmp, s32 srcSize)
+bool OpenEXR::CompressWorker::initialize(s32 compression, s32 bytesPerChunk, s32 bytesPerLine)
 {
-    u8* s = tmp;
-    s32 in;
-    for(in = 0; in < srcSize;) {
-        s8 c;
-        if(stream.read(1, &c) <= 0) {
-            return false;
-        }
-        ++in;
-        if(0 <= c) { // consecutive
-            s32 count = c + 1;
-            u8 byte;
-            if(stream.read(1, &byte) <= 0) {
-                return false;
-            }
-            ++in;
-            for(s32 k = 0; k < count; ++k, ++s) {
-                s[0] = byte;
-            }
-
-        } else { // non-consecutive
-            s32 count = -c;
-            if(stream.read(count, s) <= 0) {
-                return false;
-            }
-            s += count;
-            in += count;
-        }
+    if(PIZ_COMPRESSION == compression && CPPIMG_NULL == piz_) {
+        piz_ = CPPIMG_NEW PIZ;
     }
-    if(in != srcSize) {
-        return false;
+    if(!hasContext_) {
+        hasContext_ = szlib::SZ_OK == szlib::createDeflate(&context_);
     }
-    if(dstSize != static_cast<s32>(s - tmp)) {
+    return hasContext_
+           && tmp0_.reserve(bytesPerChunk)
+           && tmp1_.reserve(bytesPerChunk)
+           && dst_.reserve(bytesPerChunk)
+           && (bytesPerLine <= 0 || line_.reserve(bytesPerLine));
+}
+
+bool OpenEXR::isSupportedConversion(Type pixelType, Type imageType)
+{
+    return pixelType == imageType || (Type::HALF == pixelType && Type::FLOAT == imageType);
+}
+
+bool OpenEXR::getViewType(Type& type, PixelFormat format)
+{
+    switch(getBytesPerSample(format)) {
+    case 2:
+        type = Type::HALF;
+        return true;
+    case 4:
+        type = Type::FLOAT;
+        return true;
+    default:
         return false;
     }
-    postprocess(dstSize, dst, tmp);
-    return true;
 }
 
-//----------------------------------------------------
-OpenEXR::WriteContext::WriteContext()
-    : numScanlines_(0)
-    , offsetTable_(CPPIMG_NULL)
+void OpenEXR::clearView(const ImageView& view, s32 bytesPerPixel)
 {
+    s64 size = static_cast<s64>(view.width_) * bytesPerPixel;
+    for(s32 i = 0; i < view.height_; ++i) {
+        memset(view.getRow(i), 0, size);
+    }
 }
 
-OpenEXR::WriteContext::~WriteContext()
+bool OpenEXR::readView(Context& context, Stream& stream, const ImageView& view, ColorType colorType, const Box2i& region, s32 numThreads)
 {
-    CPPIMG_FREE(offsetTable_);
+    CPPIMG_ASSERT(view.width_ == (region.xMax_ - region.xMin_ + 1));
+    CPPIMG_ASSERT(view.height_ == (region.yMax_ - region.yMin_ + 1));
+    Slice slices[MaxInChannels];
+    Type type;
+    if(getColorType(view.format_) == colorType && getViewType(type, view.format_)) {
+        context.getImageSlices(slices, view.data_, view.pitch_, &type);
+        if(!context.isInDataWindow(region)) {
+            clearView(view, getBytesPerPixel(view.format_));
+        }
+        return context.readRegion(stream, slices, region, numThreads);
+    }
+
+    // Bands are aligned to chunks, so that no chunk is decoded twice
+    static const s32 BandLines = 256;
+    s32 chunkLines = context.version_.isTile() ? static_cast<s32>(context.header_.tiles_.ySize_) : context.getLinesPerChunk();
+    s32 bandLines = ((BandLines + chunkLines - 1) / chunkLines) * chunkLines;
+    PixelFormat format = getPixelFormat(colorType, Type::FLOAT);
+    s64 pitch = static_cast<s64>(view.width_) * getBytesPerPixel(format);
+    u8* band = reinterpret_cast<u8*>(CPPIMG_MALLOC(pitch * minimum(bandLines, view.height_)));
+    if(CPPIMG_NULL == band) {
+        return false;
+    }
+    type = Type::FLOAT;
+    context.getImageSlices(slices, band, pitch, &type);
+    s32 origin = context.header_.dataWindow_.yMin_;
+    bool result = true;
+    for(s32 y = region.yMin_; result && y <= region.yMax_;) {
+        s32 offset = y - origin;
+        s32 index = (0 <= offset) ? offset / bandLines : -((bandLines - 1 - offset) / bandLines);
+        s32 last = minimum(origin + (index + 1) * bandLines - 1, region.yMax_);
+        s32 lines = last - y + 1;
+        Box2i bandRegion = {region.xMin_, y, region.xMax_, last};
+        if(!context.isInDataWindow(bandRegion)) {
+            memset(band, 0, pitch * lines);
+        }
+        ImageView src = {band, view.width_, lines, pitch, format};
+        result = context.readRegion(stream, slices, bandRegion, numThreads)
+                 && convert(view.getSubView(0, y - region.yMin_, view.width_, lines), src);
+        y = last + 1;
+    }
+    CPPIMG_FREE(band);
+    return result;
 }
 
-//----------------------------------------------------
-const Char* OpenEXR::AttributeNames[AttrName_Max] =
-    {
-        "channels",
-        "compression",
-        "dataWindow",
-        "displayWindow",
-        "lineOrder",
-        "pixelAspectRatio",
-        "screenWindowCenter",
-        "screenWindowWidth",
-        "tiles",
-        "view",
-        "name",
-        "type",
-        "version",
-        "chunkCount",
-        "maxSamplesPerPixel",
-        "chromaticities",
-        "",
-};
+bool OpenEXR::writeScanlineBlocks(WriteContext& context, u64 offset, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, Compression compression, const void* data, s64 pitch, s32 numThreads)
+{
+    s32 linesPerBlock = getLinesPerBlock(compression);
+    s32 numBlocks = (height + linesPerBlock - 1) / linesPerBlock;
 
-const Char* OpenEXR::TypeNames[AttrType_Max] =
-    {
-        "box2i",
-        "box2f",
-        "chlist",
-        "chromaticities",
-        "compression",
-        "double",
-        "envmap",
-        "float",
-        "int",
-        "keycode",
-        "lineOrder",
-        "m33f",
-        "m44f",
-        "preview",
-        "rational",
-        "string",
-        "stringvector",
-        "tiledesc",
-        "timecode",
-        "v2i",
-        "v2f",
-        "v3i",
-        "v3f",
-};
+    BlockRegion* regions = reinterpret_cast<BlockRegion*>(CPPIMG_MALLOC(sizeof(BlockRegion) * numBlocks));
+    if(CPPIMG_NULL == regions) {
+        return false;
+    }
+    for(s32 i = 0; i < numBlocks; ++i) {
+        s32 y = i * linesPerBlock;
+        regions[i].src_ = reinterpret_cast<const u8*>(data) + y * pitch;
+        regions[i].pitch_ = pitch;
+        regions[i].width_ = width;
+        regions[i].lines_ = minimum(linesPerBlock, height - y);
+        regions[i].coordinates_[0] = y;
+    }
+    bool result = writeBlocks(context, offset, numBlocks, regions, 1, colorType, pixelType, imageType, compression, numThreads);
+    CPPIMG_FREE(regions);
+    return result;
+}
 
-OpenEXR::AttributeName OpenEXR::findAttributeName(const Char* str)
+namespace
 {
-    CPPIMG_ASSERT(CPPIMG_NULL != str);
-    for(s32 name = AttrName_Channels; name < AttrName_Max; ++name) {
-        if(0 == strcmp(AttributeNames[name], str)) {
-            return (AttributeName)name;
+    /**
+        @brief Average pairs of samples in x, then in y.
+        An odd last sample is paired with itself, and a size of 1 is kept
+        */
+    void boxFilterRow(f32* dst, s32 dstWidth, const f32* row0, const f32* row1, f32* sum, s32 srcWidth, s32 numChannels)
+    {
+        s32 count = srcWidth * numChannels;
+        s32 i = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        for(; (i + 4) <= count; i += 4) {
+            _mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(row0 + i), _mm_loadu_ps(row1 + i)));
+        }
+#    endif
+        for(; i < count; ++i) {
+            sum[i] = row0[i] + row1[i];
+        }
+
+        if(dstWidth == srcWidth) {
+            for(i = 0; i < count; ++i) {
+                dst[i] = sum[i] * 0.5f;
+            }
+            return;
+        }
+        s32 x = 0;
+#    if !defined(CPPIMG_DISABLE_AVX)
+        const __m128 quarter = _mm_set1_ps(0.25f);
+        s32 pairs = srcWidth >> 1;
+        if(4 == numChannels) {
+            for(; x < pairs; ++x) {
+                __m128 s0 = _mm_loadu_ps(sum + x * 8);
+                __m128 s1 = _mm_loadu_ps(sum + x * 8 + 4);
+                _mm_storeu_ps(dst + x * 4, _mm_mul_ps(_mm_add_ps(s0, s1), quarter));
+            }
+        } else if(1 == numChannels) {
+            for(; (x + 4) <= pairs; x += 4) {
+                __m128 s0 = _mm_loadu_ps(sum + x * 2);
+                __m128 s1 = _mm_loadu_ps(sum + x * 2 + 4);
+                __m128 even = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0));
+                __m128 odd = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1));
+                _mm_storeu_ps(dst + x, _mm_mul_ps(_mm_add_ps(even, odd), quarter));
+            }
+        }
+#    endif
+        for(; x < dstWidth; ++x) {
+            const f32* s0 = sum + (2 * x) * numChannels;
+            const f32* s1 = sum + minimum(2 * x + 1, srcWidth - 1) * numChannels;
+            for(s32 k = 0; k < numChannels; ++k) {
+                dst[x * numChannels + k] = (s0[k] + s1[k]) * 0.25f;
+            }
         }
     }
-    return AttrName_Max;
-}
 
-OpenEXR::AttributeType OpenEXR::findAttributeType(const Char* str)
-{
-    CPPIMG_ASSERT(CPPIMG_NULL != str);
-    for(s32 type = AttrType_Box2i; type < AttrType_Max; ++type) {
-        if(0 == strcmp(TypeNames[type], str)) {
-            return (AttributeType)type;
+    void loadRow(f32* dst, const u8* src, s32 count, Type pixelType)
+    {
+        if(Type::HALF == pixelType) {
+            convertF16ToF32(count, dst, reinterpret_cast<const u16*>(src));
+        } else {
+            memcpy(dst, src, sizeof(f32) * count);
         }
     }
 
-    return AttrType_Max;
-}
+    void storeRow(u8* dst, const f32* src, s32 count, Type pixelType)
+    {
+        if(Type::HALF == pixelType) {
+            convertF32ToF16(count, reinterpret_cast<u16*>(dst), src);
+        } else {
+            memcpy(dst, src, sizeof(f32) * count);
+        }
+    }
 
-s32 OpenEXR::read(Char str[MaxStringSize], Stream& stream)
-{
-    s32 length = 0;
-    str[length] = CPPIMG_NULLCHAR;
-    Char c;
-    while(length < MaxStringSize) {
-        if(stream.read(1, &c) <= 0) {
-            return -1;
+    /**
+        @brief Make a lower resolution level with a box filter in float.
+        UINT samples are ids, so they are point sampled instead of averaged
+        @return Success:true, Fail:false
+        */
+    bool downsample(u8* dst, s32 dstWidth, s32 dstHeight, const u8* src, s64 srcPitch, s32 srcWidth, s32 srcHeight, s32 numChannels, Type pixelType)
+    {
+        s32 bytesPerPixel = numChannels * getSize(pixelType);
+        s32 dstPitch = dstWidth * bytesPerPixel;
+        s32 stepX = (dstWidth == srcWidth) ? 1 : 2;
+        s32 stepY = (dstHeight == srcHeight) ? 1 : 2;
+        if(Type::UINT == pixelType) {
+            for(s32 y = 0; y < dstHeight; ++y) {
+                const u8* srcRow = src + y * stepY * srcPitch;
+                u8* dstRow = dst + static_cast<s64>(y) * dstPitch;
+                for(s32 x = 0; x < dstWidth; ++x) {
+                    memcpy(dstRow + x * bytesPerPixel, srcRow + x * stepX * bytesPerPixel, bytesPerPixel);
+                }
+            }
+            return true;
         }
-        str[length] = c;
-        if(CPPIMG_NULLCHAR == c) {
-            return 1;
+
+        s32 srcCount = srcWidth * numChannels;
+        f32* rows = reinterpret_cast<f32*>(CPPIMG_MALLOC(sizeof(f32) * (srcCount * 3 + dstWidth * numChannels)));
+        if(CPPIMG_NULL == rows) {
+            return false;
         }
-        ++length;
+        f32* row0 = rows;
+        f32* row1 = row0 + srcCount;
+        f32* sum = row1 + srcCount;
+        f32* out = sum + srcCount;
+        for(s32 y = 0; y < dstHeight; ++y) {
+            s32 y0 = y * stepY;
+            s32 y1 = minimum(y0 + stepY - 1, srcHeight - 1);
+            loadRow(row0, src + y0 * srcPitch, srcCount, pixelType);
+            if(y0 != y1) {
+                loadRow(row1, src + y1 * srcPitch, srcCount, pixelType);
+            }
+            boxFilterRow(out, dstWidth, row0, (y0 != y1) ? row1 : row0, sum, srcWidth, numChannels);
+            storeRow(dst + static_cast<s64>(y) * dstPitch, out, dstWidth * numChannels, pixelType);
+        }
+        CPPIMG_FREE(rows);
+        return true;
     }
-    return -1;
-}
+} // namespace
 
-s32 OpenEXR::readString(Char str[MaxStringSize], Stream& stream)
+bool OpenEXR::writeTileBlocks(WriteContext& context, u64 offset, s32 width, s32 height, ColorType colorType, Type pixelType, Type imageType, const TiledDesc& tiles, Compression compression, const void* data, s64 pitch, s32 numThreads)
 {
-    s32 length = 0;
-    if(stream.read(sizeof(s32), &length) <= 0) {
-        return -1;
+    // Lower levels are filtered in the type of the image, and converted with the full level
+    s32 numChannels = getNumChannels(colorType);
+    s32 bytesPerPixel = numChannels * getSize(imageType);
+    s32 numXLevels = 1;
+    s32 numYLevels = 1;
+    switch(tiles.levelMode_) {
+    case MIPMAP_LEVELS:
+        numXLevels = numYLevels = roundLog2(maximum(width, height), tiles.roundingMode_) + 1;
+        break;
+    case RIPMAP_LEVELS:
+        numXLevels = roundLog2(width, tiles.roundingMode_) + 1;
+        numYLevels = roundLog2(height, tiles.roundingMode_) + 1;
+        break;
+    default:
+        break;
     }
-    s32 l = 0;
-    str[l] = CPPIMG_NULLCHAR;
-    Char c;
-    while(l < MaxStringSize) {
-        if(stream.read(1, &c) <= 0) {
-            return -1;
+
+    // Levels in the order of the file, (l, l) for mipmaps, and (lx, ly) in rows for ripmaps
+    s32 numLevels = (RIPMAP_LEVELS == tiles.levelMode_) ? numXLevels * numYLevels : numXLevels;
+    u8** levels = reinterpret_cast<u8**>(CPPIMG_MALLOC(sizeof(u8*) * numLevels));
+    if(CPPIMG_NULL == levels) {
+        return false;
+    }
+    levels[0] = const_cast<u8*>(reinterpret_cast<const u8*>(data)); // never written
+    s32 numBlocks = 0;
+    bool result = true;
+    for(s32 i = 0; i < numLevels; ++i) {
+        s32 lx = (RIPMAP_LEVELS == tiles.levelMode_) ? i % numXLevels : i;
+        s32 ly = (RIPMAP_LEVELS == tiles.levelMode_) ? i / numXLevels : i;
+        s32 levelWidth = getLevelSize(width, lx, tiles.roundingMode_);
+        s32 levelHeight = getLevelSize(height, ly, tiles.roundingMode_);
+        numBlocks += ((levelWidth + tiles.xSize_ - 1) / tiles.xSize_) * ((levelHeight + tiles.ySize_ - 1) / tiles.ySize_);
+        if(0 == i) {
+            continue;
+        }
+        // Filter the nearest finer level, ripmaps are filtered in x if possible
+        s32 source = i - 1;
+        s32 sourceLx = lx - 1;
+        s32 sourceLy = ly - 1;
+        if(RIPMAP_LEVELS == tiles.levelMode_) {
+            if(0 < lx) {
+                sourceLy = ly;
+            } else {
+                source = i - numXLevels;
+                sourceLx = lx;
+            }
         }
-        str[l] = c;
-        if(CPPIMG_NULLCHAR == c) {
-            return 1;
+        s32 sourceWidth = getLevelSize(width, sourceLx, tiles.roundingMode_);
+        s32 sourceHeight = getLevelSize(height, sourceLy, tiles.roundingMode_);
+        u8* level = reinterpret_cast<u8*>(CPPIMG_MALLOC(static_cast<s64>(levelWidth) * levelHeight * bytesPerPixel));
+        if(CPPIMG_NULL == level) {
+            numLevels = i;
+            result = false;
+            break;
+        }
+        s64 sourcePitch = (0 == source) ? pitch : static_cast<s64>(sourceWidth) * bytesPerPixel;
+        levels[i] = level;
+        if(!downsample(level, levelWidth, levelHeight, levels[source], sourcePitch, sourceWidth, sourceHeight, numChannels, imageType)) {
+            numLevels = i + 1;
+            result = false;
+            break;
         }
-        ++l;
     }
-    return -1;
-}
 
-s32 OpenEXR::writeAttribute(Stream& stream, AttributeName name, AttributeType type, s32 size, const void* data)
-{
-    if(stream.write(strlen(AttributeNames[name]) + 1, AttributeNames[name]) <= 0) {
-        return 0;
+    BlockRegion* regions = CPPIMG_NULL;
+    if(result) {
+        regions = reinterpret_cast<BlockRegion*>(CPPIMG_MALLOC(sizeof(BlockRegion) * numBlocks));
+        result = (CPPIMG_NULL != regions);
     }
-    if(stream.write(strlen(TypeNames[type]) + 1, TypeNames[type]) <= 0) {
-        return 0;
+    if(result) {
+        BlockRegion* region = regions;
+        for(s32 i = 0; i < numLevels; ++i) {
+            s32 lx = (RIPMAP_LEVELS == tiles.levelMode_) ? i % numXLevels : i;
+            s32 ly = (RIPMAP_LEVELS == tiles.levelMode_) ? i / numXLevels : i;
+            s32 levelWidth = getLevelSize(width, lx, tiles.roundingMode_);
+            s32 levelHeight = getLevelSize(height, ly, tiles.roundingMode_);
+            s64 levelPitch = (0 == i) ? pitch : static_cast<s64>(levelWidth) * bytesPerPixel;
+            for(s32 y = 0; y < levelHeight; y += tiles.ySize_) {
+                for(s32 x = 0; x < levelWidth; x += tiles.xSize_) {
+                    region->src_ = levels[i] + y * levelPitch + x * bytesPerPixel;
+                    region->pitch_ = levelPitch;
+                    region->width_ = minimum(static_cast<s32>(tiles.xSize_), levelWidth - x);
+                    region->lines_ = minimum(static_cast<s32>(tiles.ySize_), levelHeight - y);
+                    region->coordinates_[0] = x / tiles.xSize_;
+                    region->coordinates_[1] = y / tiles.ySize_;
+                    region->coordinates_[2] = lx;
+                    region->coordinates_[3] = ly;
+                    ++region;
+                }
+            }
+        }
+        result = writeBlocks(context, offset, numBlocks, regions, 4, colorType, pixelType, imageType, compression, numThreads);
+        CPPIMG_FREE(regions);
     }
-    if(stream.write(sizeof(s32), &size) <= 0) {
-        return 0;
+    for(s32 i = 1; i < numLevels; ++i) {
+        CPPIMG_FREE(levels[i]);
     }
-    return stream.write(size, data);
+    CPPIMG_FREE(levels);
+    return result;
 }
 
-s32 OpenEXR::writeChannels(Stream& stream, ColorType colorType, Type pixelType)
+bool OpenEXR::writeBlocks(WriteContext& context, u64 offset, s32 numBlocks, const BlockRegion* regions, s32 numCoordinates, ColorType colorType, Type pixelType, Type imageType, Compression compression, s32 numThreads)
 {
-    static const Char* Names[5] = {"A", "B", "G", "R", "Y"};
+    static const s8 ChannelOrder_GRAY[] = {0};
+    static const s8 ChannelOrder_RGB[] = {0, 1, 2};
+    static const s8 ChannelOrder_RGBA[] = {0, 1, 2, 3};
+
+    s32 numChannels = getNumChannels(colorType);
+    s32 bytesPerChannel = getSize(pixelType);
+    s32 bytesPerPixel = numChannels * bytesPerChannel;
+    s32 bytesPerChunk = 0;
+    s32 bytesPerLine = 0;
+    for(s32 i = 0; i < numBlocks; ++i) {
+        bytesPerChunk = maximum(bytesPerChunk, regions[i].width_ * regions[i].lines_ * bytesPerPixel);
+        if(pixelType != imageType) {
+            bytesPerLine = maximum(bytesPerLine, regions[i].width_ * bytesPerPixel);
+        }
+    }
+    const s8* channelOrder = CPPIMG_NULL;
     switch(colorType) {
     case ColorType::GRAY:
-        return writeChannels(stream, 1, &Names[4], pixelType, 0, 1, 1);
+        channelOrder = ChannelOrder_GRAY;
+        break;
     case ColorType::RGB:
-        return writeChannels(stream, 3, &Names[1], pixelType, 0, 1, 1);
+        channelOrder = ChannelOrder_RGB;
+        break;
     case ColorType::RGBA:
-        return writeChannels(stream, 4, &Names[0], pixelType, 0, 1, 1);
+        channelOrder = ChannelOrder_RGBA;
+        break;
     default:
         CPPIMG_ASSERT(false);
-        return 0;
+        break;
     }
-}
 
-s32 OpenEXR::writeChannels(Stream& stream, s32 size, const Char** names, Type pixelType, u8 linear, s32 xSampling, s32 ySampling)
-{
-    CPPIMG_ASSERT(CPPIMG_NULL != names);
-    if(stream.write(strlen(AttributeNames[AttrName_Channels]) + 1, AttributeNames[AttrName_Channels]) <= 0) {
-        return 0;
-    }
-    if(stream.write(strlen(TypeNames[AttrType_Chlist]) + 1, TypeNames[AttrType_Chlist]) <= 0) {
-        return 0;
-    }
+    s32 offsets[MaxOutChannels];
+    getChannelInformation(offsets, colorType, pixelType);
 
-    static const s32 SizePerChannel = 18;
-    s32 total = SizePerChannel * size + 1;
-    if(stream.write(sizeof(s32), &total) <= 0) {
-        return 0;
+    // Compress all blocks concurrently, then lay them out in order
+    numThreads = getNumThreads(numThreads, numBlocks);
+    CompressWorker* workers = CPPIMG_NEW CompressWorker[numThreads];
+    Buffer* blocks = CPPIMG_NEW Buffer[numBlocks];
+    s32* sizes = reinterpret_cast<s32*>(CPPIMG_MALLOC(sizeof(s32) * numBlocks));
+    bool result = (CPPIMG_NULL != sizes);
+    for(s32 i = 0; result && i < numThreads; ++i) {
+        if(!workers[i].initialize(compression, bytesPerChunk, bytesPerLine)) {
+            result = false;
+            break;
+        }
     }
-    for(s32 i = 0; i < size; ++i) {
-        if(stream.write(strlen(names[i]) + 1, names[i]) <= 0) {
-            return 0;
+    if(result) {
+        CompressBlockJob job;
+        job.workers_ = workers;
+        job.blocks_ = blocks;
+        job.sizes_ = sizes;
+        job.regions_ = regions;
+        job.channelOrder_ = channelOrder;
+        job.offsets_ = offsets;
+        job.compression_ = compression;
+        job.pixelType_ = pixelType;
+        job.imageType_ = imageType;
+        job.numChannels_ = numChannels;
+        job.bytesPerChannel_ = bytesPerChannel;
+        result = parallelFor(numThreads, numBlocks, job);
+    }
+    CPPIMG_DELETE_ARRAY(workers);
+
+    if(result) {
+        context.numChunks_ = numBlocks;
+        context.offsetTable_ = reinterpret_cast<u64*>(CPPIMG_MALLOC(sizeof(u64) * context.numChunks_));
+        if(CPPIMG_NULL == context.offsetTable_) {
+            result = false;
         }
-        s32 channel[4] = {static_cast<s32>(pixelType), linear, xSampling, ySampling};
-        if(stream.write(4 * sizeof(s32), channel) <= 0) {
-            return 0;
+    }
+    if(result) {
+        offset += sizeof(u64) * context.numChunks_;
+        s64 total = 0;
+        for(s32 i = 0; i < numBlocks; ++i) {
+            total += sizes[i] + sizeof(s32) * (numCoordinates + 1);
+        }
+        context.streamBuffer_.reserve(total);
+        for(s32 i = 0; i < numBlocks; ++i) {
+            context.offsetTable_[i] = offset;
+            if(!context.write(sizeof(s32) * numCoordinates, regions[i].coordinates_)
+               || !context.write(sizeof(s32), &sizes[i])
+               || !context.write(sizeof(u8) * sizes[i], &blocks[i][0])) {
+                result = false;
+                break;
+            }
+            offset += sizes[i] + sizeof(s32) * (numCoordinates + 1);
         }
     }
-    return writeNull(stream);
+    CPPIMG_FREE(sizes);
+    CPPIMG_DELETE_ARRAY(blocks);
+    return result;
 }
 
-s32 OpenEXR::writeNull(Stream& stream)
+//----------------------------------------------------
+OpenEXR::TiledReader::TiledReader()
+    : context_(CPPIMG_NULL)
+    , worker_(CPPIMG_NULL)
+    , stream_(CPPIMG_NULL)
 {
-    u8 nul = 0x00U;
-    return stream.write(1, &nul);
+    memset(&information_, 0, sizeof(Information));
+}
+
+OpenEXR::TiledReader::~TiledReader()
+{
+    close();
 }
 
-bool OpenEXR::read(Information& information, void* image, Stream& stream)
+bool OpenEXR::TiledReader::open(Stream& stream)
 {
+    close();
     if(!stream.valid()) {
         return false;
     }
-
-    SeekSet seekSet(stream.tell(), &stream);
-
     u32 magic;
-    if(stream.read(4, &magic) <= 0) {
-        return false;
-    }
-    if(MAGIC != magic) {
+    if(stream.read(4, &magic) <= 0 || MAGIC != magic) {
         return false;
     }
-    Context* context = CPPIMG_NEW Context;
-    if(!context->readVersion(stream)) {
-        CPPIMG_DELETE(context);
-        return false;
-    }
-    if(!context->readHeader(stream)) {
-        CPPIMG_DELETE(context);
+    context_ = CPPIMG_NEW Context;
+    if(!context_->readVersion(stream)
+       || !context_->version_.isTile()
+       || context_->version_.isMultiPart()
+       || context_->version_.isDeepData()
+       || !context_->readHeader(stream)
+       || !context_->getInformation(information_, context_->getLevelWidth(0), context_->getLevelHeight(0))
+       || !context_->readOffsetTable(stream)) {
+        close();
         return false;
     }
 
-    information.width_ = context->header_.displayWindow_.xMax_ - context->header_.displayWindow_.xMin_ + 1;
-    information.height_ = context->header_.displayWindow_.yMax_ - context->header_.displayWindow_.yMin_ + 1;
-    information.numChannels_ = context->header_.numChannels_;
-    if(!context->header_.getColorType(information.colorType_)) {
-        CPPIMG_DELETE(context);
-        return false;
-    }
-    context->header_.getTypes(information.types_);
-    if(CPPIMG_NULL == image) {
-        CPPIMG_DELETE(context);
-        return true;
-    }
-    if(!context->readOffsetTable(stream)) {
-        CPPIMG_DELETE(context);
+    // The largest level has the largest tiles
+    s64 tileSize = context_->getMaxTileDataSize(0, 0);
+    worker_ = CPPIMG_NEW Context::Worker;
+    if(tileSize < 0
+       || !worker_->initialize(context_->header_.compression_)
+       || !worker_->dst_.reserve(tileSize * 2)
+       || !worker_->tmp_.reserve(tileSize * 2)) {
+        close();
         return false;
     }
-    context->image_ = image;
-    context->information_ = &information;
-
-    if(context->version_.isMultiPart()) {
-    } else if(context->version_.isTile()) {
-    } else { // Scanline
-        if(!context->readScanlines(stream)) {
-            CPPIMG_DELETE(context);
-            return false;
-        }
-    }
-    seekSet.clear();
-    CPPIMG_DELETE(context);
+    stream_ = &stream;
     return true;
 }
 
-bool OpenEXR::write(Stream& stream, s32 width, s32 height, ColorType colorType, Type pixelType, const void* image)
+void OpenEXR::TiledReader::close()
 {
-    // #define CPPIMG_OPENEXR_USE_NOCOMPRESSION
-    CPPIMG_ASSERT(1 <= width);
-    CPPIMG_ASSERT(1 <= height);
-    CPPIMG_ASSERT(CPPIMG_NULL != image);
+    CPPIMG_DELETE(worker_);
+    CPPIMG_DELETE(context_);
+    stream_ = CPPIMG_NULL;
+}
 
-    if(!stream.valid()) {
-        return false;
-    }
+const OpenEXR::Information& OpenEXR::TiledReader::getInformation() const
+{
+    return information_;
+}
 
-    SeekSet seekSet(stream.tell(), &stream);
+OpenEXR::LevelMode OpenEXR::TiledReader::getLevelMode() const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return static_cast<LevelMode>(context_->header_.tiles_.levelMode_);
+}
 
-    u64 begin = stream.tell();
+OpenEXR::RoundingMode OpenEXR::TiledReader::getRoundingMode() const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return static_cast<RoundingMode>(context_->header_.tiles_.roundingMode_);
+}
 
-    // Write common header
-    u32 magic = MAGIC;
-    if(stream.write(4, &magic) <= 0) {
-        return false;
-    }
-    Version version = Version::create(false, false, false, false);
-    if(stream.write(4, &version.version_) <= 0) {
-        return false;
-    }
+s32 OpenEXR::TiledReader::getTileWidth() const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return static_cast<s32>(context_->header_.tiles_.xSize_);
+}
 
-    // Write channels
-    if(writeChannels(stream, colorType, pixelType) <= 0) {
-        return false;
-    }
+s32 OpenEXR::TiledReader::getTileHeight() const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return static_cast<s32>(context_->header_.tiles_.ySize_);
+}
 
-    // Write compression
-#ifdef CPPIMG_OPENEXR_USE_NOCOMPRESSION
-    u8 compression = NO_COMPRESSION;
-#else
-    u8 compression = ZIP_COMPRESSION;
-#endif
-    if(writeAttribute(stream, AttrName_Compression, AttrType_Compression, 1, &compression) <= 0) {
-        return false;
-    }
+s32 OpenEXR::TiledReader::getNumXLevels() const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return context_->numXLevels_;
+}
 
-    // Write dataWindow
-    Box2i dataWindow = {0, 0, width - 1, height - 1};
-    if(writeAttribute(stream, AttrName_DataWindow, AttrType_Box2i, sizeof(Box2i), &dataWindow) <= 0) {
-        return false;
-    }
+s32 OpenEXR::TiledReader::getNumYLevels() const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return context_->numYLevels_;
+}
 
-    // Write displayWindow
-    Box2i displayWindow = {0, 0, width - 1, height - 1};
-    if(writeAttribute(stream, AttrName_DisplayWindow, AttrType_Box2i, sizeof(Box2i), &displayWindow) <= 0) {
-        return false;
-    }
+s32 OpenEXR::TiledReader::getLevelWidth(s32 lx) const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return context_->getLevelWidth(lx);
+}
 
-    // Write lineOrder
-    u8 lineOrder = INCREASING_Y;
-    if(writeAttribute(stream, AttrName_LineOrder, AttrType_LineOrder, sizeof(u8), &lineOrder) <= 0) {
-        return false;
-    }
+s32 OpenEXR::TiledReader::getLevelHeight(s32 ly) const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return context_->getLevelHeight(ly);
+}
 
-    // Write pixelAspectRatio
-    f32 pixelRatio = 1.0f;
-    if(writeAttribute(stream, AttrName_PixelAspectRatio, AttrType_Float, sizeof(f32), &pixelRatio) <= 0) {
-        return false;
-    }
+s32 OpenEXR::TiledReader::getNumXTiles(s32 lx) const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return context_->getNumXTiles(lx);
+}
 
-    // Write screenWindowCenter
-    Vector2f screenWindowCenter = {0.0f, 0.0f};
-    if(writeAttribute(stream, AttrName_ScreenWindowCenter, AttrType_V2f, sizeof(Vector2f), &screenWindowCenter) <= 0) {
-        return false;
-    }
+s32 OpenEXR::TiledReader::getNumYTiles(s32 ly) const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    return context_->getNumYTiles(ly);
+}
 
-    // Write screenWindowWidth
-    f32 screenWindotWidth = 1.0f;
-    if(writeAttribute(stream, AttrName_ScreenWindowWidth, AttrType_Float, sizeof(f32), &screenWindotWidth) <= 0) {
-        return false;
+void OpenEXR::TiledReader::findLevel(s32& lx, s32& ly, s32 width, s32 height) const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != context_);
+    lx = context_->numXLevels_ - 1;
+    while(0 < lx && context_->getLevelWidth(lx) < width) {
+        --lx;
+    }
+    ly = context_->numYLevels_ - 1;
+    while(0 < ly && context_->getLevelHeight(ly) < height) {
+        --ly;
+    }
+    if(RIPMAP_LEVELS != context_->header_.tiles_.levelMode_) {
+        lx = ly = minimum(lx, ly);
     }
+}
 
-    if(writeNull(stream) <= 0) {
+bool OpenEXR::TiledReader::readTile(void* image, s32 pitch, s32 tx, s32 ty, s32 lx, s32 ly)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != image);
+    if(CPPIMG_NULL == context_ || !context_->isValidLevel(lx, ly)) {
         return false;
     }
-    WriteContext writeContext;
-    u64 offset = stream.tell() - begin;
-#ifdef CPPIMG_OPENEXR_USE_NOCOMPRESSION
-    if(!writeScanlines_NO_COMPRESSION(writeContext, offset, width, height, colorType, pixelType, image)) {
+    if(tx < 0 || context_->getNumXTiles(lx) <= tx || ty < 0 || context_->getNumYTiles(ly) <= ty) {
         return false;
     }
-#else
-    if(!writeScanlines_ZIP_COMPRESSION(writeContext, offset, width, height, colorType, pixelType, LinesPerBlock, image)) {
+    s32 dataSize;
+    if(!context_->readTileChunk(*worker_, *stream_, tx, ty, lx, ly, dataSize)) {
         return false;
     }
-#endif
-    if(stream.write(sizeof(u64) * writeContext.numScanlines_, writeContext.offsetTable_) <= 0) {
+    Slice slices[MaxInChannels];
+    context_->getImageSlices(slices, image, pitch);
+    const Box2i& dataWindow = context_->header_.dataWindow_;
+    Box2i region;
+    region.xMin_ = dataWindow.xMin_ + tx * getTileWidth();
+    region.yMin_ = dataWindow.yMin_ + ty * getTileHeight();
+    region.xMax_ = region.xMin_ + getTileWidth() - 1;
+    region.yMax_ = region.yMin_ + getTileHeight() - 1;
+    return context_->decodeTileChunk(*worker_, slices, region, tx, ty, lx, ly, dataSize);
+}
+
+bool OpenEXR::TiledReader::readLevel(void* image, s32 lx, s32 ly, s32 numThreads)
+{
+    if(CPPIMG_NULL == context_) {
         return false;
     }
-    if(stream.write(writeContext.size(), writeContext.begin()) <= 0) {
+    Rect rect = {0, 0, context_->getLevelWidth(lx), context_->getLevelHeight(ly)};
+    return readLevel(image, rect, lx, ly, numThreads);
+}
+
+bool OpenEXR::TiledReader::readLevel(void* image, const Rect& rect, s32 lx, s32 ly, s32 numThreads)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != image);
+    if(CPPIMG_NULL == context_ || rect.width_ <= 0 || rect.height_ <= 0) {
         return false;
     }
-    seekSet.clear();
-    return true;
+    Slice slices[MaxInChannels];
+    context_->getImageSlices(slices, image, static_cast<s64>(rect.width_) * information_.getBytesPerPixel());
+    const Box2i& dataWindow = context_->header_.dataWindow_;
+    Box2i region;
+    region.xMin_ = dataWindow.xMin_ + rect.x_;
+    region.yMin_ = dataWindow.yMin_ + rect.y_;
+    region.xMax_ = region.xMin_ + rect.width_ - 1;
+    region.yMax_ = region.yMin_ + rect.height_ - 1;
+    return context_->readTiles(*stream_, slices, region, lx, ly, numThreads);
 }
 
-void OpenEXR::getChannelInformation(s32 offsets[MaxOutChannels], ColorType colorType, Type pixelType)
+//----------------------------------------------------
+OpenEXR::MultiPartReader::MultiPartReader()
+    : numParts_(0)
+    , parts_(CPPIMG_NULL)
+    , informations_(CPPIMG_NULL)
+    , offsetTables_(0)
+    , stream_(CPPIMG_NULL)
 {
-    s32 bytesPerChannel = getSize(pixelType);
-    switch(colorType) {
-    case ColorType::GRAY:
-        offsets[0] = 0;
-        break;
-    case ColorType::RGB:
-        offsets[0] = (bytesPerChannel << 1);
-        offsets[1] = bytesPerChannel;
-        offsets[2] = 0;
-        break;
-    case ColorType::RGBA:
-        offsets[0] = (bytesPerChannel << 1) + bytesPerChannel;
-        offsets[1] = (bytesPerChannel << 1);
-        offsets[2] = bytesPerChannel;
-        offsets[3] = 0;
-        break;
-    default:
-        return;
-    }
 }
 
-void OpenEXR::preprocess(s32 size, u8* dst, const u8* src)
+OpenEXR::MultiPartReader::~MultiPartReader()
 {
-    const u8* s = src;
-    const u8* end = s + size;
-    u8* t0 = dst;
-    u8* t1 = dst + ((size + 1) >> 1);
-    for(;;) {
-        if(end <= s) {
-            break;
-        }
-        *t0 = *s;
-        ++t0;
-        ++s;
-        if(end <= s) {
-            break;
-        }
-        *t1 = *s;
-        ++t1;
-        ++s;
+    close();
+}
+
+bool OpenEXR::MultiPartReader::open(Stream& stream)
+{
+    close();
+    if(!stream.valid()) {
+        return false;
+    }
+    u32 magic;
+    Version version;
+    if(stream.read(4, &magic) <= 0 || MAGIC != magic || stream.read(4, &version.version_) <= 0) {
+        return false;
     }
+    if(!readHeaders(stream, version)) {
+        close();
+        return false;
+    }
+    offsetTables_ = stream.tell();
 
-    s32 p = dst[0];
-    for(u8* t = dst + 1; t < (dst + size); ++t) {
-        s32 d = static_cast<s32>(t[0]) - p + (128 + 256);
-        p = t[0];
-        t[0] = static_cast<u8>(d);
+    informations_ = reinterpret_cast<Information*>(CPPIMG_MALLOC(sizeof(Information) * numParts_));
+    for(s32 i = 0; i < numParts_; ++i) {
+        Context* context = parts_[i];
+        Information& information = informations_[i];
+        information.width_ = context->header_.dataWindow_.xMax_ - context->header_.dataWindow_.xMin_ + 1;
+        information.height_ = context->header_.dataWindow_.yMax_ - context->header_.dataWindow_.yMin_ + 1;
+        information.numChannels_ = 0;
+        information.colorType_ = ColorType::GRAY;
+        // Parts which are not gray, rgb, or rgba have no channels, but can be read by slices
+        if(!context->version_.isDeepData()) {
+            context->getInformation(information, information.width_, information.height_);
+        }
     }
+    stream_ = &stream;
+    return true;
 }
 
-void OpenEXR::postprocess(s32 size, u8* dst, u8* src)
+bool OpenEXR::MultiPartReader::readHeaders(Stream& stream, Version version)
 {
-    for(u8* t = src + 1; t < (src + size); ++t) {
-        t[0] = static_cast<u8>(static_cast<s32>(t[-1]) + static_cast<s32>(t[0]) - 128);
-    }
-    const u8* t0 = src;
-    const u8* t1 = src + ((size + 1) >> 1);
-    u8* d = dst;
-    u8* end = d + size;
+    s32 capacity = 0;
     for(;;) {
-        if(end <= d) {
+        if(version.isMultiPart()) {
+            // An empty header ends the list
+            u8 c;
+            if(stream.read(1, &c) <= 0) {
+                return false;
+            }
+            if(0 == c) {
+                break;
+            }
+            if(!stream.seek(-1, SEEK_CUR)) {
+                return false;
+            }
+        } else if(0 < numParts_) {
             break;
         }
-        *d = *t0;
-        ++d;
-        ++t0;
-        if(end <= d) {
-            break;
+        if(capacity <= numParts_) {
+            capacity = maximum(capacity * 2, 4);
+            Context** parts = reinterpret_cast<Context**>(CPPIMG_MALLOC(sizeof(Context*) * capacity));
+            for(s32 i = 0; i < numParts_; ++i) {
+                parts[i] = parts_[i];
+            }
+            CPPIMG_FREE(parts_);
+            parts_ = parts;
+        }
+        Context* context = CPPIMG_NEW Context;
+        parts_[numParts_] = context;
+        ++numParts_;
+        context->version_ = version;
+        context->part_ = numParts_ - 1;
+        if(!context->readHeader(stream) || context->header_.chunkCount_ <= 0) {
+            return false;
         }
-        *d = *t1;
-        ++d;
-        ++t1;
     }
+    return 0 < numParts_;
 }
 
-s32 OpenEXR::compressZlib(szlib::szContext& context, Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src)
+void OpenEXR::MultiPartReader::close()
 {
-    if(!tmp.reserve(srcSize)) {
-        return -1;
+    for(s32 i = 0; i < numParts_; ++i) {
+        CPPIMG_DELETE(parts_[i]);
     }
-    preprocess(srcSize, &tmp[0], src);
-    szlib::resetDeflate(&context, srcSize, &tmp[0], szlib::SZ_Level_Fixed);
-    static const s32 ChunkSize = 512;
-    u8 chunk[ChunkSize];
+    CPPIMG_FREE(parts_);
+    CPPIMG_FREE(informations_);
+    numParts_ = 0;
+    offsetTables_ = 0;
+    stream_ = CPPIMG_NULL;
+}
 
-    s32 total = 0;
-    for(;;) {
-        context.availOut_ = ChunkSize;
-        context.nextOut_ = chunk;
-        s32 ret = szlib::deflate(&context);
-        switch(ret) {
-        case szlib::SZ_ERROR_MEMORY:
-        case szlib::SZ_ERROR_FORMAT:
-            return -1;
-        default:
-            s32 outCount = total;
-            total += context.thisTimeOut_;
-            if(dst.capacity() < total) {
-                dst.expand(1024);
-            }
-            memcpy(&dst[outCount], chunk, context.thisTimeOut_);
-            if(szlib::SZ_END != ret) {
-                continue;
-            }
-            break;
-        };
-        break;
+s32 OpenEXR::MultiPartReader::getNumParts() const
+{
+    return numParts_;
+}
+
+s32 OpenEXR::MultiPartReader::findPart(const Char* name) const
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != name);
+    for(s32 i = 0; i < numParts_; ++i) {
+        if(0 == strcmp(parts_[i]->header_.name_, name)) {
+            return i;
+        }
     }
-    return total;
+    return -1;
 }
 
-s32 OpenEXR::uncompressZlib(szlib::szContext& context, Buffer& dst, Buffer& tmp, s32 srcSize, const u8* src)
+const Char* OpenEXR::MultiPartReader::getName(s32 part) const
 {
-    szlib::resetInflate(&context, srcSize, src);
-    static const s32 ChunkSize = 512;
-    u8 chunk[ChunkSize];
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    return parts_[part]->header_.name_;
+}
 
-    s32 total = 0;
-    for(;;) {
-        context.availOut_ = ChunkSize;
-        context.nextOut_ = chunk;
-        s32 ret = szlib::inflate(&context);
-        switch(ret) {
-        case szlib::SZ_ERROR_MEMORY:
-        case szlib::SZ_ERROR_FORMAT:
-            return -1;
-        default:
-            s32 current = total;
-            total += context.thisTimeOut_;
-            if(tmp.capacity() < total) {
-                tmp.expand(1024);
-            }
-            memcpy(&tmp[current], chunk, context.thisTimeOut_);
-            if(szlib::SZ_END != ret) {
-                continue;
-            }
-            break;
-        };
-        break;
-    }
-    if(!dst.reserve(tmp.capacity())) {
-        return -1;
-    }
-    postprocess(total, &dst[0], &tmp[0]);
-    return total;
+bool OpenEXR::MultiPartReader::isTiled(s32 part) const
+{
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    return parts_[part]->version_.isTile();
 }
 
-bool OpenEXR::writeScanlines_NO_COMPRESSION(WriteContext& context, u64 offset, s32 width, s32 height, ColorType colorType, Type pixelType, const void* data)
+s32 OpenEXR::MultiPartReader::getNumChannels(s32 part) const
 {
-    s32 numChannels = getNumChannels(colorType);
-    s32 bytesPerChannel = getSize(pixelType);
-    s32 bytesPerPixel = numChannels * bytesPerChannel;
-    s32 bytesPerLine = bytesPerPixel * width;
-    s32 bytesPerChunk = bytesPerLine;
-    s32 offsets[MaxOutChannels];
-    getChannelInformation(offsets, colorType, pixelType);
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    return parts_[part]->header_.numChannels_;
+}
 
-    context.numScanlines_ = height;
-    context.offsetTable_ = reinterpret_cast<u64*>(CPPIMG_MALLOC(sizeof(u64) * context.numScanlines_));
-    offset += sizeof(u64) * context.numScanlines_;
-    for(s32 i = 0; i < height; ++i) {
-        context.offsetTable_[i] = offset;
-        offset += bytesPerLine + sizeof(s32);
-    }
-    context.streamBuffer_.setIncrements(bytesPerLine);
-    context.streamBuffer_.reserve((static_cast<s64>(bytesPerLine) + sizeof(s32) * 2) * height);
+const Char* OpenEXR::MultiPartReader::getChannelName(s32 part, s32 channel) const
+{
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    CPPIMG_ASSERT(0 <= channel && channel < parts_[part]->header_.numChannels_);
+    return parts_[part]->header_.channels_[channel].name_;
+}
 
-    for(s32 i = 0; i < height; ++i) {
-        if(!context.write(sizeof(s32), &i)) {
-            return false;
+namespace
+{
+    /**
+        @brief '*' matches any characters, and '?' matches a character
+        */
+    bool matchPattern(const Char* pattern, const Char* name)
+    {
+        const Char* star = CPPIMG_NULL;
+        const Char* retry = CPPIMG_NULL;
+        while(CPPIMG_NULLCHAR != *name) {
+            if('*' == *pattern) {
+                star = ++pattern;
+                retry = name;
+            } else if('?' == *pattern || *pattern == *name) {
+                ++pattern;
+                ++name;
+            } else if(CPPIMG_NULL != star) {
+                // Let the last star match one more character
+                pattern = star;
+                name = ++retry;
+            } else {
+                return false;
+            }
         }
-        if(!context.write(sizeof(s32), &bytesPerChunk)) {
-            return false;
+        while('*' == *pattern) {
+            ++pattern;
         }
+        return CPPIMG_NULLCHAR == *pattern;
+    }
+} // namespace
 
-        const u8* line = reinterpret_cast<const u8*>(data) + i * bytesPerChunk;
-        for(s32 j = 0; j < numChannels; ++j) {
-            const u8* pixel = line + offsets[j];
-            for(s32 k = 0; k < width; ++k) {
-                if(!context.write(bytesPerChannel, pixel)) {
-                    return false;
-                }
-                pixel += bytesPerPixel;
+s32 OpenEXR::MultiPartReader::findChannels(s32* channels, s32 maxChannels, s32 part, const Char* pattern) const
+{
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    CPPIMG_ASSERT(CPPIMG_NULL != pattern);
+    CPPIMG_ASSERT(0 == maxChannels || CPPIMG_NULL != channels);
+    const Header& header = parts_[part]->header_;
+    s32 count = 0;
+    for(s32 i = 0; i < header.numChannels_; ++i) {
+        if(matchPattern(pattern, header.channels_[i].name_)) {
+            if(count < maxChannels) {
+                channels[count] = i;
             }
+            ++count;
         }
     }
-    return true;
+    return count;
 }
 
-bool OpenEXR::writeScanlines_ZIP_COMPRESSION(WriteContext& context, u64 offset, s32 width, s32 height, ColorType colorType, Type pixelType, s32 linesPerBlock, const void* data)
+s32 OpenEXR::MultiPartReader::getChannelType(s32 part, s32 channel) const
 {
-    // #define CPPIMG_OPENEXR_DEBUG_ZIP
-    static const s8 ChannelOrder_GRAY[] = {0};
-    static const s8 ChannelOrder_RGB[] = {0, 1, 2};
-    static const s8 ChannelOrder_RGBA[] = {0, 1, 2, 3};
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    CPPIMG_ASSERT(0 <= channel && channel < parts_[part]->header_.numChannels_);
+    return parts_[part]->header_.channels_[channel].pixelType_;
+}
 
-    szlib::szContext zcontext;
-    if(szlib::SZ_OK != szlib::createDeflate(&zcontext)) {
+void OpenEXR::MultiPartReader::getDataWindow(Rect& rect, s32 part) const
+{
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    const Box2i& window = parts_[part]->header_.dataWindow_;
+    rect = {window.xMin_, window.yMin_, window.xMax_ - window.xMin_ + 1, window.yMax_ - window.yMin_ + 1};
+}
+
+void OpenEXR::MultiPartReader::getDisplayWindow(Rect& rect, s32 part) const
+{
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    const Box2i& window = parts_[part]->header_.displayWindow_;
+    rect = {window.xMin_, window.yMin_, window.xMax_ - window.xMin_ + 1, window.yMax_ - window.yMin_ + 1};
+}
+
+bool OpenEXR::MultiPartReader::getInformation(Information& information, s32 part) const
+{
+    if(part < 0 || numParts_ <= part || informations_[part].numChannels_ <= 0) {
         return false;
     }
-#ifdef CPPIMG_OPENEXR_DEBUG_ZIP
-    szlib::szContext zuncompress;
-    if(szlib::SZ_OK != szlib::createInflate(&zuncompress)) {
+    information = informations_[part];
+    return true;
+}
+
+bool OpenEXR::MultiPartReader::read(void* image, s32 part, s32 numThreads)
+{
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    Rect rect;
+    getDataWindow(rect, part);
+    return read(image, part, rect, numThreads);
+}
+
+bool OpenEXR::MultiPartReader::read(void* image, s32 part, const Rect& rect, s32 numThreads)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != image);
+    if(part < 0 || numParts_ <= part || informations_[part].numChannels_ <= 0 || rect.width_ <= 0 || rect.height_ <= 0) {
         return false;
     }
-#endif
-    s32 mask = linesPerBlock - 1;
-    s32 numBlocks = (height + mask) / linesPerBlock;
-    s32 numChannels = getNumChannels(colorType);
-    s32 bytesPerChannel = getSize(pixelType);
-    s32 bytesPerPixel = numChannels * bytesPerChannel;
-    s32 bytesPerLine = bytesPerPixel * width;
-    s32 bytesPerChannelLine = bytesPerChannel * width;
-    s32 bytesPerChunk = bytesPerLine * linesPerBlock;
-    const s8* channelOrder = CPPIMG_NULL;
-    switch(colorType) {
-    case ColorType::GRAY:
-        channelOrder = ChannelOrder_GRAY;
-        break;
-    case ColorType::RGB:
-        channelOrder = ChannelOrder_RGB;
-        break;
-    case ColorType::RGBA:
-        channelOrder = ChannelOrder_RGBA;
-        break;
-    default:
-        CPPIMG_ASSERT(false);
-        break;
+    Context* context = parts_[part];
+    Slice slices[MaxInChannels];
+    s64 pitch = static_cast<s64>(rect.width_) * informations_[part].getBytesPerPixel();
+    context->getImageSlices(slices, image, pitch);
+    Box2i region = {rect.x_, rect.y_, rect.x_ + rect.width_ - 1, rect.y_ + rect.height_ - 1};
+    if(!context->isInDataWindow(region)) {
+        memset(image, 0, pitch * rect.height_);
     }
+    return readPart(part, slices, region, numThreads);
+}
 
-    context.numScanlines_ = numBlocks;
-    context.offsetTable_ = reinterpret_cast<u64*>(CPPIMG_MALLOC(sizeof(u64) * context.numScanlines_));
-    offset += sizeof(u64) * context.numScanlines_;
-    context.streamBuffer_.setIncrements(bytesPerChunk);
-    context.streamBuffer_.reserve((static_cast<s64>(bytesPerChunk) + sizeof(s32) * 2) * numBlocks);
-
-    s32 offsets[MaxOutChannels];
-    getChannelInformation(offsets, colorType, pixelType);
-
-    bool result = true;
-    Buffer tmp0(bytesPerChunk);
-    Buffer tmp1(bytesPerChunk);
-    Buffer dst(bytesPerChunk);
-#ifdef CPPIMG_OPENEXR_DEBUG_ZIP
-    Buffer dst2(bytesPerChunk);
-#endif
-    const u8* src = reinterpret_cast<const u8*>(data);
-    for(s32 i = 0, next = 0; i < numBlocks; ++i) {
-        s32 prev = next;
-        next += linesPerBlock;
-        s32 size = (next < height) ? bytesPerChunk : (height - prev) * bytesPerLine;
-        s32 lines = (next < height) ? linesPerBlock : (height - prev);
-
-        const u8* src_line = src;
-        u8* dst_line = &tmp0[0];
-        for(s32 j = 0; j < lines; ++j) {
-            for(s32 k = 0; k < numChannels; ++k) {
-                const u8* src_pixel = src_line + offsets[k];
-                u8* dst_pixel = dst_line + channelOrder[k] * bytesPerChannelLine;
-                for(s32 l = 0; l < width; ++l) {
-                    for(s32 m = 0; m < bytesPerChannel; ++m) {
-                        dst_pixel[m] = src_pixel[m];
-                    }
-                    dst_pixel += bytesPerChannel;
-                    src_pixel += bytesPerPixel;
-                }
-            }
+bool OpenEXR::MultiPartReader::read(const ImageView& image, s32 part, const Rect& rect, s32 numThreads)
+{
+    CPPIMG_ASSERT(CPPIMG_NULL != image.data_);
+    if(part < 0 || numParts_ <= part || informations_[part].numChannels_ <= 0
+       || image.width_ != rect.width_ || image.height_ != rect.height_
+       || !readOffsetTable(part)) {
+        return false;
+    }
+    Box2i region = {rect.x_, rect.y_, rect.x_ + rect.width_ - 1, rect.y_ + rect.height_ - 1};
+    return readView(*parts_[part], *stream_, image, informations_[part].colorType_, region, numThreads);
+}
 
-            src_line += bytesPerLine;
-            dst_line += bytesPerLine;
-        }
-        CPPIMG_ASSERT(static_cast<s32>(dst_line - &tmp0[0]) == size);
+bool OpenEXR::MultiPartReader::read(s32 part, s32 numSlices, const Slice* slices, s32 numThreads)
+{
+    CPPIMG_ASSERT(0 <= part && part < numParts_);
+    Rect rect;
+    getDataWindow(rect, part);
+    return read(part, rect, numSlices, slices, numThreads);
+}
 
-        s32 compressed = compressZlib(zcontext, dst, tmp1, size, &tmp0[0]);
-        if(compressed < 0) {
-            result = false;
-            break;
-        }
+bool OpenEXR::MultiPartReader::read(s32 part, const Rect& rect, s32 numSlices, const Slice* slices, s32 numThreads)
+{
+    if(part < 0 || numParts_ <= part || parts_[part]->version_.isDeepData() || rect.width_ <= 0 || rect.height_ <= 0) {
+        return false;
+    }
+    Slice partSlices[MaxInChannels];
+    if(!parts_[part]->getSlices(partSlices, numSlices, slices)) {
+        return false;
+    }
+    Box2i region = {rect.x_, rect.y_, rect.x_ + rect.width_ - 1, rect.y_ + rect.height_ - 1};
+    return readPart(part, partSlices, region, numThreads);
+}
 
-#ifdef CPPIMG_OPENEXR_DEBUG_ZIP
-        s32 uncompressed = uncompressZlib(zuncompress, dst2, tmp1, compressed, &dst[0]);
-        CPPIMG_ASSERT(size == uncompressed);
-        for(s32 j = 0; j < size; ++j) {
-            CPPIMG_ASSERT(dst2[j] == tmp0[j]);
-        }
-#endif
-        context.offsetTable_[i] = offset;
-        src += size;
-        if(!context.write(sizeof(s32), &prev)) {
-            result = false;
-            break;
-        }
-        if(!context.write(sizeof(s32), &compressed)) {
-            result = false;
-            break;
+bool OpenEXR::MultiPartReader::readOffsetTable(s32 part)
+{
+    Context* context = parts_[part];
+    if(CPPIMG_NULL == context->offsetTable_) {
+        // Offset tables of all parts follow the headers
+        off_t offset = offsetTables_;
+        for(s32 i = 0; i < part; ++i) {
+            offset += sizeof(u64) * parts_[i]->header_.chunkCount_;
         }
-        if(!context.write(sizeof(u8) * compressed, &dst[0])) {
-            result = false;
-            break;
+        if(!stream_->seek(offset, SEEK_SET) || !context->readOffsetTable(*stream_)) {
+            CPPIMG_FREE(context->offsetTable_);
+            return false;
         }
-        offset += compressed + sizeof(s32) * 2;
     }
-#ifdef CPPIMG_OPENEXR_DEBUG_ZIP
-    szlib::termInflate(&zuncompress);
-#endif
-    szlib::termDeflate(&zcontext);
-    return result;
+    return true;
+}
+
+bool OpenEXR::MultiPartReader::readPart(s32 part, const Slice* slices, const Box2i& region, s32 numThreads)
+{
+    return readOffsetTable(part)
+           && parts_[part]->readRegion(*stream_, slices, region, numThreads);
 }
 #endif
 
@@ -0,0 +1,146 @@
+#include <string.h>
+
+#include "catch.hpp"
+
+#include "../cppimg.h"
+
+namespace
+{
+    // Colors, and their luma within 1 of the floating point weights
+    const cppimg::u8 Colors[][3] = {
+        {255, 0, 0},
+        {0, 255, 0},
+        {0, 0, 255},
+        {255, 255, 255},
+        {0, 0, 0},
+        {128, 128, 128},
+        {10, 200, 30},
+        {250, 128, 3},
+    };
+    const cppimg::s32 NumColors = sizeof(Colors) / sizeof(Colors[0]);
+    const cppimg::u8 LumaBT601[] = {77, 149, 29, 255, 0, 128, 124, 151};
+    const cppimg::u8 LumaBT709[] = {54, 182, 19, 255, 0, 128, 147, 144};
+
+    void convertLayout(cppimg::s32 width, cppimg::s32 height, cppimg::u8* dst, cppimg::s32 dstChannels, const cppimg::u8* src, cppimg::s32 srcChannels, cppimg::Luma luma)
+    {
+        switch(srcChannels*4 + dstChannels){
+        case 1*4 + 3:
+            cppimg::convertGrayToRGB(width, height, dst, src);
+            break;
+        case 1*4 + 4:
+            cppimg::convertGrayToRGBA(width, height, dst, src);
+            break;
+        case 3*4 + 1:
+            cppimg::convertRGBToGray(width, height, dst, src, luma);
+            break;
+        case 3*4 + 4:
+            cppimg::convertRGBToRGBA(width, height, dst, src);
+            break;
+        case 4*4 + 1:
+            cppimg::convertRGBAToGray(width, height, dst, src, luma);
+            break;
+        default:
+            cppimg::convertRGBAToRGB(width, height, dst, src);
+            break;
+        }
+    }
+
+    void testLayout(cppimg::s32 width, cppimg::s32 height, cppimg::s32 dstChannels, cppimg::s32 srcChannels, cppimg::Luma luma)
+    {
+        static const cppimg::s32 Guard = 16;
+        cppimg::s32 count = width*height;
+        cppimg::s32 srcSize = count*srcChannels;
+        cppimg::s32 dstSize = count*dstChannels;
+        cppimg::s32 size = (srcSize<dstSize)? dstSize : srcSize;
+        cppimg::u8* src = new cppimg::u8[srcSize];
+        cppimg::u8* expected = new cppimg::u8[dstSize];
+        cppimg::u8* dst = new cppimg::u8[dstSize + Guard];
+        cppimg::u8* inplace = new cppimg::u8[size + Guard];
+        for(cppimg::s32 i=0; i<srcSize; ++i){
+            src[i] = static_cast<cppimg::u8>(i*37 + (i>>3)*11 + 5);
+        }
+        // Gray from known colors
+        if(1 == dstChannels){
+            const cppimg::u8* lumas = (cppimg::Luma::BT709 == luma)? LumaBT709 : LumaBT601;
+            for(cppimg::s32 i=0; i<count; ++i){
+                memcpy(src + i*srcChannels, Colors[(i*3) % NumColors], 3);
+                expected[i] = lumas[(i*3) % NumColors];
+            }
+        }
+        for(cppimg::s32 i=0; 1 != dstChannels && i<count; ++i){
+            const cppimg::u8* s = src + i*srcChannels;
+            cppimg::u8* d = expected + i*dstChannels;
+            for(cppimg::s32 j=0; j<3; ++j){
+                d[j] = (1 == srcChannels)? s[0] : s[j];
+            }
+            if(4 == dstChannels){
+                d[3] = (4 == srcChannels)? s[3] : 0xFFU;
+            }
+        }
+
+        // Out of place, and nothing is written after the destination
+        memset(dst, 0xCD, dstSize + Guard);
+        convertLayout(width, height, dst, dstChannels, src, srcChannels, luma);
+        CHECK(0 == memcmp(expected, dst, dstSize));
+        bool guarded = true;
+        for(cppimg::s32 i=0; i<Guard; ++i){
+            guarded = guarded && (0xCDU == dst[dstSize + i]);
+        }
+        CHECK(guarded);
+
+        // In place, widening or narrowing
+        memset(inplace, 0xCD, size + Guard);
+        memcpy(inplace, src, srcSize);
+        convertLayout(width, height, inplace, dstChannels, inplace, srcChannels, luma);
+        CHECK(0 == memcmp(dst, inplace, dstSize));
+        for(cppimg::s32 i=0; i<Guard; ++i){
+            guarded = guarded && (0xCDU == inplace[size + i]);
+        }
+        CHECK(guarded);
+
+        delete[] inplace;
+        delete[] dst;
+        delete[] expected;
+        delete[] src;
+    }
+}
+
+TEST_CASE("Convert layouts", "[Convert]")
+{
+    static const cppimg::s32 Layouts[][2] = {
+        {3, 1},
+        {4, 1},
+        {1, 3},
+        {4, 3},
+        {1, 4},
+        {3, 4},
+    };
+    SECTION("converters"){
+        // Widths of scalar pixels only, and of vectors with scalar tails
+        static const cppimg::s32 Widths[] = {1, 15, 16, 17, 33};
+        for(const cppimg::s32* layout : Layouts){
+            for(cppimg::s32 width : Widths){
+                testLayout(width, 1, layout[0], layout[1], cppimg::Luma::BT601);
+                testLayout(width, 3, layout[0], layout[1], cppimg::Luma::BT709);
+            }
+        }
+    }
+    SECTION("luma"){
+        cppimg::u8 rgb[NumColors*3];
+        cppimg::u8 rgba[NumColors*4];
+        for(cppimg::s32 i=0; i<NumColors; ++i){
+            memcpy(rgb + i*3, Colors[i], 3);
+            memcpy(rgba + i*4, Colors[i], 3);
+            rgba[i*4 + 3] = static_cast<cppimg::u8>(i*31);
+        }
+        cppimg::u8 gray[NumColors];
+        cppimg::convertRGBToGray(NumColors, 1, gray, rgb);
+        CHECK(0 == memcmp(LumaBT601, gray, NumColors));
+        cppimg::convertRGBAToGray(NumColors, 1, gray, rgba);
+        CHECK(0 == memcmp(LumaBT601, gray, NumColors));
+        cppimg::convertRGBToGray(NumColors, 1, gray, rgb, cppimg::Luma::BT709);
+        CHECK(0 == memcmp(LumaBT709, gray, NumColors));
+        cppimg::convertRGBAToGray(NumColors, 1, gray, rgba, cppimg::Luma::BT709);
+        CHECK(0 == memcmp(LumaBT709, gray, NumColors));
+    }
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "catch.hpp"
 #include "../cppimg.h"
 
@@ -42,6 +43,45 @@ namespace
         }
         delete[] image;
     }
+
+    void testFormats(const char* src, const char* directory, cppimg::PixelFormat format)
+    {
+        cppimg::IFStream file;
+        cppimg::s32 width, height;
+        cppimg::ColorType colorType;
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        if(!file.open(buffer)){
+            CHECK(false);
+            return;
+        }
+        if(!cppimg::JPEG::read(width, height, colorType, CPPIMG_NULL, file)){
+            CHECK(false);
+            return;
+        }
+        cppimg::u8* image = new cppimg::u8[width*height*cppimg::getBytesPerPixel(colorType)];
+        CHECK(cppimg::JPEG::read(width, height, colorType, image, file));
+        cppimg::ImageView native = cppimg::ImageView::create(image, width, height, cppimg::getPixelFormat(colorType));
+
+        // Rows converted in the decoder are same as converted after decoding
+        cppimg::s32 rowSize = width*cppimg::getBytesPerPixel(format);
+        cppimg::u8* expected = new cppimg::u8[height*rowSize];
+        cppimg::u8* result = new cppimg::u8[height*(rowSize+4)];
+        cppimg::ImageView expectedView = cppimg::ImageView::create(expected, width, height, format);
+        cppimg::ImageView view = cppimg::ImageView::create(result, width, height, format, rowSize+4);
+        CHECK(cppimg::convert(expectedView, native));
+        file.seek(0, SEEK_SET);
+        CHECK(cppimg::JPEG::read(view, file));
+        for(cppimg::s32 i=0; i<height; ++i){
+            if(0 != memcmp(expectedView.getRow(i), view.getRow(i), rowSize)){
+                CHECK(false);
+                break;
+            }
+        }
+        delete[] result;
+        delete[] expected;
+        delete[] image;
+    }
 }
 
 TEST_CASE("Read JPG" "[JPG]")
@@ -59,5 +99,7 @@ TEST_CASE("Read JPG" "[JPG]")
     //}
     SECTION("lena.jpg"){
         test("lena.jpg", "lena.jpg.bmp", "../data/");
+        testFormats("lena.jpg", "../data/", cppimg::PixelFormat::RGBA8);
+        testFormats("lena.jpg", "../data/", cppimg::PixelFormat::GRAYF32);
     }
 }
@@ -1,4 +1,8 @@
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits>
+
 #include "catch.hpp"
 #include "../cppimg.h"
 
@@ -9,78 +13,820 @@ namespace
 #else
 #define SPRINTF(BUFF, FORMAT, VAR0, VAR1) sprintf((BUFF), (FORMAT), (VAR0), (VAR1))
 #endif
-    void load(const char* src, const char* dst, const char* directory)
+    /**
+        @brief Read an image in the types of the file, which is allocated with new[]
+        */
+    bool readImage(const char* path, cppimg::OpenEXR::Information& information, cppimg::u8*& image, cppimg::s32 numThreads = 0)
     {
+        image = CPPIMG_NULL;
         cppimg::IFStream file;
+        if(!file.open(path) || !cppimg::OpenEXR::read(information, CPPIMG_NULL, file)){
+            return false;
+        }
+        image = new cppimg::u8[information.width_*information.height_*information.getBytesPerPixel()];
+        if(!cppimg::OpenEXR::read(information, image, file, numThreads)){
+            delete[] image;
+            image = CPPIMG_NULL;
+            return false;
+        }
+        return true;
+    }
+
+    void load(const char* src, const char* dst, const char* directory)
+    {
         char buffer[128];
         SPRINTF(buffer, "%s%s", directory, src);
-        if(!file.open(buffer)){
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image)){
+            CHECK(false);
+            return;
+        }
+        cppimg::u8* image8 = new cppimg::u8[information.width_*information.height_*information.numChannels_];
+        cppimg::convert(information.width_, information.height_, information.numChannels_, image8, image, information.types_);
+        cppimg::OFStream ofile;
+        SPRINTF(buffer, "%s%s", directory, dst);
+        if(ofile.open(buffer)){
+            cppimg::BMP::write(ofile, information.width_, information.height_, information.colorType_, image8);
+        }
+        delete[] image8;
+        delete[] image;
+    }
+
+    void loadParallel(const char* src, const char* directory, cppimg::s32 numThreads)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image, 1)){
             CHECK(false);
             return;
         }
+        cppimg::OpenEXR::Information information2;
+        cppimg::u8* image2;
+        if(readImage(buffer, information2, image2, numThreads)){
+            CHECK(0 == memcmp(image, image2, information.width_*information.height_*information.getBytesPerPixel()));
+        }else{
+            CHECK(false);
+        }
+        delete[] image2;
+        delete[] image;
+    }
 
+    void loadLossless(const char* src, const char* reference, const char* directory)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, reference);
         cppimg::OpenEXR::Information information;
-        if(!cppimg::OpenEXR::read(information, CPPIMG_NULL, file)){
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image)){
             CHECK(false);
             return;
         }
 
-        cppimg::u8* image = new cppimg::u8[information.width_*information.height_*information.getBytesPerPixel()];
-        if(cppimg::OpenEXR::read(information, image, file)){
-            file.close();
-            cppimg::u8* image8 = new cppimg::u8[information.width_*information.height_*information.numChannels_];
-            cppimg::convert(information.width_, information.height_, information.numChannels_, image8, image, information.types_);
-            cppimg::OFStream ofile;
-            SPRINTF(buffer, "%s%s", directory, dst);
-            if(ofile.open(buffer)){
-                cppimg::BMP::write(ofile, information.width_, information.height_, information.colorType_, image8);
+        // Decoded samples are exactly same as the uncompressed image
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::OpenEXR::Information information2;
+        cppimg::u8* image2;
+        if(readImage(buffer, information2, image2)
+            && information2.width_ == information.width_
+            && information2.height_ == information.height_
+            && information2.getBytesPerPixel() == information.getBytesPerPixel()){
+            CHECK(0 == memcmp(image, image2, information.width_*information.height_*information.getBytesPerPixel()));
+        }else{
+            CHECK(false);
+        }
+        delete[] image2;
+        delete[] image;
+    }
+
+    /**
+        @brief Bits of a half in the order of values, which B44 packs
+        */
+    cppimg::s32 toOrdered(cppimg::u16 x)
+    {
+        return (x & 0x8000U) ? (~x & 0xFFFF) : (x | 0x8000U);
+    }
+
+    cppimg::u16 fromOrdered(cppimg::s32 x)
+    {
+        x = (x<0)? 0 : (0xFFFF<x)? 0xFFFF : x;
+        return static_cast<cppimg::u16>((x & 0x8000) ? (x & 0x7FFF) : (~x & 0xFFFF));
+    }
+
+    /**
+        @brief Fill a channel with the source of B44 fixtures, scale*(0.5+0.5*sin(x*0.21+y*0.13)) and noise in [0, 0.01)
+        */
+    void sineB44(cppimg::u16* lower, cppimg::u16* upper, cppimg::s32 width, cppimg::s32 height, cppimg::s32 numChannels, cppimg::s32 channel, cppimg::f32 scale)
+    {
+        for(cppimg::s32 y=0; y<height; ++y){
+            for(cppimg::s32 x=0; x<width; ++x){
+                cppimg::f32 value = scale*(0.5f + 0.5f*sinf(x*0.21f + y*0.13f));
+                cppimg::s32 index = (y*width + x)*numChannels + channel;
+                lower[index] = cppimg::toFloat16(value);
+                upper[index] = cppimg::toFloat16(value + 0.01f);
+            }
+        }
+    }
+
+    /**
+        @brief Compare a B44 image with ranges of its source samples
+        @param lower ... the lower end of each sample
+        @param upper ... the upper end of each sample
+        @param linear ... samples are packed as 8*log(x), and decoded with exp(x/8)
+
+        B44 rounds ordered bits of a 4x4 block to multiples of 2^shift, with the least shift which makes differences of neighbors fit in 6 bits.
+        So errors are less than 1/30 of the range of a block.
+        */
+    void loadB44(const char* src, const char* directory, const cppimg::u16* lower, const cppimg::u16* upper, bool linear)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* data;
+        if(!readImage(buffer, information, data)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 width = information.width_;
+        cppimg::s32 height = information.height_;
+        cppimg::s32 numChannels = information.numChannels_;
+        const cppimg::u16* image = reinterpret_cast<const cppimg::u16*>(data);
+
+        for(cppimg::s32 c=0; c<numChannels; ++c){
+            for(cppimg::s32 by=0; by<height; by+=4){
+                for(cppimg::s32 bx=0; bx<width; bx+=4){
+                    cppimg::s32 ey = cppimg::minimum(by+4, height);
+                    cppimg::s32 ex = cppimg::minimum(bx+4, width);
+                    cppimg::s32 minValue = 0xFFFF;
+                    cppimg::s32 maxValue = 0;
+                    for(cppimg::s32 y=by; y<ey; ++y){
+                        for(cppimg::s32 x=bx; x<ex; ++x){
+                            cppimg::s32 index = (y*width + x)*numChannels + c;
+                            minValue = cppimg::minimum(minValue, cppimg::minimum(toOrdered(lower[index]), toOrdered(upper[index])));
+                            maxValue = cppimg::maximum(maxValue, cppimg::maximum(toOrdered(lower[index]), toOrdered(upper[index])));
+                        }
+                    }
+                    // One more for rounding of the sources
+                    cppimg::s32 error = (maxValue - minValue)/30 + 1;
+                    for(cppimg::s32 y=by; y<ey; ++y){
+                        for(cppimg::s32 x=bx; x<ex; ++x){
+                            cppimg::s32 index = (y*width + x)*numChannels + c;
+                            cppimg::s32 l = cppimg::minimum(toOrdered(lower[index]), toOrdered(upper[index])) - error;
+                            cppimg::s32 u = cppimg::maximum(toOrdered(lower[index]), toOrdered(upper[index])) + error;
+                            bool inside;
+                            if(linear){
+                                // Rounding to halves after exp
+                                cppimg::f32 value = cppimg::toFloat32(image[index]);
+                                inside = expf(cppimg::toFloat32(fromOrdered(l))/8.0f)*(1.0f - 1.0f/1024.0f) <= value
+                                    && value <= expf(cppimg::toFloat32(fromOrdered(u))/8.0f)*(1.0f + 1.0f/1024.0f);
+                            }else{
+                                inside = l <= toOrdered(image[index]) && toOrdered(image[index]) <= u;
+                            }
+                            if(!inside){
+                                CHECK(inside);
+                                y = ey;
+                                bx = width;
+                                by = height;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        delete[] data;
+    }
+
+    /**
+        @brief PXR24 rounds floats to 24 bits, which have 15 bits of mantissa
+        */
+    void savePXR24(const char* src, const char* dst, const char* directory)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* data;
+        if(!readImage(buffer, information, data)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 count = information.width_*information.height_*information.numChannels_;
+        const cppimg::u16* image = reinterpret_cast<const cppimg::u16*>(data);
+
+        // Fill all bits of mantissa
+        cppimg::f32* floats = new cppimg::f32[count];
+        for(cppimg::s32 i=0; i<count; ++i){
+            floats[i] = cppimg::toFloat32(image[i])*1.0001f + 1.0e-5f*(i%7);
+        }
+        cppimg::f32* floats2 = new cppimg::f32[count];
+        cppimg::OFStream ofile;
+        SPRINTF(buffer, "%s%s", directory, dst);
+        if(ofile.open(buffer)){
+            CHECK(cppimg::OpenEXR::write(ofile, information.width_, information.height_, information.colorType_, cppimg::Type::FLOAT, cppimg::Type::FLOAT, floats, cppimg::OpenEXR::PXR24_COMPRESSION));
+            ofile.close();
+        }
+        cppimg::IFStream file;
+        cppimg::OpenEXR::Information information2;
+        if(file.open(buffer)
+            && cppimg::OpenEXR::read(information2, CPPIMG_NULL, file)
+            && information2.types_[0] == static_cast<cppimg::s32>(cppimg::Type::FLOAT)
+            && cppimg::OpenEXR::read(information2, floats2, file)){
+            cppimg::s32 numRounded = 0;
+            for(cppimg::s32 i=0; i<count; ++i){
+                if(floats[i] != floats2[i]){
+                    ++numRounded;
+                }
+                if((1.0f/65536.0f)*fabsf(floats[i]) < fabsf(floats[i] - floats2[i])){
+                    CHECK(false);
+                    break;
+                }
             }
-            delete[] image8;
+            CHECK(0 < numRounded);
         }else{
             CHECK(false);
         }
+        delete[] floats2;
+        delete[] floats;
+        delete[] data;
+    }
+
+    void loadTiled(const char* src, const char* reference, const char* directory)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, reference);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 bytesPerPixel = information.getBytesPerPixel();
+
+        cppimg::IFStream file;
+        SPRINTF(buffer, "%s%s", directory, src);
+        if(!file.open(buffer)){
+            CHECK(false);
+            delete[] image;
+            return;
+        }
+        cppimg::OpenEXR::TiledReader reader;
+        CHECK(reader.open(file));
+        CHECK(reader.getInformation().width_ == information.width_);
+        CHECK(reader.getInformation().height_ == information.height_);
+
+        // The full resolution level is same as the scanline image
+        cppimg::u8* level = new cppimg::u8[information.width_*information.height_*bytesPerPixel];
+        CHECK(reader.readLevel(level, 0, 0, 4));
+        CHECK(0 == memcmp(image, level, information.width_*information.height_*bytesPerPixel));
+
+        // Tiles of the coarsest level
+        cppimg::s32 lx = reader.getNumXLevels() - 1;
+        cppimg::s32 ly = reader.getNumYLevels() - 1;
+        cppimg::s32 width = reader.getLevelWidth(lx);
+        cppimg::s32 height = reader.getLevelHeight(ly);
+        CHECK(reader.readLevel(level, lx, ly));
+        cppimg::u8* tiles = new cppimg::u8[width*height*bytesPerPixel];
+        for(cppimg::s32 ty=0; ty<reader.getNumYTiles(ly); ++ty){
+            for(cppimg::s32 tx=0; tx<reader.getNumXTiles(lx); ++tx){
+                cppimg::u8* tile = tiles + (ty*reader.getTileHeight()*width + tx*reader.getTileWidth())*bytesPerPixel;
+                CHECK(reader.readTile(tile, width*bytesPerPixel, tx, ty, lx, ly));
+            }
+        }
+        CHECK(0 == memcmp(tiles, level, width*height*bytesPerPixel));
+
+        cppimg::s32 x, y;
+        reader.findLevel(x, y, width, height);
+        CHECK(reader.getLevelWidth(x) == width);
+        CHECK(reader.getLevelHeight(y) == height);
+        delete[] tiles;
+        delete[] level;
         delete[] image;
     }
 
-    void save(const char* src, const char* dst, const char* directory)
+    void loadMultiPart(const char* src, const char* reference, const char* directory)
     {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, reference);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* data;
+        if(!readImage(buffer, information, data)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 numPixels = information.width_*information.height_;
+        const cppimg::u16* image = reinterpret_cast<const cppimg::u16*>(data);
+
         cppimg::IFStream file;
+        SPRINTF(buffer, "%s%s", directory, src);
+        if(!file.open(buffer)){
+            CHECK(false);
+            delete[] data;
+            return;
+        }
+        cppimg::OpenEXR::MultiPartReader reader;
+        CHECK(reader.open(file));
+        CHECK(3 == reader.getNumParts());
+        CHECK(-1 == reader.findPart("specular"));
+
+        // A depth part is not gray, RGB, nor RGBA
+        cppimg::s32 depth = reader.findPart("depth");
+        CHECK(1 == reader.getNumChannels(depth));
+        CHECK(0 == strcmp("Z", reader.getChannelName(depth, 0)));
+        cppimg::OpenEXR::Information partInformation;
+        CHECK_FALSE(reader.getInformation(partInformation, depth));
+
+        // Decode parts in the reverse order of the file
+        cppimg::s32 albedo = reader.findPart("albedo");
+        CHECK(reader.isTiled(albedo));
+        CHECK(reader.getInformation(partInformation, albedo));
+        CHECK(cppimg::ColorType::RGB == partInformation.colorType_);
+        cppimg::u16* rgb = new cppimg::u16[numPixels*3];
+        cppimg::u16* expectedRGB = new cppimg::u16[numPixels*3];
+        for(cppimg::s32 i=0; i<numPixels; ++i){
+            memcpy(expectedRGB + i*3, image + i*4, sizeof(cppimg::u16)*3);
+        }
+        CHECK(reader.read(rgb, albedo));
+        CHECK(0 == memcmp(expectedRGB, rgb, sizeof(cppimg::u16)*numPixels*3));
+        delete[] expectedRGB;
+        delete[] rgb;
+
+        cppimg::s32 beauty = reader.findPart("beauty");
+        CHECK(0 == beauty);
+        CHECK(reader.getInformation(partInformation, beauty));
+        cppimg::u16* rgba = new cppimg::u16[numPixels*4];
+        CHECK(reader.read(rgba, beauty, 4));
+        CHECK(0 == memcmp(image, rgba, sizeof(cppimg::u16)*numPixels*4));
+        delete[] rgba;
+
+        // Select channels by a pattern, and convert to planar float
+        cppimg::s32 channels[4];
+        CHECK(4 == reader.findChannels(channels, 4, beauty, "?"));
+        CHECK(0 == reader.findChannels(channels, 4, beauty, "Z*"));
+        CHECK(4 == reader.findChannels(channels, 1, beauty, "*"));
+        CHECK(1 == reader.findChannels(channels, 4, beauty, "G"));
+        CHECK(0 == strcmp("G", reader.getChannelName(beauty, channels[0])));
+        cppimg::f32* planes = new cppimg::f32[numPixels*2];
+        cppimg::f32* expectedPlanes = new cppimg::f32[numPixels*2];
+        for(cppimg::s32 i=0; i<numPixels; ++i){
+            expectedPlanes[i] = cppimg::toFloat32(image[i*4 + 0]);
+            expectedPlanes[numPixels + i] = cppimg::toFloat32(image[i*4 + 2]);
+        }
+        cppimg::OpenEXR::Slice slices[2];
+        slices[0] = {"R", cppimg::Type::FLOAT, planes, sizeof(cppimg::f32), static_cast<cppimg::s64>(sizeof(cppimg::f32))*information.width_};
+        slices[1] = {"B", cppimg::Type::FLOAT, planes + numPixels, sizeof(cppimg::f32), static_cast<cppimg::s64>(sizeof(cppimg::f32))*information.width_};
+        CHECK(reader.read(beauty, 2, slices));
+        CHECK(0 == memcmp(expectedPlanes, planes, sizeof(cppimg::f32)*numPixels*2));
+        slices[0].name_ = "diffuse.R";
+        CHECK_FALSE(reader.read(beauty, 1, slices));
+        delete[] expectedPlanes;
+        delete[] planes;
+
+        cppimg::u16* z = new cppimg::u16[numPixels];
+        cppimg::u16* expectedZ = new cppimg::u16[numPixels];
+        for(cppimg::s32 i=0; i<numPixels; ++i){
+            expectedZ[i] = cppimg::toFloat16(static_cast<cppimg::f32>(i%information.width_ + i/information.width_));
+        }
+        cppimg::OpenEXR::Slice slice = {"Z", cppimg::Type::HALF, z, sizeof(cppimg::u16), static_cast<cppimg::s64>(sizeof(cppimg::u16))*information.width_};
+        CHECK(reader.read(depth, 1, &slice));
+        CHECK(0 == memcmp(expectedZ, z, sizeof(cppimg::u16)*numPixels));
+        delete[] expectedZ;
+        delete[] z;
+        delete[] data;
+    }
+
+    void loadRegion(const char* src, const char* tiled, const char* reference, const char* directory)
+    {
         char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, reference);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* data;
+        if(!readImage(buffer, information, data)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 width = information.width_;
+        cppimg::s32 numPixels = information.width_*information.height_;
+        const cppimg::u16* image = reinterpret_cast<const cppimg::u16*>(data);
+
+        // The data window is smaller than the display window
+        cppimg::IFStream file;
         SPRINTF(buffer, "%s%s", directory, src);
         if(!file.open(buffer)){
             CHECK(false);
+            delete[] data;
             return;
         }
+        cppimg::OpenEXR::MultiPartReader reader;
+        CHECK(reader.open(file));
+        cppimg::OpenEXR::Rect dataWindow;
+        reader.getDataWindow(dataWindow, 0);
+        CHECK((20 == dataWindow.x_ && 10 == dataWindow.y_ && 71 == dataWindow.width_ && 91 == dataWindow.height_));
+        cppimg::u16* display = new cppimg::u16[numPixels*4];
+        cppimg::u16* expected = new cppimg::u16[numPixels*4];
+        for(cppimg::s32 i=0; i<numPixels; ++i){
+            cppimg::s32 x = i%width - dataWindow.x_;
+            cppimg::s32 y = i/width - dataWindow.y_;
+            bool inside = 0<=x && x<dataWindow.width_ && 0<=y && y<dataWindow.height_;
+            for(cppimg::s32 j=0; j<4; ++j){
+                expected[i*4+j] = inside? image[i*4+j] : 0;
+            }
+        }
+        file.seek(0, SEEK_SET);
+        CHECK(cppimg::OpenEXR::read(information, display, file));
+        CHECK(width == information.width_);
+        CHECK(0 == memcmp(expected, display, sizeof(cppimg::u16)*numPixels*4));
+        delete[] expected;
 
+        // A rectangle across the edges of the data window
+        cppimg::OpenEXR::Rect rect = {5, 50, 40, 60};
+        cppimg::u16* region = new cppimg::u16[rect.width_*rect.height_*4];
+        CHECK(reader.read(region, 0, rect, 2));
+        cppimg::f32* green = new cppimg::f32[rect.width_*rect.height_];
+        for(cppimg::s32 i=0; i<rect.width_*rect.height_; ++i){
+            green[i] = -1.0f;
+        }
+        cppimg::OpenEXR::Slice slice = {"G", cppimg::Type::FLOAT, green, sizeof(cppimg::f32), static_cast<cppimg::s64>(sizeof(cppimg::f32))*rect.width_};
+        CHECK(reader.read(0, rect, 1, &slice));
+        cppimg::u16* expectedRegion = new cppimg::u16[rect.width_*rect.height_*4];
+        cppimg::f32* expectedGreen = new cppimg::f32[rect.width_*rect.height_];
+        for(cppimg::s32 i=0; i<rect.width_*rect.height_; ++i){
+            cppimg::s32 x = rect.x_ + i%rect.width_;
+            cppimg::s32 y = rect.y_ + i/rect.width_;
+            const cppimg::u16* pixel = display + (y*width + x)*4;
+            memcpy(expectedRegion + i*4, pixel, sizeof(cppimg::u16)*4);
+            bool inside = dataWindow.x_<=x && dataWindow.y_<=y && y<dataWindow.y_+dataWindow.height_;
+            expectedGreen[i] = inside? cppimg::toFloat32(pixel[1]) : -1.0f;
+        }
+        CHECK(0 == memcmp(expectedRegion, region, sizeof(cppimg::u16)*rect.width_*rect.height_*4));
+        CHECK(0 == memcmp(expectedGreen, green, sizeof(cppimg::f32)*rect.width_*rect.height_));
+        delete[] expectedGreen;
+        delete[] expectedRegion;
+        delete[] green;
+        delete[] region;
+        delete[] display;
+        file.close();
+
+        // Only tiles intersecting a rectangle
+        SPRINTF(buffer, "%s%s", directory, tiled);
+        if(!file.open(buffer)){
+            CHECK(false);
+            delete[] data;
+            return;
+        }
+        cppimg::OpenEXR::TiledReader tiledReader;
+        CHECK(tiledReader.open(file));
+        rect = {37, 21, 50, 40};
+        region = new cppimg::u16[rect.width_*rect.height_*4];
+        CHECK(tiledReader.readLevel(region, rect, 0, 0));
+        expectedRegion = new cppimg::u16[rect.width_*rect.height_*4];
+        for(cppimg::s32 y=0; y<rect.height_; ++y){
+            memcpy(expectedRegion + y*rect.width_*4, image + ((rect.y_+y)*width + rect.x_)*4, sizeof(cppimg::u16)*rect.width_*4);
+        }
+        CHECK(0 == memcmp(expectedRegion, region, sizeof(cppimg::u16)*rect.width_*rect.height_*4));
+        delete[] expectedRegion;
+        delete[] region;
+        delete[] data;
+    }
+
+    bool readAll(const char* path, cppimg::u8*& data, cppimg::s64& size)
+    {
+        cppimg::IFStream file;
+        if(!file.open(path)){
+            return false;
+        }
+        file.seek(0, SEEK_END);
+        size = file.tell();
+        file.seek(0, SEEK_SET);
+        data = new cppimg::u8[size];
+        return 0 < file.read(size, data);
+    }
+
+    void saveParallel(const char* src, const char* dst0, const char* dst1, const char* directory, cppimg::s32 numThreads)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
         cppimg::OpenEXR::Information information;
-        if(!cppimg::OpenEXR::read(information, CPPIMG_NULL, file)){
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image)){
             CHECK(false);
             return;
         }
 
-        cppimg::u8* image = new cppimg::u8[information.width_*information.height_*information.getBytesPerPixel()];
-        if(cppimg::OpenEXR::read(information, image, file)){
-            file.close();
-            for(cppimg::s32 i=0; i<information.numChannels_; ++i){
-              CHECK(information.types_[i] == static_cast<cppimg::s32>(cppimg::Type::HALF));
+        char buffer0[128];
+        char buffer1[128];
+        SPRINTF(buffer0, "%s%s", directory, dst0);
+        SPRINTF(buffer1, "%s%s", directory, dst1);
+        cppimg::OFStream ofile;
+        if(ofile.open(buffer0)){
+            CHECK(cppimg::OpenEXR::write(ofile, information.width_, information.height_, information.colorType_, cppimg::Type::HALF, image, cppimg::OpenEXR::ZIP_COMPRESSION, 1));
+            ofile.close();
+        }
+        if(ofile.open(buffer1)){
+            CHECK(cppimg::OpenEXR::write(ofile, information.width_, information.height_, information.colorType_, cppimg::Type::HALF, image, cppimg::OpenEXR::ZIP_COMPRESSION, numThreads));
+            ofile.close();
+        }
+        delete[] image;
+
+        // Blocks are compressed independently, so the output does not depend on threads
+        cppimg::u8* data0 = CPPIMG_NULL;
+        cppimg::u8* data1 = CPPIMG_NULL;
+        cppimg::s64 size0 = 0;
+        cppimg::s64 size1 = 0;
+        CHECK(readAll(buffer0, data0, size0));
+        CHECK(readAll(buffer1, data1, size1));
+        CHECK(size0 == size1);
+        if(size0 == size1){
+            CHECK(0 == memcmp(data0, data1, size0));
+        }
+        delete[] data1;
+        delete[] data0;
+    }
+
+    /**
+        @brief Compare a level with 2x2 box averages of the full level in the order of the filter, the last odd pixel is paired with itself
+        */
+    void checkBoxLevel(cppimg::OpenEXR::TiledReader& reader, const cppimg::u16* image, cppimg::s32 width, cppimg::s32 height, cppimg::s32 numChannels, cppimg::s32 lx, cppimg::s32 ly)
+    {
+        cppimg::s32 levelWidth = reader.getLevelWidth(lx);
+        cppimg::s32 levelHeight = reader.getLevelHeight(ly);
+        cppimg::u16* level = new cppimg::u16[levelWidth*levelHeight*numChannels];
+        CHECK(reader.readLevel(level, lx, ly));
+        cppimg::s32 stepX = (levelWidth == width)? 1 : 2;
+        cppimg::s32 stepY = (levelHeight == height)? 1 : 2;
+        for(cppimg::s32 y=0; y<levelHeight; ++y){
+            cppimg::s32 y0 = y*stepY;
+            cppimg::s32 y1 = cppimg::minimum(y0+stepY-1, height-1);
+            for(cppimg::s32 x=0; x<levelWidth*numChannels; ++x){
+                cppimg::s32 x0 = (x/numChannels)*stepX;
+                cppimg::s32 x1 = cppimg::minimum(x0+stepX-1, width-1);
+                cppimg::s32 c = x%numChannels;
+                cppimg::f32 sum0 = cppimg::toFloat32(image[(y0*width + x0)*numChannels + c]) + cppimg::toFloat32(image[(y1*width + x0)*numChannels + c]);
+                cppimg::f32 sum1 = cppimg::toFloat32(image[(y0*width + x1)*numChannels + c]) + cppimg::toFloat32(image[(y1*width + x1)*numChannels + c]);
+                if(cppimg::toFloat16((sum0 + sum1)*0.25f) != level[y*levelWidth*numChannels + x]){
+                    CHECK(false);
+                    y = levelHeight;
+                    break;
+                }
             }
-            cppimg::OFStream ofile;
-            SPRINTF(buffer, "%s%s", directory, dst);
-            if(ofile.open(buffer)){
-                bool result = cppimg::OpenEXR::write(ofile, information.width_, information.height_, information.colorType_, cppimg::Type::HALF, image);
-                CHECK(result);
-                ofile.close();
+        }
+        delete[] level;
+    }
+
+    void saveTiled(const char* src, const char* dst, const char* directory, cppimg::OpenEXR::LevelMode levelMode, cppimg::OpenEXR::RoundingMode roundingMode)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 size = information.width_*information.height_*information.getBytesPerPixel();
+
+        cppimg::IFStream file;
+        cppimg::OFStream ofile;
+        SPRINTF(buffer, "%s%s", directory, dst);
+        if(ofile.open(buffer)){
+            CHECK(cppimg::OpenEXR::writeTiled(ofile, information.width_, information.height_, information.colorType_, cppimg::Type::HALF, image, 32, 16, levelMode, roundingMode));
+            ofile.close();
+        }
+        if(file.open(buffer)){
+            cppimg::OpenEXR::TiledReader reader;
+            CHECK(reader.open(file));
+            CHECK(reader.getLevelMode() == levelMode);
+            CHECK(reader.getRoundingMode() == roundingMode);
+            cppimg::u8* image2 = new cppimg::u8[size];
+            CHECK(reader.readLevel(image2, 0, 0));
+            CHECK(0 == memcmp(image, image2, size));
+
+            // Levels filtered from the full level
+            const cppimg::u16* halves = reinterpret_cast<const cppimg::u16*>(image);
+            if(cppimg::OpenEXR::MIPMAP_LEVELS == levelMode){
+                checkBoxLevel(reader, halves, information.width_, information.height_, information.numChannels_, 1, 1);
+            }else if(cppimg::OpenEXR::RIPMAP_LEVELS == levelMode){
+                checkBoxLevel(reader, halves, information.width_, information.height_, information.numChannels_, 1, 0);
+                checkBoxLevel(reader, halves, information.width_, information.height_, information.numChannels_, 0, 1);
             }
-            if(file.open(buffer)){
-                cppimg::u8* image2 = new cppimg::u8[information.width_*information.height_*information.getBytesPerPixel()];
-                if(cppimg::OpenEXR::read(information, image2, file)){
-                    for(cppimg::s32 i=0; i<(information.width_*information.height_); ++i){
-                        CHECK(image[i] == image2[i]);
-                    }
+
+            // The coarsest level has a pixel
+            cppimg::s32 lx = reader.getNumXLevels() - 1;
+            cppimg::s32 ly = reader.getNumYLevels() - 1;
+            if(cppimg::OpenEXR::ONE_LEVEL != levelMode){
+                CHECK(1 == reader.getLevelWidth(lx));
+                CHECK(1 == reader.getLevelHeight(ly));
+            }
+            CHECK(reader.readLevel(image2, lx, ly));
+            delete[] image2;
+        }
+        delete[] image;
+    }
+
+    void saveFloat(const char* src, const char* dst, const char* dstTiled, const char* directory, cppimg::OpenEXR::Compression compression)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 count = information.width_*information.height_*information.numChannels_;
+        cppimg::s32 size = information.width_*information.height_*information.getBytesPerPixel();
+
+        // Halves are exact in floats, and the others are rounded, overflow or underflow
+        static const cppimg::f32 Inexacts[] = {
+            65519.0f, 65520.0f, 1.0e6f, -1.0e6f, std::numeric_limits<cppimg::f32>::infinity(), std::numeric_limits<cppimg::f32>::quiet_NaN(),
+            1.0e-6f, -3.0e-8f, 1.0e-9f, 6.1e-5f, 1.0f + 1.0f/2048.0f, 1.0f + 3.0f/2048.0f, 0.1f, -1.0f/3.0f,
+        };
+        const cppimg::s32 NumInexacts = static_cast<cppimg::s32>(sizeof(Inexacts)/sizeof(Inexacts[0]));
+        const cppimg::u16* halves = reinterpret_cast<const cppimg::u16*>(image);
+        cppimg::f32* floats = new cppimg::f32[count];
+        cppimg::u16* expected = new cppimg::u16[count];
+        for(cppimg::s32 i=0; i<count; ++i){
+            floats[i] = (i<NumInexacts)? Inexacts[i] : cppimg::toFloat32(halves[i]);
+            expected[i] = cppimg::toFloat16(floats[i]);
+        }
+
+        cppimg::u8* image2 = new cppimg::u8[size];
+        cppimg::IFStream file;
+        cppimg::OFStream ofile;
+        SPRINTF(buffer, "%s%s", directory, dst);
+        if(ofile.open(buffer)){
+            CHECK(cppimg::OpenEXR::write(ofile, information.width_, information.height_, information.colorType_, cppimg::Type::HALF, cppimg::Type::FLOAT, floats, compression));
+            ofile.close();
+        }
+        if(file.open(buffer)){
+            cppimg::OpenEXR::Information information2;
+            CHECK(cppimg::OpenEXR::read(information2, CPPIMG_NULL, file));
+            CHECK(information2.types_[0] == static_cast<cppimg::s32>(cppimg::Type::HALF));
+            CHECK(cppimg::OpenEXR::read(information2, image2, file));
+            CHECK(0 == memcmp(expected, image2, size));
+            file.close();
+        }
+
+        SPRINTF(buffer, "%s%s", directory, dstTiled);
+        if(ofile.open(buffer)){
+            CHECK(cppimg::OpenEXR::writeTiled(ofile, information.width_, information.height_, information.colorType_, cppimg::Type::HALF, cppimg::Type::FLOAT, floats, 32, 16, cppimg::OpenEXR::MIPMAP_LEVELS, cppimg::OpenEXR::ROUND_DOWN, compression));
+            ofile.close();
+        }
+        if(file.open(buffer)){
+            cppimg::OpenEXR::TiledReader reader;
+            CHECK(reader.open(file));
+            CHECK(reader.readLevel(image2, 0, 0));
+            CHECK(0 == memcmp(expected, image2, size));
+        }
+        delete[] image2;
+        delete[] expected;
+        delete[] floats;
+        delete[] image;
+    }
+
+    void loadFormats(const char* src, const char* directory)
+    {
+        static const cppimg::PixelFormat Formats[] = {
+            cppimg::PixelFormat::RGBA8,
+            cppimg::PixelFormat::GRAY8,
+            cppimg::PixelFormat::RGBF16,
+            cppimg::PixelFormat::RGBAF16,
+            cppimg::PixelFormat::GRAYF32,
+            cppimg::PixelFormat::RGBAF32,
+        };
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image)){
+            CHECK(false);
+            return;
+        }
+        for(cppimg::s32 i=1; i<information.numChannels_; ++i){
+            REQUIRE(information.types_[i] == information.types_[0]);
+        }
+        cppimg::s32 width = information.width_;
+        cppimg::s32 height = information.height_;
+        cppimg::PixelFormat nativeFormat = cppimg::getPixelFormat(information.colorType_, static_cast<cppimg::Type>(information.types_[0]));
+        cppimg::ImageView native = cppimg::ImageView::create(image, width, height, nativeFormat);
+
+        // Samples converted in the decoder are same as converted after decoding
+        cppimg::s32 maxRowSize = width*16;
+        cppimg::u8* expected = new cppimg::u8[height*maxRowSize];
+        cppimg::u8* result = new cppimg::u8[height*(maxRowSize+8)];
+        cppimg::IFStream file;
+        CHECK(file.open(buffer));
+        for(cppimg::PixelFormat format : Formats){
+            cppimg::s32 rowSize = width*cppimg::getBytesPerPixel(format);
+            cppimg::ImageView expectedView = cppimg::ImageView::create(expected, width, height, format);
+            cppimg::ImageView view = cppimg::ImageView::createBottomUp(result, width, height, format, rowSize+8);
+            CHECK(cppimg::convert(expectedView, native));
+            file.seek(0, SEEK_SET);
+            CHECK(cppimg::OpenEXR::read(information, view, file));
+            for(cppimg::s32 i=0; i<height; ++i){
+                if(0 != memcmp(expectedView.getRow(i), view.getRow(i), rowSize)){
+                    CHECK(false);
+                    break;
                 }
-                delete[] image2;
-                file.close();
             }
+        }
+        delete[] result;
+        delete[] expected;
+        delete[] image;
+    }
+
+    void saveView(const char* src, const char* dst, const char* dstTiled, const char* directory)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 width = information.width_;
+        cppimg::s32 height = information.height_;
+        cppimg::s32 size = width*height*information.getBytesPerPixel();
+
+        // Bottom-up float rows with padding
+        cppimg::PixelFormat format = cppimg::getPixelFormat(information.colorType_, cppimg::Type::FLOAT);
+        cppimg::s32 rowSize = width*cppimg::getBytesPerPixel(format);
+        cppimg::s32 pitch = rowSize + 20;
+        cppimg::u8* padded = new cppimg::u8[height*pitch];
+        cppimg::ImageView view = cppimg::ImageView::createBottomUp(padded, width, height, format, pitch);
+        cppimg::IFStream file;
+        CHECK(file.open(buffer));
+        CHECK(cppimg::OpenEXR::read(information, view, file));
+        file.close();
+        const cppimg::u16* halves = reinterpret_cast<const cppimg::u16*>(image);
+        cppimg::s32 rowCount = width*information.numChannels_;
+        for(cppimg::s32 y=0; y<height; ++y){
+            const cppimg::f32* row = reinterpret_cast<const cppimg::f32*>(view.getRow(y));
+            for(cppimg::s32 i=0; i<rowCount; ++i){
+                if(cppimg::toFloat32(halves[y*rowCount+i]) != row[i]){
+                    CHECK(false);
+                    y = height;
+                    break;
+                }
+            }
+        }
+
+        cppimg::u8* image2 = new cppimg::u8[size];
+        cppimg::OFStream ofile;
+        SPRINTF(buffer, "%s%s", directory, dst);
+        if(ofile.open(buffer)){
+            CHECK(cppimg::OpenEXR::write(ofile, view, cppimg::Type::HALF, cppimg::OpenEXR::ZIPS_COMPRESSION));
+            ofile.close();
+        }
+        if(file.open(buffer)){
+            CHECK(cppimg::OpenEXR::read(information, image2, file));
+            CHECK(0 == memcmp(image, image2, size));
+            file.close();
+        }
+
+        SPRINTF(buffer, "%s%s", directory, dstTiled);
+        if(ofile.open(buffer)){
+            CHECK(cppimg::OpenEXR::writeTiled(ofile, view, cppimg::Type::HALF, 32, 32, cppimg::OpenEXR::MIPMAP_LEVELS));
+            ofile.close();
+        }
+        if(file.open(buffer)){
+            memset(image2, 0, size);
+            CHECK(cppimg::OpenEXR::read(information, image2, file));
+            CHECK(0 == memcmp(image, image2, size));
+            file.close();
+        }
+        delete[] image2;
+        delete[] padded;
+        delete[] image;
+    }
+
+    void save(const char* src, const char* dst, const char* directory, cppimg::OpenEXR::Compression compression = cppimg::OpenEXR::ZIP_COMPRESSION)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::OpenEXR::Information information;
+        cppimg::u8* image;
+        if(!readImage(buffer, information, image)){
+            CHECK(false);
+            return;
+        }
+        for(cppimg::s32 i=0; i<information.numChannels_; ++i){
+            CHECK(information.types_[i] == static_cast<cppimg::s32>(cppimg::Type::HALF));
+        }
+        cppimg::OFStream ofile;
+        SPRINTF(buffer, "%s%s", directory, dst);
+        if(ofile.open(buffer)){
+            bool result = cppimg::OpenEXR::write(ofile, information.width_, information.height_, information.colorType_, cppimg::Type::HALF, image, compression);
+            CHECK(result);
+            ofile.close();
+        }
+        cppimg::OpenEXR::Information information2;
+        cppimg::u8* image2;
+        if(readImage(buffer, information2, image2)){
+            CHECK(0 == memcmp(image, image2, information.width_*information.height_*information.getBytesPerPixel()));
+            delete[] image2;
         }else{
             CHECK(false);
         }
@@ -90,33 +836,268 @@ namespace
 
 TEST_CASE("Read OpenEXR" "[EXR]")
 {
-    SECTION("nocompression"){
+    SECTION("read nocompression"){
         load("OpenEXR/rgb_nocompression.exr", "rgb_nocompression.exr.bmp", "../data/");
         load("OpenEXR/rgba_nocompression.exr", "rgba_nocompression.exr.bmp", "../data/");
         load("OpenEXR/gray_nocompression.exr", "gray_nocompression.exr.bmp", "../data/");
     }
 
-    SECTION("rle"){
+    SECTION("read rle"){
         load("OpenEXR/rgb_rle.exr", "rgb_rle.exr.bmp", "../data/");
         load("OpenEXR/rgba_rle.exr", "rgba_rle.exr.bmp", "../data/");
         load("OpenEXR/gray_rle.exr", "gray_rle.exr.bmp", "../data/");
     }
 
-    SECTION("zips"){
+    SECTION("read zips"){
         load("OpenEXR/rgb_zips.exr", "rgb_zips.exr.bmp", "../data/");
         load("OpenEXR/rgba_zips.exr", "rgba_zips.exr.bmp", "../data/");
         load("OpenEXR/gray_zips.exr", "gray_zips.exr.bmp", "../data/");
     }
 
-    SECTION("zip"){
+    SECTION("read zip"){
         load("OpenEXR/rgb_zip.exr", "rgb_zip.exr.bmp", "../data/");
         load("OpenEXR/rgba_zip.exr", "rgba_zip.exr.bmp", "../data/");
         load("OpenEXR/gray_zip.exr", "gray_zip.exr.bmp", "../data/");
     }
 
-    SECTION("zip"){
+    SECTION("read piz"){
+        load("OpenEXR/rgb_piz.exr", "rgb_piz.exr.bmp", "../data/");
+        load("OpenEXR/rgba_piz.exr", "rgba_piz.exr.bmp", "../data/");
+        load("OpenEXR/gray_piz.exr", "gray_piz.exr.bmp", "../data/");
+        loadLossless("OpenEXR/rgb_piz.exr", "OpenEXR/rgb_nocompression.exr", "../data/");
+        loadLossless("OpenEXR/rgba_piz.exr", "OpenEXR/rgba_nocompression.exr", "../data/");
+        loadLossless("OpenEXR/gray_piz.exr", "OpenEXR/gray_nocompression.exr", "../data/");
+        loadParallel("OpenEXR/rgba_piz.exr", "../data/", 4);
+    }
+
+    SECTION("read b44"){
+        load("OpenEXR/rgb_b44.exr", "rgb_b44.exr.bmp", "../data/");
+        load("OpenEXR/rgba_b44.exr", "rgba_b44.exr.bmp", "../data/");
+        load("OpenEXR/gray_b44a.exr", "gray_b44a.exr.bmp", "../data/");
+
+        // Sources of the fixtures, which are 37x45
+        const cppimg::s32 Width = 37;
+        const cppimg::s32 Height = 45;
+        cppimg::u16* lower = new cppimg::u16[Width*Height*4];
+        cppimg::u16* upper = new cppimg::u16[Width*Height*4];
+        static const cppimg::u16 Small[3][2] = {{0x3C00U, 0x3C14U}, {0x3800U, 0x3800U}, {0xBC00U, 0xBC1EU}};
+        for(cppimg::s32 i=0; i<Width*Height*3; ++i){
+            lower[i] = Small[i%3][0];
+            upper[i] = Small[i%3][1];
+        }
+        loadB44("OpenEXR/rgb_b44.exr", "../data/", lower, upper, false);
+
+        static const cppimg::f32 Scales[4] = {1.0f, 100.0f, -3.0f, 0.001f};
+        for(cppimg::s32 i=0; i<4; ++i){
+            sineB44(lower, upper, Width, Height, 4, i, Scales[i]);
+        }
+        loadB44("OpenEXR/rgba_b44.exr", "../data/", lower, upper, false);
+
+        sineB44(lower, upper, Width, Height, 1, 0, 2.0f);
+        loadB44("OpenEXR/gray_b44a.exr", "../data/", lower, upper, true);
+        delete[] upper;
+        delete[] lower;
+    }
+
+    SECTION("read tiled"){
+        load("OpenEXR/rgba_tiled.exr", "rgba_tiled.exr.bmp", "../data/");
+        loadTiled("OpenEXR/rgba_tiled.exr", "OpenEXR/rgba_nocompression.exr", "../data/");
+        loadTiled("OpenEXR/rgba_mipmap.exr", "OpenEXR/rgba_nocompression.exr", "../data/");
+        loadTiled("OpenEXR/rgba_ripmap.exr", "OpenEXR/rgba_nocompression.exr", "../data/");
+    }
+
+    SECTION("read multipart"){
+        load("OpenEXR/multipart.exr", "multipart.exr.bmp", "../data/");
+        loadMultiPart("OpenEXR/multipart.exr", "OpenEXR/rgba_nocompression.exr", "../data/");
+    }
+
+    SECTION("read region"){
+        loadRegion("OpenEXR/rgba_datawindow.exr", "OpenEXR/rgba_tiled.exr", "OpenEXR/rgba_nocompression.exr", "../data/");
+    }
+
+    SECTION("read formats"){
+        loadFormats("OpenEXR/rgba_zip.exr", "../data/");
+        loadFormats("OpenEXR/gray_piz.exr", "../data/");
+        loadFormats("OpenEXR/rgba_tiled.exr", "../data/");
+        loadFormats("OpenEXR/rgba_datawindow.exr", "../data/");
+        loadFormats("OpenEXR/multipart.exr", "../data/");
+    }
+
+    SECTION("read threads"){
+        loadParallel("OpenEXR/rgb_rle.exr", "../data/", 4);
+        loadParallel("OpenEXR/rgba_zips.exr", "../data/", 4);
+        loadParallel("OpenEXR/gray_zip.exr", "../data/", 4);
+        loadParallel("OpenEXR/rgba_zip.exr", "../data/", 0);
+    }
+
+    SECTION("write rle"){
+        save("OpenEXR/rgb_rle.exr", "rgb_rle.exr", "../data/", cppimg::OpenEXR::RLE_COMPRESSION);
+        save("OpenEXR/rgba_rle.exr", "rgba_rle.exr", "../data/", cppimg::OpenEXR::RLE_COMPRESSION);
+        save("OpenEXR/gray_rle.exr", "gray_rle.exr", "../data/", cppimg::OpenEXR::RLE_COMPRESSION);
+    }
+
+    SECTION("write zips"){
+        save("OpenEXR/rgb_zips.exr", "rgb_zips.exr", "../data/", cppimg::OpenEXR::ZIPS_COMPRESSION);
+        save("OpenEXR/rgba_zips.exr", "rgba_zips.exr", "../data/", cppimg::OpenEXR::ZIPS_COMPRESSION);
+        save("OpenEXR/gray_zips.exr", "gray_zips.exr", "../data/", cppimg::OpenEXR::ZIPS_COMPRESSION);
+    }
+
+    SECTION("write zip"){
         save("OpenEXR/rgb_zip.exr", "rgb_zip.exr", "../data/");
         save("OpenEXR/rgba_zip.exr", "rgba_zip.exr", "../data/");
         save("OpenEXR/gray_zip.exr", "gray_zip.exr", "../data/");
     }
+
+    SECTION("write piz"){
+        save("OpenEXR/rgb_piz.exr", "rgb_piz.exr", "../data/", cppimg::OpenEXR::PIZ_COMPRESSION);
+        save("OpenEXR/rgba_piz.exr", "rgba_piz.exr", "../data/", cppimg::OpenEXR::PIZ_COMPRESSION);
+        save("OpenEXR/gray_piz.exr", "gray_piz.exr", "../data/", cppimg::OpenEXR::PIZ_COMPRESSION);
+    }
+
+    SECTION("write pxr24"){
+        save("OpenEXR/rgb_zip.exr", "rgb_pxr24.exr", "../data/", cppimg::OpenEXR::PXR24_COMPRESSION);
+        save("OpenEXR/rgba_zip.exr", "rgba_pxr24.exr", "../data/", cppimg::OpenEXR::PXR24_COMPRESSION);
+        save("OpenEXR/gray_zip.exr", "gray_pxr24.exr", "../data/", cppimg::OpenEXR::PXR24_COMPRESSION);
+        savePXR24("OpenEXR/rgba_nocompression.exr", "rgba_pxr24_float.exr", "../data/");
+        savePXR24("OpenEXR/gray_nocompression.exr", "gray_pxr24_float.exr", "../data/");
+    }
+
+    SECTION("write float"){
+        saveFloat("OpenEXR/rgba_zip.exr", "rgba_float.exr", "rgba_float_tiled.exr", "../data/", cppimg::OpenEXR::ZIP_COMPRESSION);
+        saveFloat("OpenEXR/rgb_zip.exr", "rgb_float.exr", "rgb_float_tiled.exr", "../data/", cppimg::OpenEXR::PIZ_COMPRESSION);
+        saveFloat("OpenEXR/gray_zip.exr", "gray_float.exr", "gray_float_tiled.exr", "../data/", cppimg::OpenEXR::RLE_COMPRESSION);
+    }
+
+    SECTION("write view"){
+        saveView("OpenEXR/rgba_zip.exr", "rgba_view.exr", "rgba_view_tiled.exr", "../data/");
+        saveView("OpenEXR/gray_zip.exr", "gray_view.exr", "gray_view_tiled.exr", "../data/");
+    }
+
+    SECTION("write tiled"){
+        saveTiled("OpenEXR/rgba_zip.exr", "rgba_tiled.exr", "../data/", cppimg::OpenEXR::ONE_LEVEL, cppimg::OpenEXR::ROUND_DOWN);
+        saveTiled("OpenEXR/rgb_zip.exr", "rgb_mipmap.exr", "../data/", cppimg::OpenEXR::MIPMAP_LEVELS, cppimg::OpenEXR::ROUND_DOWN);
+        saveTiled("OpenEXR/gray_zip.exr", "gray_ripmap.exr", "../data/", cppimg::OpenEXR::RIPMAP_LEVELS, cppimg::OpenEXR::ROUND_UP);
+    }
+
+    SECTION("write threads"){
+        saveParallel("OpenEXR/rgba_zip.exr", "rgba_zip_serial.exr", "rgba_zip_parallel.exr", "../data/", 4);
+        saveParallel("OpenEXR/gray_rle.exr", "gray_zip_serial.exr", "gray_zip_parallel.exr", "../data/", 0);
+    }
+}
+
+TEST_CASE("Convert half floats" "[EXR]")
+{
+    SECTION("round trip"){
+        // Every half except NaNs comes back as it was
+        cppimg::u16* halves = new cppimg::u16[65536];
+        cppimg::u16* halves2 = new cppimg::u16[65536];
+        cppimg::f32* floats = new cppimg::f32[65536];
+        for(cppimg::s32 i=0; i<65536; ++i){
+            halves[i] = static_cast<cppimg::u16>(i);
+        }
+        cppimg::convertF16ToF32(65536, floats, halves);
+        cppimg::convertF32ToF16(65536, halves2, floats);
+        for(cppimg::s32 i=0; i<65536; ++i){
+            bool nan = (0x7C00 == (i & 0x7C00)) && (0 != (i & 0x03FF));
+            CHECK((nan || halves[i] == halves2[i]));
+            CHECK((nan || floats[i] == cppimg::toFloat32(halves[i])));
+        }
+        delete[] floats;
+        delete[] halves2;
+        delete[] halves;
+    }
+
+    SECTION("rounding"){
+        CHECK(0x3C00 == cppimg::toFloat16(1.0f));
+        CHECK(0x3C00 == cppimg::toFloat16(1.0f + 1.0f/2048.0f)); // tie to even
+        CHECK(0x3C02 == cppimg::toFloat16(1.0f + 3.0f/2048.0f));
+        CHECK(0x7BFF == cppimg::toFloat16(65504.0f));
+        CHECK(0x7C00 == cppimg::toFloat16(65520.0f));
+        CHECK(0x0001 == cppimg::toFloat16(5.9604645e-8f));
+        CHECK(0x8000 == cppimg::toFloat16(-0.0f));
+    }
+
+    SECTION("8 bits"){
+        // 84 samples go through both the vector loop of 16 samples and the tail
+        const cppimg::s32 width = 21;
+        const cppimg::s32 Float = static_cast<cppimg::s32>(cppimg::Type::FLOAT);
+        const cppimg::s32 types[] = {Float, Float, Float, Float};
+        cppimg::f32 src[width*4];
+        cppimg::u8 dst[width*4];
+        for(cppimg::s32 i=0; i<width; ++i){
+            src[i*4+0] = 0.5f;
+            src[i*4+1] = 1.0f;
+            src[i*4+2] = -1.0f;
+            src[i*4+3] = 0.5f;
+        }
+        CHECK(cppimg::convert(width, 1, 4, dst, src, types));
+        for(cppimg::s32 i=0; i<width; ++i){
+            CHECK(127 == dst[i*4+0]);
+            CHECK(255 == dst[i*4+1]);
+            CHECK(0 == dst[i*4+2]);
+            CHECK(127 == dst[i*4+3]);
+        }
+        CHECK(cppimg::convert(width, 1, 4, dst, src, types, cppimg::Convert_SRGB));
+        for(cppimg::s32 i=0; i<width; ++i){
+            CHECK(188 == dst[i*4+0]);
+            CHECK(255 == dst[i*4+1]);
+            CHECK(127 == dst[i*4+3]); // alpha is linear
+        }
+        CHECK(cppimg::convert(width, 1, 4, dst, src, types, cppimg::Convert_Reinhard, 1.0f));
+        for(cppimg::s32 i=0; i<width; ++i){
+            CHECK(127 == dst[i*4+0]);
+            CHECK(170 == dst[i*4+1]);
+            CHECK(127 == dst[i*4+3]);
+        }
+        CHECK(cppimg::convert(width, 1, 4, dst, src, types, cppimg::Convert_ACES));
+        for(cppimg::s32 i=0; i<width; ++i){
+            CHECK(157 == dst[i*4+0]);
+            CHECK(204 == dst[i*4+1]);
+        }
+    }
+
+    SECTION("8 bits of inf and NaN"){
+        // Gray and alpha, the last 10 of 26 samples are in the tail
+        const cppimg::s32 width = 13;
+        const cppimg::s32 Float = static_cast<cppimg::s32>(cppimg::Type::FLOAT);
+        const cppimg::s32 types[] = {Float, Float};
+        const cppimg::f32 inf = std::numeric_limits<cppimg::f32>::infinity();
+        const cppimg::f32 nan = std::numeric_limits<cppimg::f32>::quiet_NaN();
+        const cppimg::f32 values[] = {inf, nan, 1.0e30f, -inf, -nan};
+        const cppimg::u8 expected[] = {255, 0, 255, 0, 0};
+        cppimg::f32 src[width*2];
+        cppimg::u8 dst[width*2];
+        for(cppimg::s32 i=0; i<width*2; ++i){
+            src[i] = values[i%5];
+        }
+        const cppimg::s32 options[] = {
+            cppimg::Convert_None,
+            cppimg::Convert_SRGB,
+            cppimg::Convert_Reinhard,
+            cppimg::Convert_Reinhard | cppimg::Convert_SRGB,
+            cppimg::Convert_ACES,
+            cppimg::Convert_ACES | cppimg::Convert_SRGB,
+        };
+        for(cppimg::s32 option : options){
+            CHECK(cppimg::convert(width, 1, 2, dst, src, types, option, 2.0f));
+            for(cppimg::s32 i=0; i<width*2; ++i){
+                CHECK(expected[i%5] == dst[i]);
+            }
+        }
+    }
+
+    SECTION("rows"){
+        const cppimg::s32 width = 5;
+        const cppimg::s32 height = 3;
+        const cppimg::s32 channels = 3;
+        cppimg::f32 src[width*height*channels];
+        cppimg::u32 dst[width*height*channels];
+        for(cppimg::s32 i=0; i<width*height*channels; ++i){
+            src[i] = (0 == (i&1))? 1.0f : 0.0f;
+        }
+        cppimg::convertF32ToU32(width, height, channels, dst, src);
+        for(cppimg::s32 i=0; i<width*height*channels; ++i){
+            CHECK(dst[i] == ((0 == (i&1))? 0xFFFFFFFFU : 0U));
+        }
+    }
 }
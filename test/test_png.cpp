@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "catch.hpp"
 
@@ -41,6 +42,173 @@ namespace
         }
         delete[] image;
     }
+
+    void test16Bits(const char* src, const char* directory)
+    {
+        cppimg::IFStream file;
+        cppimg::s32 width, height, bitDepth;
+        cppimg::ColorType colorType;
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        if(!file.open(buffer)){
+            CHECK(false);
+            return;
+        }
+        if(!cppimg::PNG::read(width, height, colorType, bitDepth, CPPIMG_NULL, file, cppimg::PNG::Option_Keep16Bits)){
+            CHECK(false);
+            return;
+        }
+        CHECK(16 == bitDepth);
+        cppimg::s32 samples = width*height*cppimg::getBytesPerPixel(colorType);
+        cppimg::u16* image16 = new cppimg::u16[samples];
+        cppimg::u8* image8 = new cppimg::u8[samples];
+        CHECK(cppimg::PNG::read(width, height, colorType, bitDepth, image16, file, cppimg::PNG::Option_Keep16Bits));
+        file.seek(0, SEEK_SET);
+        CHECK(cppimg::PNG::read(width, height, colorType, bitDepth, image8, file, cppimg::PNG::Option_None));
+        CHECK(8 == bitDepth);
+        for(cppimg::s32 i=0; i<samples; ++i){
+            if((image16[i]>>8) != image8[i]){
+                CHECK(false);
+                break;
+            }
+        }
+        delete[] image8;
+        delete[] image16;
+    }
+
+    void onPass(cppimg::s32 pass, const void*, void* userData)
+    {
+        cppimg::s32* passes = reinterpret_cast<cppimg::s32*>(userData);
+        CHECK(pass == *passes);
+        ++(*passes);
+    }
+
+    void testInterlace(const char* src, const char* reference, const char* directory)
+    {
+        cppimg::IFStream file;
+        cppimg::s32 width, height, bitDepth;
+        cppimg::ColorType colorType;
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, reference);
+        if(!file.open(buffer)){
+            CHECK(false);
+            return;
+        }
+        if(!cppimg::PNG::read(width, height, colorType, CPPIMG_NULL, file)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 size = width*height*cppimg::getBytesPerPixel(colorType);
+        cppimg::u8* expected = new cppimg::u8[size];
+        cppimg::u8* image = new cppimg::u8[size];
+        CHECK(cppimg::PNG::read(width, height, colorType, expected, file));
+        file.close();
+
+        SPRINTF(buffer, "%s%s", directory, src);
+        if(file.open(buffer)){
+            cppimg::s32 passes = 0;
+            CHECK(cppimg::PNG::read(width, height, colorType, bitDepth, image, file, cppimg::PNG::Option_None, onPass, &passes));
+            CHECK(7 == passes);
+            CHECK(0 == memcmp(expected, image, size));
+        }else{
+            CHECK(false);
+        }
+        delete[] image;
+        delete[] expected;
+    }
+
+    void testDecoder(const char* src, const char* directory)
+    {
+        cppimg::IFStream file;
+        cppimg::s32 width, height;
+        cppimg::ColorType colorType;
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        if(!file.open(buffer)){
+            CHECK(false);
+            return;
+        }
+        if(!cppimg::PNG::read(width, height, colorType, CPPIMG_NULL, file)){
+            CHECK(false);
+            return;
+        }
+        cppimg::s32 rowSize = width*cppimg::getBytesPerPixel(colorType);
+        cppimg::u8* expected = new cppimg::u8[rowSize*height];
+        CHECK(cppimg::PNG::read(width, height, colorType, expected, file));
+        file.seek(0, SEEK_SET);
+
+        // Decode through a ring of two rows
+        cppimg::PNG::Decoder decoder;
+        CHECK(decoder.open(file));
+        CHECK(width == decoder.getWidth());
+        CHECK(height == decoder.getHeight());
+        CHECK(colorType == decoder.getColorType());
+        CHECK(rowSize == decoder.getRowSize());
+        cppimg::u8* ring = new cppimg::u8[rowSize*2];
+        void* rows[2] = {ring, ring+rowSize};
+        bool match = true;
+        for(cppimg::s32 y=0; y<height; y+=2){
+            cppimg::s32 count = decoder.readRows(2, rows);
+            CHECK((count == 2 || y+count == height));
+            for(cppimg::s32 i=0; i<count; ++i){
+                match = match && (0 == memcmp(rows[i], expected + (y+i)*rowSize, rowSize));
+            }
+        }
+        CHECK(match);
+        CHECK(height == decoder.getRow());
+        CHECK_FALSE(decoder.readRow(ring));
+        delete[] ring;
+        delete[] expected;
+    }
+
+    void testFormats(const char* src, const char* directory)
+    {
+        static const cppimg::PixelFormat Formats[] = {
+            cppimg::PixelFormat::RGBA8,
+            cppimg::PixelFormat::RGB8,
+            cppimg::PixelFormat::GRAY8,
+            cppimg::PixelFormat::RGBAF16,
+            cppimg::PixelFormat::RGBAF32,
+        };
+        cppimg::IFStream file;
+        cppimg::s32 width, height;
+        cppimg::ColorType colorType;
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        if(!file.open(buffer)){
+            CHECK(false);
+            return;
+        }
+        if(!cppimg::PNG::read(width, height, colorType, CPPIMG_NULL, file)){
+            CHECK(false);
+            return;
+        }
+        cppimg::u8* image = new cppimg::u8[width*height*cppimg::getBytesPerPixel(colorType)];
+        CHECK(cppimg::PNG::read(width, height, colorType, image, file));
+        cppimg::ImageView native = cppimg::ImageView::create(image, width, height, cppimg::getPixelFormat(colorType));
+
+        // Rows converted in the decoder are same as converted after decoding
+        cppimg::s32 maxRowSize = width*16;
+        cppimg::u8* expected = new cppimg::u8[height*maxRowSize];
+        cppimg::u8* result = new cppimg::u8[height*(maxRowSize+8)];
+        for(cppimg::PixelFormat format : Formats){
+            cppimg::s32 rowSize = width*cppimg::getBytesPerPixel(format);
+            cppimg::ImageView expectedView = cppimg::ImageView::create(expected, width, height, format);
+            cppimg::ImageView view = cppimg::ImageView::createBottomUp(result, width, height, format, rowSize+8);
+            CHECK(cppimg::convert(expectedView, native));
+            file.seek(0, SEEK_SET);
+            CHECK(cppimg::PNG::read(view, file));
+            for(cppimg::s32 i=0; i<height; ++i){
+                if(0 != memcmp(expectedView.getRow(i), view.getRow(i), rowSize)){
+                    CHECK(false);
+                    break;
+                }
+            }
+        }
+        delete[] result;
+        delete[] expected;
+        delete[] image;
+    }
 }
 
 TEST_CASE("Read/Write PNG" "[PNG]")
@@ -51,4 +219,43 @@ TEST_CASE("Read/Write PNG" "[PNG]")
     SECTION("test01.png"){
         test("test01.png", "out01.png.bmp", "../data/");
     }
+    SECTION("test02_16bits.png"){
+        test("test02_16bits.png", "out02.png.bmp", "../data/");
+        test16Bits("test02_16bits.png", "../data/");
+    }
+    SECTION("test03_gray2bits.png"){
+        test("test03_gray2bits.png", "out03.png.bmp", "../data/");
+    }
+    SECTION("test04_index4bits.png"){
+        test("test04_index4bits.png", "out04.png.bmp", "../data/");
+    }
+    SECTION("test05_adam7.png"){
+        test("test05_adam7.png", "out05.png.bmp", "../data/");
+        testInterlace("test05_adam7.png", "test02_16bits.png", "../data/");
+    }
+    SECTION("formats"){
+        testFormats("test00.png", "../data/");
+        testFormats("test03_gray2bits.png", "../data/");
+        testFormats("test05_adam7.png", "../data/");
+    }
+    SECTION("test06_index_trns.png"){
+        cppimg::IFStream file;
+        cppimg::s32 width, height;
+        cppimg::ColorType colorType;
+        CHECK(file.open("../data/test06_index_trns.png"));
+        CHECK(cppimg::PNG::read(width, height, colorType, CPPIMG_NULL, file));
+        CHECK(cppimg::ColorType::RGBA == colorType);
+        file.close();
+        test("test06_index_trns.png", "out06.png.bmp", "../data/");
+    }
+    SECTION("PNG::Decoder"){
+        testDecoder("test00.png", "../data/");
+        testDecoder("test03_gray2bits.png", "../data/");
+        testDecoder("test06_index_trns.png", "../data/");
+
+        cppimg::IFStream file;
+        cppimg::PNG::Decoder decoder;
+        CHECK(file.open("../data/test05_adam7.png"));
+        CHECK_FALSE(decoder.open(file));
+    }
 }
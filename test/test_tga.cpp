@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "catch.hpp"
 
@@ -11,6 +12,252 @@ namespace
 #else
 #define SPRINTF(BUFF, FORMAT, VAR0, VAR1) sprintf((BUFF), (FORMAT), (VAR0), (VAR1))
 #endif
+    class MemoryStream: public cppimg::Stream
+    {
+    public:
+        explicit MemoryStream(cppimg::s32 capacity)
+            : capacity_(capacity)
+            , size_(0)
+            , position_(0)
+            , data_(new cppimg::u8[capacity])
+        {
+        }
+        ~MemoryStream()
+        {
+            delete[] data_;
+        }
+
+        virtual bool valid() const
+        {
+            return true;
+        }
+        virtual bool seek(off_t pos, cppimg::s32 whence)
+        {
+            off_t position = (SEEK_SET == whence) ? pos : (SEEK_CUR == whence) ? position_ + pos : size_ + pos;
+            if(position < 0 || size_ < position){
+                return false;
+            }
+            position_ = static_cast<cppimg::s32>(position);
+            return true;
+        }
+        virtual off_t tell()
+        {
+            return position_;
+        }
+        virtual cppimg::s64 size()
+        {
+            return size_;
+        }
+        virtual cppimg::s32 read(size_t size, void* dst)
+        {
+            if(static_cast<size_t>(size_ - position_) < size){
+                return 0;
+            }
+            memcpy(dst, data_ + position_, size);
+            position_ += static_cast<cppimg::s32>(size);
+            return static_cast<cppimg::s32>(size);
+        }
+        virtual cppimg::s32 write(size_t size, const void* src)
+        {
+            if(static_cast<size_t>(capacity_ - position_) < size){
+                return 0;
+            }
+            memcpy(data_ + position_, src, size);
+            position_ += static_cast<cppimg::s32>(size);
+            size_ = (size_ < position_) ? position_ : size_;
+            return static_cast<cppimg::s32>(size);
+        }
+
+    private:
+        cppimg::s32 capacity_;
+        cppimg::s32 size_;
+        cppimg::s32 position_;
+        cppimg::u8* data_;
+    };
+
+    cppimg::u8* readImage(const char* path, cppimg::s32& width, cppimg::s32& height, cppimg::ColorType& colorType)
+    {
+        cppimg::IFStream file;
+        if(!file.open(path) || !cppimg::TGA::read(width, height, colorType, CPPIMG_NULL, file)){
+            return CPPIMG_NULL;
+        }
+        cppimg::u8* image = new cppimg::u8[width*height*cppimg::getBytesPerPixel(colorType)];
+        if(!cppimg::TGA::read(width, height, colorType, image, file)){
+            delete[] image;
+            return CPPIMG_NULL;
+        }
+        return image;
+    }
+
+    void compareRLE(const char* src, const char* reference, const char* directory)
+    {
+        char buffer[128];
+        cppimg::s32 width, height, width2, height2;
+        cppimg::ColorType colorType, colorType2;
+        SPRINTF(buffer, "%s%s", directory, reference);
+        cppimg::u8* image = readImage(buffer, width, height, colorType);
+        SPRINTF(buffer, "%s%s", directory, src);
+        cppimg::u8* image2 = readImage(buffer, width2, height2, colorType2);
+        if(CPPIMG_NULL != image && CPPIMG_NULL != image2 && width == width2 && height == height2 && colorType == colorType2){
+            CHECK(0 == memcmp(image, image2, width*height*cppimg::getBytesPerPixel(colorType)));
+        }else{
+            CHECK(false);
+        }
+        delete[] image2;
+        delete[] image;
+    }
+
+    void writeHeader(cppimg::Stream& stream, cppimg::s32 width, cppimg::s32 height, cppimg::s32 bpp, bool compress)
+    {
+        cppimg::u8 header[18] = {0};
+        header[2] = compress? 0x0AU : 0x02U;
+        header[12] = static_cast<cppimg::u8>(width & 0xFFU);
+        header[13] = static_cast<cppimg::u8>((width >> 8) & 0xFFU);
+        header[14] = static_cast<cppimg::u8>(height & 0xFFU);
+        header[15] = static_cast<cppimg::u8>((height >> 8) & 0xFFU);
+        header[16] = static_cast<cppimg::u8>(bpp*8);
+        header[17] = (4 == bpp) ? 8 : 0;
+        stream.write(sizeof(header), header);
+    }
+
+    /**
+        @brief Decode packets, which are independent of rows, and compare with pixels written in order
+        */
+    void decodeRLE(cppimg::s32 width, cppimg::s32 bpp)
+    {
+        // Counts of packets, a negative count is a run
+        static const cppimg::s32 Packets[] = {-128, 128, -3, 1, 5, -2, 17, -128, 2, -1, 128, -31, 16};
+        static const cppimg::s32 NumPackets = sizeof(Packets)/sizeof(Packets[0]);
+        cppimg::s32 height = 700/width + 1;
+        cppimg::s32 numPixels = width*height;
+        cppimg::s32 rowSize = width*bpp;
+        MemoryStream stream(18 + numPixels*(bpp+1));
+        writeHeader(stream, width, height, bpp, true);
+
+        // Pixels in the order of the file, which begins from the bottom row
+        cppimg::u8* expected = new cppimg::u8[numPixels*bpp];
+        cppimg::u8 pixel[4];
+        for(cppimg::s32 i=0, p=0; i<numPixels; ++p){
+            cppimg::s32 count = cppimg::minimum(Packets[p%NumPackets]<0? -Packets[p%NumPackets] : Packets[p%NumPackets], numPixels-i);
+            bool run = Packets[p%NumPackets] < 0;
+            cppimg::u8 header = static_cast<cppimg::u8>((run? 0x80U : 0x00U) | (count-1));
+            stream.write(1, &header);
+            for(cppimg::s32 j=0; j<count; ++j, ++i){
+                if(!run || 0 == j){
+                    for(cppimg::s32 k=0; k<bpp; ++k){
+                        pixel[k] = static_cast<cppimg::u8>(i*7 + k*61 + p);
+                    }
+                    stream.write(bpp, pixel);
+                }
+                cppimg::u8* dst = expected + ((height - 1 - i/width)*width + i%width)*bpp;
+                dst[0] = pixel[2];
+                dst[1] = pixel[1];
+                dst[2] = pixel[0];
+                if(4 == bpp){
+                    dst[3] = pixel[3];
+                }
+            }
+        }
+
+        cppimg::u8* image = new cppimg::u8[numPixels*bpp];
+        cppimg::s32 w, h;
+        cppimg::ColorType colorType;
+        stream.seek(0, SEEK_SET);
+        CHECK(cppimg::TGA::read(w, h, colorType, image, stream));
+        CHECK((w == width && h == height));
+        CHECK(0 == memcmp(expected, image, numPixels*bpp));
+        CHECK(stream.size() == stream.tell());
+
+        // A bottom-up view with padding
+        cppimg::s32 pitch = rowSize + 5;
+        cppimg::u8* padded = new cppimg::u8[height*pitch];
+        cppimg::ImageView view = cppimg::ImageView::createBottomUp(padded, width, height, (4 == bpp)? cppimg::PixelFormat::RGBA8 : cppimg::PixelFormat::RGB8, pitch);
+        stream.seek(0, SEEK_SET);
+        CHECK(cppimg::TGA::read(view, stream));
+        for(cppimg::s32 y=0; y<height; ++y){
+            if(0 != memcmp(expected + y*rowSize, view.getRow(y), rowSize)){
+                CHECK(false);
+                break;
+            }
+        }
+
+        // Truncated packets
+        MemoryStream truncated(static_cast<cppimg::s32>(stream.size()));
+        cppimg::u8* data = new cppimg::u8[stream.size()];
+        stream.seek(0, SEEK_SET);
+        stream.read(static_cast<size_t>(stream.size() - 1), data);
+        truncated.write(static_cast<size_t>(stream.size() - 1), data);
+        truncated.seek(0, SEEK_SET);
+        CHECK_FALSE(cppimg::TGA::read(w, h, colorType, image, truncated));
+        delete[] data;
+        delete[] padded;
+        delete[] image;
+        delete[] expected;
+    }
+
+    enum Pattern
+    {
+        Pattern_Uniform,
+        Pattern_Alternating,
+        Pattern_Mixed,
+    };
+
+    /**
+        @brief Encode and decode an image, and check sizes of packets if they are known
+        */
+    void encodeRLE(cppimg::s32 width, cppimg::s32 height, cppimg::s32 bpp, Pattern pattern)
+    {
+        cppimg::s32 rowSize = width*bpp;
+        cppimg::u8* image = new cppimg::u8[height*rowSize];
+        for(cppimg::s32 y=0; y<height; ++y){
+            for(cppimg::s32 x=0; x<width; ++x){
+                cppimg::s32 value;
+                switch(pattern){
+                case Pattern_Uniform:
+                    value = 0;
+                    break;
+                case Pattern_Alternating:
+                    value = (x+y)&1;
+                    break;
+                default:
+                    // Runs of 1 to 4 pixels
+                    value = x/(1 + y%4);
+                    break;
+                }
+                for(cppimg::s32 k=0; k<bpp; ++k){
+                    image[y*rowSize + x*bpp + k] = static_cast<cppimg::u8>(value*37 + k*101 + 3);
+                }
+            }
+        }
+        cppimg::ColorType colorType = (4 == bpp)? cppimg::ColorType::RGBA : cppimg::ColorType::RGB;
+        MemoryStream stream(18 + height*(rowSize + width));
+        CHECK(cppimg::TGA::write(stream, width, height, colorType, image));
+
+        // Packets do not continue to the next row, and have at most 128 pixels
+        cppimg::s32 numPackets = (width + 127)/128;
+        switch(pattern){
+        case Pattern_Uniform:
+            CHECK(stream.size() == 18 + height*numPackets*(1 + bpp));
+            break;
+        case Pattern_Alternating:
+            CHECK(stream.size() == 18 + height*(numPackets + rowSize));
+            break;
+        default:
+            CHECK(stream.size() <= 18 + height*(width + rowSize));
+            break;
+        }
+
+        cppimg::u8* result = new cppimg::u8[height*rowSize];
+        cppimg::s32 w, h;
+        cppimg::ColorType resultType;
+        stream.seek(0, SEEK_SET);
+        CHECK(cppimg::TGA::read(w, h, resultType, result, stream));
+        CHECK((w == width && h == height && resultType == colorType));
+        CHECK(0 == memcmp(image, result, height*rowSize));
+        delete[] result;
+        delete[] image;
+    }
+
     void test(const char* src, const char* dst, const char* directory, bool compress)
     {
         cppimg::IFStream file;
@@ -38,6 +285,95 @@ namespace
         }
         delete[] image;
     }
+
+    void testView(const char* src, const char* dst, const char* directory)
+    {
+        cppimg::IFStream file;
+        cppimg::s32 width, height;
+        cppimg::ColorType colorType;
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+        if(!file.open(buffer)){
+            CHECK(false);
+            return;
+        }
+        if(!cppimg::TGA::read(width, height, colorType, CPPIMG_NULL, file)){
+            CHECK(false);
+            return;
+        }
+        cppimg::PixelFormat format = cppimg::getPixelFormat(colorType);
+        cppimg::s32 rowSize = width * cppimg::getBytesPerPixel(format);
+        cppimg::s32 pitch = rowSize + 13;
+        cppimg::u8* image = new cppimg::u8[height * rowSize];
+        cppimg::u8* padded = new cppimg::u8[height * pitch];
+        cppimg::f32* floats = new cppimg::f32[width * height * 4];
+        cppimg::u8* result = new cppimg::u8[height * rowSize];
+        CHECK(cppimg::TGA::read(width, height, colorType, image, file));
+
+        // Bottom-up rows with padding
+        cppimg::ImageView view = cppimg::ImageView::createBottomUp(padded, width, height, format, pitch);
+        file.seek(0, SEEK_SET);
+        CHECK(cppimg::TGA::read(view, file));
+        for(cppimg::s32 i = 0; i < height; ++i){
+            CHECK(0 == memcmp(image + i * rowSize, view.getRow(i), rowSize));
+            CHECK(0 == memcmp(image + i * rowSize, padded + (height - 1 - i) * pitch, rowSize));
+        }
+        cppimg::ImageView mismatch = cppimg::ImageView::create(padded, width - 1, height, format, pitch);
+        file.seek(0, SEEK_SET);
+        CHECK_FALSE(cppimg::TGA::read(mismatch, file));
+
+        // Through a float view and back
+        cppimg::ImageView floatView = cppimg::ImageView::create(floats, width, height, cppimg::PixelFormat::RGBAF32);
+        cppimg::ImageView resultView = cppimg::ImageView::create(result, width, height, format);
+        CHECK(cppimg::convert(floatView, view));
+        CHECK(cppimg::convert(resultView, floatView));
+        // Linear samples are truncated to 8 bits
+        cppimg::s32 maxDiff = 0;
+        for(cppimg::s32 i = 0; i < height * rowSize; ++i){
+            cppimg::s32 diff = static_cast<cppimg::s32>(image[i]) - result[i];
+            maxDiff = (maxDiff < diff) ? diff : (maxDiff < -diff ? -diff : maxDiff);
+        }
+        CHECK(maxDiff <= 1);
+
+        // A sub view
+        if(2 < width && 2 < height){
+            cppimg::ImageView sub = view.getSubView(1, 1, width - 2, height - 2);
+            CHECK(0 == memcmp(image + rowSize + cppimg::getBytesPerPixel(format), sub.getRow(0), (width - 2) * cppimg::getBytesPerPixel(format)));
+        }
+
+        cppimg::OFStream ofile;
+        SPRINTF(buffer, "%s%s", directory, dst);
+        if(ofile.open(buffer)){
+            CHECK(cppimg::TGA::write(ofile, view));
+            ofile.close();
+            cppimg::IFStream ifile;
+            CHECK(ifile.open(buffer));
+            memset(result, 0, height * rowSize);
+            CHECK(cppimg::TGA::read(width, height, colorType, result, ifile));
+            CHECK(0 == memcmp(image, result, height * rowSize));
+        }
+
+        // Rows converted in the decoder
+        cppimg::ImageView native = cppimg::ImageView::create(image, width, height, format);
+        cppimg::ImageView expected = cppimg::ImageView::create(floats, width, height, cppimg::PixelFormat::RGBAF16);
+        cppimg::ImageView converted = cppimg::ImageView::create(floats + width * height * 2, width, height, cppimg::PixelFormat::RGBAF16);
+        CHECK(cppimg::convert(expected, native));
+        file.seek(0, SEEK_SET);
+        CHECK(cppimg::TGA::read(converted, file));
+        CHECK(0 == memcmp(expected.data_, converted.data_, width * height * 8));
+        cppimg::ImageView gray = cppimg::ImageView::create(result, width, height, cppimg::PixelFormat::GRAY8);
+        cppimg::ImageView grayPadded = cppimg::ImageView::createBottomUp(padded, width, height, cppimg::PixelFormat::GRAY8, pitch);
+        CHECK(cppimg::convert(gray, native));
+        file.seek(0, SEEK_SET);
+        CHECK(cppimg::TGA::read(grayPadded, file));
+        for(cppimg::s32 i = 0; i < height; ++i){
+            CHECK(0 == memcmp(gray.getRow(i), grayPadded.getRow(i), width));
+        }
+        delete[] result;
+        delete[] floats;
+        delete[] padded;
+        delete[] image;
+    }
 }
 
 TEST_CASE("Read/Write TGA" "[PNG]")
@@ -47,11 +383,38 @@ TEST_CASE("Read/Write TGA" "[PNG]")
     }
     SECTION("test00_rle.tga"){
         test("test00_rle.tga", "out00_rle.tga", "../data/", true);
+        compareRLE("test00_rle.tga", "test00.tga", "../data/");
     }
     SECTION("test01.tga"){
         test("test01.tga", "out01.tga", "../data/", false);
     }
     SECTION("test01_rle.tga"){
         test("test01_rle.tga", "out01_rle.tga", "../data/", true);
+        compareRLE("test01_rle.tga", "test01.tga", "../data/");
+    }
+    SECTION("rle packets"){
+        // Widths around blocks of SIMD
+        for(cppimg::s32 width=1; width<=17; ++width){
+            decodeRLE(width, 3);
+            decodeRLE(width, 4);
+        }
+    }
+    SECTION("rle round trip"){
+        static const Pattern Patterns[] = {Pattern_Uniform, Pattern_Alternating, Pattern_Mixed};
+        for(Pattern pattern : Patterns){
+            for(cppimg::s32 width=1; width<=17; ++width){
+                encodeRLE(width, 5, 3, pattern);
+                encodeRLE(width, 5, 4, pattern);
+            }
+            // Runs longer than a packet
+            encodeRLE(128, 3, 3, pattern);
+            encodeRLE(129, 3, 4, pattern);
+            encodeRLE(300, 3, 3, pattern);
+            encodeRLE(300, 3, 4, pattern);
+        }
+    }
+    SECTION("view"){
+        testView("test00_rle.tga", "out00_view.tga", "../data/");
+        testView("test01.tga", "out01_view.tga", "../data/");
     }
 }